@@ -41,36 +41,489 @@ static SQLITE_WSD int mutexIsInit = 0;
 
 
 #ifndef SQLITE_MUTEX_OMIT
+
+#ifdef SQLITE_MUTEX_DEVIRTUALIZE
+#ifdef SQLITE_MUTEX_PTHREADS
+/*
+** The pthreads and futex backends, so that their enter, try and leave
+** methods may be inlined into the dispatch routines below.
+*/
+#include "mutex_unix.h"
+#endif
+#ifdef SQLITE_MUTEX_RUNTIME_OVERRIDE
+/*
+** True if the methods in sqlite3GlobalConfig.mutex are exactly those of
+** the compile-time backend, so that they may be called directly.
+*/
+static int mutexIsDirect = 0;
+#endif
+
+/*
+** Dispatch mutex operations to the compile-time backend Impl.  See the
+** description of SQLITE_MUTEX_DEVIRTUALIZE in mutex.h.
+*/
+template<class Impl> struct MutexDispatch {
+  static sqlite3_mutex *Alloc(int id){
+#ifdef SQLITE_MUTEX_RUNTIME_OVERRIDE
+    if( !mutexIsDirect ) return sqlite3GlobalConfig.mutex.xMutexAlloc(id);
+#endif
+    return Impl::Alloc(id);
+  }
+  static void Free(sqlite3_mutex *p){
+#ifdef SQLITE_MUTEX_RUNTIME_OVERRIDE
+    if( !mutexIsDirect ){ sqlite3GlobalConfig.mutex.xMutexFree(p); return; }
+#endif
+    Impl::Free(p);
+  }
+  static void Enter(sqlite3_mutex *p){
+#ifdef SQLITE_MUTEX_RUNTIME_OVERRIDE
+    if( !mutexIsDirect ){ sqlite3GlobalConfig.mutex.xMutexEnter(p); return; }
+#endif
+    Impl::Enter(p);
+  }
+  static int Try(sqlite3_mutex *p){
+#ifdef SQLITE_MUTEX_RUNTIME_OVERRIDE
+    if( !mutexIsDirect ) return sqlite3GlobalConfig.mutex.xMutexTry(p);
+#endif
+    return Impl::Try(p);
+  }
+  static void Leave(sqlite3_mutex *p){
+#ifdef SQLITE_MUTEX_RUNTIME_OVERRIDE
+    if( !mutexIsDirect ){ sqlite3GlobalConfig.mutex.xMutexLeave(p); return; }
+#endif
+    Impl::Leave(p);
+  }
+};
+typedef MutexDispatch<sqlite3MutexImpl> MutexDirect;
+#endif /* SQLITE_MUTEX_DEVIRTUALIZE */
+
+#ifdef SQLITE_ENABLE_MUTEX_STATUS
+/*
+** Mutex contention profiling.
+**
+** If SQLite is compiled with SQLITE_ENABLE_MUTEX_STATUS, sqlite3MutexInit()
+** wraps whatever mutex implementation has been selected (the default, the
+** no-op mutexes or an implementation installed by the application using
+** SQLITE_CONFIG_MUTEX) in the methods below.  Each mutex handed out by
+** the wrapper is an instance of the MutexProf structure, which points to
+** the real mutex and accumulates an sqlite3_mutex_stats record for it.
+**
+** sqlite3_mutex_enter() first tries the real mutex with xMutexTry.  If that
+** fails, the acquisition is counted as contended and the time spent
+** blocked in xMutexEnter is recorded.  Hold times are measured from the
+** outermost enter to the matching leave.
+**
+** The per-mutex record is only ever written by the thread holding the
+** mutex.  The per-type records, one for each static mutex id and one
+** each for all SQLITE_MUTEX_FAST, SQLITE_MUTEX_RECURSIVE and
+** SQLITE_MUTEX_RW mutexes, are shared by many mutexes and so are
+** updated atomically.  Entries to an SQLITE_MUTEX_RW mutex in shared
+** mode are counted in nEnter only.
+**
+** Without SQLITE_ENABLE_MUTEX_STATUS none of this code is compiled and
+** the mutex methods are dispatched exactly as before.
+*/
+#include <chrono>
+
+typedef struct MutexProf MutexProf;
+struct MutexProf {
+  sqlite3_mutex *pReal;      /* The underlying mutex */
+  int id;                    /* Mutex type */
+  int nDepth;                /* Number of entrances by the owner */
+  sqlite3_uint64 iAcquire;   /* Time of the outermost enter, in ns */
+  sqlite3_mutex_stats stats; /* Statistics for this mutex */
+};
+
+/*
+** The real mutex methods, a profiling wrapper for each static mutex and
+** the per-type statistics.
+*/
+static sqlite3_mutex_methods_v2 mutexReal;
+static MutexProf aMutexProfStatic[SQLITE_MUTEX_NSTATIC];
+static sqlite3_mutex_stats aMutexProfType[SQLITE_MUTEX_NID];
+
+/*
+** Return the current value of a monotonic clock in nanoseconds.
+*/
+static sqlite3_uint64 mutexProfNow(void){
+  return (sqlite3_uint64)std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()
+  ).count();
+}
+
+/*
+** Return the index of the hold-time histogram bucket for a hold of
+** nNs nanoseconds.  Bucket 0 counts holds shorter than 128ns and each
+** subsequent bucket covers twice the range of its predecessor.  The last
+** bucket also counts everything longer.
+*/
+static int mutexProfBucket(sqlite3_uint64 nNs){
+  int i = 0;
+  nNs >>= 7;
+  while( nNs && i<SQLITE_MUTEX_NHOLD-1 ){
+    nNs >>= 1;
+    i++;
+  }
+  return i;
+}
+
+static void mutexProfMax(sqlite3_uint64 *pMax, sqlite3_uint64 v){
+  sqlite3_uint64 cur = __atomic_load_n(pMax, __ATOMIC_RELAXED);
+  while( v>cur && !__atomic_compare_exchange_n(pMax, &cur, v, 1,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED) ){}
+}
+
+/*
+** Record one acquisition in statistics record pStat.  bContended is
+** true if the acquisition had to wait, in which case nWait is the
+** number of nanoseconds spent waiting.
+*/
+static void mutexProfRecordEnter(
+  sqlite3_mutex_stats *pStat,
+  int bContended,
+  sqlite3_uint64 nWait
+){
+  __atomic_fetch_add(&pStat->nEnter, 1, __ATOMIC_RELAXED);
+  if( bContended ){
+    __atomic_fetch_add(&pStat->nContended, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&pStat->nWaitNs, nWait, __ATOMIC_RELAXED);
+    mutexProfMax(&pStat->mxWaitNs, nWait);
+  }
+}
+
+/*
+** Record a hold time of nHold nanoseconds in statistics record pStat.
+*/
+static void mutexProfRecordLeave(sqlite3_mutex_stats *pStat, sqlite3_uint64 nHold){
+  __atomic_fetch_add(&pStat->nHoldNs, nHold, __ATOMIC_RELAXED);
+  mutexProfMax(&pStat->mxHoldNs, nHold);
+  __atomic_fetch_add(&pStat->aHold[mutexProfBucket(nHold)], 1, __ATOMIC_RELAXED);
+}
+
+static int mutexProfInit(void){
+  return mutexReal.xMutexInit();
+}
+static int mutexProfEnd(void){
+  return mutexReal.xMutexEnd();
+}
+
+static sqlite3_mutex *mutexProfAlloc(int id){
+  MutexProf *p;
+  sqlite3_mutex *pReal = mutexReal.xMutexAlloc(id);
+  if( pReal==0 ) return 0;
+  if( id<=SQLITE_MUTEX_RECURSIVE || id==SQLITE_MUTEX_RW ){
+    p = (MutexProf*)sqlite3MallocZero( sizeof(*p) );
+    if( p==0 ){
+      mutexReal.xMutexFree(pReal);
+      return 0;
+    }
+  }else{
+    /* A static mutex.  Every call for the same id returns the same real
+    ** mutex, so concurrent callers all store the same pointer here. */
+    p = &aMutexProfStatic[sqlite3MutexStaticIndex(id)];
+  }
+  p->pReal = pReal;
+  p->id = id;
+  return (sqlite3_mutex*)p;
+}
+
+static void mutexProfFree(sqlite3_mutex *pMutex){
+  MutexProf *p = (MutexProf*)pMutex;
+  mutexReal.xMutexFree(p->pReal);
+  if( p->id<=SQLITE_MUTEX_RECURSIVE || p->id==SQLITE_MUTEX_RW ){
+    sqlite3_free(p);
+  }
+}
+
+/*
+** Called by the owner of mutex p after it has been entered.
+*/
+static void mutexProfEntered(MutexProf *p, int bContended, sqlite3_uint64 nWait){
+  if( p->nDepth++==0 ){
+    p->iAcquire = mutexProfNow();
+  }
+  mutexProfRecordEnter(&p->stats, bContended, nWait);
+  mutexProfRecordEnter(&aMutexProfType[p->id], bContended, nWait);
+}
+
+static void mutexProfEnter(sqlite3_mutex *pMutex){
+  MutexProf *p = (MutexProf*)pMutex;
+  if( mutexReal.xMutexTry(p->pReal)==SQLITE_OK ){
+    mutexProfEntered(p, 0, 0);
+  }else{
+    sqlite3_uint64 iStart = mutexProfNow();
+    mutexReal.xMutexEnter(p->pReal);
+    mutexProfEntered(p, 1, mutexProfNow() - iStart);
+  }
+}
+
+static int mutexProfTry(sqlite3_mutex *pMutex){
+  MutexProf *p = (MutexProf*)pMutex;
+  int rc = mutexReal.xMutexTry(p->pReal);
+  if( rc==SQLITE_OK ){
+    mutexProfEntered(p, 0, 0);
+  }
+  return rc;
+}
+
+static void mutexProfLeave(sqlite3_mutex *pMutex){
+  MutexProf *p = (MutexProf*)pMutex;
+  assert( p->nDepth>0 );
+  if( --p->nDepth==0 ){
+    sqlite3_uint64 nHold = mutexProfNow() - p->iAcquire;
+    mutexProfRecordLeave(&p->stats, nHold);
+    mutexProfRecordLeave(&aMutexProfType[p->id], nHold);
+  }
+  mutexReal.xMutexLeave(p->pReal);
+}
+
+static void mutexProfEnterShared(sqlite3_mutex *pMutex){
+  MutexProf *p = (MutexProf*)pMutex;
+  mutexReal.xMutexEnterShared(p->pReal);
+  __atomic_fetch_add(&p->stats.nEnter, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&aMutexProfType[p->id].nEnter, 1, __ATOMIC_RELAXED);
+}
+static void mutexProfLeaveShared(sqlite3_mutex *pMutex){
+  MutexProf *p = (MutexProf*)pMutex;
+  mutexReal.xMutexLeaveShared(p->pReal);
+}
+
+/*
+** A thread waiting on a condition variable releases the mutex for the
+** duration of the wait, so the wait ends one hold period and begins
+** another.  The reacquisition is not counted as an enter, as the caller
+** enters and leaves the mutex only once.  Condition variables themselves
+** are not wrapped.
+*/
+static int mutexProfCondWait(
+  sqlite3_mutex_cond *pCond,
+  sqlite3_mutex *pMutex,
+  int ms
+){
+  MutexProf *p = (MutexProf*)pMutex;
+  sqlite3_uint64 nHold;
+  int rc;
+  assert( p->nDepth==1 );
+  p->nDepth = 0;
+  nHold = mutexProfNow() - p->iAcquire;
+  mutexProfRecordLeave(&p->stats, nHold);
+  mutexProfRecordLeave(&aMutexProfType[p->id], nHold);
+  rc = mutexReal.xCondWait(pCond, p->pReal, ms);
+  p->nDepth = 1;
+  p->iAcquire = mutexProfNow();
+  return rc;
+}
+
+static int mutexProfHeld(sqlite3_mutex *pMutex){
+  MutexProf *p = (MutexProf*)pMutex;
+  return mutexReal.xMutexHeld(p->pReal);
+}
+static int mutexProfNotheld(sqlite3_mutex *pMutex){
+  MutexProf *p = (MutexProf*)pMutex;
+  return mutexReal.xMutexNotheld(p->pReal);
+}
+
+/*
+** Install the profiling wrapper around the mutex methods in *pTo.  This
+** is a no-op if the wrapper is already installed, as happens when the
+** library is shut down and reinitialized.
+*/
+static void mutexProfInstall(sqlite3_mutex_methods_v2 *pTo){
+  if( pTo->xMutexAlloc==mutexProfAlloc ) return;
+  mutexReal = *pTo;
+  pTo->xMutexInit = mutexProfInit;
+  pTo->xMutexEnd = mutexProfEnd;
+  pTo->xMutexFree = mutexProfFree;
+  pTo->xMutexEnter = mutexProfEnter;
+  pTo->xMutexTry = mutexProfTry;
+  pTo->xMutexLeave = mutexProfLeave;
+  pTo->xMutexHeld = mutexReal.xMutexHeld ? mutexProfHeld : 0;
+  pTo->xMutexNotheld = mutexReal.xMutexNotheld ? mutexProfNotheld : 0;
+  pTo->xMutexEnterShared = mutexReal.xMutexEnterShared ? mutexProfEnterShared : 0;
+  pTo->xMutexLeaveShared = mutexReal.xMutexLeaveShared ? mutexProfLeaveShared : 0;
+  pTo->xCondWait = mutexReal.xCondWait ? mutexProfCondWait : 0;
+  sqlite3ReleaseBarrier();
+  pTo->xMutexAlloc = mutexProfAlloc;
+}
+
+/*
+** Copy statistics record pFrom into *pOut, then zero pFrom if resetFlag
+** is true.
+*/
+static void mutexProfRead(
+  sqlite3_mutex_stats *pFrom,
+  sqlite3_mutex_stats *pOut,
+  int resetFlag
+){
+  if( pOut ) memcpy(pOut, pFrom, sizeof(*pOut));
+  if( resetFlag ) memset(pFrom, 0, sizeof(*pFrom));
+}
+
+/*
+** Read the statistics accumulated for all mutexes of type id.  For the
+** static mutex types this is the statistics of that single mutex.  For
+** SQLITE_MUTEX_FAST and SQLITE_MUTEX_RECURSIVE it is the sum over all
+** dynamic mutexes of that type, including those already freed.
+*/
+SQLITE_API int SQLITE_STDCALL sqlite3_mutex_status(
+  int id,
+  sqlite3_mutex_stats *pOut,
+  int resetFlag
+){
+  if( id<0 || id>=ArraySize(aMutexProfType) ){
+    return SQLITE_MISUSE_BKPT;
+  }
+  mutexProfRead(&aMutexProfType[id], pOut, resetFlag);
+  return SQLITE_OK;
+}
+
+/*
+** Read the statistics accumulated for the single mutex pMutex.
+*/
+SQLITE_API int SQLITE_STDCALL sqlite3_mutex_status_handle(
+  sqlite3_mutex *pMutex,
+  sqlite3_mutex_stats *pOut,
+  int resetFlag
+){
+  if( pMutex==0 || sqlite3GlobalConfig.mutex.xMutexAlloc!=mutexProfAlloc ){
+    return SQLITE_MISUSE_BKPT;
+  }
+  mutexProfRead(&((MutexProf*)pMutex)->stats, pOut, resetFlag);
+  return SQLITE_OK;
+}
+#endif /* SQLITE_ENABLE_MUTEX_STATUS */
+
+/*
+** Copy the methods that sqlite3_mutex_methods and sqlite3_mutex_methods_v2
+** have in common from *pFrom to *pTo.  xMutexAlloc is copied last, after
+** a release barrier, as sqlite3MutexInit() takes a non-NULL xMutexAlloc
+** to mean that the other methods are in place.
+*/
+template<class To, class From>
+static void mutexCopyMethods(To *pTo, const From *pFrom){
+  pTo->xMutexInit = pFrom->xMutexInit;
+  pTo->xMutexEnd = pFrom->xMutexEnd;
+  pTo->xMutexFree = pFrom->xMutexFree;
+  pTo->xMutexEnter = pFrom->xMutexEnter;
+  pTo->xMutexTry = pFrom->xMutexTry;
+  pTo->xMutexLeave = pFrom->xMutexLeave;
+  pTo->xMutexHeld = pFrom->xMutexHeld;
+  pTo->xMutexNotheld = pFrom->xMutexNotheld;
+  sqlite3ReleaseBarrier();
+  pTo->xMutexAlloc = pFrom->xMutexAlloc;
+}
+
+/*
+** Implementation of SQLITE_CONFIG_MUTEX and SQLITE_CONFIG_MUTEX_V2.  pArg
+** points to an sqlite3_mutex_methods object if bV2 is false, or to an
+** sqlite3_mutex_methods_v2 object otherwise.  Its methods are copied into
+** sqlite3GlobalConfig.mutex.  Methods that the object does not provide,
+** because it is an sqlite3_mutex_methods or its iVersion is too low, are
+** set to NULL.
+*/
+SQLITE_PRIVATE void sqlite3MutexSetMethods(const void *pArg, int bV2){
+  sqlite3_mutex_methods_v2 *pTo = &sqlite3GlobalConfig.mutex;
+  memset(pTo, 0, sizeof(*pTo));
+  if( bV2 ){
+    const sqlite3_mutex_methods_v2 *pFrom;
+    pFrom = (const sqlite3_mutex_methods_v2*)pArg;
+    pTo->iVersion = pFrom->iVersion;
+    if( pTo->iVersion>SQLITE_MUTEX_METHODS_VERSION ){
+      pTo->iVersion = SQLITE_MUTEX_METHODS_VERSION;
+    }
+    if( pTo->iVersion>=1 ){
+      pTo->xMutexEnterShared = pFrom->xMutexEnterShared;
+      pTo->xMutexLeaveShared = pFrom->xMutexLeaveShared;
+    }
+    if( pTo->iVersion>=2 ){
+      pTo->xCondAlloc = pFrom->xCondAlloc;
+      pTo->xCondFree = pFrom->xCondFree;
+      pTo->xCondWait = pFrom->xCondWait;
+      pTo->xCondBroadcast = pFrom->xCondBroadcast;
+    }
+    mutexCopyMethods(pTo, pFrom);
+  }else{
+    mutexCopyMethods(pTo, (const sqlite3_mutex_methods*)pArg);
+  }
+}
+
+/*
+** Implementation of SQLITE_CONFIG_GETMUTEX and SQLITE_CONFIG_GETMUTEX_V2.
+** Copy the current mutex methods into the sqlite3_mutex_methods object
+** (if bV2 is false) or sqlite3_mutex_methods_v2 object (otherwise) that
+** pArg points to.  In the latter case only the methods present in the
+** version given by the caller's iVersion are written.
+*/
+SQLITE_PRIVATE void sqlite3MutexGetMethods(void *pArg, int bV2){
+  const sqlite3_mutex_methods_v2 *pFrom = &sqlite3GlobalConfig.mutex;
+  if( bV2 ){
+    sqlite3_mutex_methods_v2 *pTo = (sqlite3_mutex_methods_v2*)pArg;
+    if( pTo->iVersion>SQLITE_MUTEX_METHODS_VERSION ){
+      pTo->iVersion = SQLITE_MUTEX_METHODS_VERSION;
+    }
+    if( pTo->iVersion>=1 ){
+      pTo->xMutexEnterShared = pFrom->xMutexEnterShared;
+      pTo->xMutexLeaveShared = pFrom->xMutexLeaveShared;
+    }
+    if( pTo->iVersion>=2 ){
+      pTo->xCondAlloc = pFrom->xCondAlloc;
+      pTo->xCondFree = pFrom->xCondFree;
+      pTo->xCondWait = pFrom->xCondWait;
+      pTo->xCondBroadcast = pFrom->xCondBroadcast;
+    }
+    mutexCopyMethods(pTo, pFrom);
+  }else{
+    mutexCopyMethods((sqlite3_mutex_methods*)pArg, pFrom);
+  }
+}
+
 /*
 ** Initialize the mutex system.
 */
 SQLITE_PRIVATE int sqlite3MutexInit(void){
   int rc = SQLITE_OK;
+#if defined(SQLITE_MUTEX_DEVIRTUALIZE) && !defined(SQLITE_MUTEX_RUNTIME_OVERRIDE)
+  /* Mutex calls are dispatched directly to the compile-time backend, so
+  ** the methods recorded here must be that backend's, even if the
+  ** application has installed others or the core mutexes are disabled. */
+  if( sqlite3GlobalConfig.mutex.xMutexAlloc!=sqlite3DefaultMutex()->xMutexAlloc ){
+    sqlite3GlobalConfig.mutex.xMutexAlloc = 0;
+  }
+#endif
   if( !sqlite3GlobalConfig.mutex.xMutexAlloc ){
     /* If the xMutexAlloc method has not been set, then the user did not
     ** install a mutex implementation via sqlite3_config() prior to
     ** sqlite3_initialize() being called. This block copies pointers to
     ** the default implementation into the sqlite3GlobalConfig structure.
     */
-    sqlite3_mutex_methods const *pFrom;
-    sqlite3_mutex_methods *pTo = &sqlite3GlobalConfig.mutex;
+    sqlite3_mutex_methods_v2 const *pFrom;
+    sqlite3_mutex_methods_v2 *pTo = &sqlite3GlobalConfig.mutex;
 
+#if defined(SQLITE_MUTEX_DEVIRTUALIZE) && !defined(SQLITE_MUTEX_RUNTIME_OVERRIDE)
+    pFrom = sqlite3DefaultMutex();
+#else
     if( sqlite3GlobalConfig.bCoreMutex ){
       pFrom = sqlite3DefaultMutex();
     }else{
       pFrom = sqlite3NoopMutex();
     }
-    pTo->xMutexInit = pFrom->xMutexInit;
-    pTo->xMutexEnd = pFrom->xMutexEnd;
-    pTo->xMutexFree = pFrom->xMutexFree;
-    pTo->xMutexEnter = pFrom->xMutexEnter;
-    pTo->xMutexTry = pFrom->xMutexTry;
-    pTo->xMutexLeave = pFrom->xMutexLeave;
-    pTo->xMutexHeld = pFrom->xMutexHeld;
-    pTo->xMutexNotheld = pFrom->xMutexNotheld;
-    sqlite3MemoryBarrier();
-    pTo->xMutexAlloc = pFrom->xMutexAlloc;
+#endif
+    pTo->iVersion = pFrom->iVersion;
+    pTo->xMutexEnterShared = pFrom->xMutexEnterShared;
+    pTo->xMutexLeaveShared = pFrom->xMutexLeaveShared;
+    pTo->xCondAlloc = pFrom->xCondAlloc;
+    pTo->xCondFree = pFrom->xCondFree;
+    pTo->xCondWait = pFrom->xCondWait;
+    pTo->xCondBroadcast = pFrom->xCondBroadcast;
+    mutexCopyMethods(pTo, pFrom);
   }
+#ifdef SQLITE_ENABLE_MUTEX_STATUS
+  mutexProfInstall(&sqlite3GlobalConfig.mutex);
+#endif
+#if defined(SQLITE_MUTEX_DEVIRTUALIZE) && defined(SQLITE_MUTEX_RUNTIME_OVERRIDE)
+  mutexIsDirect = memcmp(&sqlite3GlobalConfig.mutex, sqlite3DefaultMutex(),
+                         sizeof(sqlite3_mutex_methods_v2))==0;
+#endif
   assert( sqlite3GlobalConfig.mutex.xMutexInit );
   rc = sqlite3GlobalConfig.mutex.xMutexInit();
 
@@ -98,16 +551,69 @@ SQLITE_PRIVATE int sqlite3MutexEnd(void){
   return rc;
 }
 
+/*
+** Mutex implementations that predate SQLITE_MUTEX_RW, including those
+** installed by applications using SQLITE_CONFIG_MUTEX, do not provide
+** the xMutexEnterShared and xMutexLeaveShared methods.  For these, an
+** SQLITE_MUTEX_RW request is satisfied with an SQLITE_MUTEX_FAST mutex,
+** and shared entry falls back to exclusive entry.
+*/
+static int mutexAllocType(int id){
+  if( id==SQLITE_MUTEX_RW && sqlite3GlobalConfig.mutex.xMutexEnterShared==0 ){
+    return SQLITE_MUTEX_FAST;
+  }
+  return id;
+}
+
+/*
+** Return the shard of the sharded static mutexes that the calling thread
+** should use, a value between 0 and SQLITE_MUTEX_NSHARD-1.
+**
+** By default each thread is assigned a shard, round-robin, the first time
+** it calls this routine.  If SQLite is compiled with
+** SQLITE_MUTEX_SHARD_BY_CPU on Linux, the shard is instead chosen by the
+** CPU the thread is currently running on, so that threads which share a
+** CPU also share a shard.
+*/
+#if SQLITE_MUTEX_NSHARD>1
+#if defined(SQLITE_MUTEX_SHARD_BY_CPU) && defined(__linux__)
+#include <sched.h>
+#endif
+SQLITE_PRIVATE int sqlite3MutexShard(void){
+  static unsigned int iNext = 0;
+  static SQLITE_THREAD_LOCAL int iShard = -1;
+#if defined(SQLITE_MUTEX_SHARD_BY_CPU) && defined(__linux__)
+  int iCpu = sched_getcpu();
+  if( iCpu>=0 ) return iCpu % SQLITE_MUTEX_NSHARD;
+#endif
+  if( iShard<0 ){
+#if defined(__GNUC__) || defined(__clang__)
+    iShard = __atomic_fetch_add(&iNext, 1, __ATOMIC_RELAXED) % SQLITE_MUTEX_NSHARD;
+#else
+    iShard = iNext++ % SQLITE_MUTEX_NSHARD;
+#endif
+  }
+  return iShard;
+}
+#else
+SQLITE_PRIVATE int sqlite3MutexShard(void){ return 0; }
+#endif
+
 /*
 ** Retrieve a pointer to a static mutex or allocate a new dynamic one.
 */
 SQLITE_API sqlite3_mutex *SQLITE_STDCALL sqlite3_mutex_alloc(int id){
+  int bDynamic = (id<=SQLITE_MUTEX_RECURSIVE || id==SQLITE_MUTEX_RW);
 #ifndef SQLITE_OMIT_AUTOINIT
-  if( id<=SQLITE_MUTEX_RECURSIVE && sqlite3_initialize() ) return 0;
-  if( id>SQLITE_MUTEX_RECURSIVE && sqlite3MutexInit() ) return 0;
+  if( bDynamic && sqlite3_initialize() ) return 0;
+  if( !bDynamic && sqlite3MutexInit() ) return 0;
 #endif
+#ifdef SQLITE_MUTEX_DEVIRTUALIZE
+  return MutexDirect::Alloc(mutexAllocType(id));
+#else
   assert( sqlite3GlobalConfig.mutex.xMutexAlloc );
-  return sqlite3GlobalConfig.mutex.xMutexAlloc(id);
+  return sqlite3GlobalConfig.mutex.xMutexAlloc(mutexAllocType(id));
+#endif
 }
 
 SQLITE_PRIVATE sqlite3_mutex *sqlite3MutexAlloc(int id){
@@ -115,8 +621,12 @@ SQLITE_PRIVATE sqlite3_mutex *sqlite3MutexAlloc(int id){
     return 0;
   }
   assert( GLOBAL(int, mutexIsInit) );
+#ifdef SQLITE_MUTEX_DEVIRTUALIZE
+  return MutexDirect::Alloc(mutexAllocType(id));
+#else
   assert( sqlite3GlobalConfig.mutex.xMutexAlloc );
-  return sqlite3GlobalConfig.mutex.xMutexAlloc(id);
+  return sqlite3GlobalConfig.mutex.xMutexAlloc(mutexAllocType(id));
+#endif
 }
 
 /*
@@ -124,8 +634,12 @@ SQLITE_PRIVATE sqlite3_mutex *sqlite3MutexAlloc(int id){
 */
 SQLITE_API void SQLITE_STDCALL sqlite3_mutex_free(sqlite3_mutex *p){
   if( p ){
+#ifdef SQLITE_MUTEX_DEVIRTUALIZE
+    MutexDirect::Free(p);
+#else
     assert( sqlite3GlobalConfig.mutex.xMutexFree );
     sqlite3GlobalConfig.mutex.xMutexFree(p);
+#endif
   }
 }
 
@@ -135,8 +649,12 @@ SQLITE_API void SQLITE_STDCALL sqlite3_mutex_free(sqlite3_mutex *p){
 */
 SQLITE_API void SQLITE_STDCALL sqlite3_mutex_enter(sqlite3_mutex *p){
   if( p ){
+#ifdef SQLITE_MUTEX_DEVIRTUALIZE
+    MutexDirect::Enter(p);
+#else
     assert( sqlite3GlobalConfig.mutex.xMutexEnter );
     sqlite3GlobalConfig.mutex.xMutexEnter(p);
+#endif
   }
 }
 
@@ -147,8 +665,12 @@ SQLITE_API void SQLITE_STDCALL sqlite3_mutex_enter(sqlite3_mutex *p){
 SQLITE_API int SQLITE_STDCALL sqlite3_mutex_try(sqlite3_mutex *p){
   int rc = SQLITE_OK;
   if( p ){
+#ifdef SQLITE_MUTEX_DEVIRTUALIZE
+    return MutexDirect::Try(p);
+#else
     assert( sqlite3GlobalConfig.mutex.xMutexTry );
     return sqlite3GlobalConfig.mutex.xMutexTry(p);
+#endif
   }
   return rc;
 }
@@ -161,8 +683,91 @@ SQLITE_API int SQLITE_STDCALL sqlite3_mutex_try(sqlite3_mutex *p){
 */
 SQLITE_API void SQLITE_STDCALL sqlite3_mutex_leave(sqlite3_mutex *p){
   if( p ){
+#ifdef SQLITE_MUTEX_DEVIRTUALIZE
+    MutexDirect::Leave(p);
+#else
     assert( sqlite3GlobalConfig.mutex.xMutexLeave );
     sqlite3GlobalConfig.mutex.xMutexLeave(p);
+#endif
+  }
+}
+
+/*
+** Obtain an SQLITE_MUTEX_RW mutex in shared mode, blocking until no other
+** thread holds it exclusively.  If the mutex implementation has no shared
+** mode, the mutex is obtained exclusively.
+*/
+SQLITE_API void SQLITE_STDCALL sqlite3_mutex_enter_shared(sqlite3_mutex *p){
+  if( p ){
+    if( sqlite3GlobalConfig.mutex.xMutexEnterShared ){
+      sqlite3GlobalConfig.mutex.xMutexEnterShared(p);
+    }else{
+      assert( sqlite3GlobalConfig.mutex.xMutexEnter );
+      sqlite3GlobalConfig.mutex.xMutexEnter(p);
+    }
+  }
+}
+
+/*
+** Release a mutex obtained by sqlite3_mutex_enter_shared().
+*/
+SQLITE_API void SQLITE_STDCALL sqlite3_mutex_leave_shared(sqlite3_mutex *p){
+  if( p ){
+    if( sqlite3GlobalConfig.mutex.xMutexLeaveShared ){
+      sqlite3GlobalConfig.mutex.xMutexLeaveShared(p);
+    }else{
+      assert( sqlite3GlobalConfig.mutex.xMutexLeave );
+      sqlite3GlobalConfig.mutex.xMutexLeave(p);
+    }
+  }
+}
+
+/*
+** Allocate a condition variable.  Return NULL if the mutex
+** implementation does not support condition variables.
+*/
+SQLITE_API sqlite3_mutex_cond *SQLITE_STDCALL sqlite3_mutex_cond_alloc(void){
+#ifndef SQLITE_OMIT_AUTOINIT
+  if( sqlite3_initialize() ) return 0;
+#endif
+  if( sqlite3GlobalConfig.mutex.xCondAlloc==0 ) return 0;
+  return sqlite3GlobalConfig.mutex.xCondAlloc();
+}
+
+/*
+** Free a condition variable.  No thread may be waiting on it.
+*/
+SQLITE_API void SQLITE_STDCALL sqlite3_mutex_cond_free(sqlite3_mutex_cond *pCond){
+  if( pCond ){
+    assert( sqlite3GlobalConfig.mutex.xCondFree );
+    sqlite3GlobalConfig.mutex.xCondFree(pCond);
+  }
+}
+
+/*
+** Release mutex p, wait up to ms milliseconds for pCond to be signaled,
+** then obtain p again.  Return SQLITE_OK if woken or SQLITE_BUSY on
+** timeout.
+*/
+SQLITE_API int SQLITE_STDCALL sqlite3_mutex_cond_wait(
+  sqlite3_mutex_cond *pCond,
+  sqlite3_mutex *p,
+  int ms
+){
+  if( pCond==0 || p==0 ) return SQLITE_BUSY;
+  assert( sqlite3GlobalConfig.mutex.xCondWait );
+  return sqlite3GlobalConfig.mutex.xCondWait(pCond, p, ms);
+}
+
+/*
+** Wake all threads waiting on pCond.
+*/
+SQLITE_API void SQLITE_STDCALL sqlite3_mutex_cond_broadcast(
+  sqlite3_mutex_cond *pCond
+){
+  if( pCond ){
+    assert( sqlite3GlobalConfig.mutex.xCondBroadcast );
+    sqlite3GlobalConfig.mutex.xCondBroadcast(pCond);
   }
 }
 
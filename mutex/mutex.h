@@ -55,6 +55,7 @@ History:
 ** <ul>
 ** <li>  SQLITE_MUTEX_FAST
 ** <li>  SQLITE_MUTEX_RECURSIVE
+** <li>  SQLITE_MUTEX_RW
 ** <li>  SQLITE_MUTEX_STATIC_MASTER
 ** <li>  SQLITE_MUTEX_STATIC_MEM
 ** <li>  SQLITE_MUTEX_STATIC_OPEN
@@ -73,6 +74,11 @@ History:
 ** cause sqlite3_mutex_alloc() to create
 ** a new mutex.  ^The new mutex is recursive when SQLITE_MUTEX_RECURSIVE
 ** is used but not necessarily so when SQLITE_MUTEX_FAST is used.
+** ^SQLITE_MUTEX_RW also creates a new, non-recursive mutex.  ^In addition
+** to the usual exclusive entry, an SQLITE_MUTEX_RW mutex may be entered
+** in shared mode using sqlite3_mutex_enter_shared() by any number of
+** threads at once, provided no thread holds it exclusively.
+** ^Shared entry is released with sqlite3_mutex_leave_shared().
 ** The mutex implementation does not need to make a distinction
 ** between SQLITE_MUTEX_RECURSIVE and SQLITE_MUTEX_FAST if it does
 ** not want to.  SQLite will only request a recursive mutex in
@@ -132,6 +138,46 @@ SQLITE_API void SQLITE_STDCALL sqlite3_mutex_free(sqlite3_mutex*);
 SQLITE_API void SQLITE_STDCALL sqlite3_mutex_enter(sqlite3_mutex*);
 SQLITE_API int SQLITE_STDCALL sqlite3_mutex_try(sqlite3_mutex*);
 SQLITE_API void SQLITE_STDCALL sqlite3_mutex_leave(sqlite3_mutex*);
+SQLITE_API void SQLITE_STDCALL sqlite3_mutex_enter_shared(sqlite3_mutex*);
+SQLITE_API void SQLITE_STDCALL sqlite3_mutex_leave_shared(sqlite3_mutex*);
+
+/*
+** CAPI3REF: Mutex Condition Variables
+**
+** ^A condition variable allows a thread that holds a mutex to release
+** the mutex and wait until another thread reports that some state
+** protected by the mutex has changed.
+**
+** ^The sqlite3_mutex_cond_alloc() routine allocates a new condition
+** variable.  ^It returns NULL if memory cannot be allocated or if the
+** mutex implementation does not provide condition variables.  ^A
+** condition variable is deallocated with sqlite3_mutex_cond_free().
+**
+** ^The sqlite3_mutex_cond_wait(C,M,T) routine must be called by a thread
+** that has entered mutex M exactly once.  M must be an SQLITE_MUTEX_FAST
+** mutex.  ^It releases M, blocks until condition variable C is signaled
+** by sqlite3_mutex_cond_broadcast() or until T milliseconds have passed,
+** and then enters M again before returning.  ^If T is negative there is
+** no time limit.  ^The return value is SQLITE_OK if the thread was woken
+** and SQLITE_BUSY if the time limit expired.  Wake-ups may be spurious,
+** so the caller must test the state it is waiting for in a loop.  ^If C
+** is a NULL pointer, sqlite3_mutex_cond_wait() returns SQLITE_BUSY
+** immediately, without releasing M.
+**
+** ^The sqlite3_mutex_cond_broadcast(C) routine wakes all threads waiting
+** on condition variable C.  It is usually called by a thread holding the
+** mutex that the waiters passed to sqlite3_mutex_cond_wait(), after it
+** changes the state that they are waiting for.
+**
+** ^If the argument to sqlite3_mutex_cond_free() or
+** sqlite3_mutex_cond_broadcast() is a NULL pointer, these routines
+** behave as no-ops.
+*/
+typedef struct sqlite3_mutex_cond sqlite3_mutex_cond;
+SQLITE_API sqlite3_mutex_cond *SQLITE_STDCALL sqlite3_mutex_cond_alloc(void);
+SQLITE_API void SQLITE_STDCALL sqlite3_mutex_cond_free(sqlite3_mutex_cond*);
+SQLITE_API int SQLITE_STDCALL sqlite3_mutex_cond_wait(sqlite3_mutex_cond*, sqlite3_mutex*, int);
+SQLITE_API void SQLITE_STDCALL sqlite3_mutex_cond_broadcast(sqlite3_mutex_cond*);
 
 /*
 ** CAPI3REF: Mutex Methods Object
@@ -211,6 +257,104 @@ struct sqlite3_mutex_methods {
   int (*xMutexNotheld)(sqlite3_mutex *);
 };
 
+/*
+** CAPI3REF: Mutex Methods Object, Version 2
+**
+** An instance of this structure defines the same low-level mutex routines
+** as [sqlite3_mutex_methods], followed by methods that were added to the
+** mutex interface later.  The application passes it to sqlite3_config()
+** with the [SQLITE_CONFIG_MUTEX_V2] option, or reads the current mutex
+** implementation into it with the [SQLITE_CONFIG_GETMUTEX_V2] option.
+** [sqlite3_mutex_methods] itself is never extended, so that applications
+** compiled against older versions of this header continue to work.
+**
+** ^The iVersion field is the version of the structure, which determines
+** which of the methods that follow xMutexNotheld are present.  It is
+** currently 2.  ^The methods from xMutexInit to xMutexNotheld have the
+** same meaning as in [sqlite3_mutex_methods].
+**
+** ^(Version 1 adds the xMutexEnterShared and xMutexLeaveShared methods,
+** which implement [sqlite3_mutex_enter_shared()] and
+** [sqlite3_mutex_leave_shared()] for mutexes allocated as
+** SQLITE_MUTEX_RW.)^  ^An implementation that does not support shared
+** entry may set both to NULL.  ^In that case SQLite allocates an
+** SQLITE_MUTEX_FAST mutex whenever SQLITE_MUTEX_RW is requested and
+** enters it exclusively in place of shared entry.
+**
+** ^(Version 2 adds the xCondAlloc, xCondFree, xCondWait and xCondBroadcast
+** methods, which implement [sqlite3_mutex_cond_alloc()],
+** [sqlite3_mutex_cond_free()], [sqlite3_mutex_cond_wait()] and
+** [sqlite3_mutex_cond_broadcast()].)^  ^An implementation that does not
+** provide condition variables may set all four to NULL, in which case
+** sqlite3_mutex_cond_alloc() always returns NULL.  ^xCondAlloc() may use
+** SQLite memory allocation.
+**
+** ^Methods that are not present, because the mutex routines were set
+** using [SQLITE_CONFIG_MUTEX] or the iVersion passed with
+** [SQLITE_CONFIG_MUTEX_V2] is too low, are treated as NULL.
+*/
+typedef struct sqlite3_mutex_methods_v2 sqlite3_mutex_methods_v2;
+struct sqlite3_mutex_methods_v2 {
+  int iVersion;
+  int (*xMutexInit)(void);
+  int (*xMutexEnd)(void);
+  sqlite3_mutex *(*xMutexAlloc)(int);
+  void (*xMutexFree)(sqlite3_mutex *);
+  void (*xMutexEnter)(sqlite3_mutex *);
+  int (*xMutexTry)(sqlite3_mutex *);
+  void (*xMutexLeave)(sqlite3_mutex *);
+  int (*xMutexHeld)(sqlite3_mutex *);
+  int (*xMutexNotheld)(sqlite3_mutex *);
+  /* Methods above are valid for version 0 */
+  void (*xMutexEnterShared)(sqlite3_mutex *);
+  void (*xMutexLeaveShared)(sqlite3_mutex *);
+  /* Methods above are valid for version 1 */
+  sqlite3_mutex_cond *(*xCondAlloc)(void);
+  void (*xCondFree)(sqlite3_mutex_cond *);
+  int (*xCondWait)(sqlite3_mutex_cond *, sqlite3_mutex *, int);
+  void (*xCondBroadcast)(sqlite3_mutex_cond *);
+  /* Methods above are valid for version 2 */
+};
+
+#ifdef SQLITE_ENABLE_FUTEX_MUTEX
+/*
+** CAPI3REF: Adaptive Spin-Then-Futex Mutexes
+**
+** ^On Linux builds compiled with SQLITE_ENABLE_FUTEX_MUTEX, this routine
+** returns a pointer to an [sqlite3_mutex_methods_v2] object whose mutexes
+** spin in user space for a short, self-tuning number of iterations before
+** blocking on a futex.  The object may be passed to
+** [sqlite3_config]([SQLITE_CONFIG_MUTEX_V2],...).  ^If SQLite is also compiled
+** with SQLITE_DEFAULT_FUTEX_MUTEX then these methods are used by default.
+**
+** ^The SQLITE_MUTEX_FIFO, SQLITE_ENABLE_MUTEX_POOL and
+** SQLITE_ATOMIC_RECURSIVE_MUTEX options of the pthreads mutexes have no
+** effect on the futex mutexes.  ^Their static mutexes are never FIFO,
+** their dynamic mutexes are always obtained from sqlite3_malloc(), and
+** recursive entry is counted by the futex mutex itself.  ^The futex
+** mutexes do not support shared entry, so an SQLITE_MUTEX_RW request is
+** satisfied with an SQLITE_MUTEX_FAST mutex that is always entered
+** exclusively.
+*/
+SQLITE_API sqlite3_mutex_methods_v2 const *SQLITE_STDCALL
+sqlite3_mutex_futex(void);
+#endif
+
+/*
+** The version of the sqlite3_mutex_methods_v2 object implemented by this
+** build.
+*/
+#define SQLITE_MUTEX_METHODS_VERSION 2
+
+/*
+** SQLITE_MUTEX_USE_FUTEX is defined if the futex mutexes are both
+** available and selected as the default mutex implementation.
+*/
+#if defined(SQLITE_MUTEX_PTHREADS) && defined(SQLITE_DEFAULT_FUTEX_MUTEX) \
+ && defined(SQLITE_ENABLE_FUTEX_MUTEX) && defined(__linux__)
+# define SQLITE_MUTEX_USE_FUTEX 1
+#endif
+
 /*
 ** CAPI3REF: Mutex Verification Routines
 **
@@ -271,6 +415,54 @@ SQLITE_API int SQLITE_STDCALL sqlite3_mutex_notheld(sqlite3_mutex*);
 #define SQLITE_MUTEX_STATIC_VFS1     11  /* For use by built-in VFS */
 #define SQLITE_MUTEX_STATIC_VFS2     12  /* For use by extension VFS */
 #define SQLITE_MUTEX_STATIC_VFS3     13  /* For use by application VFS */
+#define SQLITE_MUTEX_RW              14  /* Dynamic reader/writer mutex */
+
+#ifdef SQLITE_ENABLE_MUTEX_STATUS
+/*
+** CAPI3REF: Mutex Contention Statistics
+**
+** ^If SQLite is compiled with SQLITE_ENABLE_MUTEX_STATUS, every mutex
+** obtained from [sqlite3_mutex_alloc()] records the statistics in an
+** instance of the following structure.  All times are in nanoseconds.
+**
+** ^The nEnter field counts successful calls to [sqlite3_mutex_enter()]
+** and [sqlite3_mutex_try()], and nContended counts those calls to
+** sqlite3_mutex_enter() that had to wait for another thread.  ^nWaitNs
+** and mxWaitNs are the total and the largest time spent waiting.
+** ^nHoldNs and mxHoldNs are the total and the largest time the mutex was
+** held, measured from the outermost enter to the matching leave, and
+** aHold[] is a histogram of hold times.  ^aHold[0] counts holds shorter
+** than 128ns, each subsequent bucket covers twice the range of its
+** predecessor, and aHold[SQLITE_MUTEX_NHOLD-1] also counts all holds
+** longer than that.
+**
+** ^sqlite3_mutex_status(id,pOut,resetFlag) copies the statistics for the
+** mutex type id into *pOut.  ^For the static mutex types (for example
+** SQLITE_MUTEX_STATIC_MEM or SQLITE_MUTEX_STATIC_VFS1) these are the
+** statistics of that single mutex.  ^For SQLITE_MUTEX_FAST and
+** SQLITE_MUTEX_RECURSIVE they are the sum over every dynamic mutex of
+** that type.  ^sqlite3_mutex_status_handle() copies the statistics of a
+** single mutex, which may be either static or dynamic.  ^In both cases
+** the statistics are zeroed afterwards if resetFlag is true, and
+** SQLITE_MISUSE is returned if the arguments are not valid.
+**
+** The statistics are updated without locking and should be treated
+** as approximate if they are read while the mutexes are in use.
+*/
+#define SQLITE_MUTEX_NHOLD 20
+typedef struct sqlite3_mutex_stats sqlite3_mutex_stats;
+struct sqlite3_mutex_stats {
+  sqlite3_uint64 nEnter;      /* Successful enter and try calls */
+  sqlite3_uint64 nContended;  /* Enter calls that had to wait */
+  sqlite3_uint64 nWaitNs;     /* Total time spent waiting */
+  sqlite3_uint64 mxWaitNs;    /* Longest single wait */
+  sqlite3_uint64 nHoldNs;     /* Total time held */
+  sqlite3_uint64 mxHoldNs;    /* Longest single hold */
+  sqlite3_uint64 aHold[SQLITE_MUTEX_NHOLD];  /* Hold-time histogram */
+};
+SQLITE_API int SQLITE_STDCALL sqlite3_mutex_status(int id, sqlite3_mutex_stats*, int resetFlag);
+SQLITE_API int SQLITE_STDCALL sqlite3_mutex_status_handle(sqlite3_mutex*, sqlite3_mutex_stats*, int resetFlag);
+#endif
 
 /*
 ** CAPI3REF: Retrieve the mutex for a database connection
@@ -319,4 +511,136 @@ SQLITE_API sqlite3_mutex *SQLITE_STDCALL sqlite3_db_mutex(sqlite3*);
 */
 SQLITE_API int SQLITE_STDCALL sqlite3_file_control(sqlite3*, const char *zDbName, int op, void*);
 
+/*
+** Compile-time mutex dispatch.
+**
+** By default every sqlite3_mutex_enter(), sqlite3_mutex_leave() and
+** similar call is dispatched through the function pointers in
+** sqlite3GlobalConfig.mutex.  If SQLite is compiled with
+** SQLITE_MUTEX_DEVIRTUALIZE, the backend is instead chosen at compile
+** time and called directly:
+**
+**   SQLITE_MUTEX_NOOP                    sqlite3NoopMutexImpl
+**   SQLITE_MUTEX_NOOP and SQLITE_DEBUG   sqlite3DebugMutexImpl
+**   SQLITE_MUTEX_PTHREADS                sqlite3PthreadMutexImpl
+**   ... and SQLITE_MUTEX_USE_FUTEX      sqlite3FutexMutexImpl
+**
+** Each backend is a class with the static member functions declared by
+** SQLITE_MUTEX_IMPL_METHODS.  The no-op backend is defined inline here,
+** so that in a no-op build the mutex calls compile to nothing.  The
+** enter, try and leave methods of the pthreads and futex backends are
+** defined inline in mutex_unix.h, which mutex.cpp includes, so that
+** they are inlined into sqlite3_mutex_enter() and the other dispatch
+** routines.  Their alloc and free methods, and all methods of the
+** debugging backend, are ordinary out-of-line functions.
+**
+** In this mode SQLITE_CONFIG_MUTEX is not honored, and sqlite3MutexInit()
+** always installs the compile-time backend.  To keep the runtime override
+** available, also compile with SQLITE_MUTEX_RUNTIME_OVERRIDE.  The direct
+** call is then made only while the installed methods are those of the
+** compile-time backend, and at the cost of one extra test per call.
+*/
+#ifdef SQLITE_MUTEX_DEVIRTUALIZE
+#define SQLITE_MUTEX_IMPL_METHODS                   \
+  static sqlite3_mutex *Alloc(int);                 \
+  static void Free(sqlite3_mutex*);                 \
+  static void Enter(sqlite3_mutex*);                \
+  static int Try(sqlite3_mutex*);                   \
+  static void Leave(sqlite3_mutex*);
+
+#if defined(SQLITE_MUTEX_NOOP) && !defined(SQLITE_DEBUG)
+struct sqlite3NoopMutexImpl {
+  static sqlite3_mutex *Alloc(int){ return (sqlite3_mutex*)8; }
+  static void Free(sqlite3_mutex*){}
+  static void Enter(sqlite3_mutex*){}
+  static int Try(sqlite3_mutex*){ return SQLITE_OK; }
+  static void Leave(sqlite3_mutex*){}
+};
+typedef sqlite3NoopMutexImpl sqlite3MutexImpl;
+#elif defined(SQLITE_MUTEX_NOOP)
+struct sqlite3DebugMutexImpl { SQLITE_MUTEX_IMPL_METHODS };
+typedef sqlite3DebugMutexImpl sqlite3MutexImpl;
+#elif defined(SQLITE_MUTEX_USE_FUTEX)
+struct sqlite3FutexMutexImpl { SQLITE_MUTEX_IMPL_METHODS };
+typedef sqlite3FutexMutexImpl sqlite3MutexImpl;
+#elif defined(SQLITE_MUTEX_PTHREADS)
+struct sqlite3PthreadMutexImpl { SQLITE_MUTEX_IMPL_METHODS };
+typedef sqlite3PthreadMutexImpl sqlite3MutexImpl;
+#else
+# error "SQLITE_MUTEX_DEVIRTUALIZE requires SQLITE_MUTEX_NOOP or SQLITE_MUTEX_PTHREADS"
+#endif
+
+/*
+** The mutex contention profiler works by replacing the methods in
+** sqlite3GlobalConfig.mutex, so it requires runtime dispatch.
+*/
+#if defined(SQLITE_ENABLE_MUTEX_STATUS) && !defined(SQLITE_MUTEX_RUNTIME_OVERRIDE)
+# define SQLITE_MUTEX_RUNTIME_OVERRIDE 1
+#endif
+#endif /* SQLITE_MUTEX_DEVIRTUALIZE */
+
+/*
+** Sharded static mutexes.
+**
+** If SQLite is compiled with SQLITE_MUTEX_NSHARD set to some N greater
+** than 1, there are N additional static mutexes for each of
+** SQLITE_MUTEX_STATIC_MEM and SQLITE_MUTEX_STATIC_LRU.  A subsystem that
+** splits its state into N partitions protects partition i with the mutex
+** SQLITE_MUTEX_SHARD(SQLITE_MUTEX_STATIC_MEM,i) (or the LRU equivalent)
+** instead of the single static mutex, and calls sqlite3MutexShard() to
+** choose the partition used by the calling thread.  If N is 1,
+** SQLITE_MUTEX_SHARD() is the unsharded mutex and sqlite3MutexShard()
+** always returns 0.
+**
+** sqlite3MutexShard() may return a different value each time it is
+** called, so the caller must remember which shard it entered.
+**
+** The shard ids follow SQLITE_MUTEX_RW.  SQLITE_MUTEX_NSTATIC is the
+** total number of static mutexes, sqlite3MutexStaticIndex() maps the id
+** of a static mutex onto the range 0..SQLITE_MUTEX_NSTATIC-1, and
+** SQLITE_MUTEX_NID is one more than the largest mutex id.
+*/
+#ifndef SQLITE_MUTEX_NSHARD
+# define SQLITE_MUTEX_NSHARD 1
+#endif
+#if SQLITE_MUTEX_NSHARD>1
+# define SQLITE_MUTEX_STATIC_MEM_SHARD  15
+# define SQLITE_MUTEX_STATIC_LRU_SHARD  (15+SQLITE_MUTEX_NSHARD)
+# define SQLITE_MUTEX_NSTATIC           (12+2*SQLITE_MUTEX_NSHARD)
+# define SQLITE_MUTEX_SHARD(id,i) ((id)==SQLITE_MUTEX_STATIC_MEM ? \
+    SQLITE_MUTEX_STATIC_MEM_SHARD+(i) : SQLITE_MUTEX_STATIC_LRU_SHARD+(i))
+#else
+# define SQLITE_MUTEX_NSTATIC           12
+# define SQLITE_MUTEX_SHARD(id,i)       (id)
+#endif
+#define SQLITE_MUTEX_NID                (SQLITE_MUTEX_NSTATIC+3)
+#define sqlite3MutexStaticIndex(id) ((id)<SQLITE_MUTEX_RW ? (id)-2 : (id)-3)
+
+/*
+** Memory barriers.
+**
+** sqlite3MemoryBarrier(), provided by the mutex subsystem, is a full
+** barrier: no load or store is moved across it in either direction.  The
+** barriers below are weaker, and cheaper on most hardware.  On x86, for
+** example, they emit no instructions and only prevent the compiler from
+** reordering accesses.
+**
+**   sqlite3AcquireBarrier()  No load or store after the barrier is moved
+**                            before a load that precedes it.
+**   sqlite3ReleaseBarrier()  No load or store before the barrier is moved
+**                            after a store that follows it.
+**   sqlite3AcqRelBarrier()   Both of the above.  Only a store before the
+**                            barrier and a load after it may be reordered.
+**
+** These are C++11 fences and do not depend on the mutex implementation.
+** Unlike sqlite3MemoryBarrier() they are therefore not no-ops in builds
+** that use SQLITE_MUTEX_NOOP or SQLITE_MUTEX_OMIT.  The hardware fences
+** they emit also order accesses to memory shared between processes, such
+** as the WAL-index.
+*/
+#include <atomic>
+#define sqlite3AcquireBarrier() std::atomic_thread_fence(std::memory_order_acquire)
+#define sqlite3ReleaseBarrier() std::atomic_thread_fence(std::memory_order_release)
+#define sqlite3AcqRelBarrier()  std::atomic_thread_fence(std::memory_order_acq_rel)
+
 #endif  //OS_MUTEX_H_
@@ -63,9 +63,34 @@ static int noopMutexTry(sqlite3_mutex *p){
   return SQLITE_OK;
 }
 static void noopMutexLeave(sqlite3_mutex *p){ UNUSED_PARAMETER(p); return; }
+static void noopMutexEnterShared(sqlite3_mutex *p){
+  UNUSED_PARAMETER(p);
+  return;
+}
+static void noopMutexLeaveShared(sqlite3_mutex *p){
+  UNUSED_PARAMETER(p);
+  return;
+}
+
+/*
+** With only a single thread there is nothing to wait for, so a wait on
+** a condition variable times out at once.
+*/
+static sqlite3_mutex_cond *noopCondAlloc(void){
+  return (sqlite3_mutex_cond*)8;
+}
+static void noopCondFree(sqlite3_mutex_cond *p){ UNUSED_PARAMETER(p); }
+static int noopCondWait(sqlite3_mutex_cond *p, sqlite3_mutex *pMutex, int ms){
+  UNUSED_PARAMETER(p);
+  UNUSED_PARAMETER(pMutex);
+  UNUSED_PARAMETER(ms);
+  return SQLITE_BUSY;
+}
+static void noopCondBroadcast(sqlite3_mutex_cond *p){ UNUSED_PARAMETER(p); }
 
-SQLITE_PRIVATE sqlite3_mutex_methods const *sqlite3NoopMutex(void){
-  static const sqlite3_mutex_methods sMutex = {
+SQLITE_PRIVATE sqlite3_mutex_methods_v2 const *sqlite3NoopMutex(void){
+  static const sqlite3_mutex_methods_v2 sMutex = {
+    SQLITE_MUTEX_METHODS_VERSION,
     noopMutexInit,
     noopMutexEnd,
     noopMutexAlloc,
@@ -76,6 +101,13 @@ SQLITE_PRIVATE sqlite3_mutex_methods const *sqlite3NoopMutex(void){
 
     0,
     0,
+
+    noopMutexEnterShared,
+    noopMutexLeaveShared,
+    noopCondAlloc,
+    noopCondFree,
+    noopCondWait,
+    noopCondBroadcast
   };
 
   return &sMutex;
@@ -122,12 +154,13 @@ static int debugMutexEnd(void){ return SQLITE_OK; }
 ** that means that a mutex could not be allocated.
 */
 static sqlite3_mutex *debugMutexAlloc(int id){
-  static sqlite3_debug_mutex aStatic[SQLITE_MUTEX_STATIC_VFS3 - 1];
+  static sqlite3_debug_mutex aStatic[SQLITE_MUTEX_NSTATIC];
   sqlite3_debug_mutex *pNew = 0;
   switch( id ){
     case SQLITE_MUTEX_FAST:
-    case SQLITE_MUTEX_RECURSIVE: {
-      pNew = sqlite3Malloc(sizeof(*pNew));
+    case SQLITE_MUTEX_RECURSIVE:
+    case SQLITE_MUTEX_RW: {
+      pNew = (sqlite3_debug_mutex*)sqlite3Malloc(sizeof(*pNew));
       if( pNew ){
         pNew->id = id;
         pNew->cnt = 0;
@@ -135,13 +168,14 @@ static sqlite3_mutex *debugMutexAlloc(int id){
       break;
     }
     default: {
+      int iStatic = sqlite3MutexStaticIndex(id);
 #ifdef SQLITE_ENABLE_API_ARMOR
-      if( id-2<0 || id-2>=ArraySize(aStatic) ){
+      if( iStatic<0 || iStatic>=ArraySize(aStatic) ){
         (void)SQLITE_MISUSE_BKPT;
         return 0;
       }
 #endif
-      pNew = &aStatic[id-2];
+      pNew = &aStatic[iStatic];
       pNew->id = id;
       break;
     }
@@ -155,7 +189,9 @@ static sqlite3_mutex *debugMutexAlloc(int id){
 static void debugMutexFree(sqlite3_mutex *pX){
   sqlite3_debug_mutex *p = (sqlite3_debug_mutex*)pX;
   assert( p->cnt==0 );
-  if( p->id==SQLITE_MUTEX_RECURSIVE || p->id==SQLITE_MUTEX_FAST ){
+  if( p->id==SQLITE_MUTEX_RECURSIVE || p->id==SQLITE_MUTEX_FAST
+   || p->id==SQLITE_MUTEX_RW
+  ){
     sqlite3_free(p);
   }else{
 #ifdef SQLITE_ENABLE_API_ARMOR
@@ -200,8 +236,44 @@ static void debugMutexLeave(sqlite3_mutex *pX){
   assert( p->id==SQLITE_MUTEX_RECURSIVE || debugMutexNotheld(pX) );
 }
 
-SQLITE_PRIVATE sqlite3_mutex_methods const *sqlite3NoopMutex(void){
-  static const sqlite3_mutex_methods sMutex = {
+/*
+** Enter and leave an SQLITE_MUTEX_RW mutex in shared mode.  Shared
+** entries are counted in the same way as exclusive ones, so an attempt
+** to enter the mutex exclusively while it is held in shared mode fails
+** the assert() in debugMutexEnter().
+*/
+static void debugMutexEnterShared(sqlite3_mutex *pX){
+  sqlite3_debug_mutex *p = (sqlite3_debug_mutex*)pX;
+  assert( p->id==SQLITE_MUTEX_RW );
+  p->cnt++;
+}
+static void debugMutexLeaveShared(sqlite3_mutex *pX){
+  sqlite3_debug_mutex *p = (sqlite3_debug_mutex*)pX;
+  assert( p->id==SQLITE_MUTEX_RW );
+  assert( debugMutexHeld(pX) );
+  p->cnt--;
+}
+
+/*
+** Condition variables.  No other thread can signal a condition variable,
+** so a wait times out at once.  The mutex is checked but not released.
+*/
+static sqlite3_mutex_cond *debugCondAlloc(void){
+  return (sqlite3_mutex_cond*)8;
+}
+static void debugCondFree(sqlite3_mutex_cond *p){ UNUSED_PARAMETER(p); }
+static int debugCondWait(sqlite3_mutex_cond *p, sqlite3_mutex *pX, int ms){
+  UNUSED_PARAMETER(p);
+  UNUSED_PARAMETER(ms);
+  assert( ((sqlite3_debug_mutex*)pX)->id==SQLITE_MUTEX_FAST );
+  assert( ((sqlite3_debug_mutex*)pX)->cnt==1 );
+  return SQLITE_BUSY;
+}
+static void debugCondBroadcast(sqlite3_mutex_cond *p){ UNUSED_PARAMETER(p); }
+
+SQLITE_PRIVATE sqlite3_mutex_methods_v2 const *sqlite3NoopMutex(void){
+  static const sqlite3_mutex_methods_v2 sMutex = {
+    SQLITE_MUTEX_METHODS_VERSION,
     debugMutexInit,
     debugMutexEnd,
     debugMutexAlloc,
@@ -211,11 +283,29 @@ SQLITE_PRIVATE sqlite3_mutex_methods const *sqlite3NoopMutex(void){
     debugMutexLeave,
 
     debugMutexHeld,
-    debugMutexNotheld
+    debugMutexNotheld,
+
+    debugMutexEnterShared,
+    debugMutexLeaveShared,
+    debugCondAlloc,
+    debugCondFree,
+    debugCondWait,
+    debugCondBroadcast
   };
 
   return &sMutex;
 }
+
+#if defined(SQLITE_MUTEX_DEVIRTUALIZE) && defined(SQLITE_MUTEX_NOOP)
+/*
+** The debugging mutexes as the compile-time mutex backend.
+*/
+sqlite3_mutex *sqlite3DebugMutexImpl::Alloc(int id){ return debugMutexAlloc(id); }
+void sqlite3DebugMutexImpl::Free(sqlite3_mutex *p){ debugMutexFree(p); }
+void sqlite3DebugMutexImpl::Enter(sqlite3_mutex *p){ debugMutexEnter(p); }
+int sqlite3DebugMutexImpl::Try(sqlite3_mutex *p){ return debugMutexTry(p); }
+void sqlite3DebugMutexImpl::Leave(sqlite3_mutex *p){ debugMutexLeave(p); }
+#endif
 #endif /* SQLITE_DEBUG */
 
 /*
@@ -223,7 +313,7 @@ SQLITE_PRIVATE sqlite3_mutex_methods const *sqlite3NoopMutex(void){
 ** is used regardless of the run-time threadsafety setting.
 */
 #ifdef SQLITE_MUTEX_NOOP
-SQLITE_PRIVATE sqlite3_mutex_methods const *sqlite3DefaultMutex(void){
+SQLITE_PRIVATE sqlite3_mutex_methods_v2 const *sqlite3DefaultMutex(void){
   return sqlite3NoopMutex();
 }
 #endif /* defined(SQLITE_MUTEX_NOOP) */
@@ -35,82 +35,310 @@ History:
 */
 #ifdef SQLITE_MUTEX_PTHREADS
 
-#include <pthread.h>
+/*
+** The mutex objects and the enter, try and leave routines are in
+** mutex_unix.h.
+*/
+#include "mutex_unix.h"
 
+#ifdef SQLITE_ATOMIC_RECURSIVE_MUTEX
 /*
-** The sqlite3_mutex.id, sqlite3_mutex.nRef, and sqlite3_mutex.owner fields
-** are necessary under two condidtions:  (1) Debug builds and (2) using
-** home-grown mutexes.  Encapsulate these conditions into a single #define.
+** The thread-local variable whose address identifies the calling thread.
+** See pthreadMutexSelf() in mutex_unix.h.
 */
-#if defined(SQLITE_DEBUG) || defined(SQLITE_HOMEGROWN_RECURSIVE_MUTEX)
-# define SQLITE_MUTEX_NREF 1
-#else
-# define SQLITE_MUTEX_NREF 0
+SQLITE_THREAD_LOCAL char sqlite3PthreadMutexTag;
 #endif
 
 /*
-** Each recursive mutex is an instance of the following structure.
+** Provide a full memory barrier.  No load or store is moved across the
+** barrier in either direction.  See also sqlite3AcquireBarrier() and
+** sqlite3ReleaseBarrier(), which are sufficient for most purposes.
 */
-struct sqlite3_mutex {
-  pthread_mutex_t mutex;     /* Mutex controlling the lock */
-#if SQLITE_MUTEX_NREF || defined(SQLITE_ENABLE_API_ARMOR)
-  int id;                    /* Mutex type */
-#endif
-#if SQLITE_MUTEX_NREF
-  volatile int nRef;         /* Number of entrances */
-  volatile pthread_t owner;  /* Thread that is within this mutex */
-  int trace;                 /* True to trace changes */
+SQLITE_PRIVATE void sqlite3MemoryBarrier(void){
+#if defined(SQLITE_MEMORY_BARRIER)
+  SQLITE_MEMORY_BARRIER;
+#else
+  std::atomic_thread_fence(std::memory_order_seq_cst);
 #endif
-};
-#if SQLITE_MUTEX_NREF
-#define SQLITE3_MUTEX_INITIALIZER { PTHREAD_MUTEX_INITIALIZER, 0, 0, (pthread_t)0, 0 }
+}
+
+#ifndef SQLITE_MUTEX_USE_FUTEX
+/*
+** The pthreads mutex methods.  These are not compiled when the futex
+** mutexes are the default, as nothing would refer to them.
+*/
+
+/*
+** Initialize the pthread_mutex_t of a new SQLITE_MUTEX_FAST or
+** SQLITE_MUTEX_RECURSIVE mutex.
+*/
+static void pthreadMutexInitDynamic(sqlite3_mutex *p, int iType){
+  if( iType==SQLITE_MUTEX_RECURSIVE ){
+#if defined(SQLITE_HOMEGROWN_RECURSIVE_MUTEX) \
+ || defined(SQLITE_ATOMIC_RECURSIVE_MUTEX)
+    /* If recursive mutexes are not available, or if owner-tracking
+    ** recursive mutexes are in use, we will have to build our own.
+    ** See below. */
+    pthread_mutex_init(&p->mutex, 0);
 #else
-#define SQLITE3_MUTEX_INITIALIZER { PTHREAD_MUTEX_INITIALIZER }
+    /* Use a recursive mutex if it is available */
+    pthread_mutexattr_t recursiveAttr;
+    pthread_mutexattr_init(&recursiveAttr);
+    pthread_mutexattr_settype(&recursiveAttr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&p->mutex, &recursiveAttr);
+    pthread_mutexattr_destroy(&recursiveAttr);
 #endif
+  }else{
+    pthread_mutex_init(&p->mutex, 0);
+  }
+  p->id = iType;
+}
 
+#ifdef SQLITE_ENABLE_MUTEX_POOL
 /*
-** The sqlite3_mutex_held() and sqlite3_mutex_notheld() routine are
-** intended for use only inside assert() statements.  On some platforms,
-** there might be race conditions that can cause these routines to
-** deliver incorrect results.  In particular, if pthread_equal() is
-** not an atomic operation, then these routines might delivery
-** incorrect results.  On most platforms, pthread_equal() is a
-** comparison of two integers and is therefore atomic.  But we are
-** told that HPUX is not such a platform.  If so, then these routines
-** will not always work correctly on HPUX.
+** Pooled allocation of dynamic mutexes.
+**
+** If SQLite is compiled with SQLITE_ENABLE_MUTEX_POOL, SQLITE_MUTEX_FAST
+** and SQLITE_MUTEX_RECURSIVE mutexes are not obtained from sqlite3_malloc()
+** and released with sqlite3_free().  Instead they are carved out of
+** slabs of SQLITE_MUTEX_POOL_SLAB objects, each object aligned to and
+** padded out to its own cache line.  The pthread_mutex_t within each
+** object is initialized once when the slab is allocated and remains
+** initialized while the object sits on a free list, so allocating and
+** freeing a mutex are just list operations.
+**
+** There is one pool for each of the two types.  Each thread keeps a
+** private free list of up to SQLITE_MUTEX_POOL_CACHE objects per type,
+** which is used without any locking.  When a thread's list is empty it
+** takes a batch of objects from the shared free list, and when it grows
+** too long it returns half of its objects.  Only the shared lists, and
+** the allocation of new slabs, are protected by a mutex, which is a
+** private pthread mutex rather than SQLITE_MUTEX_STATIC_MEM.  The
+** objects on an exiting thread's list are returned to the shared list.
 **
-** On those platforms where pthread_equal() is not atomic, SQLite
-** should be compiled without -DSQLITE_DEBUG and with -DNDEBUG to
-** make sure no assert() statements are evaluated and hence these
-** routines are never called.
+** Slabs are obtained directly from the C library and are released by
+** pthreadMutexEnd().  Each call to pthreadMutexEnd() also increments
+** mutexPoolGen, which invalidates the private lists of all threads.
 */
-#if !defined(NDEBUG) || defined(SQLITE_DEBUG)
-static int pthreadMutexHeld(sqlite3_mutex *p){
-  return (p->nRef!=0 && pthread_equal(p->owner, pthread_self()));
+#ifndef SQLITE_MUTEX_POOL_SLAB
+# define SQLITE_MUTEX_POOL_SLAB 64
+#endif
+#ifndef SQLITE_MUTEX_POOL_CACHE
+# define SQLITE_MUTEX_POOL_CACHE 16
+#endif
+
+typedef struct MutexPoolEntry MutexPoolEntry;
+typedef struct MutexPool MutexPool;
+typedef struct MutexPoolCache MutexPoolCache;
+
+struct alignas(SQLITE_MUTEX_CACHELINE) MutexPoolEntry {
+  sqlite3_mutex m;           /* The mutex.  Must be first */
+  MutexPoolEntry *pNextFree; /* Next entry on the same free list */
+};
+
+struct MutexPool {
+  pthread_mutex_t mutex;     /* Protects the other fields */
+  MutexPoolEntry *pFree;     /* Shared free list */
+  void *pSlab;               /* All slabs, linked through their first word */
+};
+
+struct MutexPoolCache {
+  unsigned int iGen;         /* Value of mutexPoolGen for this cache */
+  int bRegistered;           /* True once the exit destructor is set */
+  int anFree[2];             /* Number of entries on each apFree[] list */
+  MutexPoolEntry *apFree[2]; /* Private free lists, indexed by type */
+};
+
+/* The pools, indexed by SQLITE_MUTEX_FAST and SQLITE_MUTEX_RECURSIVE */
+static MutexPool aMutexPool[2] = {
+  { PTHREAD_MUTEX_INITIALIZER, 0, 0 },
+  { PTHREAD_MUTEX_INITIALIZER, 0, 0 },
+};
+static volatile unsigned int mutexPoolGen = 1;
+static SQLITE_THREAD_LOCAL MutexPoolCache mutexPoolCache;
+static pthread_key_t mutexPoolKey;
+static pthread_once_t mutexPoolOnce = PTHREAD_ONCE_INIT;
+
+/*
+** Move entries from the private list of type iType in cache pCache to
+** the shared list until at most nKeep remain.
+*/
+static void mutexPoolRelease(MutexPoolCache *pCache, int iType, int nKeep){
+  MutexPool *pPool = &aMutexPool[iType];
+  pthread_mutex_lock(&pPool->mutex);
+  while( pCache->anFree[iType]>nKeep ){
+    MutexPoolEntry *pEntry = pCache->apFree[iType];
+    pCache->apFree[iType] = pEntry->pNextFree;
+    pCache->anFree[iType]--;
+    pEntry->pNextFree = pPool->pFree;
+    pPool->pFree = pEntry;
+  }
+  pthread_mutex_unlock(&pPool->mutex);
 }
-static int pthreadMutexNotheld(sqlite3_mutex *p){
-  return p->nRef==0 || pthread_equal(p->owner, pthread_self())==0;
+
+/*
+** Thread-exit destructor.  Return the exiting thread's private entries
+** to the shared lists, unless they belong to an earlier generation.
+*/
+static void mutexPoolThreadExit(void *pArg){
+  MutexPoolCache *pCache = (MutexPoolCache*)pArg;
+  if( pCache->iGen==mutexPoolGen ){
+    mutexPoolRelease(pCache, SQLITE_MUTEX_FAST, 0);
+    mutexPoolRelease(pCache, SQLITE_MUTEX_RECURSIVE, 0);
+  }
+}
+static void mutexPoolCreateKey(void){
+  pthread_key_create(&mutexPoolKey, mutexPoolThreadExit);
 }
-#endif
 
 /*
-** Try to provide a memory barrier operation, needed for initialization
-** and also for the implementation of xShmBarrier in the VFS in cases
-** where SQLite is compiled without mutexes.
+** Refill the empty private list of type iType in cache pCache with up to
+** half of SQLITE_MUTEX_POOL_CACHE entries, allocating a new slab if the
+** shared list is empty.
 */
-SQLITE_PRIVATE void sqlite3MemoryBarrier(void){
-#if defined(SQLITE_MEMORY_BARRIER)
-  SQLITE_MEMORY_BARRIER;
-#elif defined(__GNUC__) && GCC_VERSION>=4001000
-  __sync_synchronize();
-#endif
+static void mutexPoolRefill(MutexPoolCache *pCache, int iType){
+  MutexPool *pPool = &aMutexPool[iType];
+  int nWant = SQLITE_MUTEX_POOL_CACHE/2 + 1;
+  pthread_mutex_lock(&pPool->mutex);
+  if( pPool->pFree==0 ){
+    /* The first cache line of each slab holds the slab list pointer */
+    size_t nByte = SQLITE_MUTEX_CACHELINE
+                 + SQLITE_MUTEX_POOL_SLAB*sizeof(MutexPoolEntry);
+    void *pSlab = 0;
+    if( posix_memalign(&pSlab, SQLITE_MUTEX_CACHELINE, nByte)==0 ){
+      MutexPoolEntry *aEntry;
+      int i;
+      memset(pSlab, 0, nByte);
+      *(void**)pSlab = pPool->pSlab;
+      pPool->pSlab = pSlab;
+      aEntry = (MutexPoolEntry*)&((char*)pSlab)[SQLITE_MUTEX_CACHELINE];
+      for(i=0; i<SQLITE_MUTEX_POOL_SLAB; i++){
+        pthreadMutexInitDynamic(&aEntry[i].m, iType);
+        aEntry[i].pNextFree = pPool->pFree;
+        pPool->pFree = &aEntry[i];
+      }
+    }
+  }
+  while( pPool->pFree && nWant-- ){
+    MutexPoolEntry *pEntry = pPool->pFree;
+    pPool->pFree = pEntry->pNextFree;
+    pEntry->pNextFree = pCache->apFree[iType];
+    pCache->apFree[iType] = pEntry;
+    pCache->anFree[iType]++;
+  }
+  pthread_mutex_unlock(&pPool->mutex);
+}
+
+/*
+** Return the calling thread's cache, discarding its contents if they
+** belong to an earlier generation of the pools.
+*/
+static MutexPoolCache *mutexPoolGetCache(void){
+  MutexPoolCache *pCache = &mutexPoolCache;
+  if( pCache->iGen!=mutexPoolGen ){
+    pCache->iGen = mutexPoolGen;
+    pCache->anFree[0] = pCache->anFree[1] = 0;
+    pCache->apFree[0] = pCache->apFree[1] = 0;
+    if( !pCache->bRegistered ){
+      pthread_once(&mutexPoolOnce, mutexPoolCreateKey);
+      pthread_setspecific(mutexPoolKey, (void*)pCache);
+      pCache->bRegistered = 1;
+    }
+  }
+  return pCache;
+}
+
+/*
+** Allocate a mutex of type iType (SQLITE_MUTEX_FAST or
+** SQLITE_MUTEX_RECURSIVE) from the pool.
+*/
+static sqlite3_mutex *mutexPoolAlloc(int iType){
+  MutexPoolCache *pCache = mutexPoolGetCache();
+  MutexPoolEntry *pEntry;
+  if( pCache->apFree[iType]==0 ){
+    mutexPoolRefill(pCache, iType);
+    if( pCache->apFree[iType]==0 ) return 0;
+  }
+  pEntry = pCache->apFree[iType];
+  pCache->apFree[iType] = pEntry->pNextFree;
+  pCache->anFree[iType]--;
+  assert( pEntry->m.id==iType );
+  return &pEntry->m;
+}
+
+/*
+** Return mutex p, allocated by mutexPoolAlloc(), to the pool.
+*/
+static void mutexPoolFree(sqlite3_mutex *p){
+  MutexPoolCache *pCache = mutexPoolGetCache();
+  MutexPoolEntry *pEntry = (MutexPoolEntry*)p;
+  int iType = p->id;
+  pEntry->pNextFree = pCache->apFree[iType];
+  pCache->apFree[iType] = pEntry;
+  pCache->anFree[iType]++;
+  if( pCache->anFree[iType]>SQLITE_MUTEX_POOL_CACHE ){
+    mutexPoolRelease(pCache, iType, SQLITE_MUTEX_POOL_CACHE/2);
+  }
+}
+
+/*
+** Release all slabs.  Called by pthreadMutexEnd(), at which point all
+** dynamic mutexes have been freed.
+*/
+static void mutexPoolShutdown(void){
+  int iType;
+  for(iType=0; iType<2; iType++){
+    MutexPool *pPool = &aMutexPool[iType];
+    pthread_mutex_lock(&pPool->mutex);
+    while( pPool->pSlab ){
+      void *pSlab = pPool->pSlab;
+      MutexPoolEntry *aEntry;
+      int i;
+      aEntry = (MutexPoolEntry*)&((char*)pSlab)[SQLITE_MUTEX_CACHELINE];
+      for(i=0; i<SQLITE_MUTEX_POOL_SLAB; i++){
+        pthread_mutex_destroy(&aEntry[i].m.mutex);
+      }
+      pPool->pSlab = *(void**)pSlab;
+      free(pSlab);
+    }
+    pPool->pFree = 0;
+    pthread_mutex_unlock(&pPool->mutex);
+  }
+  mutexPoolGen++;
+}
+#endif /* SQLITE_ENABLE_MUTEX_POOL */
+
+#if SQLITE_MUTEX_NSHARD>1
+/*
+** The sharded static mutexes.  There is a variable number of these, so
+** they are initialized by pthreadMutexInit() instead of by a static
+** initializer.
+*/
+static sqlite3_static_mutex shardMutexes[2*SQLITE_MUTEX_NSHARD];
+static pthread_once_t shardMutexOnce = PTHREAD_ONCE_INIT;
+static void pthreadMutexShardInit(void){
+  int i;
+  for(i=0; i<ArraySize(shardMutexes); i++){
+    pthread_mutex_init(&shardMutexes[i].m.mutex, 0);
+  }
 }
+#endif
 
 /*
 ** Initialize and deinitialize the mutex subsystem.
 */
-static int pthreadMutexInit(void){ return SQLITE_OK; }
-static int pthreadMutexEnd(void){ return SQLITE_OK; }
+static int pthreadMutexInit(void){
+#if SQLITE_MUTEX_NSHARD>1
+  pthread_once(&shardMutexOnce, pthreadMutexShardInit);
+#endif
+  return SQLITE_OK;
+}
+static int pthreadMutexEnd(void){
+#ifdef SQLITE_ENABLE_MUTEX_POOL
+  mutexPoolShutdown();
+#endif
+  return SQLITE_OK;
+}
 
 /*
 ** The sqlite3_mutex_alloc() routine allocates a new
@@ -122,6 +350,7 @@ static int pthreadMutexEnd(void){ return SQLITE_OK; }
 ** <ul>
 ** <li>  SQLITE_MUTEX_FAST
 ** <li>  SQLITE_MUTEX_RECURSIVE
+** <li>  SQLITE_MUTEX_RW
 ** <li>  SQLITE_MUTEX_STATIC_MASTER
 ** <li>  SQLITE_MUTEX_STATIC_MEM
 ** <li>  SQLITE_MUTEX_STATIC_OPEN
@@ -136,9 +365,11 @@ static int pthreadMutexEnd(void){ return SQLITE_OK; }
 ** <li>  SQLITE_MUTEX_STATIC_VFS3
 ** </ul>
 **
-** The first two constants cause sqlite3_mutex_alloc() to create
+** The first three constants cause sqlite3_mutex_alloc() to create
 ** a new mutex.  The new mutex is recursive when SQLITE_MUTEX_RECURSIVE
 ** is used but not necessarily so when SQLITE_MUTEX_FAST is used.
+** SQLITE_MUTEX_RW creates a non-recursive mutex that may also be entered
+** in shared mode by any number of threads at once.
 ** The mutex implementation does not need to make a distinction
 ** between SQLITE_MUTEX_RECURSIVE and SQLITE_MUTEX_FAST if it does
 ** not want to.  But SQLite will only request a recursive mutex in
@@ -161,61 +392,71 @@ static int pthreadMutexEnd(void){ return SQLITE_OK; }
 ** the same type number.
 */
 static sqlite3_mutex *pthreadMutexAlloc(int iType){
-  static sqlite3_mutex staticMutexes[] = {
-    SQLITE3_MUTEX_INITIALIZER,
-    SQLITE3_MUTEX_INITIALIZER,
-    SQLITE3_MUTEX_INITIALIZER,
-    SQLITE3_MUTEX_INITIALIZER,
-    SQLITE3_MUTEX_INITIALIZER,
-    SQLITE3_MUTEX_INITIALIZER,
-    SQLITE3_MUTEX_INITIALIZER,
-    SQLITE3_MUTEX_INITIALIZER,
-    SQLITE3_MUTEX_INITIALIZER,
-    SQLITE3_MUTEX_INITIALIZER,
-    SQLITE3_MUTEX_INITIALIZER,
-    SQLITE3_MUTEX_INITIALIZER
+  static sqlite3_static_mutex staticMutexes[] = {
+    SQLITE3_STATIC_MUTEX_INITIALIZER,
+    SQLITE3_STATIC_MUTEX_INITIALIZER,
+    SQLITE3_STATIC_MUTEX_INITIALIZER,
+    SQLITE3_STATIC_MUTEX_INITIALIZER,
+    SQLITE3_STATIC_MUTEX_INITIALIZER,
+    SQLITE3_STATIC_MUTEX_INITIALIZER,
+    SQLITE3_STATIC_MUTEX_INITIALIZER,
+    SQLITE3_STATIC_MUTEX_INITIALIZER,
+    SQLITE3_STATIC_MUTEX_INITIALIZER,
+    SQLITE3_STATIC_MUTEX_INITIALIZER,
+    SQLITE3_STATIC_MUTEX_INITIALIZER,
+    SQLITE3_STATIC_MUTEX_INITIALIZER
   };
   sqlite3_mutex *p;
   switch( iType ){
-    case SQLITE_MUTEX_RECURSIVE: {
-      p = sqlite3MallocZero( sizeof(*p) );
-      if( p ){
-#ifdef SQLITE_HOMEGROWN_RECURSIVE_MUTEX
-        /* If recursive mutexes are not available, we will have to
-        ** build our own.  See below. */
-        pthread_mutex_init(&p->mutex, 0);
+    case SQLITE_MUTEX_RECURSIVE:
+    case SQLITE_MUTEX_FAST: {
+#ifdef SQLITE_ENABLE_MUTEX_POOL
+      p = mutexPoolAlloc(iType);
 #else
-        /* Use a recursive mutex if it is available */
-        pthread_mutexattr_t recursiveAttr;
-        pthread_mutexattr_init(&recursiveAttr);
-        pthread_mutexattr_settype(&recursiveAttr, PTHREAD_MUTEX_RECURSIVE);
-        pthread_mutex_init(&p->mutex, &recursiveAttr);
-        pthread_mutexattr_destroy(&recursiveAttr);
-#endif
+      p = (sqlite3_mutex*)sqlite3MallocZero( sizeof(*p) );
+      if( p ){
+        pthreadMutexInitDynamic(p, iType);
       }
+#endif
       break;
     }
-    case SQLITE_MUTEX_FAST: {
-      p = sqlite3MallocZero( sizeof(*p) );
-      if( p ){
-        pthread_mutex_init(&p->mutex, 0);
+    case SQLITE_MUTEX_RW: {
+      sqlite3_rw_mutex *pRw = (sqlite3_rw_mutex*)sqlite3MallocZero( sizeof(*pRw) );
+      p = 0;
+      if( pRw ){
+        pthread_rwlockattr_t rwAttr;
+        pthread_rwlockattr_init(&rwAttr);
+#if defined(__GLIBC__) && defined(_GNU_SOURCE)
+        /* glibc rwlocks prefer readers by default, which can starve
+        ** writers indefinitely when there are many reader threads. */
+        pthread_rwlockattr_setkind_np(&rwAttr,
+            PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+        pthread_rwlock_init(&pRw->rwlock, &rwAttr);
+        pthread_rwlockattr_destroy(&rwAttr);
+        p = &pRw->base;
       }
       break;
     }
     default: {
+      int iStatic = sqlite3MutexStaticIndex(iType);
 #ifdef SQLITE_ENABLE_API_ARMOR
-      if( iType-2<0 || iType-2>=ArraySize(staticMutexes) ){
+      if( iStatic<0 || iStatic>=SQLITE_MUTEX_NSTATIC ){
         (void)SQLITE_MISUSE_BKPT;
         return 0;
       }
 #endif
-      p = &staticMutexes[iType-2];
+#if SQLITE_MUTEX_NSHARD>1
+      if( iStatic>=ArraySize(staticMutexes) ){
+        p = &shardMutexes[iStatic-ArraySize(staticMutexes)].m;
+        break;
+      }
+#endif
+      p = &staticMutexes[iStatic].m;
       break;
     }
   }
-#if SQLITE_MUTEX_NREF || defined(SQLITE_ENABLE_API_ARMOR)
   if( p ) p->id = iType;
-#endif
   return p;
 }
 
@@ -227,12 +468,20 @@ static sqlite3_mutex *pthreadMutexAlloc(int iType){
 */
 static void pthreadMutexFree(sqlite3_mutex *p){
   assert( p->nRef==0 );
+  if( p->id==SQLITE_MUTEX_RW ){
+    pthread_rwlock_destroy(&((sqlite3_rw_mutex*)p)->rwlock);
+    sqlite3_free(p);
+  }else
 #if SQLITE_ENABLE_API_ARMOR
   if( p->id==SQLITE_MUTEX_FAST || p->id==SQLITE_MUTEX_RECURSIVE )
 #endif
   {
+#ifdef SQLITE_ENABLE_MUTEX_POOL
+    mutexPoolFree(p);
+#else
     pthread_mutex_destroy(&p->mutex);
     sqlite3_free(p);
+#endif
   }
 #ifdef SQLITE_ENABLE_API_ARMOR
   else{
@@ -241,141 +490,254 @@ static void pthreadMutexFree(sqlite3_mutex *p){
 #endif
 }
 
+
 /*
-** The sqlite3_mutex_enter() and sqlite3_mutex_try() routines attempt
-** to enter a mutex.  If another thread is already within the mutex,
-** sqlite3_mutex_enter() will block and sqlite3_mutex_try() will return
-** SQLITE_BUSY.  The sqlite3_mutex_try() interface returns SQLITE_OK
-** upon successful entry.  Mutexes created using SQLITE_MUTEX_RECURSIVE can
-** be entered multiple times by the same thread.  In such cases the,
-** mutex must be exited an equal number of times before another thread
-** can enter.  If the same thread tries to enter any other kind of mutex
-** more than once, the behavior is undefined.
+** The sqlite3_mutex_enter_shared() and sqlite3_mutex_leave_shared()
+** routines enter and leave an SQLITE_MUTEX_RW mutex in shared mode.  Any
+** number of threads may hold the mutex in shared mode at once, but not
+** while another thread holds it exclusively.
 */
-static void pthreadMutexEnter(sqlite3_mutex *p){
-  assert( p->id==SQLITE_MUTEX_RECURSIVE || pthreadMutexNotheld(p) );
-
-#ifdef SQLITE_HOMEGROWN_RECURSIVE_MUTEX
-  /* If recursive mutexes are not available, then we have to grow
-  ** our own.  This implementation assumes that pthread_equal()
-  ** is atomic - that it cannot be deceived into thinking self
-  ** and p->owner are equal if p->owner changes between two values
-  ** that are not equal to self while the comparison is taking place.
-  ** This implementation also assumes a coherent cache - that
-  ** separate processes cannot read different values from the same
-  ** address at the same time.  If either of these two conditions
-  ** are not met, then the mutexes will fail and problems will result.
-  */
-  {
-    pthread_t self = pthread_self();
-    if( p->nRef>0 && pthread_equal(p->owner, self) ){
-      p->nRef++;
-    }else{
-      pthread_mutex_lock(&p->mutex);
-      assert( p->nRef==0 );
-      p->owner = self;
-      p->nRef = 1;
-    }
-  }
+static void pthreadMutexEnterShared(sqlite3_mutex *p){
+  assert( p->id==SQLITE_MUTEX_RW );
+  assert( pthreadMutexNotheld(p) );
+  pthread_rwlock_rdlock(&((sqlite3_rw_mutex*)p)->rwlock);
+}
+static void pthreadMutexLeaveShared(sqlite3_mutex *p){
+  assert( p->id==SQLITE_MUTEX_RW );
+  pthread_rwlock_unlock(&((sqlite3_rw_mutex*)p)->rwlock);
+}
+
+/*
+** Condition variables.  Where the platform allows it, the condition
+** variable measures timeouts against CLOCK_MONOTONIC so that a wait is
+** not lengthened or cut short by changes to the system clock.
+*/
+#if !defined(__APPLE__)
+# define SQLITE_MUTEX_COND_CLOCK CLOCK_MONOTONIC
 #else
-  /* Use the built-in recursive mutexes if they are available.
-  */
-  pthread_mutex_lock(&p->mutex);
-#if SQLITE_MUTEX_NREF
-  assert( p->nRef>0 || p->owner==0 );
-  p->owner = pthread_self();
-  p->nRef++;
-#endif
+# define SQLITE_MUTEX_COND_CLOCK CLOCK_REALTIME
 #endif
+struct sqlite3_mutex_cond {
+  pthread_cond_t cond;       /* The condition variable */
+};
 
-#ifdef SQLITE_DEBUG
-  if( p->trace ){
-    printf("enter mutex %p (%d) with nRef=%d\n", p, p->trace, p->nRef);
-  }
+static sqlite3_mutex_cond *pthreadCondAlloc(void){
+  sqlite3_mutex_cond *p = (sqlite3_mutex_cond*)sqlite3MallocZero(sizeof(*p));
+  if( p ){
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+#if !defined(__APPLE__)
+    pthread_condattr_setclock(&attr, SQLITE_MUTEX_COND_CLOCK);
 #endif
+    pthread_cond_init(&p->cond, &attr);
+    pthread_condattr_destroy(&attr);
+  }
+  return p;
+}
+static void pthreadCondFree(sqlite3_mutex_cond *p){
+  pthread_cond_destroy(&p->cond);
+  sqlite3_free(p);
 }
-static int pthreadMutexTry(sqlite3_mutex *p){
+
+/*
+** Wait on condition variable pCond.  The owner and nRef fields of p are
+** cleared for the duration of the wait, as another thread may enter p
+** while this one is blocked.
+*/
+static int pthreadCondWait(sqlite3_mutex_cond *pCond, sqlite3_mutex *p, int ms){
   int rc;
-  assert( p->id==SQLITE_MUTEX_RECURSIVE || pthreadMutexNotheld(p) );
-
-#ifdef SQLITE_HOMEGROWN_RECURSIVE_MUTEX
-  /* If recursive mutexes are not available, then we have to grow
-  ** our own.  This implementation assumes that pthread_equal()
-  ** is atomic - that it cannot be deceived into thinking self
-  ** and p->owner are equal if p->owner changes between two values
-  ** that are not equal to self while the comparison is taking place.
-  ** This implementation also assumes a coherent cache - that
-  ** separate processes cannot read different values from the same
-  ** address at the same time.  If either of these two conditions
-  ** are not met, then the mutexes will fail and problems will result.
-  */
-  {
-    pthread_t self = pthread_self();
-    if( p->nRef>0 && pthread_equal(p->owner, self) ){
-      p->nRef++;
-      rc = SQLITE_OK;
-    }else if( pthread_mutex_trylock(&p->mutex)==0 ){
-      assert( p->nRef==0 );
-      p->owner = self;
-      p->nRef = 1;
-      rc = SQLITE_OK;
-    }else{
-      rc = SQLITE_BUSY;
-    }
-  }
-#else
-  /* Use the built-in recursive mutexes if they are available.
-  */
-  if( pthread_mutex_trylock(&p->mutex)==0 ){
+  assert( p->id==SQLITE_MUTEX_FAST );
+  assert( pthreadMutexHeld(p) );
 #if SQLITE_MUTEX_NREF
-    p->owner = pthread_self();
-    p->nRef++;
+  assert( p->nRef==1 );
+  p->nRef = 0;
+  p->owner = 0;
 #endif
-    rc = SQLITE_OK;
+  if( ms<0 ){
+    rc = pthread_cond_wait(&pCond->cond, &p->mutex);
   }else{
-    rc = SQLITE_BUSY;
+    struct timespec t;
+    clock_gettime(SQLITE_MUTEX_COND_CLOCK, &t);
+    t.tv_sec += ms/1000;
+    t.tv_nsec += (long)(ms%1000)*1000000;
+    if( t.tv_nsec>=1000000000 ){
+      t.tv_sec++;
+      t.tv_nsec -= 1000000000;
+    }
+    rc = pthread_cond_timedwait(&pCond->cond, &p->mutex, &t);
   }
+#if SQLITE_MUTEX_NREF
+  p->owner = pthread_self();
+  p->nRef = 1;
 #endif
+  return rc==ETIMEDOUT ? SQLITE_BUSY : SQLITE_OK;
+}
+static void pthreadCondBroadcast(sqlite3_mutex_cond *p){
+  pthread_cond_broadcast(&p->cond);
+}
+#endif /* !SQLITE_MUTEX_USE_FUTEX */
 
-#ifdef SQLITE_DEBUG
-  if( rc==SQLITE_OK && p->trace ){
-    printf("enter mutex %p (%d) with nRef=%d\n", p, p->trace, p->nRef);
+#if defined(SQLITE_ENABLE_FUTEX_MUTEX) && defined(__linux__)
+/*
+** The futex mutex methods.  The mutex object and the enter, try and leave
+** routines are in mutex_unix.h, together with a description of how the
+** futex mutexes work.
+*/
+static int futexMutexInit(void){ return SQLITE_OK; }
+static int futexMutexEnd(void){ return SQLITE_OK; }
+
+/*
+** Allocate a futex mutex.  Static mutexes live in a zero-initialized
+** array, which is a valid unlocked state, so no initialization is
+** required for them.  As for the pthreads mutexes, each static mutex
+** has a cache line to itself.
+*/
+static sqlite3_mutex *futexMutexAlloc(int iType){
+  static struct alignas(SQLITE_MUTEX_CACHELINE) {
+    sqlite3_futex_mutex m;
+  } staticMutexes[SQLITE_MUTEX_NSTATIC];
+  sqlite3_futex_mutex *p;
+  switch( iType ){
+    case SQLITE_MUTEX_RECURSIVE:
+    case SQLITE_MUTEX_FAST: {
+      p = (sqlite3_futex_mutex*)sqlite3MallocZero( sizeof(*p) );
+      break;
+    }
+    default: {
+      int iStatic = sqlite3MutexStaticIndex(iType);
+#ifdef SQLITE_ENABLE_API_ARMOR
+      if( iStatic<0 || iStatic>=ArraySize(staticMutexes) ){
+        (void)SQLITE_MISUSE_BKPT;
+        return 0;
+      }
+#endif
+      p = &staticMutexes[iStatic].m;
+      break;
+    }
+  }
+  if( p ) p->id = iType;
+  return (sqlite3_mutex*)p;
+}
+
+static void futexMutexFree(sqlite3_mutex *pMutex){
+  sqlite3_futex_mutex *p = (sqlite3_futex_mutex*)pMutex;
+  assert( p->nRef==0 );
+  assert( p->iState==0 );
+#ifdef SQLITE_ENABLE_API_ARMOR
+  if( p->id==SQLITE_MUTEX_FAST || p->id==SQLITE_MUTEX_RECURSIVE )
+#endif
+  {
+    sqlite3_free(p);
+  }
+#ifdef SQLITE_ENABLE_API_ARMOR
+  else{
+    (void)SQLITE_MISUSE_BKPT;
   }
 #endif
-  return rc;
 }
 
+
 /*
-** The sqlite3_mutex_leave() routine exits a mutex that was
-** previously entered by the same thread.  The behavior
-** is undefined if the mutex is not currently entered or
-** is not currently allocated.  SQLite will never do either.
+** Condition variables for the futex mutexes.  The iSeq field is a
+** sequence number incremented by each broadcast.  A waiter samples it
+** before releasing the mutex and sleeps on the futex only for as long as
+** it is unchanged, so a broadcast that falls between the release and the
+** sleep is not lost.
 */
-static void pthreadMutexLeave(sqlite3_mutex *p){
-  assert( pthreadMutexHeld(p) );
-#if SQLITE_MUTEX_NREF
-  p->nRef--;
-  if( p->nRef==0 ) p->owner = 0;
-#endif
-  assert( p->nRef==0 || p->id==SQLITE_MUTEX_RECURSIVE );
+typedef struct sqlite3_futex_cond sqlite3_futex_cond;
+struct sqlite3_futex_cond {
+  int iSeq;                  /* Incremented by each broadcast */
+};
 
-#ifdef SQLITE_HOMEGROWN_RECURSIVE_MUTEX
-  if( p->nRef==0 ){
-    pthread_mutex_unlock(&p->mutex);
+static sqlite3_mutex_cond *futexCondAlloc(void){
+  return (sqlite3_mutex_cond*)sqlite3MallocZero(sizeof(sqlite3_futex_cond));
+}
+static void futexCondFree(sqlite3_mutex_cond *p){
+  sqlite3_free(p);
+}
+static int futexCondWait(
+  sqlite3_mutex_cond *pC,
+  sqlite3_mutex *pMutex,
+  int ms
+){
+  sqlite3_futex_cond *pCond = (sqlite3_futex_cond*)pC;
+  sqlite3_futex_mutex *p = (sqlite3_futex_mutex*)pMutex;
+  int iSeq = __atomic_load_n(&pCond->iSeq, __ATOMIC_RELAXED);
+  long rc;
+  assert( p->id==SQLITE_MUTEX_FAST );
+  assert( futexMutexHeld(pMutex) && p->nRef==1 );
+  p->nRef = 0;
+  p->owner = 0;
+  futexMutexUnlock(p);
+  if( ms<0 ){
+    rc = syscall(SYS_futex, &pCond->iSeq, FUTEX_WAIT_PRIVATE, iSeq, 0, 0, 0);
+  }else{
+    struct timespec t;
+    t.tv_sec = ms/1000;
+    t.tv_nsec = (long)(ms%1000)*1000000;
+    rc = syscall(SYS_futex, &pCond->iSeq, FUTEX_WAIT_PRIVATE, iSeq, &t, 0, 0);
   }
-#else
-  pthread_mutex_unlock(&p->mutex);
-#endif
+  if( rc<0 && errno==ETIMEDOUT ){
+    rc = SQLITE_BUSY;
+  }else{
+    rc = SQLITE_OK;
+  }
+  futexMutexLock(p);
+  p->owner = pthread_self();
+  p->nRef = 1;
+  return (int)rc;
+}
+static void futexCondBroadcast(sqlite3_mutex_cond *pC){
+  sqlite3_futex_cond *p = (sqlite3_futex_cond*)pC;
+  __atomic_fetch_add(&p->iSeq, 1, __ATOMIC_RELAXED);
+  syscall(SYS_futex, &p->iSeq, FUTEX_WAKE_PRIVATE, INT_MAX, 0, 0, 0);
+}
 
+SQLITE_API sqlite3_mutex_methods_v2 const *SQLITE_STDCALL
+sqlite3_mutex_futex(void){
+  static const sqlite3_mutex_methods_v2 sMutex = {
+    SQLITE_MUTEX_METHODS_VERSION,
+    futexMutexInit,
+    futexMutexEnd,
+    futexMutexAlloc,
+    futexMutexFree,
+    futexMutexEnter,
+    futexMutexTry,
+    futexMutexLeave,
 #ifdef SQLITE_DEBUG
-  if( p->trace ){
-    printf("leave mutex %p (%d) with nRef=%d\n", p, p->trace, p->nRef);
-  }
+    futexMutexHeld,
+    futexMutexNotheld,
+#else
+    0,
+    0,
 #endif
+    0,
+    0,
+    futexCondAlloc,
+    futexCondFree,
+    futexCondWait,
+    futexCondBroadcast
+  };
+
+  return &sMutex;
 }
 
-SQLITE_PRIVATE sqlite3_mutex_methods const *sqlite3DefaultMutex(void){
-  static const sqlite3_mutex_methods sMutex = {
+#if defined(SQLITE_MUTEX_DEVIRTUALIZE) && defined(SQLITE_MUTEX_USE_FUTEX)
+/*
+** The futex mutexes as the compile-time mutex backend.  The other methods
+** are defined inline in mutex_unix.h.
+*/
+sqlite3_mutex *sqlite3FutexMutexImpl::Alloc(int id){ return futexMutexAlloc(id); }
+void sqlite3FutexMutexImpl::Free(sqlite3_mutex *p){ futexMutexFree(p); }
+#endif
+#endif /* SQLITE_ENABLE_FUTEX_MUTEX && __linux__ */
+
+SQLITE_PRIVATE sqlite3_mutex_methods_v2 const *sqlite3DefaultMutex(void){
+#ifdef SQLITE_MUTEX_USE_FUTEX
+  return sqlite3_mutex_futex();
+#else
+  static const sqlite3_mutex_methods_v2 sMutex = {
+    SQLITE_MUTEX_METHODS_VERSION,
     pthreadMutexInit,
     pthreadMutexEnd,
     pthreadMutexAlloc,
@@ -385,14 +747,30 @@ SQLITE_PRIVATE sqlite3_mutex_methods const *sqlite3DefaultMutex(void){
     pthreadMutexLeave,
 #ifdef SQLITE_DEBUG
     pthreadMutexHeld,
-    pthreadMutexNotheld
+    pthreadMutexNotheld,
 #else
     0,
-    0
+    0,
 #endif
+    pthreadMutexEnterShared,
+    pthreadMutexLeaveShared,
+    pthreadCondAlloc,
+    pthreadCondFree,
+    pthreadCondWait,
+    pthreadCondBroadcast
   };
 
   return &sMutex;
+#endif
 }
 
+#if defined(SQLITE_MUTEX_DEVIRTUALIZE) && !defined(SQLITE_MUTEX_USE_FUTEX)
+/*
+** The pthreads mutexes as the compile-time mutex backend.  The other
+** methods are defined inline in mutex_unix.h.
+*/
+sqlite3_mutex *sqlite3PthreadMutexImpl::Alloc(int id){ return pthreadMutexAlloc(id); }
+void sqlite3PthreadMutexImpl::Free(sqlite3_mutex *p){ pthreadMutexFree(p); }
+#endif
+
 #endif /* SQLITE_MUTEX_PTHREADS */
@@ -0,0 +1,733 @@
+/*************************************************
+Copyright (C) 2020-2030 PENDLE. All Rights Reserved
+File name : mutex_unix.h
+Author : pendle
+Version : V1.0
+Date : 20210304
+Description : 底层mutex相关部分的unix相关的.h文件
+mutex_unix.cpp中加锁、解锁的快速路径
+Others:
+History:
+*************************************************/
+
+#ifndef OS_MUTEX_UNIX_H_
+#define OS_MUTEX_UNIX_H_
+
+/*
+** This file contains the parts of the pthreads and futex mutex
+** implementations that run on every sqlite3_mutex_enter(),
+** sqlite3_mutex_try() and sqlite3_mutex_leave() call: the mutex objects
+** themselves and the enter, try and leave routines.  It is included by
+** mutex_unix.cpp and, if SQLite is compiled with SQLITE_MUTEX_DEVIRTUALIZE,
+** by mutex.cpp, where the compiler is able to inline the routines into
+** the mutex dispatch functions.
+*/
+
+#include <pthread.h>
+#include <atomic>
+#include <errno.h>
+#include <time.h>
+
+/*
+** The sqlite3_mutex.id, sqlite3_mutex.nRef, and sqlite3_mutex.owner fields
+** are necessary under two condidtions:  (1) Debug builds and (2) using
+** home-grown mutexes.  Encapsulate these conditions into a single #define.
+*/
+#if defined(SQLITE_DEBUG) || defined(SQLITE_HOMEGROWN_RECURSIVE_MUTEX)
+# define SQLITE_MUTEX_NREF 1
+#else
+# define SQLITE_MUTEX_NREF 0
+#endif
+
+/*
+** Each recursive mutex is an instance of the following structure.
+*/
+struct sqlite3_mutex {
+  pthread_mutex_t mutex;     /* Mutex controlling the lock */
+  int id;                    /* Mutex type */
+#if SQLITE_MUTEX_NREF
+  volatile int nRef;         /* Number of entrances */
+  volatile pthread_t owner;  /* Thread that is within this mutex */
+  int trace;                 /* True to trace changes */
+#endif
+#ifdef SQLITE_ATOMIC_RECURSIVE_MUTEX
+  std::atomic<uptr> atomicOwner; /* Owner of a recursive mutex, or 0 */
+  int nDepth;                    /* Entry count of a recursive mutex */
+#endif
+};
+#if SQLITE_MUTEX_NREF
+#define SQLITE3_MUTEX_INITIALIZER { PTHREAD_MUTEX_INITIALIZER, 0, 0, (pthread_t)0, 0 }
+#else
+#define SQLITE3_MUTEX_INITIALIZER { PTHREAD_MUTEX_INITIALIZER, 0 }
+#endif
+
+/*
+** Each static mutex is padded out to a cache line of its own, so that
+** threads using unrelated static mutexes (for example SQLITE_MUTEX_STATIC_MEM
+** and SQLITE_MUTEX_STATIC_VFS1) do not contend for the same cache line.
+*/
+#define SQLITE_MUTEX_CACHELINE 64
+#ifdef SQLITE_MUTEX_FIFO
+# ifndef SQLITE_MUTEX_FIFO_NSLOT
+#  define SQLITE_MUTEX_FIFO_NSLOT 8
+# endif
+typedef struct sqlite3_fifo_slot sqlite3_fifo_slot;
+struct sqlite3_fifo_slot {
+  unsigned int iSeq;         /* Futex word.  Incremented by each wake-up */
+  int nSleep;                /* Number of threads blocked on iSeq */
+};
+#endif
+typedef struct sqlite3_static_mutex sqlite3_static_mutex;
+struct alignas(SQLITE_MUTEX_CACHELINE) sqlite3_static_mutex {
+  sqlite3_mutex m;           /* The mutex */
+#ifdef SQLITE_MUTEX_FIFO
+  unsigned int iTicket;      /* Next ticket to hand out */
+  unsigned int iServing;     /* Ticket of the thread that may enter */
+  sqlite3_fifo_slot aSlot[SQLITE_MUTEX_FIFO_NSLOT]; /* Sleeping waiters */
+#endif
+};
+#define SQLITE3_STATIC_MUTEX_INITIALIZER { SQLITE3_MUTEX_INITIALIZER }
+
+/*
+** Hint to the CPU that the caller is in a spin-wait loop.
+*/
+#if defined(__i386__) || defined(__x86_64__)
+# define mutexSpinPause() __asm__ __volatile__("pause")
+#elif defined(__aarch64__) || defined(__arm__)
+# define mutexSpinPause() __asm__ __volatile__("yield")
+#else
+# define mutexSpinPause()
+#endif
+
+#ifdef SQLITE_MUTEX_FIFO
+/*
+** FIFO static mutexes.
+**
+** A pthreads mutex makes no promise about the order in which waiting
+** threads are granted the mutex, and under heavy contention some threads
+** may wait far longer than others.  If SQLite is compiled with
+** SQLITE_MUTEX_FIFO set to a bitmask of static mutex ids, the static
+** mutexes with those ids are instead ticket locks, which grant the mutex
+** in strict arrival order.  For example:
+**
+**    -DSQLITE_MUTEX_FIFO='(1<<SQLITE_MUTEX_STATIC_VFS1)'
+**
+** makes the global lock of the unix VFS (unixBigLock) a FIFO lock.  This
+** costs some throughput, as the mutex cannot be handed to a thread that
+** happens to be running when it is released, in return for a bound on
+** the time any one thread waits.  Only the static mutexes from
+** SQLITE_MUTEX_STATIC_MASTER to SQLITE_MUTEX_STATIC_VFS3 may be FIFO
+** mutexes.
+**
+** A thread entering the mutex takes the next ticket from iTicket and
+** waits until iServing reaches it.  A waiting thread spins for up to
+** SQLITE_MUTEX_FIFO_SPIN iterations and then, on Linux, sleeps on a
+** futex.  Elsewhere it yields the CPU instead.
+**
+** So that releasing the mutex does not wake every sleeping thread, each
+** mutex has SQLITE_MUTEX_FIFO_NSLOT futex words, and the holder of
+** ticket T sleeps on the word in slot (T % SQLITE_MUTEX_FIFO_NSLOT).
+** Leaving the mutex increments iServing and then wakes only the threads
+** in the slot of the new value of iServing.  Unless there are more than
+** SQLITE_MUTEX_FIFO_NSLOT waiters, this is just the thread that holds
+** the next ticket.
+*/
+#ifndef SQLITE_MUTEX_FIFO_SPIN
+# define SQLITE_MUTEX_FIFO_SPIN 100
+#endif
+#define pthreadMutexIsFifo(id) \
+  ((id)>=SQLITE_MUTEX_STATIC_MASTER && (id)<=SQLITE_MUTEX_STATIC_VFS3 \
+   && (((SQLITE_MUTEX_FIFO)>>(id))&1))
+
+#ifdef __linux__
+#include <limits.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#else
+#include <sched.h>
+#endif
+
+static inline void pthreadFifoEnter(sqlite3_static_mutex *p){
+  unsigned int iMine = __atomic_fetch_add(&p->iTicket, 1, __ATOMIC_RELAXED);
+  int nSpin = 0;
+  while( __atomic_load_n(&p->iServing, __ATOMIC_ACQUIRE)!=iMine ){
+    if( nSpin<SQLITE_MUTEX_FIFO_SPIN ){
+      nSpin++;
+      mutexSpinPause();
+      continue;
+    }
+#ifdef __linux__
+    {
+      /* Register as a sleeper and sample the futex word before reading
+      ** iServing.  Either this thread sees the new value of iServing, or
+      ** the thread that stored it sees nSleep>0 and changes iSeq before
+      ** issuing the wake-up, so that the FUTEX_WAIT cannot miss it. */
+      sqlite3_fifo_slot *pSlot = &p->aSlot[iMine % SQLITE_MUTEX_FIFO_NSLOT];
+      unsigned int iSeq;
+      __atomic_fetch_add(&pSlot->nSleep, 1, __ATOMIC_SEQ_CST);
+      iSeq = __atomic_load_n(&pSlot->iSeq, __ATOMIC_SEQ_CST);
+      if( __atomic_load_n(&p->iServing, __ATOMIC_SEQ_CST)!=iMine ){
+        syscall(SYS_futex, &pSlot->iSeq, FUTEX_WAIT_PRIVATE, iSeq, 0, 0, 0);
+      }
+      __atomic_fetch_sub(&pSlot->nSleep, 1, __ATOMIC_SEQ_CST);
+    }
+#else
+    sched_yield();
+#endif
+  }
+}
+static inline int pthreadFifoTry(sqlite3_static_mutex *p){
+  unsigned int iServing = __atomic_load_n(&p->iServing, __ATOMIC_ACQUIRE);
+  unsigned int iTicket = iServing;
+  return __atomic_compare_exchange_n(&p->iTicket, &iTicket, iServing+1,
+      0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+static inline void pthreadFifoLeave(sqlite3_static_mutex *p){
+  /* Only the holder of the mutex modifies iServing */
+  unsigned int iNext = p->iServing+1;
+  __atomic_store_n(&p->iServing, iNext, __ATOMIC_SEQ_CST);
+#ifdef __linux__
+  {
+    /* Wake the threads in the slot of ticket iNext.  All of them are
+    ** woken, as the holder of iNext may share the slot with threads
+    ** holding later tickets. */
+    sqlite3_fifo_slot *pSlot = &p->aSlot[iNext % SQLITE_MUTEX_FIFO_NSLOT];
+    if( __atomic_load_n(&pSlot->nSleep, __ATOMIC_SEQ_CST)>0 ){
+      __atomic_fetch_add(&pSlot->iSeq, 1, __ATOMIC_SEQ_CST);
+      syscall(SYS_futex, &pSlot->iSeq, FUTEX_WAKE_PRIVATE, INT_MAX, 0, 0, 0);
+    }
+  }
+#endif
+}
+#else
+# define pthreadMutexIsFifo(id) 0
+#endif /* SQLITE_MUTEX_FIFO */
+
+/*
+** A mutex of type SQLITE_MUTEX_RW is an instance of the following
+** structure.  The sqlite3_mutex.mutex field of the base object is not
+** used.  Instead, exclusive (writer) entry to the mutex takes a write
+** lock on the rwlock field and shared entry takes a read lock.
+**
+** Only exclusive holders are recorded in the sqlite3_mutex.nRef and
+** sqlite3_mutex.owner fields, so sqlite3_mutex_held() does not detect
+** that a thread holds the mutex in shared mode.
+*/
+typedef struct sqlite3_rw_mutex sqlite3_rw_mutex;
+struct sqlite3_rw_mutex {
+  sqlite3_mutex base;        /* Base class.  Must be first */
+  pthread_rwlock_t rwlock;   /* Reader/writer lock */
+};
+
+/*
+** The sqlite3_mutex_held() and sqlite3_mutex_notheld() routine are
+** intended for use only inside assert() statements.  On some platforms,
+** there might be race conditions that can cause these routines to
+** deliver incorrect results.  In particular, if pthread_equal() is
+** not an atomic operation, then these routines might delivery
+** incorrect results.  On most platforms, pthread_equal() is a
+** comparison of two integers and is therefore atomic.  But we are
+** told that HPUX is not such a platform.  If so, then these routines
+** will not always work correctly on HPUX.
+**
+** On those platforms where pthread_equal() is not atomic, SQLite
+** should be compiled without -DSQLITE_DEBUG and with -DNDEBUG to
+** make sure no assert() statements are evaluated and hence these
+** routines are never called.
+*/
+#if !defined(NDEBUG) || defined(SQLITE_DEBUG)
+static inline int pthreadMutexHeld(sqlite3_mutex *p){
+  return (p->nRef!=0 && pthread_equal(p->owner, pthread_self()));
+}
+static inline int pthreadMutexNotheld(sqlite3_mutex *p){
+  return p->nRef==0 || pthread_equal(p->owner, pthread_self())==0;
+}
+#endif
+
+#ifdef SQLITE_ATOMIC_RECURSIVE_MUTEX
+/*
+** Owner-tracking recursive mutexes.
+**
+** If SQLite is compiled with SQLITE_ATOMIC_RECURSIVE_MUTEX, the
+** sqlite3_mutex.mutex field of an SQLITE_MUTEX_RECURSIVE mutex is an
+** ordinary non-recursive pthreads mutex, which is faster to lock and
+** unlock than a PTHREAD_MUTEX_RECURSIVE one.  Recursion is handled by
+** recording the owning thread in sqlite3_mutex.atomicOwner.  A thread
+** that finds its own id there already holds the mutex, so re-entry is a
+** single comparison followed by an increment of sqlite3_mutex.nDepth,
+** with no call into the pthreads library.
+**
+** No thread other than the owner can ever find its own id in atomicOwner,
+** so relaxed loads and stores are sufficient.  Ordering between
+** successive owners is provided by sqlite3_mutex.mutex.  The nDepth
+** field is only accessed by the owner and so is not atomic.
+**
+** The thread id is the address of a thread-local variable, which is never
+** zero and is unique among running threads.  Unlike pthread_self(), it
+** does not require a function call.
+*/
+extern SQLITE_THREAD_LOCAL char sqlite3PthreadMutexTag;
+#define pthreadMutexSelf() ((uptr)&sqlite3PthreadMutexTag)
+#endif
+
+/*
+** The sqlite3_mutex_enter() and sqlite3_mutex_try() routines attempt
+** to enter a mutex.  If another thread is already within the mutex,
+** sqlite3_mutex_enter() will block and sqlite3_mutex_try() will return
+** SQLITE_BUSY.  The sqlite3_mutex_try() interface returns SQLITE_OK
+** upon successful entry.  Mutexes created using SQLITE_MUTEX_RECURSIVE can
+** be entered multiple times by the same thread.  In such cases the,
+** mutex must be exited an equal number of times before another thread
+** can enter.  If the same thread tries to enter any other kind of mutex
+** more than once, the behavior is undefined.
+*/
+static inline void pthreadMutexEnter(sqlite3_mutex *p){
+  assert( p->id==SQLITE_MUTEX_RECURSIVE || pthreadMutexNotheld(p) );
+
+#ifdef SQLITE_MUTEX_FIFO
+  if( pthreadMutexIsFifo(p->id) ){
+    pthreadFifoEnter((sqlite3_static_mutex*)p);
+#if SQLITE_MUTEX_NREF
+    assert( p->nRef==0 );
+    p->owner = pthread_self();
+    p->nRef = 1;
+#endif
+    return;
+  }
+#endif
+
+  if( p->id==SQLITE_MUTEX_RW ){
+    /* Exclusive entry to a reader/writer mutex */
+    pthread_rwlock_wrlock(&((sqlite3_rw_mutex*)p)->rwlock);
+#if SQLITE_MUTEX_NREF
+    assert( p->nRef==0 );
+    p->owner = pthread_self();
+    p->nRef = 1;
+#endif
+    return;
+  }
+
+#if defined(SQLITE_ATOMIC_RECURSIVE_MUTEX)
+  /* Owner-tracking recursive mutexes.  See pthreadMutexSelf() above.
+  */
+  if( p->id==SQLITE_MUTEX_RECURSIVE ){
+    uptr self = pthreadMutexSelf();
+    if( p->atomicOwner.load(std::memory_order_relaxed)==self ){
+      p->nDepth++;
+    }else{
+      pthread_mutex_lock(&p->mutex);
+      p->atomicOwner.store(self, std::memory_order_relaxed);
+      p->nDepth = 1;
+    }
+  }else{
+    pthread_mutex_lock(&p->mutex);
+  }
+#if SQLITE_MUTEX_NREF
+  assert( p->nRef>0 || p->owner==0 );
+  p->owner = pthread_self();
+  p->nRef++;
+#endif
+#elif defined(SQLITE_HOMEGROWN_RECURSIVE_MUTEX)
+  /* If recursive mutexes are not available, then we have to grow
+  ** our own.  This implementation assumes that pthread_equal()
+  ** is atomic - that it cannot be deceived into thinking self
+  ** and p->owner are equal if p->owner changes between two values
+  ** that are not equal to self while the comparison is taking place.
+  ** This implementation also assumes a coherent cache - that
+  ** separate processes cannot read different values from the same
+  ** address at the same time.  If either of these two conditions
+  ** are not met, then the mutexes will fail and problems will result.
+  */
+  {
+    pthread_t self = pthread_self();
+    if( p->nRef>0 && pthread_equal(p->owner, self) ){
+      p->nRef++;
+    }else{
+      pthread_mutex_lock(&p->mutex);
+      assert( p->nRef==0 );
+      p->owner = self;
+      p->nRef = 1;
+    }
+  }
+#else
+  /* Use the built-in recursive mutexes if they are available.
+  */
+  pthread_mutex_lock(&p->mutex);
+#if SQLITE_MUTEX_NREF
+  assert( p->nRef>0 || p->owner==0 );
+  p->owner = pthread_self();
+  p->nRef++;
+#endif
+#endif
+
+#ifdef SQLITE_DEBUG
+  if( p->trace ){
+    printf("enter mutex %p (%d) with nRef=%d\n", p, p->trace, p->nRef);
+  }
+#endif
+}
+static inline int pthreadMutexTry(sqlite3_mutex *p){
+  int rc;
+  assert( p->id==SQLITE_MUTEX_RECURSIVE || pthreadMutexNotheld(p) );
+
+#ifdef SQLITE_MUTEX_FIFO
+  if( pthreadMutexIsFifo(p->id) ){
+    if( !pthreadFifoTry((sqlite3_static_mutex*)p) ){
+      return SQLITE_BUSY;
+    }
+#if SQLITE_MUTEX_NREF
+    assert( p->nRef==0 );
+    p->owner = pthread_self();
+    p->nRef = 1;
+#endif
+    return SQLITE_OK;
+  }
+#endif
+
+  if( p->id==SQLITE_MUTEX_RW ){
+    if( pthread_rwlock_trywrlock(&((sqlite3_rw_mutex*)p)->rwlock)!=0 ){
+      return SQLITE_BUSY;
+    }
+#if SQLITE_MUTEX_NREF
+    assert( p->nRef==0 );
+    p->owner = pthread_self();
+    p->nRef = 1;
+#endif
+    return SQLITE_OK;
+  }
+
+#if defined(SQLITE_ATOMIC_RECURSIVE_MUTEX)
+  /* Owner-tracking recursive mutexes.  See pthreadMutexSelf() above.
+  */
+  if( p->id==SQLITE_MUTEX_RECURSIVE ){
+    uptr self = pthreadMutexSelf();
+    if( p->atomicOwner.load(std::memory_order_relaxed)==self ){
+      p->nDepth++;
+      rc = SQLITE_OK;
+    }else if( pthread_mutex_trylock(&p->mutex)==0 ){
+      p->atomicOwner.store(self, std::memory_order_relaxed);
+      p->nDepth = 1;
+      rc = SQLITE_OK;
+    }else{
+      rc = SQLITE_BUSY;
+    }
+  }else if( pthread_mutex_trylock(&p->mutex)==0 ){
+    rc = SQLITE_OK;
+  }else{
+    rc = SQLITE_BUSY;
+  }
+#if SQLITE_MUTEX_NREF
+  if( rc==SQLITE_OK ){
+    p->owner = pthread_self();
+    p->nRef++;
+  }
+#endif
+#elif defined(SQLITE_HOMEGROWN_RECURSIVE_MUTEX)
+  /* If recursive mutexes are not available, then we have to grow
+  ** our own.  This implementation assumes that pthread_equal()
+  ** is atomic - that it cannot be deceived into thinking self
+  ** and p->owner are equal if p->owner changes between two values
+  ** that are not equal to self while the comparison is taking place.
+  ** This implementation also assumes a coherent cache - that
+  ** separate processes cannot read different values from the same
+  ** address at the same time.  If either of these two conditions
+  ** are not met, then the mutexes will fail and problems will result.
+  */
+  {
+    pthread_t self = pthread_self();
+    if( p->nRef>0 && pthread_equal(p->owner, self) ){
+      p->nRef++;
+      rc = SQLITE_OK;
+    }else if( pthread_mutex_trylock(&p->mutex)==0 ){
+      assert( p->nRef==0 );
+      p->owner = self;
+      p->nRef = 1;
+      rc = SQLITE_OK;
+    }else{
+      rc = SQLITE_BUSY;
+    }
+  }
+#else
+  /* Use the built-in recursive mutexes if they are available.
+  */
+  if( pthread_mutex_trylock(&p->mutex)==0 ){
+#if SQLITE_MUTEX_NREF
+    p->owner = pthread_self();
+    p->nRef++;
+#endif
+    rc = SQLITE_OK;
+  }else{
+    rc = SQLITE_BUSY;
+  }
+#endif
+
+#ifdef SQLITE_DEBUG
+  if( rc==SQLITE_OK && p->trace ){
+    printf("enter mutex %p (%d) with nRef=%d\n", p, p->trace, p->nRef);
+  }
+#endif
+  return rc;
+}
+
+/*
+** The sqlite3_mutex_leave() routine exits a mutex that was
+** previously entered by the same thread.  The behavior
+** is undefined if the mutex is not currently entered or
+** is not currently allocated.  SQLite will never do either.
+*/
+static inline void pthreadMutexLeave(sqlite3_mutex *p){
+  assert( pthreadMutexHeld(p) );
+#if SQLITE_MUTEX_NREF
+  p->nRef--;
+  if( p->nRef==0 ) p->owner = 0;
+#endif
+  assert( p->nRef==0 || p->id==SQLITE_MUTEX_RECURSIVE );
+
+  if( p->id==SQLITE_MUTEX_RW ){
+    pthread_rwlock_unlock(&((sqlite3_rw_mutex*)p)->rwlock);
+    return;
+  }
+#ifdef SQLITE_MUTEX_FIFO
+  if( pthreadMutexIsFifo(p->id) ){
+    pthreadFifoLeave((sqlite3_static_mutex*)p);
+    return;
+  }
+#endif
+
+#if defined(SQLITE_ATOMIC_RECURSIVE_MUTEX)
+  if( p->id==SQLITE_MUTEX_RECURSIVE ){
+    assert( p->atomicOwner.load(std::memory_order_relaxed)==pthreadMutexSelf() );
+    assert( p->nDepth>0 );
+    if( --p->nDepth==0 ){
+      p->atomicOwner.store(0, std::memory_order_relaxed);
+      pthread_mutex_unlock(&p->mutex);
+    }
+  }else{
+    pthread_mutex_unlock(&p->mutex);
+  }
+#elif defined(SQLITE_HOMEGROWN_RECURSIVE_MUTEX)
+  if( p->nRef==0 ){
+    pthread_mutex_unlock(&p->mutex);
+  }
+#else
+  pthread_mutex_unlock(&p->mutex);
+#endif
+
+#ifdef SQLITE_DEBUG
+  if( p->trace ){
+    printf("leave mutex %p (%d) with nRef=%d\n", p, p->trace, p->nRef);
+  }
+#endif
+}
+
+#if defined(SQLITE_ENABLE_FUTEX_MUTEX) && defined(__linux__)
+/*
+** Adaptive spin-then-futex mutexes.
+**
+** This is an alternative set of mutex methods for Linux.  A contended
+** sqlite3_mutex_enter() first spins in user space for a bounded number
+** of iterations and only then parks the thread on a futex.  Most of the
+** mutexes used by the SQLite core (SQLITE_MUTEX_STATIC_MEM, the per-inode
+** unixInodeInfo.pLockMutex and the unixShmNode.pShmMutex) protect very
+** short critical sections, so the spin phase usually avoids the kernel
+** round-trip altogether.
+**
+** Each mutex carries its own spin budget, adjusted after every contended
+** acquisition in the same way as glibc's adaptive mutexes.  A contended
+** thread spins for at most twice the budget plus 10 iterations (and
+** never more than SQLITE_FUTEX_MAX_SPIN), after which the budget moves
+** 1/8th of the way toward the number of iterations that were actually
+** used.  Mutexes that are usually released quickly therefore spin only
+** briefly, while the spin phase of a mutex that is usually held for a
+** long time is bounded by SQLITE_FUTEX_MAX_SPIN.
+**
+** The methods are obtained from sqlite3_mutex_futex() and may be installed
+** using sqlite3_config(SQLITE_CONFIG_MUTEX,...).  If SQLite is compiled
+** with SQLITE_DEFAULT_FUTEX_MUTEX they are also returned by
+** sqlite3DefaultMutex() in place of the pthreads mutexes.
+*/
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <limits.h>
+
+#ifndef SQLITE_FUTEX_MAX_SPIN
+# define SQLITE_FUTEX_MAX_SPIN 100
+#endif
+
+/*
+** Each futex mutex is an instance of the following structure.  The
+** iState field takes one of three values:
+**
+**    0     Unlocked.
+**    1     Locked, no other thread is waiting on the futex.
+**    2     Locked, and there may be threads waiting on the futex.
+**
+** The owner and nRef fields are always maintained, as they are required
+** to implement SQLITE_MUTEX_RECURSIVE without a second lock.
+*/
+typedef struct sqlite3_futex_mutex sqlite3_futex_mutex;
+struct sqlite3_futex_mutex {
+  int iState;                /* 0, 1 or 2, as described above */
+  int nSpin;                 /* Adaptive spin budget */
+  int id;                    /* Mutex type */
+  volatile int nRef;         /* Number of entrances */
+  volatile pthread_t owner;  /* Thread that is within this mutex */
+};
+
+static inline long futexMutexWait(int *pState, int iVal){
+  return syscall(SYS_futex, pState, FUTEX_WAIT_PRIVATE, iVal, 0, 0, 0);
+}
+static inline long futexMutexWake(int *pState){
+  return syscall(SYS_futex, pState, FUTEX_WAKE_PRIVATE, 1, 0, 0, 0);
+}
+
+#if !defined(NDEBUG) || defined(SQLITE_DEBUG)
+static inline int futexMutexHeld(sqlite3_mutex *pMutex){
+  sqlite3_futex_mutex *p = (sqlite3_futex_mutex*)pMutex;
+  return (p->nRef!=0 && pthread_equal(p->owner, pthread_self()));
+}
+static inline int futexMutexNotheld(sqlite3_mutex *pMutex){
+  sqlite3_futex_mutex *p = (sqlite3_futex_mutex*)pMutex;
+  return p->nRef==0 || pthread_equal(p->owner, pthread_self())==0;
+}
+#endif
+
+/*
+** Attempt to move the futex word from 0 (unlocked) to 1 (locked).
+** Return true if successful.
+*/
+static inline int futexMutexTryLock(sqlite3_futex_mutex *p){
+  int iExpect = 0;
+  return __atomic_compare_exchange_n(&p->iState, &iExpect, 1, 0,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+/*
+** Acquire the futex word of mutex p, blocking if necessary.
+*/
+static inline void futexMutexLock(sqlite3_futex_mutex *p){
+  int nMax;
+  int i;
+  int c;
+
+  if( futexMutexTryLock(p) ) return;
+
+  /* Spin phase.  Only the thread that eventually takes the lock updates
+  ** the budget, and a stale read by another thread is harmless, so plain
+  ** relaxed accesses are sufficient for nSpin. */
+  nMax = __atomic_load_n(&p->nSpin, __ATOMIC_RELAXED)*2 + 10;
+  if( nMax>SQLITE_FUTEX_MAX_SPIN ) nMax = SQLITE_FUTEX_MAX_SPIN;
+  for(i=0; i<nMax; i++){
+    mutexSpinPause();
+    if( __atomic_load_n(&p->iState, __ATOMIC_RELAXED)==0
+     && futexMutexTryLock(p)
+    ){
+      c = __atomic_load_n(&p->nSpin, __ATOMIC_RELAXED);
+      __atomic_store_n(&p->nSpin, c + (i - c)/8, __ATOMIC_RELAXED);
+      return;
+    }
+  }
+
+  /* The lock was not released within the spin budget.  Record the
+  ** iterations spent and park on the futex.  State 2 tells the owner
+  ** that it must issue a wake-up on release. */
+  c = __atomic_load_n(&p->nSpin, __ATOMIC_RELAXED);
+  __atomic_store_n(&p->nSpin, c + (nMax - c)/8, __ATOMIC_RELAXED);
+  c = __atomic_exchange_n(&p->iState, 2, __ATOMIC_ACQUIRE);
+  while( c!=0 ){
+    futexMutexWait(&p->iState, 2);
+    c = __atomic_exchange_n(&p->iState, 2, __ATOMIC_ACQUIRE);
+  }
+}
+
+/*
+** Release the futex word of mutex p, waking one waiter if there
+** might be any.
+*/
+static inline void futexMutexUnlock(sqlite3_futex_mutex *p){
+  if( __atomic_exchange_n(&p->iState, 0, __ATOMIC_RELEASE)==2 ){
+    futexMutexWake(&p->iState);
+  }
+}
+
+/*
+** The enter, try and leave methods.  Recursion is handled in the same
+** way as the SQLITE_HOMEGROWN_RECURSIVE_MUTEX pthreads implementation
+** above and relies on the same assumptions about pthread_equal().
+*/
+static inline void futexMutexEnter(sqlite3_mutex *pMutex){
+  sqlite3_futex_mutex *p = (sqlite3_futex_mutex*)pMutex;
+  pthread_t self = pthread_self();
+  assert( p->id==SQLITE_MUTEX_RECURSIVE || futexMutexNotheld(pMutex) );
+  if( p->id==SQLITE_MUTEX_RECURSIVE
+   && p->nRef>0 && pthread_equal(p->owner, self)
+  ){
+    p->nRef++;
+  }else{
+    futexMutexLock(p);
+    assert( p->nRef==0 );
+    p->owner = self;
+    p->nRef = 1;
+  }
+}
+static inline int futexMutexTry(sqlite3_mutex *pMutex){
+  sqlite3_futex_mutex *p = (sqlite3_futex_mutex*)pMutex;
+  pthread_t self = pthread_self();
+  assert( p->id==SQLITE_MUTEX_RECURSIVE || futexMutexNotheld(pMutex) );
+  if( p->id==SQLITE_MUTEX_RECURSIVE
+   && p->nRef>0 && pthread_equal(p->owner, self)
+  ){
+    p->nRef++;
+  }else if( futexMutexTryLock(p) ){
+    assert( p->nRef==0 );
+    p->owner = self;
+    p->nRef = 1;
+  }else{
+    return SQLITE_BUSY;
+  }
+  return SQLITE_OK;
+}
+static inline void futexMutexLeave(sqlite3_mutex *pMutex){
+  sqlite3_futex_mutex *p = (sqlite3_futex_mutex*)pMutex;
+  assert( futexMutexHeld(pMutex) );
+  p->nRef--;
+  assert( p->nRef==0 || p->id==SQLITE_MUTEX_RECURSIVE );
+  if( p->nRef==0 ){
+    p->owner = 0;
+    futexMutexUnlock(p);
+  }
+}
+#endif /* SQLITE_ENABLE_FUTEX_MUTEX && __linux__ */
+
+#ifdef SQLITE_MUTEX_DEVIRTUALIZE
+/*
+** The enter, try and leave methods of the compile-time mutex backend.
+** The Alloc and Free methods are not on the fast path, and are defined
+** in mutex_unix.cpp.
+*/
+#ifdef SQLITE_MUTEX_USE_FUTEX
+inline void sqlite3FutexMutexImpl::Enter(sqlite3_mutex *p){
+  futexMutexEnter(p);
+}
+inline int sqlite3FutexMutexImpl::Try(sqlite3_mutex *p){
+  return futexMutexTry(p);
+}
+inline void sqlite3FutexMutexImpl::Leave(sqlite3_mutex *p){
+  futexMutexLeave(p);
+}
+#else
+inline void sqlite3PthreadMutexImpl::Enter(sqlite3_mutex *p){
+  pthreadMutexEnter(p);
+}
+inline int sqlite3PthreadMutexImpl::Try(sqlite3_mutex *p){
+  return pthreadMutexTry(p);
+}
+inline void sqlite3PthreadMutexImpl::Leave(sqlite3_mutex *p){
+  pthreadMutexLeave(p);
+}
+#endif
+#endif /* SQLITE_MUTEX_DEVIRTUALIZE */
+
+#endif  //OS_MUTEX_UNIX_H_
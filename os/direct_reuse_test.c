@@ -0,0 +1,87 @@
+/*
+** 2026 October 17
+**
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+**
+******************************************************************************
+**
+** Test that a "unix" connection does not inherit direct I/O from a file
+** descriptor that a "unix-direct" connection left behind.
+**
+** A "unix-direct" connection is closed while a "unix" connection holds a
+** lock on the same file, so its descriptor, still in direct mode, goes
+** to the inode's list of unused descriptors.  A second "unix" connection
+** then opens the file and reuses that descriptor.  Afterwards no open
+** descriptor of the process may be in direct mode.
+**
+** The test is skipped if the file system does not support O_DIRECT.
+*/
+#include "os_test.h"
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+
+#define TEST_DB "direct_reuse_test.db"
+
+/*
+** Return the number of file descriptors of this process that are open
+** with O_DIRECT.
+*/
+static int testCountDirect(void){
+  DIR *pDir = opendir("/proc/self/fd");
+  struct dirent *pEntry;
+  int n = 0;
+  if( pDir==0 ) osTestFail("opendir");
+  while( (pEntry = readdir(pDir))!=0 ){
+    int f;
+    if( pEntry->d_name[0]=='.' ) continue;
+    f = fcntl(atoi(pEntry->d_name), F_GETFL);
+    if( f>=0 && (f & O_DIRECT)!=0 ) n++;
+  }
+  closedir(pDir);
+  return n;
+}
+
+int main(void){
+  sqlite3_vfs *pUnix;
+  sqlite3_vfs *pDirect;
+  sqlite3_file *pHolder;
+  sqlite3_file *pFile;
+  int rc;
+
+  pUnix = osTestInit("unix");
+  pDirect = sqlite3_vfs_find("unix-direct");
+  if( pUnix==0 || pDirect==0 ) osTestFail("no unix or unix-direct VFS");
+  unlink(TEST_DB);
+
+  pHolder = osTestOpen(pUnix, TEST_DB);
+  rc = pHolder->pMethods->xLock(pHolder, SQLITE_LOCK_SHARED);
+  if( rc!=SQLITE_OK ) osTestFail("SHARED lock: %d", rc);
+
+  pFile = osTestOpen(pDirect, TEST_DB);
+  if( testCountDirect()==0 ){
+    printf("direct_reuse_test: skipped, no O_DIRECT support\n");
+    osTestClose(pFile);
+    osTestClose(pHolder);
+    unlink(TEST_DB);
+    return 0;
+  }
+  rc = pFile->pMethods->xLock(pFile, SQLITE_LOCK_SHARED);
+  if( rc!=SQLITE_OK ) osTestFail("SHARED lock: %d", rc);
+  osTestClose(pFile);
+
+  pFile = osTestOpen(pUnix, TEST_DB);
+  if( testCountDirect()!=0 ){
+    osTestFail("a unix connection reused a descriptor in direct mode");
+  }
+  osTestClose(pFile);
+  osTestClose(pHolder);
+  unlink(TEST_DB);
+  printf("direct_reuse_test: ok\n");
+  return 0;
+}
@@ -0,0 +1,118 @@
+/*
+** 2026 October 17
+**
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+**
+******************************************************************************
+**
+** Test that a shared-lock lease held by an idle process does not keep a
+** writer in another process out of the database for long.
+**
+** The first process enables leases on its connection, reads (takes and
+** releases a SHARED lock), so that the SHARED lock is kept as a lease,
+** and then makes no further calls into the VFS until the second process
+** exits.  The second process takes a RESERVED lock and asks for an
+** EXCLUSIVE lock.  Its first attempt must fail, as the lease is held.
+** It keeps trying, and must succeed within TEST_TIMEOUT_MS once the lease
+** has expired and been given up by the first process's reaper thread.
+*/
+#include "os_test.h"
+#include <unistd.h>
+#include <time.h>
+#include <sys/wait.h>
+
+#define TEST_DB          "lease_test.db"
+#define TEST_TIMEOUT_MS  5000
+
+/*
+** Return the current value of a monotonic clock in milliseconds.
+*/
+static sqlite3_int64 testNowMs(void){
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (sqlite3_int64)t.tv_sec*1000 + t.tv_nsec/1000000;
+}
+
+/*
+** Body of the second process.  Wait until the first holds its lease, then
+** obtain an EXCLUSIVE lock.
+*/
+static int testWriter(int fdWait){
+  sqlite3_vfs *pVfs;
+  sqlite3_file *pFile;
+  const sqlite3_io_methods *pM;
+  sqlite3_int64 iStart;
+  char c;
+  int rc;
+
+  if( read(fdWait, &c, 1)!=1 ) return 2;
+  pVfs = osTestInit("unix");
+  pFile = osTestOpen(pVfs, TEST_DB);
+  pM = pFile->pMethods;
+  rc = pM->xLock(pFile, SQLITE_LOCK_SHARED);
+  if( rc==SQLITE_OK ) rc = pM->xLock(pFile, SQLITE_LOCK_RESERVED);
+  if( rc!=SQLITE_OK ){
+    fprintf(stderr, "FAILED: RESERVED lock: %d\n", rc);
+    return 1;
+  }
+  rc = pM->xLock(pFile, SQLITE_LOCK_EXCLUSIVE);
+  if( rc!=SQLITE_BUSY ){
+    fprintf(stderr, "FAILED: the lease was not kept: %d\n", rc);
+    return 1;
+  }
+  iStart = testNowMs();
+  while( rc==SQLITE_BUSY && testNowMs()-iStart<TEST_TIMEOUT_MS ){
+    usleep(10000);
+    rc = pM->xLock(pFile, SQLITE_LOCK_EXCLUSIVE);
+  }
+  if( rc!=SQLITE_OK ){
+    fprintf(stderr, "FAILED: EXCLUSIVE lock behind idle lease: %d\n", rc);
+    return 1;
+  }
+  pM->xUnlock(pFile, SQLITE_LOCK_NONE);
+  osTestClose(pFile);
+  return 0;
+}
+
+int main(void){
+  sqlite3_vfs *pVfs;
+  sqlite3_file *pFile;
+  int bLease = 1;
+  int aPipe[2];
+  int status = 0;
+  pid_t pid;
+  int rc;
+
+  unlink(TEST_DB);
+  if( pipe(aPipe) ) osTestFail("pipe");
+  pid = fork();
+  if( pid<0 ) osTestFail("fork");
+  if( pid==0 ) exit(testWriter(aPipe[0]));
+
+  pVfs = osTestInit("unix");
+  if( pVfs==0 ) osTestFail("no unix VFS");
+  pFile = osTestOpen(pVfs, TEST_DB);
+  rc = pFile->pMethods->xFileControl(pFile, SQLITE_FCNTL_SHARED_LEASE, &bLease);
+  if( rc!=SQLITE_OK ) osTestFail("SQLITE_FCNTL_SHARED_LEASE: %d", rc);
+  rc = pFile->pMethods->xLock(pFile, SQLITE_LOCK_SHARED);
+  if( rc!=SQLITE_OK ) osTestFail("SHARED lock: %d", rc);
+  rc = pFile->pMethods->xUnlock(pFile, SQLITE_LOCK_NONE);
+  if( rc!=SQLITE_OK ) osTestFail("unlock: %d", rc);
+
+  /* Stay idle until the writer is done. */
+  if( write(aPipe[1], "x", 1)!=1 ) osTestFail("write");
+  waitpid(pid, &status, 0);
+  if( !WIFEXITED(status) || WEXITSTATUS(status)!=0 ){
+    osTestFail("writer was not granted the lock");
+  }
+
+  osTestClose(pFile);
+  unlink(TEST_DB);
+  printf("lease_test: ok\n");
+  return 0;
+}
@@ -0,0 +1,342 @@
+/*
+** 2026 October 17
+**
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+**
+******************************************************************************
+**
+** This file contains a multi-threaded micro-benchmark for the
+** sqlite3_mutex_methods implementations.  It is built by the
+** "mutex_bench" and "mutex_bench_debug" targets of the Makefile in this
+** directory.
+**
+** Each implementation is driven directly through its method table, so
+** that the benchmark measures the implementation and not the dispatch in
+** mutex.cpp.  The implementations are:
+**
+**    default   sqlite3DefaultMutex(): the pthreads mutexes, or the futex
+**              mutexes if compiled with SQLITE_DEFAULT_FUTEX_MUTEX
+**    futex     sqlite3_mutex_futex(), if compiled with
+**              SQLITE_ENABLE_FUTEX_MUTEX on Linux
+**    noop      sqlite3NoopMutex(): the no-op mutexes, or the debugging
+**              mutexes if compiled with SQLITE_DEBUG
+**
+** The other compile-time mutex options (SQLITE_ENABLE_MUTEX_POOL,
+** SQLITE_ATOMIC_RECURSIVE_MUTEX, SQLITE_MUTEX_FIFO and so on) are
+** measured by rebuilding the benchmark with BENCH_OPTS set accordingly.
+**
+** The workloads are:
+**
+**    static     All threads enter and leave SQLITE_MUTEX_STATIC_APP1.
+**    dynamic    All threads enter and leave one SQLITE_MUTEX_FAST mutex.
+**    recursive  All threads share one SQLITE_MUTEX_RECURSIVE mutex, which
+**               each thread enters three times before leaving it three
+**               times.
+**    try        All threads share one SQLITE_MUTEX_FAST mutex, which they
+**               acquire by calling xMutexTry() in a loop until it succeeds.
+**
+** Every combination of implementation, workload, thread count and
+** critical-section length is run, and one line is reported for each
+** giving the throughput in acquisitions per second and the 50th, 99th
+** and 99.9th percentile latency of an acquisition in nanoseconds.  For
+** the try workload the number of failed xMutexTry() calls is also shown.
+** The no-op and debugging mutexes provide no mutual exclusion, so they
+** are only run with a single thread.
+**
+** Usage:
+**
+**    mutex_bench ?-threads LIST? ?-cs LIST? ?-ops N? ?-impl NAME?
+**                ?-workload NAME?
+**
+** LIST is a comma-separated list of integers.  The defaults are
+** "-threads 1,2,4,8 -cs 0,50,500 -ops 200000".  The critical-section
+** length is a number of iterations of an empty loop.  -ops is the number
+** of acquisitions made by each thread.
+*/
+#include "mutex_bench.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+/*
+** Stand-ins for the parts of the library that the mutex subsystem uses.
+** The benchmark is built from the mutex sources alone (see mutex_bench.h),
+** so memory comes from the system allocator and sqlite3_initialize()
+** initializes only the mutex subsystem.
+*/
+struct Sqlite3Config sqlite3Config = { 0, 1 };
+
+void *sqlite3Malloc(u64 n){ return malloc((size_t)n); }
+void *sqlite3MallocZero(u64 n){ return calloc(1, (size_t)n); }
+SQLITE_API void SQLITE_STDCALL sqlite3_free(void *p){ free(p); }
+SQLITE_API int SQLITE_STDCALL sqlite3_initialize(void){
+  return sqlite3MutexInit();
+}
+SQLITE_API int SQLITE_STDCALL sqlite3_shutdown(void){
+  return sqlite3MutexEnd();
+}
+
+/*
+** One mutex implementation under test.
+*/
+typedef struct BenchImpl BenchImpl;
+struct BenchImpl {
+  const char *zName;                       /* Name used by -impl */
+  sqlite3_mutex_methods_v2 const *pMethods;   /* The implementation */
+  int bThreadsafe;                         /* False for noop and debug */
+};
+
+/*
+** Workloads.
+*/
+#define BENCH_STATIC     0
+#define BENCH_DYNAMIC    1
+#define BENCH_RECURSIVE  2
+#define BENCH_TRY        3
+static const char *azWorkload[] = { "static", "dynamic", "recursive", "try" };
+
+/*
+** A single benchmark run.
+*/
+typedef struct BenchRun BenchRun;
+struct BenchRun {
+  sqlite3_mutex_methods_v2 const *pMethods;   /* Implementation */
+  sqlite3_mutex *pMutex;                   /* The shared mutex */
+  int eWorkload;                           /* One of the BENCH_* values */
+  int nCs;                                 /* Critical-section length */
+  int nOp;                                 /* Acquisitions per thread */
+  std::atomic<int> nReady;                 /* Threads ready to start */
+  std::atomic<int> bGo;                    /* Set to start all threads */
+  std::atomic<sqlite3_uint64> nTryFail;    /* Failed xMutexTry() calls */
+  volatile sqlite3_uint64 iShared;         /* Modified within the mutex */
+};
+
+static sqlite3_uint64 benchNow(void){
+  return (sqlite3_uint64)std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()
+  ).count();
+}
+
+/*
+** The body of each thread.  The latency of every acquisition is stored
+** in aLat[].
+*/
+static void benchThread(BenchRun *p, std::vector<sqlite3_uint64> *aLat){
+  sqlite3_mutex_methods_v2 const *pM = p->pMethods;
+  sqlite3_mutex *pMutex = p->pMutex;
+  sqlite3_uint64 nFail = 0;
+  int i, j;
+
+  aLat->resize(p->nOp);
+  p->nReady++;
+  while( !p->bGo.load() ){ std::this_thread::yield(); }
+
+  for(i=0; i<p->nOp; i++){
+    sqlite3_uint64 iStart = benchNow();
+    if( p->eWorkload==BENCH_TRY ){
+      while( pM->xMutexTry(pMutex)!=SQLITE_OK ){
+        nFail++;
+        std::this_thread::yield();
+      }
+    }else{
+      pM->xMutexEnter(pMutex);
+    }
+    (*aLat)[i] = benchNow() - iStart;
+    if( p->eWorkload==BENCH_RECURSIVE ){
+      pM->xMutexEnter(pMutex);
+      pM->xMutexEnter(pMutex);
+    }
+    for(j=0; j<p->nCs; j++){
+      p->iShared++;
+    }
+    p->iShared++;
+    if( p->eWorkload==BENCH_RECURSIVE ){
+      pM->xMutexLeave(pMutex);
+      pM->xMutexLeave(pMutex);
+    }
+    pM->xMutexLeave(pMutex);
+  }
+  p->nTryFail += nFail;
+}
+
+/*
+** Return the iPct/1000 percentile of the sorted array a[].
+*/
+static sqlite3_uint64 benchPercentile(std::vector<sqlite3_uint64> &a, int iPct){
+  size_t i = (size_t)((a.size()-1) * (sqlite3_uint64)iPct / 1000);
+  return a[i];
+}
+
+/*
+** Run one workload with nThread threads and report the results.
+*/
+static void benchRun(
+  BenchImpl *pImpl,
+  int eWorkload,
+  int nThread,
+  int nCs,
+  int nOp
+){
+  BenchRun run;
+  std::vector<std::thread> aThread;
+  std::vector< std::vector<sqlite3_uint64> > aLat(nThread);
+  std::vector<sqlite3_uint64> aAll;
+  sqlite3_uint64 iStart, nElapsed;
+  int i;
+
+  run.pMethods = pImpl->pMethods;
+  run.eWorkload = eWorkload;
+  run.nCs = nCs;
+  run.nOp = nOp;
+  run.nReady = 0;
+  run.bGo = 0;
+  run.nTryFail = 0;
+  run.iShared = 0;
+  switch( eWorkload ){
+    case BENCH_STATIC:
+      run.pMutex = run.pMethods->xMutexAlloc(SQLITE_MUTEX_STATIC_APP1);
+      break;
+    case BENCH_RECURSIVE:
+      run.pMutex = run.pMethods->xMutexAlloc(SQLITE_MUTEX_RECURSIVE);
+      break;
+    default:
+      run.pMutex = run.pMethods->xMutexAlloc(SQLITE_MUTEX_FAST);
+      break;
+  }
+  if( run.pMutex==0 ){
+    fprintf(stderr, "%s: cannot allocate mutex\n", pImpl->zName);
+    return;
+  }
+
+  for(i=0; i<nThread; i++){
+    aThread.push_back(std::thread(benchThread, &run, &aLat[i]));
+  }
+  while( run.nReady.load()<nThread ){ std::this_thread::yield(); }
+  iStart = benchNow();
+  run.bGo = 1;
+  for(i=0; i<nThread; i++){
+    aThread[i].join();
+  }
+  nElapsed = benchNow() - iStart;
+
+  if( eWorkload!=BENCH_STATIC ){
+    run.pMethods->xMutexFree(run.pMutex);
+  }
+  if( pImpl->bThreadsafe && run.iShared!=(sqlite3_uint64)nThread*nOp*(nCs+1) ){
+    fprintf(stderr, "%s/%s: mutual exclusion failed\n",
+        pImpl->zName, azWorkload[eWorkload]);
+  }
+
+  for(i=0; i<nThread; i++){
+    aAll.insert(aAll.end(), aLat[i].begin(), aLat[i].end());
+  }
+  std::sort(aAll.begin(), aAll.end());
+  printf("%-8s %-10s %3d %5d %12.0f %8llu %8llu %8llu",
+      pImpl->zName, azWorkload[eWorkload], nThread, nCs,
+      (double)aAll.size() * 1.0e9 / (double)(nElapsed ? nElapsed : 1),
+      benchPercentile(aAll, 500),
+      benchPercentile(aAll, 990),
+      benchPercentile(aAll, 999)
+  );
+  if( eWorkload==BENCH_TRY ){
+    printf(" %llu", (sqlite3_uint64)run.nTryFail.load());
+  }
+  printf("\n");
+  fflush(stdout);
+}
+
+/*
+** Parse a comma-separated list of integers.
+*/
+static std::vector<int> benchParseList(const char *z){
+  std::vector<int> a;
+  while( *z ){
+    a.push_back(atoi(z));
+    while( *z && *z!=',' ) z++;
+    if( *z==',' ) z++;
+  }
+  return a;
+}
+
+static void benchUsage(const char *zArgv0){
+  fprintf(stderr,
+      "Usage: %s ?-threads LIST? ?-cs LIST? ?-ops N? ?-impl NAME?"
+      " ?-workload NAME?\n", zArgv0);
+  exit(1);
+}
+
+int main(int argc, char **argv){
+  std::vector<int> aThread = benchParseList("1,2,4,8");
+  std::vector<int> aCs = benchParseList("0,50,500");
+  int nOp = 200000;
+  const char *zImpl = 0;
+  const char *zWorkload = 0;
+  std::vector<BenchImpl> aImpl;
+  size_t i, j, k;
+  int eWorkload;
+
+  for(i=1; i<(size_t)argc; i++){
+    const char *z = argv[i];
+    if( i+1>=(size_t)argc ) benchUsage(argv[0]);
+    if( strcmp(z, "-threads")==0 ){
+      aThread = benchParseList(argv[++i]);
+    }else if( strcmp(z, "-cs")==0 ){
+      aCs = benchParseList(argv[++i]);
+    }else if( strcmp(z, "-ops")==0 ){
+      nOp = atoi(argv[++i]);
+    }else if( strcmp(z, "-impl")==0 ){
+      zImpl = argv[++i];
+    }else if( strcmp(z, "-workload")==0 ){
+      zWorkload = argv[++i];
+    }else{
+      benchUsage(argv[0]);
+    }
+  }
+  if( nOp<=0 ) benchUsage(argv[0]);
+
+  /* The dynamic mutexes are allocated from the SQLite heap */
+  if( sqlite3_initialize()!=SQLITE_OK ){
+    fprintf(stderr, "sqlite3_initialize() failed\n");
+    return 1;
+  }
+
+  aImpl.push_back(BenchImpl{ "default", sqlite3DefaultMutex(), 1 });
+#if defined(SQLITE_ENABLE_FUTEX_MUTEX) && defined(__linux__)
+  aImpl.push_back(BenchImpl{ "futex", sqlite3_mutex_futex(), 1 });
+#endif
+#ifdef SQLITE_DEBUG
+  aImpl.push_back(BenchImpl{ "debug", sqlite3NoopMutex(), 0 });
+#else
+  aImpl.push_back(BenchImpl{ "noop", sqlite3NoopMutex(), 0 });
+#endif
+
+  printf("%-8s %-10s %3s %5s %12s %8s %8s %8s\n",
+      "impl", "workload", "thr", "cs", "ops/sec", "p50", "p99", "p999");
+  for(i=0; i<aImpl.size(); i++){
+    if( zImpl && strcmp(zImpl, aImpl[i].zName)!=0 ) continue;
+    /* xMutexEnd() is not called afterwards, as the SQLite core may still
+    ** be using the same implementation. */
+    aImpl[i].pMethods->xMutexInit();
+    for(eWorkload=0; eWorkload<ArraySize(azWorkload); eWorkload++){
+      if( zWorkload && strcmp(zWorkload, azWorkload[eWorkload])!=0 ) continue;
+      for(j=0; j<aThread.size(); j++){
+        if( aThread[j]<1 ) continue;
+        if( aThread[j]>1 && !aImpl[i].bThreadsafe ) continue;
+        for(k=0; k<aCs.size(); k++){
+          benchRun(&aImpl[i], eWorkload, aThread[j], aCs[k], nOp);
+        }
+      }
+    }
+  }
+
+  sqlite3_shutdown();
+  return 0;
+}
@@ -0,0 +1,109 @@
+/*
+** 2026 October 17
+**
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+**
+******************************************************************************
+**
+** This header stands in for sqliteInt.h when the mutex sources are
+** compiled into the mutex micro-benchmark (see mutex_bench.cpp).  It
+** provides only the internal definitions that the mutex subsystem uses,
+** so that the benchmark can be built from the mutex sources alone.  The
+** library routines that the mutex subsystem calls, such as
+** sqlite3MallocZero(), are implemented in mutex_bench.cpp.
+**
+** The Makefile passes this file to the compiler with -include for each
+** of the mutex sources.
+**
+** The public definitions used by the mutex sources are also provided
+** here, rather than by sqlite3.h, because sqlite3.h repeats the mutex
+** interfaces that mutex.h declares.
+*/
+#ifndef MUTEX_BENCH_H
+#define MUTEX_BENCH_H
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+/*
+** Public definitions from sqlite3.h.
+*/
+#define SQLITE_API
+#define SQLITE_STDCALL
+#define SQLITE_OK           0
+#define SQLITE_ERROR        1
+#define SQLITE_BUSY         5
+#define SQLITE_NOMEM        7
+#define SQLITE_MISUSE      21
+typedef long long int sqlite_int64;
+typedef unsigned long long int sqlite_uint64;
+typedef sqlite_int64 sqlite3_int64;
+typedef sqlite_uint64 sqlite3_uint64;
+typedef struct sqlite3 sqlite3;
+typedef struct sqlite3_mutex sqlite3_mutex;
+SQLITE_API int SQLITE_STDCALL sqlite3_initialize(void);
+SQLITE_API int SQLITE_STDCALL sqlite3_shutdown(void);
+SQLITE_API void SQLITE_STDCALL sqlite3_free(void*);
+
+/*
+** Internal definitions from sqliteInt.h.
+*/
+#define SQLITE_PRIVATE
+#define SQLITE_WSD
+#define GLOBAL(t,v) v
+#define SQLITE_MISUSE_BKPT SQLITE_MISUSE
+#define UNUSED_PARAMETER(x) (void)(x)
+#define ArraySize(X)    ((int)(sizeof(X)/sizeof(X[0])))
+#define ALWAYS(X)      (X)
+#define NEVER(X)       (X)
+
+#if defined(__GNUC__)
+#  define SQLITE_THREAD_LOCAL  __thread
+#else
+#  define SQLITE_THREAD_LOCAL  thread_local
+#endif
+
+typedef sqlite_int64 i64;
+typedef sqlite_uint64 u64;
+typedef unsigned int u32;
+typedef unsigned short int u16;
+typedef unsigned char u8;
+typedef uintptr_t uptr;
+
+#include "mutex.h"
+
+/*
+** The fields of the library configuration used by the mutex subsystem.
+*/
+struct Sqlite3Config {
+  int bMemstat;                     /* True to enable memory status */
+  u8 bCoreMutex;                    /* True to enable core mutexing */
+  sqlite3_mutex_methods_v2 mutex;   /* Low-level mutex interface */
+};
+extern struct Sqlite3Config sqlite3Config;
+#define sqlite3GlobalConfig sqlite3Config
+
+void *sqlite3Malloc(u64);
+void *sqlite3MallocZero(u64);
+
+sqlite3_mutex_methods_v2 const *sqlite3DefaultMutex(void);
+sqlite3_mutex_methods_v2 const *sqlite3NoopMutex(void);
+sqlite3_mutex *sqlite3MutexAlloc(int);
+int sqlite3MutexShard(void);
+int sqlite3MutexInit(void);
+int sqlite3MutexEnd(void);
+#if !defined(SQLITE_MUTEX_OMIT) && !defined(SQLITE_MUTEX_NOOP)
+  void sqlite3MemoryBarrier(void);
+#else
+# define sqlite3MemoryBarrier()
+#endif
+
+#endif /* MUTEX_BENCH_H */
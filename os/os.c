@@ -48,7 +48,9 @@ int sqlite3_open_file_count = 0;
 ** testing:
 **
 **     sqlite3OsRead()
+**     sqlite3OsReadV()
 **     sqlite3OsWrite()
+**     sqlite3OsWriteV()
 **     sqlite3OsSync()
 **     sqlite3OsFileSize()
 **     sqlite3OsLock()
@@ -93,6 +95,36 @@ int sqlite3OsWrite(sqlite3_file *id, const void *pBuf, int amt, i64 offset){
   DO_OS_MALLOC_TEST(id);
   return id->pMethods->xWrite(id, pBuf, amt, offset);
 }
+int sqlite3OsReadV(sqlite3_file *id, const sqlite3_io_vec *aVec, int nVec){
+  int rc = SQLITE_OK;
+  int i;
+  DO_OS_MALLOC_TEST(id);
+  if( id->pMethods->iVersion>=6 && id->pMethods->xReadV ){
+    return id->pMethods->xReadV(id, aVec, nVec);
+  }
+  for(i=0; i<nVec; i++){
+    int rc2 = id->pMethods->xRead(id, aVec[i].pBuf, aVec[i].nAmt,
+                                  aVec[i].iOfst);
+    if( rc2==SQLITE_IOERR_SHORT_READ ){
+      rc = rc2;
+    }else if( rc2!=SQLITE_OK ){
+      return rc2;
+    }
+  }
+  return rc;
+}
+int sqlite3OsWriteV(sqlite3_file *id, const sqlite3_io_vec *aVec, int nVec){
+  int rc = SQLITE_OK;
+  int i;
+  DO_OS_MALLOC_TEST(id);
+  if( id->pMethods->iVersion>=5 && id->pMethods->xWriteV ){
+    return id->pMethods->xWriteV(id, aVec, nVec);
+  }
+  for(i=0; rc==SQLITE_OK && i<nVec; i++){
+    rc = id->pMethods->xWrite(id, aVec[i].pBuf, aVec[i].nAmt, aVec[i].iOfst);
+  }
+  return rc;
+}
 int sqlite3OsTruncate(sqlite3_file *id, i64 size){
   return id->pMethods->xTruncate(id, size);
 }
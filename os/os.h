@@ -172,7 +172,9 @@ int sqlite3OsInit(void);
 */
 void sqlite3OsClose(sqlite3_file*);
 int sqlite3OsRead(sqlite3_file*, void*, int amt, i64 offset);
+int sqlite3OsReadV(sqlite3_file*, const sqlite3_io_vec*, int nVec);
 int sqlite3OsWrite(sqlite3_file*, const void*, int amt, i64 offset);
+int sqlite3OsWriteV(sqlite3_file*, const sqlite3_io_vec*, int nVec);
 int sqlite3OsTruncate(sqlite3_file*, i64 size);
 int sqlite3OsSync(sqlite3_file*, int);
 int sqlite3OsFileSize(sqlite3_file*, i64 *pSize);
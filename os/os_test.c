@@ -0,0 +1,270 @@
+/*
+** 2026 October 17
+**
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+**
+******************************************************************************
+**
+** Stand-ins for the library routines that os_unix.c calls, so that the
+** unix VFS tests can be linked from os_unix.c alone (see os_test.h), and
+** helper routines shared by the tests.
+**
+** The mutexes are plain pthreads mutexes that remember their owner, so
+** that sqlite3_mutex_held() works in assert() statements.  Shared entry
+** to an SQLITE_MUTEX_RW mutex is exclusive here, which is enough for the
+** tests.
+*/
+#include "os_test.h"
+#include <pthread.h>
+#include <stdarg.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+
+struct Sqlite3Config sqlite3Config = { 0, 1, 0, 0x7fff0000 };
+int sqlite3PendingByte = 0x40000000;
+char *sqlite3_temp_directory = 0;
+
+/*
+** Memory allocation.
+*/
+void *sqlite3_malloc64(sqlite3_uint64 n){ return malloc((size_t)n); }
+void *sqlite3_realloc(void *p, int n){ return realloc(p, (size_t)n); }
+void sqlite3_free(void *p){ free(p); }
+
+/*
+** Strings.
+*/
+int sqlite3Strlen30(const char *z){
+  return z ? 0x3fffffff & (int)strlen(z) : 0;
+}
+void sqlite3FileSuffix3(const char *zBase, char *z){
+  UNUSED_PARAMETER(zBase);
+  UNUSED_PARAMETER(z);
+}
+char *sqlite3_snprintf(int n, char *zBuf, const char *zFormat, ...){
+  va_list ap;
+  if( n<=0 ) return zBuf;
+  va_start(ap, zFormat);
+  vsnprintf(zBuf, (size_t)n, zFormat, ap);
+  va_end(ap);
+  return zBuf;
+}
+char *sqlite3_mprintf(const char *zFormat, ...){
+  va_list ap;
+  char *z = 0;
+  va_start(ap, zFormat);
+  if( vasprintf(&z, zFormat, ap)<0 ) z = 0;
+  va_end(ap);
+  return z;
+}
+void sqlite3_log(int iErrCode, const char *zFormat, ...){
+  UNUSED_PARAMETER(iErrCode);
+  UNUSED_PARAMETER(zFormat);
+}
+void sqlite3_randomness(int N, void *pBuf){
+  unsigned char *z = (unsigned char*)pBuf;
+  while( N-->0 ) *(z++) = (unsigned char)rand();
+}
+
+/*
+** URI parameters are not used by the tests.
+*/
+const char *sqlite3_uri_parameter(const char *zFilename, const char *zParam){
+  UNUSED_PARAMETER2(zFilename, zParam);
+  return 0;
+}
+int sqlite3_uri_boolean(const char *zFile, const char *zParam, int bDflt){
+  UNUSED_PARAMETER2(zFile, zParam);
+  return bDflt!=0;
+}
+
+/*
+** Mutexes and condition variables.
+*/
+struct sqlite3_mutex {
+  pthread_mutex_t mutex;          /* The mutex */
+  pthread_t owner;                /* Thread that holds the mutex */
+  int nRef;                       /* Number of entries by owner */
+};
+struct sqlite3_mutex_cond {
+  pthread_cond_t cond;            /* The condition variable */
+};
+
+static sqlite3_mutex aStatic[SQLITE_MUTEX_STATIC_VFS3+1];
+
+sqlite3_mutex *sqlite3_mutex_alloc(int id){
+  sqlite3_mutex *p;
+  if( id>SQLITE_MUTEX_RECURSIVE && id!=SQLITE_MUTEX_RW ){
+    if( id>=ArraySize(aStatic) ) return 0;
+    p = &aStatic[id];
+  }else{
+    p = (sqlite3_mutex*)calloc(1, sizeof(*p));
+    if( p==0 ) return 0;
+  }
+  pthread_mutex_init(&p->mutex, 0);
+  return p;
+}
+sqlite3_mutex *sqlite3MutexAlloc(int id){
+  return sqlite3_mutex_alloc(id);
+}
+void sqlite3_mutex_free(sqlite3_mutex *p){
+  if( p && (p<aStatic || p>=&aStatic[ArraySize(aStatic)]) ){
+    pthread_mutex_destroy(&p->mutex);
+    free(p);
+  }
+}
+void sqlite3_mutex_enter(sqlite3_mutex *p){
+  if( p==0 ) return;
+  pthread_mutex_lock(&p->mutex);
+  p->owner = pthread_self();
+  p->nRef = 1;
+}
+int sqlite3_mutex_try(sqlite3_mutex *p){
+  if( p==0 ) return SQLITE_OK;
+  if( pthread_mutex_trylock(&p->mutex) ) return SQLITE_BUSY;
+  p->owner = pthread_self();
+  p->nRef = 1;
+  return SQLITE_OK;
+}
+void sqlite3_mutex_leave(sqlite3_mutex *p){
+  if( p==0 ) return;
+  p->nRef = 0;
+  pthread_mutex_unlock(&p->mutex);
+}
+void sqlite3_mutex_enter_shared(sqlite3_mutex *p){ sqlite3_mutex_enter(p); }
+void sqlite3_mutex_leave_shared(sqlite3_mutex *p){ sqlite3_mutex_leave(p); }
+int sqlite3_mutex_held(sqlite3_mutex *p){
+  return p==0 || (p->nRef>0 && pthread_equal(p->owner, pthread_self()));
+}
+int sqlite3_mutex_notheld(sqlite3_mutex *p){
+  return p==0 || p->nRef==0 || !pthread_equal(p->owner, pthread_self());
+}
+
+sqlite3_mutex_cond *sqlite3_mutex_cond_alloc(void){
+  sqlite3_mutex_cond *p;
+  p = (sqlite3_mutex_cond*)calloc(1, sizeof(*p));
+  if( p ) pthread_cond_init(&p->cond, 0);
+  return p;
+}
+void sqlite3_mutex_cond_free(sqlite3_mutex_cond *p){
+  if( p ){
+    pthread_cond_destroy(&p->cond);
+    free(p);
+  }
+}
+int sqlite3_mutex_cond_wait(sqlite3_mutex_cond *p, sqlite3_mutex *m, int ms){
+  int rc;
+  if( p==0 ) return SQLITE_BUSY;
+  m->nRef = 0;
+  if( ms<0 ){
+    rc = pthread_cond_wait(&p->cond, &m->mutex);
+  }else{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += ms/1000;
+    ts.tv_nsec += (long)(ms%1000)*1000000;
+    if( ts.tv_nsec>=1000000000 ){
+      ts.tv_sec++;
+      ts.tv_nsec -= 1000000000;
+    }
+    rc = pthread_cond_timedwait(&p->cond, &m->mutex, &ts);
+  }
+  m->owner = pthread_self();
+  m->nRef = 1;
+  return rc==ETIMEDOUT ? SQLITE_BUSY : SQLITE_OK;
+}
+void sqlite3_mutex_cond_broadcast(sqlite3_mutex_cond *p){
+  if( p ) pthread_cond_broadcast(&p->cond);
+}
+
+/*
+** VFS registration.
+*/
+static sqlite3_vfs *pVfsList = 0;
+int sqlite3_vfs_register(sqlite3_vfs *pVfs, int makeDflt){
+  sqlite3_vfs **pp;
+  for(pp=&pVfsList; *pp && *pp!=pVfs; pp=&(*pp)->pNext);
+  if( *pp ) *pp = pVfs->pNext;
+  if( makeDflt || pVfsList==0 ){
+    pVfs->pNext = pVfsList;
+    pVfsList = pVfs;
+  }else{
+    pVfs->pNext = pVfsList->pNext;
+    pVfsList->pNext = pVfs;
+  }
+  return SQLITE_OK;
+}
+sqlite3_vfs *sqlite3_vfs_find(const char *zVfs){
+  sqlite3_vfs *p;
+  for(p=pVfsList; p && zVfs && strcmp(zVfs, p->zName)!=0; p=p->pNext);
+  return p;
+}
+
+/*
+** Test helpers.
+*/
+static int osTestPagesize(void){
+  return (int)sysconf(_SC_PAGESIZE);
+}
+
+/*
+** Initialize the unix VFS and return the VFS named zVfs.
+*/
+sqlite3_vfs *osTestInit(const char *zVfs){
+  sqlite3_vfs *pVfs;
+  if( sqlite3_os_init()!=SQLITE_OK ) return 0;
+  pVfs = sqlite3_vfs_find(zVfs);
+  if( pVfs ){
+    pVfs->xSetSystemCall(pVfs, "getpagesize",
+                         (sqlite3_syscall_ptr)osTestPagesize);
+  }
+  return pVfs;
+}
+
+/*
+** Open database file zName using pVfs.  Return the new file, or exit the
+** process if the open fails.  The full pathname, which must remain valid
+** while the file is open and be followed by an empty URI parameter list,
+** is stored after the sqlite3_file object.
+*/
+sqlite3_file *osTestOpen(sqlite3_vfs *pVfs, const char *zName){
+  int flags = SQLITE_OPEN_MAIN_DB|SQLITE_OPEN_READWRITE|SQLITE_OPEN_CREATE;
+  sqlite3_file *pFile;
+  char *zFull;
+  int rc;
+  pFile = (sqlite3_file*)calloc(1, pVfs->szOsFile + pVfs->mxPathname + 2);
+  if( pFile==0 ) osTestFail("out of memory");
+  zFull = &((char*)pFile)[pVfs->szOsFile];
+  rc = pVfs->xFullPathname(pVfs, zName, pVfs->mxPathname, zFull);
+  if( rc!=SQLITE_OK ) osTestFail("cannot find %s: %d", zName, rc);
+  rc = pVfs->xOpen(pVfs, zFull, pFile, flags, &flags);
+  if( rc!=SQLITE_OK ) osTestFail("cannot open %s: %d", zName, rc);
+  return pFile;
+}
+
+/*
+** Close a file opened by osTestOpen().
+*/
+void osTestClose(sqlite3_file *pFile){
+  pFile->pMethods->xClose(pFile);
+  free(pFile);
+}
+
+/*
+** Report a failed test and exit the process.
+*/
+void osTestFail(const char *zFormat, ...){
+  va_list ap;
+  va_start(ap, zFormat);
+  fprintf(stderr, "FAILED: ");
+  vfprintf(stderr, zFormat, ap);
+  fprintf(stderr, "\n");
+  va_end(ap);
+  exit(1);
+}
@@ -0,0 +1,108 @@
+/*
+** 2026 October 17
+**
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+**
+******************************************************************************
+**
+** This header stands in for sqliteInt.h when os_unix.c is compiled into
+** the unix VFS tests (see os_test.c).  It provides only the internal
+** definitions that os_unix.c uses, so that the tests can be built from
+** os_unix.c alone.  The library routines that os_unix.c calls, such as
+** sqlite3_malloc64() and the mutex interfaces, are implemented in
+** os_test.c.
+**
+** The Makefile passes this file to the compiler with -include when it
+** compiles os_unix.c.  It defines SQLITEINT_H, so the #include of
+** sqliteInt.h in os_unix.c has no effect.
+*/
+#ifndef OS_TEST_H
+#define OS_TEST_H
+#define SQLITEINT_H
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "sqlite3.h"
+
+/*
+** Internal definitions from sqliteInt.h.
+*/
+#define SQLITE_PRIVATE
+#define UNUSED_PARAMETER(x) (void)(x)
+#define UNUSED_PARAMETER2(x,y) UNUSED_PARAMETER(x),UNUSED_PARAMETER(y)
+#define ArraySize(X)    ((int)(sizeof(X)/sizeof(X[0])))
+#define ALWAYS(X)      (X)
+#define NEVER(X)       (X)
+#define MAX(A,B) ((A)>(B)?(A):(B))
+#define MIN(A,B) ((A)<(B)?(A):(B))
+#define OSTRACE(X)
+#define SQLITE_NOMEM_BKPT SQLITE_NOMEM
+#define SQLITE_IOERR_NOMEM_BKPT SQLITE_IOERR_NOMEM
+#define SQLITE_CANTOPEN_BKPT SQLITE_CANTOPEN
+#define SQLITE_MISUSE_BKPT SQLITE_MISUSE
+#define SQLITE_MAX_MMAP_SIZE 0x7fff0000
+#define SQLITE_POWERSAFE_OVERWRITE 1
+#define HAVE_PREAD 1
+#define HAVE_PWRITE 1
+
+#if defined(__GNUC__)
+#  define SQLITE_THREAD_LOCAL  __thread
+#else
+#  define SQLITE_THREAD_LOCAL  thread_local
+#endif
+
+typedef sqlite_int64 i64;
+typedef sqlite_uint64 u64;
+typedef unsigned int u32;
+typedef unsigned short int u16;
+typedef unsigned char u8;
+typedef uintptr_t uptr;
+
+/*
+** The fields of the library configuration used by os_unix.c.
+*/
+struct Sqlite3Config {
+  int bMemstat;                     /* True to enable memory status */
+  u8 bCoreMutex;                    /* True to enable core mutexing */
+  sqlite3_int64 szMmap;             /* mmap() space per open file */
+  sqlite3_int64 mxMmap;             /* Maximum value for szMmap */
+};
+extern struct Sqlite3Config sqlite3Config;
+#define sqlite3GlobalConfig sqlite3Config
+extern int sqlite3PendingByte;
+
+#include "os.h"
+
+/*
+** From mutex.h.  The tests compile os_unix.c as C, so a builtin takes
+** the place of the C++11 fence.
+*/
+#define sqlite3AcqRelBarrier() __atomic_thread_fence(__ATOMIC_ACQ_REL)
+
+/*
+** sqliteInt.h leaves these to os_unix.c, which does not define them.
+*/
+#define unixFileMutexHeld(p) sqlite3_mutex_held((p)->pInode->pLockMutex)
+#define unixFileMutexNotheld(p) sqlite3_mutex_notheld((p)->pInode->pLockMutex)
+
+sqlite3_mutex *sqlite3MutexAlloc(int);
+int sqlite3Strlen30(const char*);
+void sqlite3FileSuffix3(const char*, char*);
+
+/*
+** Helpers for the tests, implemented in os_test.c.
+*/
+sqlite3_vfs *osTestInit(const char *zVfs);
+sqlite3_file *osTestOpen(sqlite3_vfs *pVfs, const char *zName);
+void osTestClose(sqlite3_file *pFile);
+void osTestFail(const char *zFormat, ...);
+
+#endif /* OS_TEST_H */
@@ -205,6 +205,30 @@ struct UnixUnusedFd {
   UnixUnusedFd *pNext;      /* Next unused file descriptor on same file */  //同一文件的下一个未使用的文件描述符
 };
 
+/*
+** HAVE_POSIX_FADVISE defaults to true on Linux and the BSDs and false
+** everywhere else.  If it is true, unixRead() gives the kernel readahead
+** hints using posix_fadvise().  See SQLITE_FCNTL_READAHEAD.
+*/
+#if !defined(HAVE_POSIX_FADVISE)
+# if (defined(__linux__) && defined(_GNU_SOURCE)) || defined(__FreeBSD__) \
+  || defined(__NetBSD__) || defined(__DragonFly__)
+#  define HAVE_POSIX_FADVISE 1
+# else
+#  define HAVE_POSIX_FADVISE 0
+# endif
+#endif
+
+/*
+** SQLITE_UNIX_DIRECT_IO is defined if the "unix-direct" VFS is available.
+** That VFS reads and writes database files without going through the
+** operating system's page cache, using O_DIRECT, or F_NOCACHE on systems
+** that have no O_DIRECT.  Journal and WAL files are used as usual.
+*/
+#if !defined(SQLITE_OMIT_DIRECT_IO) && (defined(O_DIRECT) || defined(F_NOCACHE))
+# define SQLITE_UNIX_DIRECT_IO 1
+#endif
+
 /*
 ** The unixFile structure is subclass of sqlite3_file specific to the unix
 ** VFS implementations.
@@ -242,6 +266,27 @@ struct unixFile {
 #ifdef SQLITE_ENABLE_SETLK_TIMEOUT
   unsigned iBusyTimeout;              /* Wait this many millisec on locks */
 #endif
+#ifdef SQLITE_ENABLE_LOCK_STATUS
+  sqlite3_lock_stats lockStats;       /* SQLITE_FCNTL_LOCK_STATUS counters */
+  unsigned char eStatLock;            /* eFileLock as last seen by lockStats */
+  sqlite3_int64 iReservedStart;       /* When RESERVED or higher was taken */
+  sqlite3_int64 iExclusiveStart;      /* When EXCLUSIVE was taken */
+  sqlite3_int64 aShmStart[SQLITE_SHM_NLOCK];  /* When each shm lock was taken */
+#endif
+#ifndef SQLITE_OMIT_IOSTATS
+  sqlite3_io_stats ioStats;           /* SQLITE_FCNTL_IOSTATS counters */
+#endif
+  struct unixAio *pAio;               /* State of xSubmit/xComplete, or NULL */
+#if HAVE_POSIX_FADVISE
+  sqlite3_readahead ra;               /* SQLITE_FCNTL_READAHEAD state */
+  unsigned char eRaAdvice;            /* SQLITE_READAHEAD_* advice in force */
+  int nRaRun;                         /* Sequential (>0) or random (<0) run */
+  sqlite3_int64 iRaNext;              /* Offset just past the last read */
+  sqlite3_int64 iRaEnd;               /* End of the last WILLNEED range */
+#endif
+#ifdef SQLITE_UNIX_DIRECT_IO
+  int szDirect;                       /* Alignment needed by UNIXFILE_DIRECT */
+#endif
 };
 
 /* This variable holds the process id (pid) from when the xRandomness()
@@ -266,6 +311,17 @@ static pid_t randomnessPid = 0;
 #define UNIXFILE_DELETE      0x20     /* Delete on close */  //关闭后删除
 #define UNIXFILE_URI         0x40     /* Filename might have query parameters */  //文件名可能有查询参数
 #define UNIXFILE_NOLOCK      0x80     /* Do no file locking */   //没有文件锁定
+#define UNIXFILE_LEASE      0x100     /* Retain SHARED locks as leases */
+#define UNIXFILE_DIRECT     0x200     /* Bypass the OS page cache */
+
+/*
+** True if pFile was opened for direct I/O by the "unix-direct" VFS.
+*/
+#ifdef SQLITE_UNIX_DIRECT_IO
+# define unixIsDirect(pFile) (((pFile)->ctrlFlags & UNIXFILE_DIRECT)!=0)
+#else
+# define unixIsDirect(pFile) 0
+#endif
 
 /*
 ** Include code that is common to all os_*.c files  //包含了所有os_*.c文件通用的代码
@@ -311,6 +367,31 @@ static pid_t randomnessPid = 0;
 # endif
 #endif
 
+/*
+** HAVE_PWRITEV defaults to true on Linux and the BSDs and false everywhere
+** else.  If it is true, unixWriteV() uses pwritev() to write runs of
+** adjacent buffers with a single system call.
+*/
+#if !defined(HAVE_PWRITEV)
+# if (defined(__linux__) && defined(_GNU_SOURCE)) || defined(__FreeBSD__) \
+  || defined(__NetBSD__) || defined(__OpenBSD__) || defined(__DragonFly__)
+#  define HAVE_PWRITEV 1
+# else
+#  define HAVE_PWRITEV 0
+# endif
+#endif
+
+/*
+** HAVE_PREADV is true by default wherever HAVE_PWRITEV is.  If it is
+** true, unixReadV() uses preadv() in the same way.
+*/
+#if !defined(HAVE_PREADV)
+# define HAVE_PREADV HAVE_PWRITEV
+#endif
+#if HAVE_PWRITEV || HAVE_PREADV
+# include <sys/uio.h>
+#endif
+
 
 #ifdef __linux__
 /*
@@ -341,6 +422,25 @@ static int posixOpen(const char *zFile, int flags, int mode){
   return open(zFile, flags, mode);
 }
 
+/*
+** HAVE_GETRANDOM defaults to true on Linux if the C library exposes the
+** getrandom() system call number.  The call is made through syscall()
+** so that older C libraries without a getrandom() wrapper also work.
+*/
+#if !defined(HAVE_GETRANDOM)
+# if defined(__linux__)
+#  include <sys/syscall.h>
+#  if defined(SYS_getrandom)
+#   define HAVE_GETRANDOM 1
+#  endif
+# endif
+#endif
+#if HAVE_GETRANDOM
+static ssize_t unixGetrandom(void *pBuf, size_t nBuf, unsigned int flags){
+  return (ssize_t)syscall(SYS_getrandom, pBuf, nBuf, flags);
+}
+#endif
+
 /* Forward reference */
 static int openDirectory(const char*, int*);
 static int unixGetpagesize(void);
@@ -511,6 +611,36 @@ static struct unix_syscall {
 
   { "ioctl",         (sqlite3_syscall_ptr)0,              0 },
 
+#if HAVE_GETRANDOM
+  { "getrandom",     (sqlite3_syscall_ptr)unixGetrandom,  0 },
+#else
+  { "getrandom",     (sqlite3_syscall_ptr)0,              0 },
+#endif
+#define osGetrandom ((ssize_t(*)(void*,size_t,unsigned int))aSyscall[29].pCurrent)
+
+#if HAVE_PWRITEV
+  { "pwritev",       (sqlite3_syscall_ptr)pwritev,        0 },
+#else
+  { "pwritev",       (sqlite3_syscall_ptr)0,              0 },
+#endif
+#define osPwritev ((ssize_t(*)(int,const struct iovec*,int,off_t))\
+                  aSyscall[30].pCurrent)
+
+#if HAVE_PREADV
+  { "preadv",        (sqlite3_syscall_ptr)preadv,         0 },
+#else
+  { "preadv",        (sqlite3_syscall_ptr)0,              0 },
+#endif
+#define osPreadv ((ssize_t(*)(int,const struct iovec*,int,off_t))\
+                 aSyscall[31].pCurrent)
+
+#if HAVE_POSIX_FADVISE
+  { "posix_fadvise", (sqlite3_syscall_ptr)posix_fadvise,  0 },
+#else
+  { "posix_fadvise", (sqlite3_syscall_ptr)0,              0 },
+#endif
+#define osFadvise ((int(*)(int,off_t,off_t,int))aSyscall[32].pCurrent)
+
 }; /* End of the overrideable system calls */  //可重写系统调用结束
 
 
@@ -687,32 +817,17 @@ static int robust_open(const char *z, int f, mode_t m){
 }
 
 /*
-** Helper functions to obtain and relinquish the global mutex. The
-** global mutex is used to protect the unixInodeInfo and
-** vxworksFileId objects used by this file, all of which may be 
-** shared by multiple threads.
-** //获得和放弃全局互斥锁的helper函数。全局互斥锁用户保护使用此文件中，所有的一切都可以由多个线程共享的unixInodeInfo
-** //和vxwordsFileId的对象。
-**
-** Function unixMutexHeld() is used to assert() that the global mutex 
-** is held when required. This function is only used as part of assert() 
-** statements. e.g.
-** //当有需要时，函数unixMutexHeld()用于使用全局互斥锁是所需的assert()函数。此函数仅用作assert()语句的一部分，例如：
-**
-**   unixEnterMutex()
-**     assert( unixMutexHeld() );
-**   unixEnterLeave()
-**
-** To prevent deadlock, the global unixBigLock must must be acquired
-** before the unixInodeInfo.pLockMutex mutex, if both are held.  It is
-** OK to get the pLockMutex without holding unixBigLock first, but if
-** that happens, the unixBigLock mutex must not be acquired until after
-** pLockMutex is released.
-**
-**      OK:     enter(unixBigLock),  enter(pLockInfo)
-**      OK:     enter(unixBigLock)
-**      OK:     enter(pLockInfo)
-**   ERROR:     enter(pLockInfo), enter(unixBigLock)
+** Helper functions to obtain and relinquish the global mutex.  The
+** global mutex only serializes calls to dlerror(), whose state may be
+** shared by multiple threads.  The unixInodeInfo objects are protected
+** by the mutexes of the sharded inode table instead (see
+** unixInodeShardOf()), and each unixInodeInfo by its own pLockMutex.
+** //获得和放弃全局互斥锁的helper函数。全局互斥锁仅用于串行化对dlerror()的调用。
+** //unixInodeInfo对象由分片inode表的互斥锁保护，每个unixInodeInfo由它自己的pLockMutex保护。
+**
+** The global mutex is not recursive, and no other mutex is acquired
+** while it is held, so it does not take part in any lock ordering.
+** //全局互斥锁不是递归的，持有它时不会获取其他互斥锁，所以它不参与任何加锁顺序。
 */
 static sqlite3_mutex *unixBigLock = 0;
 static void unixEnterMutex(void){
@@ -762,6 +877,7 @@ static int sqliteErrorFromPosixError(int posixError, int sqliteIOErr) {
   case ETIMEDOUT:
   case EBUSY:
   case EINTR:
+  case EDEADLK:
   case ENOLCK:  
     /* random NFS retry error, unless during file system support 
      * introspection, in which it actually means what it says */
@@ -931,43 +1047,202 @@ struct unixFileId {
 **
 **  (1) Only the pLockMutex mutex must be held in order to read or write
 **      any of the locking fields:
-**          nShared, nLock, eFileLock, bProcessLock, pUnused
+**          nShared, nLock, eFileLock, bProcessLock, bLease, hLease,
+**          iLeaseExpire, pUnused, nLockWait
 **
 **  (2) When nRef>0, then the following fields are unchanging and can
 **      be read (but not written) without holding any mutex:
-**          fileId, pLockMutex
+**          fileId, pLockMutex, pLockCond
 **
 **  (3) With the exceptions above, all the fields may only be read
-**      or written while holding the global unixBigLock mutex.
+**      or written while holding the mutex of the inode table shard
+**      that the object belongs to.  See unixInodeShardOf().
 **
-** Deadlock prevention:  The global unixBigLock mutex may not
-** be acquired while holding the pLockMutex mutex.  If both unixBigLock
-** and pLockMutex are needed, then unixBigLock must be acquired first.
+** Deadlock prevention:  A shard mutex may not be acquired while holding
+** the pLockMutex mutex.  If both a shard mutex and pLockMutex are needed,
+** then the shard mutex must be acquired first.  At most one shard mutex
+** is held at a time.
 */
 struct unixInodeInfo {
   struct unixFileId fileId;       /* The lookup key */  //查找键
   sqlite3_mutex *pLockMutex;      /* Hold this mutex for... */  
+  sqlite3_mutex_cond *pLockCond;  /* Signaled when a lock is lowered */
+  int nLockWait;                    /* Threads waiting on pLockCond */
   int nShared;                      /* Number of SHARED locks held */  //持有共享锁的数目
   int nLock;                        /* Number of outstanding file locks */  //未完成的文件锁定的数目
   unsigned char eFileLock;          /* One of SHARED_LOCK, RESERVED_LOCK etc. */
   unsigned char bProcessLock;       /* An exclusive process lock is held */  //独占进程锁
+  unsigned char bLease;             /* A SHARED lock is retained as a lease */
+  int hLease;                       /* Descriptor to release the lease with */
+  sqlite3_int64 iLeaseExpire;       /* unixMonotonicMs() when lease expires */
   UnixUnusedFd *pUnused;            /* Unused file descriptors to close */  //关闭未使用的文件描述符
   int nRef;                       /* Number of pointers to this structure */  //指向这个结构体的指针数目
   unixShmNode *pShmNode;          /* Shared memory associated with this inode */  //与这个i节点有关的共享内存
-  unixInodeInfo *pNext;           /* List of all unixInodeInfo objects */  //所有的unixInodeInfo对象的列表
-  unixInodeInfo *pPrev;           /*    .... doubly linked */  //双重链接
+  unixInodeInfo *pNext;           /* Next object in the same hash bucket */
 #if SQLITE_ENABLE_LOCKING_STYLE
   unsigned long long sharedByte;  /* for AFP simulated shared lock */  //用于模拟APF共享锁
 #endif
 };
 
 /*
-** A lists of all unixInodeInfo objects.
+** All unixInodeInfo objects are kept in a hash table keyed by their
+** unixFileId.  The table is split into SQLITE_UNIX_INODE_NSHARD shards,
+** each with its own mutex and its own array of hash buckets, so that
+** threads opening or closing unrelated files do not serialize on a
+** single global mutex or walk a single long list.
+**
+** The low bits of the hash of a unixFileId select the shard, and the
+** remaining bits select a bucket within the shard.  The bucket array of
+** a shard doubles in size whenever the shard holds more objects than it
+** has buckets.
+**
+** The mutex of a shard must be held in order to search, add objects to,
+** or remove objects from that shard.  It also protects the nRef and
+** pShmNode fields of every unixInodeInfo object in the shard, as well as
+** unixShmNode.nRef.
+*/
+#ifndef SQLITE_UNIX_INODE_NSHARD
+# define SQLITE_UNIX_INODE_NSHARD 64
+#endif
+#if SQLITE_UNIX_INODE_NSHARD<1 \
+ || (SQLITE_UNIX_INODE_NSHARD&(SQLITE_UNIX_INODE_NSHARD-1))!=0
+# error "SQLITE_UNIX_INODE_NSHARD must be a power of two"
+#endif
+#define UNIX_INODE_MINBUCKET 16   /* Initial size of a shard bucket array */
+
+typedef struct unixInodeShard unixInodeShard;
+struct unixInodeShard {
+  sqlite3_mutex *pMutex;          /* Protects this shard */
+  int nInode;                     /* Number of objects in this shard */
+  int nBucket;                    /* Size of aBucket[]. Zero or a power of 2 */
+  unixInodeInfo **aBucket;        /* Hash buckets */
+};
+static unixInodeShard aInodeShard[SQLITE_UNIX_INODE_NSHARD];
+
+/*
+** Return a hash of the unixFileId *pId.  Inode numbers allocated by a
+** file-system are often sequential, so the bits are mixed well enough
+** that both the shard and the bucket selected are evenly distributed.
+*/
+static u64 unixFileIdHash(const struct unixFileId *pId){
+  u64 h = pId->ino ^ ((u64)pId->dev * 0x9e3779b97f4a7c15ULL);
+  h = (h ^ (h>>30)) * 0xbf58476d1ce4e5b9ULL;
+  h = (h ^ (h>>27)) * 0x94d049bb133111ebULL;
+  return h ^ (h>>31);
+}
+
+/*
+** Return the inode table shard that unixInodeInfo objects with file-id
+** *pId belong to.
+*/
+static unixInodeShard *unixInodeShardOf(const struct unixFileId *pId){
+  return &aInodeShard[unixFileIdHash(pId) & (SQLITE_UNIX_INODE_NSHARD-1)];
+}
+
+/*
+** Return a pointer to the hash bucket of shard pShard that unixInodeInfo
+** objects with file-id *pId are stored in.  The shard must have a bucket
+** array.
+*/
+static unixInodeInfo **unixInodeBucket(
+  unixInodeShard *pShard,
+  const struct unixFileId *pId
+){
+  u64 h = unixFileIdHash(pId) / SQLITE_UNIX_INODE_NSHARD;
+  assert( pShard->nBucket>0 );
+  return &pShard->aBucket[h & (pShard->nBucket-1)];
+}
+
+/*
+** Search shard pShard for the unixInodeInfo object with file-id *pId.
+** Return a pointer to it, or NULL if there is no such object.
+**
+** The shard mutex must be held when this routine is called.
+*/
+static unixInodeInfo *unixInodeLookup(
+  unixInodeShard *pShard,
+  const struct unixFileId *pId
+){
+  unixInodeInfo *pInode = 0;
+  assert( sqlite3_mutex_held(pShard->pMutex) );
+  if( pShard->nBucket ){
+    pInode = *unixInodeBucket(pShard, pId);
+    while( pInode && memcmp(pId, &pInode->fileId, sizeof(*pId)) ){
+      pInode = pInode->pNext;
+    }
+  }
+  return pInode;
+}
+
+/*
+** Add unixInodeInfo object pInode to shard pShard, growing the bucket
+** array of the shard first if required.  Return SQLITE_OK if successful,
+** or SQLITE_NOMEM if a bucket array is needed and cannot be allocated.
+** A failure to grow an existing bucket array is not an error - the
+** object is added to the existing array.
+**
+** The shard mutex must be held when this routine is called.
+*/
+static int unixInodeInsert(unixInodeShard *pShard, unixInodeInfo *pInode){
+  unixInodeInfo **pp;
+  assert( sqlite3_mutex_held(pShard->pMutex) );
+  assert( unixInodeShardOf(&pInode->fileId)==pShard );
+  if( pShard->nInode>=pShard->nBucket ){
+    int nNew = pShard->nBucket ? pShard->nBucket*2 : UNIX_INODE_MINBUCKET;
+    unixInodeInfo **aNew;
+    aNew = (unixInodeInfo**)sqlite3_malloc64( sizeof(unixInodeInfo*)*nNew );
+    if( aNew ){
+      unixInodeInfo **aOld = pShard->aBucket;
+      int nOld = pShard->nBucket;
+      int i;
+      memset(aNew, 0, sizeof(unixInodeInfo*)*nNew);
+      pShard->aBucket = aNew;
+      pShard->nBucket = nNew;
+      for(i=0; i<nOld; i++){
+        unixInodeInfo *p;
+        unixInodeInfo *pNext;
+        for(p=aOld[i]; p; p=pNext){
+          pNext = p->pNext;
+          pp = unixInodeBucket(pShard, &p->fileId);
+          p->pNext = *pp;
+          *pp = p;
+        }
+      }
+      sqlite3_free(aOld);
+    }else if( pShard->nBucket==0 ){
+      return SQLITE_NOMEM_BKPT;
+    }
+  }
+  pp = unixInodeBucket(pShard, &pInode->fileId);
+  pInode->pNext = *pp;
+  *pp = pInode;
+  pShard->nInode++;
+  return SQLITE_OK;
+}
+
+/*
+** Remove unixInodeInfo object pInode from shard pShard.
 **
-** Must hold unixBigLock in order to read or write this variable.
-** //unixInodeInfo的所有对象的列表，为了读或者写这个变量，必须有unixBigLock
+** The shard mutex must be held when this routine is called.
+*/
+static void unixInodeRemove(unixInodeShard *pShard, unixInodeInfo *pInode){
+  unixInodeInfo **pp;
+  assert( sqlite3_mutex_held(pShard->pMutex) );
+  pp = unixInodeBucket(pShard, &pInode->fileId);
+  while( *pp!=pInode ){
+    assert( *pp!=0 );
+    pp = &(*pp)->pNext;
+  }
+  *pp = pInode->pNext;
+  pShard->nInode--;
+}
+
+/*
+** Macro used to assert() that the mutex of the shard that unixInodeInfo
+** object pInode belongs to is held.
 */
-static unixInodeInfo *inodeList = 0;  /* All unixInodeInfo objects */
+#define unixInodeMutexHeld(pInode) \
+  sqlite3_mutex_held(unixInodeShardOf(&(pInode)->fileId)->pMutex)
 
 /*
 **
@@ -1086,12 +1361,15 @@ static void storeLastErrno(unixFile *pFile, int error){
 /*
 ** Close all file descriptors accumuated in the unixInodeInfo->pUnused list.
 ** //关闭所有存放在unixInodeInfo->pUnused列表中的文件描述符
+**
+** closeInodePendingFds() closes those of pInode.  pFile, which may be
+** NULL, is used only to report errors.  closePendingFds() closes those of
+** the inode of pFile.
 */ 
-static void closePendingFds(unixFile *pFile){
-  unixInodeInfo *pInode = pFile->pInode;
+static void closeInodePendingFds(unixInodeInfo *pInode, unixFile *pFile){
   UnixUnusedFd *p;
   UnixUnusedFd *pNext;
-  assert( unixFileMutexHeld(pFile) );
+  assert( sqlite3_mutex_held(pInode->pLockMutex) );
   for(p=pInode->pUnused; p; p=pNext){
     pNext = p->pNext;
     robust_close(pFile, p->fd, __LINE__);
@@ -1099,37 +1377,33 @@ static void closePendingFds(unixFile *pFile){
   }
   pInode->pUnused = 0;
 }
+static void closePendingFds(unixFile *pFile){
+  assert( unixFileMutexHeld(pFile) );
+  closeInodePendingFds(pFile->pInode, pFile);
+}
 
 /*
 ** Release a unixInodeInfo structure previously allocated by findInodeInfo().
 ** //释放之前findInodeInfo()分配一个unixInodeInfo结构
 **
-** The global mutex must be held when this routine is called, but the mutex
-** on the inode being deleted must NOT be held.
-** //当这个函数调用时，必须使用unixEnterMutex()函数输入的互斥量
+** The mutex of the inode table shard that the inode belongs to must be
+** held when this routine is called, but the mutex on the inode being
+** deleted must NOT be held.
 */
 static void releaseInodeInfo(unixFile *pFile){
   unixInodeInfo *pInode = pFile->pInode;
-  assert( unixMutexHeld() );
   assert( unixFileMutexNotheld(pFile) );
   if( ALWAYS(pInode) ){
+    assert( unixInodeMutexHeld(pInode) );
     pInode->nRef--;
     if( pInode->nRef==0 ){
       assert( pInode->pShmNode==0 );
       sqlite3_mutex_enter(pInode->pLockMutex);
       closePendingFds(pFile);
       sqlite3_mutex_leave(pInode->pLockMutex);
-      if( pInode->pPrev ){
-        assert( pInode->pPrev->pNext==pInode );
-        pInode->pPrev->pNext = pInode->pNext;
-      }else{
-        assert( inodeList==pInode );
-        inodeList = pInode->pNext;
-      }
-      if( pInode->pNext ){
-        assert( pInode->pNext->pPrev==pInode );
-        pInode->pNext->pPrev = pInode->pPrev;
-      }
+      unixInodeRemove(unixInodeShardOf(&pInode->fileId), pInode);
+      assert( pInode->nLockWait==0 );
+      sqlite3_mutex_cond_free(pInode->pLockCond);
       sqlite3_mutex_free(pInode->pLockMutex);
       sqlite3_free(pInode);
     }
@@ -1137,35 +1411,21 @@ static void releaseInodeInfo(unixFile *pFile){
 }
 
 /*
-** Given a file descriptor, locate the unixInodeInfo object that
-** describes that file descriptor.  Create a new one if necessary.  The
-** return value might be uninitialized if an error occurs.
-** //给定一个文件描述符，定位unixInodeInfo对象描述文件描述符。在必要时创建一个新的。如果出现错误，返回值可能是未初始化的。
-**
-** The global mutex must held when calling this routine.
-** //当这个函数被调用时，必须使用unixEnterMutex()函数输入的互斥量
+** Populate *pId with the key used to look up the unixInodeInfo object
+** for the file open on pFile->h.  Return SQLITE_OK if successful, or an
+** appropriate error code if the fstat() call fails.
 **
-** Return an appropriate error code.
-** //返回相应的错误代码
+** No mutex need be held when calling this routine.
 */
-static int findInodeInfo(
-  unixFile *pFile,               /* Unix file with file desc used in the key */  //降序排列的Unix文件使用的键
-  unixInodeInfo **ppInode        /* Return the unixInodeInfo object here */  //返回unixInodeInfo对象
-){
+static int unixFileIdOf(unixFile *pFile, struct unixFileId *pId){
   int rc;                        /* System call return code */  //系统调用返回代码
-  int fd;                        /* The file descriptor for pFile */  //pFile的文件描述符
-  struct unixFileId fileId;      /* Lookup key for the unixInodeInfo */  //unixInodeInfo的查找键
   struct stat statbuf;           /* Low-level file information */  //底层文件信息
-  unixInodeInfo *pInode = 0;     /* Candidate unixInodeInfo object */  //候选的unixInodeInfo对象
-
-  assert( unixMutexHeld() );
 
   /* Get low-level information about the file that we can used to
   ** create a unique name for the file.
   ** //获得底层文件信息，我们可以用来为该文件创建一个唯一的名称。
   */
-  fd = pFile->h;
-  rc = osFstat(fd, &statbuf);
+  rc = osFstat(pFile->h, &statbuf);
   if( rc!=0 ){
     storeLastErrno(pFile, errno);
 #if defined(EOVERFLOW) && defined(SQLITE_DISABLE_LFS)
@@ -1174,34 +1434,58 @@ static int findInodeInfo(
     return SQLITE_IOERR;
   }
 
-  memset(&fileId, 0, sizeof(fileId));
-  fileId.dev = statbuf.st_dev;
-  fileId.ino = (u64)statbuf.st_ino;
-  assert( unixMutexHeld() );
-  pInode = inodeList;
-  while( pInode && memcmp(&fileId, &pInode->fileId, sizeof(fileId)) ){
-    pInode = pInode->pNext;
-  }
+  memset(pId, 0, sizeof(*pId));
+  pId->dev = statbuf.st_dev;
+  pId->ino = (u64)statbuf.st_ino;
+  return SQLITE_OK;
+}
+
+/*
+** Locate the unixInodeInfo object with file-id *pId, which was obtained
+** from pFile by unixFileIdOf().  Create a new one if necessary.  The
+** return value might be uninitialized if an error occurs.
+** //给定一个文件描述符，定位unixInodeInfo对象描述文件描述符。在必要时创建一个新的。如果出现错误，返回值可能是未初始化的。
+**
+** The mutex of the inode table shard for *pId must be held when calling
+** this routine.
+**
+** Return an appropriate error code.
+** //返回相应的错误代码
+*/
+static int findInodeInfo(
+  const struct unixFileId *pId,  /* Lookup key for the unixInodeInfo */  //unixInodeInfo的查找键
+  unixInodeInfo **ppInode        /* Return the unixInodeInfo object here */  //返回unixInodeInfo对象
+){
+  unixInodeShard *pShard = unixInodeShardOf(pId);
+  unixInodeInfo *pInode = 0;     /* Candidate unixInodeInfo object */  //候选的unixInodeInfo对象
+
+  assert( sqlite3_mutex_held(pShard->pMutex) );
+  pInode = unixInodeLookup(pShard, pId);
   if( pInode==0 ){
     pInode = sqlite3_malloc64( sizeof(*pInode) );
     if( pInode==0 ){
       return SQLITE_NOMEM_BKPT;
     }
     memset(pInode, 0, sizeof(*pInode));
-    memcpy(&pInode->fileId, &fileId, sizeof(fileId));
+    memcpy(&pInode->fileId, pId, sizeof(*pId));
     if( sqlite3GlobalConfig.bCoreMutex ){
       pInode->pLockMutex = sqlite3_mutex_alloc(SQLITE_MUTEX_FAST);
       if( pInode->pLockMutex==0 ){
         sqlite3_free(pInode);
         return SQLITE_NOMEM_BKPT;
       }
+      /* A NULL pLockCond is not an error.  It only means that threads
+      ** that find the inode locked by another thread are not able to
+      ** wait for it to be unlocked. */
+      pInode->pLockCond = sqlite3_mutex_cond_alloc();
+    }
+    if( unixInodeInsert(pShard, pInode)!=SQLITE_OK ){
+      sqlite3_mutex_cond_free(pInode->pLockCond);
+      sqlite3_mutex_free(pInode->pLockMutex);
+      sqlite3_free(pInode);
+      return SQLITE_NOMEM_BKPT;
     }
     pInode->nRef = 1;
-    assert( unixMutexHeld() );
-    pInode->pNext = inodeList;
-    pInode->pPrev = 0;
-    if( inodeList ) inodeList->pPrev = pInode;
-    inodeList = pInode;
   }else{
     pInode->nRef++;
   }
@@ -1308,6 +1592,73 @@ static int unixCheckReservedLock(sqlite3_file *id, int *pResOut){
 
 /* Forward declaration*/  //前向声明
 static int unixSleep(sqlite3_vfs*,int);
+static u64 unixRandomU64(void);
+
+/*
+** Return the current value of a monotonic clock in milliseconds.
+*/
+static sqlite3_int64 unixMonotonicMs(void){
+  struct timespec t;
+#ifdef CLOCK_MONOTONIC
+  clock_gettime(CLOCK_MONOTONIC, &t);
+#else
+  clock_gettime(CLOCK_REALTIME, &t);
+#endif
+  return (sqlite3_int64)t.tv_sec*1000 + t.tv_nsec/1000000;
+}
+
+#if defined(SQLITE_ENABLE_LOCK_STATUS) || !defined(SQLITE_OMIT_IOSTATS)
+/*
+** Return the current value of a monotonic clock in nanoseconds.
+*/
+static sqlite3_int64 unixMonotonicNs(void){
+  struct timespec t;
+#ifdef CLOCK_MONOTONIC
+  clock_gettime(CLOCK_MONOTONIC, &t);
+#else
+  clock_gettime(CLOCK_REALTIME, &t);
+#endif
+  return (sqlite3_int64)t.tv_sec*1000000000 + t.tv_nsec;
+}
+#endif
+
+/*
+** Jittered exponential backoff for loops that retry an operation until
+** it succeeds or a time limit expires.
+**
+** Each call to unixBackoffSleep() sleeps for a random interval between
+** one half and all of the current delay, then doubles the delay, up to
+** SQLITE_UNIX_BACKOFF_MAX microseconds.  A retry loop therefore polls
+** often while the wait is short but does not keep waking up while it is
+** long, and the random element stops threads that collided once from
+** retrying in lock-step.
+*/
+#ifndef SQLITE_UNIX_BACKOFF_MIN
+# define SQLITE_UNIX_BACKOFF_MIN 50        /* First delay, microseconds */
+#endif
+#ifndef SQLITE_UNIX_BACKOFF_MAX
+# define SQLITE_UNIX_BACKOFF_MAX 20000     /* Largest delay, microseconds */
+#endif
+typedef struct UnixBackoff UnixBackoff;
+struct UnixBackoff {
+  int iDelay;                /* Current delay in microseconds */
+};
+#define UNIX_BACKOFF_INIT { SQLITE_UNIX_BACKOFF_MIN }
+
+/*
+** Sleep for the next interval of backoff p, but for no more than
+** mxSleep microseconds.  Return the number of microseconds slept.
+*/
+static int unixBackoffSleep(UnixBackoff *p, sqlite3_int64 mxSleep){
+  int iSleep = p->iDelay/2;
+  iSleep += (int)(unixRandomU64() % (u64)(p->iDelay - iSleep + 1));
+  if( iSleep>mxSleep ) iSleep = (int)mxSleep;
+  if( p->iDelay<SQLITE_UNIX_BACKOFF_MAX ){
+    p->iDelay *= 2;
+    if( p->iDelay>SQLITE_UNIX_BACKOFF_MAX ) p->iDelay = SQLITE_UNIX_BACKOFF_MAX;
+  }
+  return iSleep>0 ? unixSleep(0, iSleep) : 0;
+}
 
 /*
 ** Set a posix-advisory-lock.
@@ -1325,27 +1676,309 @@ static int unixSleep(sqlite3_vfs*,int);
 #ifndef SQLITE_ENABLE_SETLK_TIMEOUT
 # define osSetPosixAdvisoryLock(h,x,t) osFcntl(h,F_SETLK,x)
 #else
-static int osSetPosixAdvisoryLock(
+
+/*
+** On Linux, a lock that cannot be obtained at once is waited for using a
+** blocking F_SETLKW, so that it is granted as soon as the holder lets go
+** of it.  The time limit is enforced by a POSIX timer that sends signal
+** SQLITE_UNIX_LOCK_SIGNAL to the waiting thread, and so interrupts the
+** fcntl() with EINTR.  After the time limit, the timer keeps firing every
+** SQLITE_UNIX_LOCK_SIGNAL_MS milliseconds until it is disarmed.  A signal
+** that arrives before the fcntl() starts to block is therefore followed
+** by another, and cannot leave the thread blocked indefinitely.
+**
+** Note that this installs a process-wide signal handler from library
+** code.  The first time a blocking lock is needed, SQLite installs a
+** handler, which does nothing, for SQLITE_UNIX_LOCK_SIGNAL (by default
+** SIGRTMAX-2) using sigaction().  This is only done if the signal has no
+** handler at that time.  If the application already handles the signal,
+** or if the signal is blocked in the calling thread, the lock is instead
+** polled for with unixBackoffSleep() between attempts.  Applications
+** that use SIGRTMAX-2 themselves may move SQLite to another signal by
+** defining SQLITE_UNIX_LOCK_SIGNAL.  Compiling with
+** SQLITE_DISABLE_BLOCKING_LOCK disables blocking locks, so that no
+** handler is installed and no timer is created.
+*/
+#if defined(__linux__) && !defined(SQLITE_DISABLE_BLOCKING_LOCK)
+# define SQLITE_UNIX_BLOCKING_LOCK 1
+#endif
+
+#ifdef SQLITE_UNIX_BLOCKING_LOCK
+#include <signal.h>
+#include <sys/syscall.h>
+#ifndef SQLITE_UNIX_LOCK_SIGNAL
+# define SQLITE_UNIX_LOCK_SIGNAL (SIGRTMAX-2)
+#endif
+#ifndef SQLITE_UNIX_LOCK_SIGNAL_MS
+# define SQLITE_UNIX_LOCK_SIGNAL_MS 1
+#endif
+#ifndef sigev_notify_thread_id
+# define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+/*
+** 0 if the handler for SQLITE_UNIX_LOCK_SIGNAL has not been looked at
+** yet, 1 if it has been installed, or -1 if the application has its own
+** handler for the signal.
+*/
+static int unixLockSignalState = 0;
+
+static void unixLockSignalHandler(int sig){
+  UNUSED_PARAMETER(sig);
+}
+
+/*
+** Return true if blocking locks may be used by the calling thread.
+*/
+static int unixBlockingLockReady(void){
+  int eState = __atomic_load_n(&unixLockSignalState, __ATOMIC_ACQUIRE);
+  sigset_t mask;
+  if( eState==0 ){
+    struct sigaction old;
+    eState = -1;
+    if( sigaction(SQLITE_UNIX_LOCK_SIGNAL, 0, &old)==0
+     && (old.sa_flags & SA_SIGINFO)==0
+     && (old.sa_handler==SIG_DFL || old.sa_handler==unixLockSignalHandler)
+    ){
+      struct sigaction sa;
+      memset(&sa, 0, sizeof(sa));
+      sa.sa_handler = unixLockSignalHandler;
+      sigemptyset(&sa.sa_mask);
+      sa.sa_flags = 0;           /* Not SA_RESTART, so fcntl() is interrupted */
+      if( sigaction(SQLITE_UNIX_LOCK_SIGNAL, &sa, 0)==0 ) eState = 1;
+    }
+    __atomic_store_n(&unixLockSignalState, eState, __ATOMIC_RELEASE);
+  }
+  if( eState<0 ) return 0;
+#if SQLITE_THREADSAFE
+  if( pthread_sigmask(SIG_BLOCK, 0, &mask)!=0 ) return 0;
+#else
+  if( sigprocmask(SIG_BLOCK, 0, &mask)!=0 ) return 0;
+#endif
+  return sigismember(&mask, SQLITE_UNIX_LOCK_SIGNAL)==0;
+}
+
+/*
+** Take the lock described by pLock on file descriptor h using the
+** blocking fcntl() command eCmd (F_SETLKW or F_OFD_SETLKW), waiting for
+** no more than ms milliseconds.  Return 0 if the lock is obtained, or -1
+** with errno set if it is not.  Return 1, without attempting the lock,
+** if a timer cannot be created.
+*/
+static int unixBlockingLock(int h, int eCmd, struct flock *pLock, int ms){
+  struct sigevent sev;
+  struct itimerspec its;
+  timer_t timer;
+  sqlite3_int64 iDeadline;
+  int rc;
+  int iErrno;
+
+  memset(&sev, 0, sizeof(sev));
+  sev.sigev_notify = SIGEV_THREAD_ID;
+  sev.sigev_signo = SQLITE_UNIX_LOCK_SIGNAL;
+  sev.sigev_notify_thread_id = (pid_t)syscall(SYS_gettid);
+  if( timer_create(CLOCK_MONOTONIC, &sev, &timer)!=0 ) return 1;
+  memset(&its, 0, sizeof(its));
+  its.it_value.tv_sec = ms/1000;
+  its.it_value.tv_nsec = (long)(ms%1000)*1000000;
+  its.it_interval.tv_sec = SQLITE_UNIX_LOCK_SIGNAL_MS/1000;
+  its.it_interval.tv_nsec = (long)(SQLITE_UNIX_LOCK_SIGNAL_MS%1000)*1000000;
+  iDeadline = unixMonotonicMs() + ms;
+  if( timer_settime(timer, 0, &its, 0)!=0 ){
+    timer_delete(timer);
+    return 1;
+  }
+
+  /* Other signals may interrupt the fcntl() too.  Only give up once the
+  ** time limit has passed.  If the timer signal was delivered before the
+  ** fcntl() blocked, the next one interrupts it. */
+  do{
+    rc = osFcntl(h, eCmd, pLock);
+  }while( rc<0 && errno==EINTR && unixMonotonicMs()<iDeadline );
+  iErrno = errno;
+
+  memset(&its, 0, sizeof(its));
+  timer_settime(timer, 0, &its, 0);
+  timer_delete(timer);
+  errno = iErrno;
+  return rc<0 ? -1 : 0;
+}
+#endif /* SQLITE_UNIX_BLOCKING_LOCK */
+
+/*
+** Take the lock described by pLock on file descriptor h using the
+** non-blocking fcntl() command eCmd.  If it is not granted at once and tm
+** is greater than zero, keep trying for up to tm milliseconds, using the
+** blocking command eCmdWait where possible.
+*/
+static int unixSetLockTimeout(
   int h,                /* The file descriptor on which to take the lock */
+  int eCmd,             /* F_SETLK or F_OFD_SETLK */
+  int eCmdWait,         /* F_SETLKW or F_OFD_SETLKW */
   struct flock *pLock,  /* The description of the lock */
-  unixFile *pFile       /* Structure holding timeout value */
+  int tm                /* Milliseconds to wait for the lock */
 ){
-  int tm = pFile->iBusyTimeout;
-  int rc = osFcntl(h,F_SETLK,pLock);
-  while( rc<0 && tm>0 ){
-    /* On systems that support some kind of blocking file lock with a timeout,
-    ** make appropriate changes here to invoke that blocking file lock.  On
-    ** generic posix, however, there is no such API.  So we simply try the
-    ** lock once every millisecond until either the timeout expires, or until
-    ** the lock is obtained. */
-    unixSleep(0,1000);
-    rc = osFcntl(h,F_SETLK,pLock);
-    tm--;
+  int rc = osFcntl(h,eCmd,pLock);
+  if( rc<0 && tm>0 && pLock->l_type!=F_UNLCK ){
+    UnixBackoff backoff = UNIX_BACKOFF_INIT;
+    sqlite3_int64 iDeadline;
+    sqlite3_int64 iNow;
+#ifdef SQLITE_UNIX_BLOCKING_LOCK
+    if( unixBlockingLockReady() ){
+      int rc2 = unixBlockingLock(h, eCmdWait, pLock, tm);
+      if( rc2<=0 ) return rc2;
+    }
+#else
+    UNUSED_PARAMETER(eCmdWait);
+#endif
+    /* Where no blocking file lock with a timeout is available, simply
+    ** retry the lock, with a jittered exponential backoff, until either
+    ** the timeout expires or the lock is obtained.  The time limit is
+    ** measured with the clock, not by adding up the sleeps, as a sleep
+    ** may overrun. */
+    iDeadline = unixMonotonicMs() + tm;
+    while( rc<0 && (iNow = unixMonotonicMs())<iDeadline ){
+      unixBackoffSleep(&backoff, (iDeadline - iNow)*1000);
+      rc = osFcntl(h,eCmd,pLock);
+    }
   }
   return rc;
 }
+
+static int osSetPosixAdvisoryLock(
+  int h,                /* The file descriptor on which to take the lock */
+  struct flock *pLock,  /* The description of the lock */
+  unixFile *pFile       /* Structure holding timeout value */
+){
+  return unixSetLockTimeout(h, F_SETLK, F_SETLKW, pLock, pFile->iBusyTimeout);
+}
 #endif /* SQLITE_ENABLE_SETLK_TIMEOUT */
 
+#ifdef SQLITE_ENABLE_LOCK_STATUS
+/*
+** Lock contention statistics.
+**
+** If SQLite is compiled with SQLITE_ENABLE_LOCK_STATUS, each unixFile
+** counts the lock requests made on it by xLock, xUnlock and xShmLock, how
+** they ended, and the fcntl() calls issued on their behalf.  The counters
+** are returned by SQLITE_FCNTL_LOCK_STATUS.  They are only ever updated
+** by the thread using the file, so no mutex is required.
+**
+** A request that fails with SQLITE_BUSY is counted as refused locally if
+** the conflicting lock is held by another connection in this process, and
+** as refused remotely if it was fcntl() that reported the conflict.
+*/
+#define UnixLockStat(X) X
+
+/*
+** Account for a change in pFile->eFileLock since the last call.  Time
+** spent at RESERVED or higher (including PENDING) and at EXCLUSIVE is
+** added to the statistics when the level drops back below it.
+*/
+static void unixLockStatHeld(unixFile *pFile){
+  int eOld = pFile->eStatLock;
+  int eNew = pFile->eFileLock;
+  sqlite3_lock_stats *pStat = &pFile->lockStats;
+  sqlite3_int64 iNow;
+
+  if( eOld==eNew ) return;
+  iNow = unixMonotonicNs();
+  if( eOld<RESERVED_LOCK && eNew>=RESERVED_LOCK ){
+    pFile->iReservedStart = iNow;
+  }else if( eOld>=RESERVED_LOCK && eNew<RESERVED_LOCK ){
+    pStat->nReservedNs += iNow - pFile->iReservedStart;
+  }
+  if( eOld<EXCLUSIVE_LOCK && eNew==EXCLUSIVE_LOCK ){
+    pFile->iExclusiveStart = iNow;
+  }else if( eOld==EXCLUSIVE_LOCK && eNew<EXCLUSIVE_LOCK ){
+    pStat->nExclusiveNs += iNow - pFile->iExclusiveStart;
+  }
+  pFile->eStatLock = (unsigned char)eNew;
+}
+
+/*
+** Record the outcome of an xLock request for level eFileLock that
+** returned rc.  bLocal is true if any SQLITE_BUSY was caused by another
+** connection in this process, and bInProcess is true if no fcntl() call
+** was made.
+*/
+static void unixLockStatLock(
+  unixFile *pFile,
+  int eFileLock,
+  int rc,
+  int bLocal,
+  int bInProcess
+){
+  sqlite3_lock_stats *pStat = &pFile->lockStats;
+  assert( eFileLock>NO_LOCK && eFileLock<=EXCLUSIVE_LOCK );
+  pStat->aLock[eFileLock]++;
+  if( rc==SQLITE_OK ){
+    pStat->aLockOk[eFileLock]++;
+    if( bInProcess ) pStat->nInProcess++;
+  }else if( (rc&0xff)==SQLITE_BUSY ){
+    if( bLocal ){
+      pStat->aBusyLocal[eFileLock]++;
+    }else{
+      pStat->aBusyRemote[eFileLock]++;
+    }
+  }
+  unixLockStatHeld(pFile);
+}
+
+/*
+** Record the outcome of an xShmLock request on locks ofst through
+** ofst+n-1 that returned rc.  bInProcess is true if no fcntl() call was
+** made, in which case any SQLITE_BUSY was caused by another connection
+** in this process.
+**
+** mChanged is the mask of locks that the connection took or released
+** as a result of the request.  Hold times are only started or stopped
+** for those locks, so that taking a lock that is already held does not
+** restart its hold time, and releasing a lock that is not held does
+** not add to it.
+*/
+static void unixLockStatShm(
+  unixFile *pFile,
+  int ofst,
+  int n,
+  int flags,
+  int rc,
+  int bInProcess,
+  u16 mChanged
+){
+  sqlite3_lock_stats *pStat = &pFile->lockStats;
+  sqlite3_int64 iNow;
+  int ii;
+
+  if( rc==SQLITE_OK ){
+    if( bInProcess ) pStat->nShmInProcess++;
+    if( mChanged ){
+      iNow = unixMonotonicNs();
+      for(ii=ofst; ii<ofst+n; ii++){
+        if( (mChanged & (1<<ii))==0 ) continue;
+        if( flags & SQLITE_SHM_UNLOCK ){
+          pStat->aShmHeldNs[ii] += iNow - pFile->aShmStart[ii];
+        }else{
+          pFile->aShmStart[ii] = iNow;
+        }
+      }
+    }
+  }
+  if( flags & SQLITE_SHM_LOCK ){
+    pStat->aShmLock[ofst]++;
+    if( (rc&0xff)==SQLITE_BUSY ){
+      if( bInProcess ){
+        pStat->aShmBusyLocal[ofst]++;
+      }else{
+        pStat->aShmBusyRemote[ofst]++;
+      }
+    }
+  }
+}
+#else
+# define UnixLockStat(X)
+#endif /* SQLITE_ENABLE_LOCK_STATUS */
+
 
 /*
 ** Attempt to set a system-lock on the file pFile.  The lock is 
@@ -1385,6 +2018,7 @@ static int unixFileLock(unixFile *pFile, struct flock *pLock){
       lock.l_start = SHARED_FIRST;
       lock.l_len = SHARED_SIZE;
       lock.l_type = F_WRLCK;
+      UnixLockStat( pFile->lockStats.nFcntl++ );
       rc = osSetPosixAdvisoryLock(pFile->h, &lock, pFile);
       if( rc<0 ) return rc;
       pInode->bProcessLock = 1;
@@ -1393,34 +2027,321 @@ static int unixFileLock(unixFile *pFile, struct flock *pLock){
       rc = 0;
     }
   }else{
+    UnixLockStat( pFile->lockStats.nFcntl++ );
     rc = osSetPosixAdvisoryLock(pFile->h, pLock, pFile);
   }
   return rc;
 }
 
 /*
-** Lock the file with the lock specified by parameter eFileLock - one
-** of the following:
-** 对文件进行由参数eFileLock指定的下列加锁
-**
-**     (1) SHARED_LOCK  共享锁
-**     (2) RESERVED_LOCK  保留锁
-**     (3) PENDING_LOCK  未决锁
-**     (4) EXCLUSIVE_LOCK  排它锁
-**
-** Sometimes when requesting one lock state, additional lock states
-** are inserted in between.  The locking might fail on one of the later
-** transitions leaving the lock state different from what it started but
-** still short of its goal.  The following chart shows the allowed
-** transitions and the inserted intermediate states:
-** 有时，请求一个锁定状态时，会插入额外的锁定状态。之后的转让锁的状态不同于它开始的状态，
-** 锁定可能失败，达不到预期的目标，下面的图表显示了允许转换和插入的中间状态
-**
-**    UNLOCKED -> SHARED  未加锁 -> 共享
-**    SHARED -> RESERVED  共享 -> 保留
-**    SHARED -> (PENDING) -> EXCLUSIVE  共享 -> (未决) -> 排他
-**    RESERVED -> (PENDING) -> EXCLUSIVE  保留 -> （未决）-> 排他
-**    PENDING -> EXCLUSIVE  未决-> 排它
+** The maximum number of milliseconds that unixLock() waits for another
+** thread in this process to lower its lock on an inode, in cases where
+** that is known to be safe.  Zero means that unixLock() returns
+** SQLITE_BUSY at once, as it always has.  If SQLite is compiled with
+** SQLITE_ENABLE_SETLK_TIMEOUT and a busy timeout has been set on the file
+** using SQLITE_FCNTL_LOCK_TIMEOUT, the busy timeout is used instead.
+*/
+#ifndef SQLITE_UNIX_INODE_WAIT
+# define SQLITE_UNIX_INODE_WAIT 0
+#endif
+
+/*
+** Wait on pInode->pLockCond for another thread to lower its lock on
+** the inode of pFile.  The pInode->pLockMutex mutex must be held.  It is
+** released while waiting.
+**
+** *piDeadline is the time, according to unixMonotonicMs(), at which the
+** thread gives up.  If it is zero on entry it is set here.  Return
+** SQLITE_OK if the thread was woken before the deadline, in which case
+** the caller should test the state of the inode again, or SQLITE_BUSY
+** otherwise.
+*/
+static int unixInodeWait(unixFile *pFile, sqlite3_int64 *piDeadline){
+  unixInodeInfo *pInode = pFile->pInode;
+  sqlite3_int64 iNow;
+  int ms = SQLITE_UNIX_INODE_WAIT;
+  int rc;
+
+  assert( sqlite3_mutex_held(pInode->pLockMutex) );
+#ifdef SQLITE_ENABLE_SETLK_TIMEOUT
+  if( pFile->iBusyTimeout ) ms = (int)pFile->iBusyTimeout;
+#endif
+  if( ms<=0 || pInode->pLockCond==0 ) return SQLITE_BUSY;
+  iNow = unixMonotonicMs();
+  if( *piDeadline==0 ) *piDeadline = iNow + ms;
+  if( iNow>=*piDeadline ) return SQLITE_BUSY;
+
+  pInode->nLockWait++;
+  rc = sqlite3_mutex_cond_wait(pInode->pLockCond, pInode->pLockMutex,
+                               (int)(*piDeadline - iNow));
+  pInode->nLockWait--;
+  return rc;
+}
+
+/*
+** Wake any threads waiting in unixInodeWait() on the inode.  The
+** pInode->pLockMutex mutex must be held.
+*/
+static void unixInodeWake(unixInodeInfo *pInode){
+  assert( sqlite3_mutex_held(pInode->pLockMutex) );
+  if( pInode->nLockWait>0 ){
+    sqlite3_mutex_cond_broadcast(pInode->pLockCond);
+  }
+}
+
+/*
+** Called by unixLock() on behalf of a thread that holds the PENDING byte
+** and wants EXCLUSIVE, but other threads in this process still hold
+** SHARED locks on the inode.  Move pFile and the inode to PENDING, which
+** stops new SHARED locks from being granted and tells threads waiting
+** for RESERVED to give up, then wait for the other SHARED locks to be
+** released.  Return SQLITE_OK once this is the only thread holding a
+** SHARED lock, or SQLITE_BUSY if the wait times out.
+*/
+static int unixLockWaitShared(unixFile *pFile, sqlite3_int64 *piDeadline){
+  unixInodeInfo *pInode = pFile->pInode;
+  assert( pFile->eFileLock>=SHARED_LOCK );
+  if( pFile->eFileLock<PENDING_LOCK ){
+    pFile->eFileLock = PENDING_LOCK;
+    pInode->eFileLock = PENDING_LOCK;
+    unixInodeWake(pInode);
+  }
+  while( pInode->nShared>1 ){
+    if( unixInodeWait(pFile, piDeadline)!=SQLITE_OK ) return SQLITE_BUSY;
+  }
+  return SQLITE_OK;
+}
+
+/*
+** Shared-lock leases.
+**
+** Acquiring a SHARED lock from scratch takes three fcntl() calls (lock
+** the PENDING byte, lock the shared range, unlock the PENDING byte) and
+** releasing it takes one more.  If a file has the UNIXFILE_LEASE flag
+** set (see SQLITE_FCNTL_SHARED_LEASE), then when the last SHARED lock
+** held by this process on the inode is released, the read-lock on the
+** shared range is kept and unixInodeInfo.bLease is set instead.  The
+** next SHARED lock on the inode then costs just a single F_GETLK probe
+** of the PENDING and RESERVED bytes.  If that shows that a writer in
+** another process holds either byte, or if the file that wants the lock
+** does not have UNIXFILE_LEASE set, the lease is given up and the lock
+** is acquired in the usual way.
+**
+** While a lease is held it counts as one of the unixInodeInfo.nLock
+** locks, so that file descriptors closed in the meantime are deferred
+** to the pUnused list instead of silently dropping the lease.  This also
+** keeps unixInodeInfo.hLease, the descriptor of the file that released
+** the last SHARED lock, open until the lease is given up.
+**
+** A process that holds a lease and then stops reading the database makes
+** no further calls that could check it, yet would keep writers in other
+** processes from obtaining an EXCLUSIVE lock.  So each lease expires
+** SQLITE_UNIX_LEASE_MS milliseconds after it was taken, and a reaper
+** thread, started when the first lease is taken, gives up expired leases
+** every SQLITE_UNIX_LEASE_MS milliseconds.  A writer is therefore held up
+** by an idle reader for at most about twice that.  Builds without
+** threads, or whose mutexes do not support condition variables, never
+** keep leases.
+*/
+#ifndef SQLITE_UNIX_LEASE_MS
+# define SQLITE_UNIX_LEASE_MS 100
+#endif
+#if SQLITE_THREADSAFE>0
+# define SQLITE_UNIX_LEASE_REAPER 1
+#endif
+
+/*
+** Return true if a process other than this one holds a write-lock on
+** the PENDING or RESERVED byte of the file, indicating that a writer
+** wants the SHARED lock leased by this process to be released.  If the
+** probe fails, true is also returned.
+*/
+static int unixLeaseRevoked(unixFile *pFile){
+  struct flock lock;
+  assert( PENDING_BYTE+1==RESERVED_BYTE );
+  lock.l_whence = SEEK_SET;
+  lock.l_start = PENDING_BYTE;
+  lock.l_len = 2;
+  lock.l_type = F_RDLCK;
+  UnixLockStat( pFile->lockStats.nFcntl++ );
+  if( osFcntl(pFile->h, F_GETLK, &lock) ) return 1;
+  return lock.l_type!=F_UNLCK;
+}
+
+/*
+** Give up the SHARED lock lease held on pInode.  The pInode->pLockMutex
+** mutex must be held, and no thread in this process may hold a SHARED
+** lock on the inode.  pFile is the file that wants a lock on the inode,
+** or NULL if the lease has expired.
+*/
+static int unixLeaseRelease(unixInodeInfo *pInode, unixFile *pFile){
+  struct flock lock;
+  int rc = SQLITE_OK;
+
+  assert( sqlite3_mutex_held(pInode->pLockMutex) );
+  assert( pInode->bLease && pInode->nShared==0 && pInode->nLock>0 );
+  lock.l_type = F_UNLCK;
+  lock.l_whence = SEEK_SET;
+  lock.l_start = lock.l_len = 0L;
+  if( pFile ) UnixLockStat( pFile->lockStats.nFcntl++ );
+  if( osFcntl(pInode->hLease, F_SETLK, &lock) ){
+    rc = SQLITE_IOERR_UNLOCK;
+    if( pFile ) storeLastErrno(pFile, errno);
+  }
+  pInode->bLease = 0;
+  pInode->nLock--;
+  if( pInode->nLock==0 ) closeInodePendingFds(pInode, pFile);
+  return rc;
+}
+
+#ifdef SQLITE_UNIX_LEASE_REAPER
+/*
+** The lease reaper.  The mutex and condition variable are allocated by
+** sqlite3_os_init().  bActive is set whenever a lease is taken, and
+** cleared by the thread when it finds no leases left.
+*/
+static struct unixLeaseReaperType {
+  sqlite3_mutex *pMutex;          /* Protects starting the thread, bShutdown */
+  sqlite3_mutex_cond *pCond;      /* Signaled when bActive or bShutdown set */
+  int bActive;                    /* True if leases may be held.  Atomic */
+  int bRunning;                   /* True if the thread was started.  Atomic */
+  int bShutdown;                  /* True when the thread should exit */
+  pthread_t thread;               /* The reaper thread */
+} unixLeaseReaper;
+
+/*
+** Give up all expired leases.  Return true if any leases remain.
+*/
+static int unixLeaseExpire(void){
+  sqlite3_int64 iNow = unixMonotonicMs();
+  int bRemain = 0;
+  int i, j;
+  for(i=0; i<SQLITE_UNIX_INODE_NSHARD; i++){
+    unixInodeShard *pShard = &aInodeShard[i];
+    sqlite3_mutex_enter(pShard->pMutex);
+    for(j=0; j<pShard->nBucket; j++){
+      unixInodeInfo *pInode;
+      for(pInode=pShard->aBucket[j]; pInode; pInode=pInode->pNext){
+        sqlite3_mutex_enter(pInode->pLockMutex);
+        if( pInode->bLease ){
+          if( pInode->iLeaseExpire<=iNow ){
+            unixLeaseRelease(pInode, 0);
+          }else{
+            bRemain = 1;
+          }
+        }
+        sqlite3_mutex_leave(pInode->pLockMutex);
+      }
+    }
+    sqlite3_mutex_leave(pShard->pMutex);
+  }
+  return bRemain;
+}
+
+/*
+** Body of the reaper thread.  While leases may be held, give up those
+** that have expired every SQLITE_UNIX_LEASE_MS milliseconds.
+*/
+static void *unixLeaseReaperMain(void *pArg){
+  UNUSED_PARAMETER(pArg);
+  sqlite3_mutex_enter(unixLeaseReaper.pMutex);
+  while( !unixLeaseReaper.bShutdown ){
+    if( __atomic_load_n(&unixLeaseReaper.bActive, __ATOMIC_SEQ_CST)==0 ){
+      sqlite3_mutex_cond_wait(unixLeaseReaper.pCond, unixLeaseReaper.pMutex,
+                              -1);
+      continue;
+    }
+    sqlite3_mutex_cond_wait(unixLeaseReaper.pCond, unixLeaseReaper.pMutex,
+                            SQLITE_UNIX_LEASE_MS);
+    if( unixLeaseReaper.bShutdown ) break;
+
+    /* bActive is cleared before the scan.  A lease taken after the scan
+    ** has passed its inode sets it again. */
+    __atomic_store_n(&unixLeaseReaper.bActive, 0, __ATOMIC_SEQ_CST);
+    sqlite3_mutex_leave(unixLeaseReaper.pMutex);
+    if( unixLeaseExpire() ){
+      __atomic_store_n(&unixLeaseReaper.bActive, 1, __ATOMIC_SEQ_CST);
+    }
+    sqlite3_mutex_enter(unixLeaseReaper.pMutex);
+  }
+  sqlite3_mutex_leave(unixLeaseReaper.pMutex);
+  return 0;
+}
+
+/*
+** Record that a lease has just been taken, starting the reaper thread if
+** it is not already running.  Return SQLITE_OK if the thread is running,
+** or an error code if the lease must not be kept.  The pLockMutex of the
+** inode that holds the lease must be held.
+*/
+static int unixLeaseTaken(void){
+  if( unixLeaseReaper.pCond==0 ) return SQLITE_ERROR;
+  if( __atomic_load_n(&unixLeaseReaper.bRunning, __ATOMIC_ACQUIRE)==0 ){
+    int rc = SQLITE_OK;
+    sqlite3_mutex_enter(unixLeaseReaper.pMutex);
+    if( !unixLeaseReaper.bRunning ){
+      if( pthread_create(&unixLeaseReaper.thread, 0, unixLeaseReaperMain, 0) ){
+        rc = SQLITE_ERROR;
+      }else{
+        __atomic_store_n(&unixLeaseReaper.bRunning, 1, __ATOMIC_RELEASE);
+      }
+    }
+    sqlite3_mutex_leave(unixLeaseReaper.pMutex);
+    if( rc ) return rc;
+  }
+  if( __atomic_load_n(&unixLeaseReaper.bActive, __ATOMIC_SEQ_CST)==0
+   && __atomic_exchange_n(&unixLeaseReaper.bActive, 1, __ATOMIC_SEQ_CST)==0
+  ){
+    sqlite3_mutex_enter(unixLeaseReaper.pMutex);
+    sqlite3_mutex_cond_broadcast(unixLeaseReaper.pCond);
+    sqlite3_mutex_leave(unixLeaseReaper.pMutex);
+  }
+  return SQLITE_OK;
+}
+
+/*
+** Stop the reaper thread.  Called by sqlite3_os_end(), when no files are
+** open and so no leases are held.
+*/
+static void unixLeaseReaperShutdown(void){
+  if( unixLeaseReaper.bRunning ){
+    sqlite3_mutex_enter(unixLeaseReaper.pMutex);
+    unixLeaseReaper.bShutdown = 1;
+    sqlite3_mutex_cond_broadcast(unixLeaseReaper.pCond);
+    sqlite3_mutex_leave(unixLeaseReaper.pMutex);
+    pthread_join(unixLeaseReaper.thread, 0);
+  }
+  sqlite3_mutex_cond_free(unixLeaseReaper.pCond);
+  sqlite3_mutex_free(unixLeaseReaper.pMutex);
+  memset(&unixLeaseReaper, 0, sizeof(unixLeaseReaper));
+}
+#else
+# define unixLeaseTaken() SQLITE_ERROR
+#endif /* SQLITE_UNIX_LEASE_REAPER */
+
+/*
+** Lock the file with the lock specified by parameter eFileLock - one
+** of the following:
+** 对文件进行由参数eFileLock指定的下列加锁
+**
+**     (1) SHARED_LOCK  共享锁
+**     (2) RESERVED_LOCK  保留锁
+**     (3) PENDING_LOCK  未决锁
+**     (4) EXCLUSIVE_LOCK  排它锁
+**
+** Sometimes when requesting one lock state, additional lock states
+** are inserted in between.  The locking might fail on one of the later
+** transitions leaving the lock state different from what it started but
+** still short of its goal.  The following chart shows the allowed
+** transitions and the inserted intermediate states:
+** 有时，请求一个锁定状态时，会插入额外的锁定状态。之后的转让锁的状态不同于它开始的状态，
+** 锁定可能失败，达不到预期的目标，下面的图表显示了允许转换和插入的中间状态
+**
+**    UNLOCKED -> SHARED  未加锁 -> 共享
+**    SHARED -> RESERVED  共享 -> 保留
+**    SHARED -> (PENDING) -> EXCLUSIVE  共享 -> (未决) -> 排他
+**    RESERVED -> (PENDING) -> EXCLUSIVE  保留 -> （未决）-> 排他
+**    PENDING -> EXCLUSIVE  未决-> 排它
 **
 ** This routine will only increase a lock.  Use the sqlite3OsUnlock()
 ** routine to lower a locking level.
@@ -1483,6 +2404,10 @@ static int unixLock(sqlite3_file *id, int eFileLock){
   unixInodeInfo *pInode;
   struct flock lock;
   int tErrno = 0;
+  sqlite3_int64 iDeadline = 0;   /* When to stop waiting on other threads */
+#ifdef SQLITE_ENABLE_LOCK_STATUS
+  sqlite3_uint64 nFcntl = pFile->lockStats.nFcntl;
+#endif
 
   assert( pFile );
   OSTRACE(("LOCK    %d %s was %s(%s,%d) pid=%d (unix)\n", pFile->h,
@@ -1523,10 +2448,23 @@ static int unixLock(sqlite3_file *id, int eFileLock){
   /* If some thread using this PID has a lock via a different unixFile*
   ** handle that precludes the requested lock, return BUSY.
   ** 如果使用此PID的线程通过一个不同的unixFile* handle，即排除请求的锁，获得了一个锁，返回BUSY。
+  **
+  ** Or, in two cases, wait for the other thread to lower its lock.  A
+  ** thread that holds no lock and wants SHARED may wait, as may a thread
+  ** that wants RESERVED while the other thread holds RESERVED.  Neither
+  ** can hold up the other thread.  Once the other thread moves on to
+  ** PENDING it must wait for all SHARED locks to be released, so from
+  ** then on threads that hold SHARED stop waiting and return BUSY.
   */
-  if( (pFile->eFileLock!=pInode->eFileLock && 
-          (pInode->eFileLock>=PENDING_LOCK || eFileLock>SHARED_LOCK))
+  while( pFile->eFileLock!=pInode->eFileLock && 
+          (pInode->eFileLock>=PENDING_LOCK || eFileLock>SHARED_LOCK)
   ){
+    if( (eFileLock==SHARED_LOCK
+         || (eFileLock==RESERVED_LOCK && pInode->eFileLock==RESERVED_LOCK))
+     && unixInodeWait(pFile, &iDeadline)==SQLITE_OK
+    ){
+      continue;
+    }
     rc = SQLITE_BUSY;
     goto end_lock;
   }
@@ -1547,6 +2485,23 @@ static int unixLock(sqlite3_file *id, int eFileLock){
     goto end_lock;
   }
 
+  /* If this process holds a lease on the SHARED lock and no writer in
+  ** another process wants it back, take the lock over from the lease.
+  ** Otherwise give the lease up and continue as normal.
+  */
+  if( eFileLock==SHARED_LOCK && pInode->bLease ){
+    assert( pInode->nShared==0 && pInode->eFileLock==NO_LOCK );
+    if( (pFile->ctrlFlags & UNIXFILE_LEASE)!=0 && !unixLeaseRevoked(pFile) ){
+      pInode->bLease = 0;
+      pFile->eFileLock = SHARED_LOCK;
+      pInode->eFileLock = SHARED_LOCK;
+      pInode->nShared = 1;
+      goto end_lock;
+    }
+    rc = unixLeaseRelease(pInode, pFile);
+    if( rc ) goto end_lock;
+  }
+
 
   /* A PENDING lock is needed before acquiring a SHARED lock and before
   ** acquiring an EXCLUSIVE lock.  For the SHARED lock, the PENDING will
@@ -1608,7 +2563,8 @@ static int unixLock(sqlite3_file *id, int eFileLock){
       pInode->nLock++;
       pInode->nShared = 1;
     }
-  }else if( eFileLock==EXCLUSIVE_LOCK && pInode->nShared>1 ){
+  }else if( eFileLock==EXCLUSIVE_LOCK && pInode->nShared>1
+         && unixLockWaitShared(pFile, &iDeadline)!=SQLITE_OK ){
     /* We are trying for an exclusive lock but another thread in this
     ** same process is still holding a shared lock. 
     ** 我们尝试获取排它锁，但是在这一过程中另一个线程一直持有共享锁
@@ -1652,6 +2608,11 @@ static int unixLock(sqlite3_file *id, int eFileLock){
 
 end_lock:
   sqlite3_mutex_leave(pInode->pLockMutex);
+#ifdef SQLITE_ENABLE_LOCK_STATUS
+  /* Every BUSY that came from fcntl() also set tErrno */
+  unixLockStatLock(pFile, eFileLock, rc, tErrno==0,
+                   nFcntl==pFile->lockStats.nFcntl);
+#endif
   OSTRACE(("LOCK    %d %s %s (unix)\n", pFile->h, azFileLock(eFileLock), 
       rc==SQLITE_OK ? "ok" : "failed"));
   return rc;
@@ -1695,6 +2656,10 @@ static int posixUnlock(sqlite3_file *id, int eFileLock, int handleNFSUnlock){
   unixInodeInfo *pInode;
   struct flock lock;
   int rc = SQLITE_OK;
+  int bSharedOnly = pFile->eFileLock==SHARED_LOCK;
+#ifdef SQLITE_ENABLE_LOCK_STATUS
+  sqlite3_uint64 nFcntl = pFile->lockStats.nFcntl;
+#endif
 
   assert( pFile );
   OSTRACE(("UNLOCK  %d %d was %d(%d,%d) pid=%d (unix)\n", pFile->h, eFileLock,
@@ -1768,7 +2733,18 @@ static int posixUnlock(sqlite3_file *id, int eFileLock, int handleNFSUnlock){
     ** 共享锁计数器进行递减。当这一进程中的所有线程释放时，释放使用OS调用的锁。
     */
     pInode->nShared--;
-    if( pInode->nShared==0 ){
+    if( pInode->nShared==0 && bSharedOnly && pInode->bProcessLock==0
+     && (pFile->ctrlFlags & UNIXFILE_LEASE)!=0
+     && unixLeaseTaken()==SQLITE_OK
+    ){
+      /* Keep the read-lock on the shared range as a lease.  The lease
+      ** holds a count of its own in nLock until it is released. */
+      pInode->eFileLock = NO_LOCK;
+      pInode->bLease = 1;
+      pInode->hLease = pFile->h;
+      pInode->iLeaseExpire = unixMonotonicMs() + SQLITE_UNIX_LEASE_MS;
+      pInode->nLock++;
+    }else if( pInode->nShared==0 ){
       lock.l_type = F_UNLCK;
       lock.l_whence = SEEK_SET;
       lock.l_start = lock.l_len = 0L;
@@ -1793,10 +2769,18 @@ static int posixUnlock(sqlite3_file *id, int eFileLock, int handleNFSUnlock){
   }
 
 end_unlock:
+  unixInodeWake(pInode);
   sqlite3_mutex_leave(pInode->pLockMutex);
   if( rc==SQLITE_OK ){
     pFile->eFileLock = eFileLock;
   }
+#ifdef SQLITE_ENABLE_LOCK_STATUS
+  pFile->lockStats.nUnlock++;
+  if( rc==SQLITE_OK && nFcntl==pFile->lockStats.nFcntl ){
+    pFile->lockStats.nInProcess++;
+  }
+  unixLockStatHeld(pFile);
+#endif
   return rc;
 }
 
@@ -1820,6 +2804,7 @@ static int unixUnlock(sqlite3_file *id, int eFileLock){
 static int unixMapfile(unixFile *pFd, i64 nByte);
 static void unixUnmapfile(unixFile *pFd);
 #endif
+static void unixAioFree(unixFile *pFile);
 
 /*
 ** This function performs the parts of the "close file" operation 
@@ -1836,6 +2821,7 @@ static void unixUnmapfile(unixFile *pFd);
 */
 static int closeUnixFile(sqlite3_file *id){
   unixFile *pFile = (unixFile*)id;
+  unixAioFree(pFile);
 #if SQLITE_MAX_MMAP_SIZE>0
   unixUnmapfile(pFile);
 #endif
@@ -1865,12 +2851,14 @@ static int unixClose(sqlite3_file *id){
   int rc = SQLITE_OK;
   unixFile *pFile = (unixFile *)id;
   unixInodeInfo *pInode = pFile->pInode;
+  sqlite3_mutex *pShardMutex;
 
   assert( pInode!=0 );
   verifyDbFile(pFile);
   unixUnlock(id, NO_LOCK);
   assert( unixFileMutexNotheld(pFile) );
-  unixEnterMutex();
+  pShardMutex = unixInodeShardOf(&pInode->fileId)->pMutex;
+  sqlite3_mutex_enter(pShardMutex);
 
   /* unixFile.pInode is always valid here. Otherwise, a different close
   ** routine (e.g. nolockClose()) would be called instead.
@@ -1892,7 +2880,7 @@ static int unixClose(sqlite3_file *id){
   releaseInodeInfo(pFile);
   assert( pFile->pShm==0 );
   rc = closeUnixFile(id);
-  unixLeaveMutex();
+  sqlite3_mutex_leave(pShardMutex);
   return rc;
 }
 
@@ -1900,347 +2888,369 @@ static int unixClose(sqlite3_file *id){
 ******************************************************************************/
 
 /******************************************************************************
-****************************** No-op Locking **********************************
-**
-** 无操作锁
-** Of the various locking implementations available, this is by far the
-** simplest:  locking is ignored.  No attempt is made to lock the database
-** file for reading or writing.
-** 相对于其他一系列锁的实现，这种无操作锁是迄今为止最简单的，它没有试图锁住数据库文件进行读或写。
-**
-** This locking mode is appropriate for use on read-only databases
-** (ex: databases that are burned into CD-ROM, for example.)  It can
-** also be used if the application employs some external mechanism to
-** prevent simultaneous access of the same database by two or more
-** database connections.  But there is a serious risk of database
-** corruption if this locking mode is used in situations where multiple
-** database connections are accessing the same database file at the same
-** time and one or more of those connections are writing.
-** 这种模式的锁适用于只读的数据库，例如刻在CD-ROM上的数据库。当一个应用程序使用外部机制去阻止两个
-** 或两个以上的数据库连接对同一个数据库同时进行访问时也可以使用它。但是，当这种锁用于大量的数据库连接
-** 同时访问一个数据库，并且这些连接当中有一个或者更多的是进行写操作的情况的时候，就会有一个严重的数据
-** 库损坏风险。
-*/
-
-static int nolockCheckReservedLock(sqlite3_file *NotUsed, int *pResOut){
-  UNUSED_PARAMETER(NotUsed);
-  *pResOut = 0;
-  return SQLITE_OK;
-}
-static int nolockLock(sqlite3_file *NotUsed, int NotUsed2){
-  UNUSED_PARAMETER2(NotUsed, NotUsed2);
-  return SQLITE_OK;
-}
-static int nolockUnlock(sqlite3_file *NotUsed, int NotUsed2){
-  UNUSED_PARAMETER2(NotUsed, NotUsed2);
-  return SQLITE_OK;
-}
-
-/*
-** Close the file.
-*/
-static int nolockClose(sqlite3_file *id) {
-  return closeUnixFile(id);
-}
-
-/******************* End of the no-op lock implementation *********************
-******************************************************************************/
-
-/******************************************************************************
-************************* Begin dot-file Locking ******************************
-** 点文件锁
-** The dotfile locking implementation uses the existence of separate lock
-** files (really a directory) to control access to the database.  This works
-** on just about every filesystem imaginable.  But there are serious downsides:
-**
-**    (1)  There is zero concurrency.  A single reader blocks all other
-**         connections from reading or writing the database.
-**
-**    (2)  An application crash or power loss can leave stale lock files
-**         sitting around that need to be cleared manually.
-**
-** Nevertheless, a dotlock is an appropriate locking mode for use if no
-** other locking strategy is available.
-** 点文件锁的实现是使用存在单独的锁文件，就是一种目录来控制对数据库的访问。这种机制用于任意一种文件
-** 系统，但是它又存在严重的缺陷：
-** （1）它没有并发性，一个读者就阻碍了其他所有要对数据库进行读写的连接；
-** （2）应用程序的崩溃或功率的损耗都会使旧的锁文件无法自动清理，而需要手动清除。
-** 不过，点文件锁是一种适用于没有其他锁策略可用的情况的锁机制。
-**
-** Dotfile locking works by creating a subdirectory in the same directory as
-** the database and with the same name but with a ".lock" extension added.
-** The existence of a lock directory implies an EXCLUSIVE lock.  All other
-** lock types (SHARED, RESERVED, PENDING) are mapped into EXCLUSIVE.
-** 点文件锁的工作原理是在同一个目录里面创建次级目录存入数据库，并且有相同的扩展名".lock"。一个锁
-** 目录的存在意味着它是排它锁。其他所有类型的锁（共享锁，保留锁，未决锁）都映射到排它锁。
-*/
+*************************** Begin OFD Locking *********************************
+**
+** Open file description (OFD) locks, available on Linux since 3.15, are
+** byte-range locks with the same ranges and conflict rules as POSIX
+** advisory locks.  The difference is that an OFD lock belongs to the open
+** file description created by open(), not to the process.  It conflicts
+** with locks held through other open() calls in the same process, and it
+** is released only when the last descriptor referring to that open file
+** description is closed, not when the process closes any descriptor on
+** the file.
+**
+** So each unixFile can own its locks outright and the "unix-ofd" VFS
+** needs none of the machinery above.  There are no unixInodeInfo lock
+** counts, no pLockMutex, and no deferred closes, and xOpen and xClose
+** do not enter the global mutex.  A unixInodeInfo is attached to the file
+** only if it is used in WAL mode, as it is the inode that links database
+** connections to their shared-memory node.
+**
+** Do not use unix-ofd and one of the POSIX locking VFSes on the same file
+** in the same process.  Closing a unix-ofd file releases any POSIX locks
+** the process holds on the file, as for any other descriptor.
+*/
+#if defined(F_OFD_SETLK) && defined(F_OFD_SETLKW) && defined(F_OFD_GETLK) \
+ && !defined(SQLITE_DISABLE_OFD_LOCKS)
+# define SQLITE_UNIX_OFD_LOCKS 1
+#endif
 
-/*
-** The file suffix added to the data base filename in order to create the
-** lock directory.
-** 文件后缀添加到数据库文件里面以创建锁目录
-*/
-#define DOTLOCK_SUFFIX ".lock"  //预定义锁文件的后缀为.lock
+#ifdef SQLITE_UNIX_OFD_LOCKS
+#ifndef SQLITE_ENABLE_SETLK_TIMEOUT
+# define osSetOfdLock(h,x,t) osFcntl(h,F_OFD_SETLK,x)
+#else
+# define osSetOfdLock(h,x,t) \
+    unixSetLockTimeout(h,F_OFD_SETLK,F_OFD_SETLKW,x,(t)->iBusyTimeout)
+#endif
 
 /*
 ** This routine checks if there is a RESERVED lock held on the specified
-** file by this or any other process. If such a lock is held, set *pResOut
+** file by this or any other connection.  If such a lock is held, set *pResOut
 ** to a non-zero value otherwise *pResOut is set to zero.  The return value
 ** is set to SQLITE_OK unless an I/O error occurs during lock checking.
-** 这个程序会检查指定文件或者是其他任何进程里面是否持有保留锁，如果持有保留锁，将指针*pResOut的值设为
-** 非零，否则设为0。返回值设定为SQLITE_OK除非在锁检查期间发生I/O错误。
-**
-** In dotfile locking, either a lock exists or it does not.  So in this
-** variation of CheckReservedLock(), *pResOut is set to true if any lock
-** is held on the file and false if the file is unlocked.
-** 在点文件锁机制中，锁要么存在要么不存在。所以函数CheckReservedLock()的变化就是如果文件被加锁，*pResOut
-** 的值设为true，文件没被加锁，则设为false。
 */
-static int dotlockCheckReservedLock(sqlite3_file *id, int *pResOut) {
+static int ofdCheckReservedLock(sqlite3_file *id, int *pResOut){
   int rc = SQLITE_OK;
   int reserved = 0;
   unixFile *pFile = (unixFile*)id;
 
   SimulateIOError( return SQLITE_IOERR_CHECKRESERVEDLOCK; );
-  
   assert( pFile );
-  reserved = osAccess((const char*)pFile->lockingContext, 0)==0;
-  OSTRACE(("TEST WR-LOCK %d %d %d (dotlock)\n", pFile->h, rc, reserved));
+
+  if( pFile->eFileLock>SHARED_LOCK ){
+    reserved = 1;
+  }else{
+    struct flock lock;
+    memset(&lock, 0, sizeof(lock));
+    lock.l_whence = SEEK_SET;
+    lock.l_start = RESERVED_BYTE;
+    lock.l_len = 1;
+    lock.l_type = F_WRLCK;
+    if( osFcntl(pFile->h, F_OFD_GETLK, &lock) ){
+      rc = SQLITE_IOERR_CHECKRESERVEDLOCK;
+      storeLastErrno(pFile, errno);
+    }else if( lock.l_type!=F_UNLCK ){
+      reserved = 1;
+    }
+  }
+  OSTRACE(("TEST WR-LOCK %d %d %d (ofd)\n", pFile->h, rc, reserved));
+
   *pResOut = reserved;
   return rc;
 }
 
 /*
-** Lock the file with the lock specified by parameter eFileLock - one
-** of the following:
-**
-** 使用参数eFileLock以下值之一指定的锁对文件加锁
-**     (1) SHARED_LOCK  //共享锁
-**     (2) RESERVED_LOCK  //保留锁
-**     (3) PENDING_LOCK  //未决锁
-**     (4) EXCLUSIVE_LOCK  //排它锁
-**
-** Sometimes when requesting one lock state, additional lock states
-** are inserted in between.  The locking might fail on one of the later
-** transitions leaving the lock state different from what it started but
-** still short of its goal.  The following chart shows the allowed
-** transitions and the inserted intermediate states:
-** 当请求一个锁状态的时候，额外的锁状态会插入其中。锁定失败后，后来的转换会使它不同于开始的时候
-** 的锁状态，但是仍能达到目标。以下的记录是允许的转换和插入的状态。
-**
-**    UNLOCKED -> SHARED  //未加锁->共享锁
-**    SHARED -> RESERVED  //共享锁->保留锁
-**    SHARED -> (PENDING) -> EXCLUSIVE  //共享锁->未决锁（插入）->排它锁
-**    RESERVED -> (PENDING) -> EXCLUSIVE  //保留锁->未决锁（插入）->排它锁
-**    PENDING -> EXCLUSIVE  //未决锁->排它锁
-**
-** This routine will only increase a lock.  Use the sqlite3OsUnlock()
-** routine to lower a locking level.
-** 这个程序只是增加一个锁。使用sqlite3的OsUnlock()程序降低锁的级别。
-**
-** With dotfile locking, we really only support state (4): EXCLUSIVE.
-** But we track the other locking levels internally.
-** 使用点文件锁，实际上只支持第四种状态：排它锁，但是可以在内部追踪其他级别的锁。
+** Lock the file with the lock specified by parameter eFileLock.  The
+** lock states, the transitions between them and the bytes locked for
+** each are the same as for unixLock().  Only the bookkeeping that
+** unixLock() does to share POSIX locks among the threads of a process
+** is left out.
 */
-static int dotlockLock(sqlite3_file *id, int eFileLock) {
-  unixFile *pFile = (unixFile*)id;
-  char *zLockFile = (char *)pFile->lockingContext;
+static int ofdLock(sqlite3_file *id, int eFileLock){
   int rc = SQLITE_OK;
+  unixFile *pFile = (unixFile*)id;
+  struct flock lock;
+  int tErrno = 0;
 
+  assert( pFile );
+  OSTRACE(("LOCK    %d %s was %s pid=%d (ofd)\n", pFile->h,
+      azFileLock(eFileLock), azFileLock(pFile->eFileLock), osGetpid(0)));
 
-  /* If we have any lock, then the lock file already exists.  All we have
-  ** to do is adjust our internal record of the lock level.
-  ** 如果有任意一种锁，那么锁文件其实已经存在了，我们要做的只是修改内部纪录的锁级别
-  */
-  if( pFile->eFileLock > NO_LOCK ){
-    pFile->eFileLock = eFileLock;
-    /* Always update the timestamp on the old file */  //更新旧文件的时间戳
-#ifdef HAVE_UTIME
-    utime(zLockFile, NULL);
-#else
-    utimes(zLockFile, NULL);
-#endif
+  if( pFile->eFileLock>=eFileLock ){
+    OSTRACE(("LOCK    %d %s ok (already held) (ofd)\n", pFile->h,
+            azFileLock(eFileLock)));
     return SQLITE_OK;
   }
-  
-  /* grab an exclusive lock */  //攫取一个排它锁
-  rc = osMkdir(zLockFile, 0777);
-  if( rc<0 ){
-    /* failed to open/create the lock directory */  //创建锁目录失败
-    int tErrno = errno;
-    if( EEXIST == tErrno ){
-      rc = SQLITE_BUSY;
-    } else {
+  assert( pFile->eFileLock!=NO_LOCK || eFileLock==SHARED_LOCK );
+  assert( eFileLock!=PENDING_LOCK );
+  assert( eFileLock!=RESERVED_LOCK || pFile->eFileLock==SHARED_LOCK );
+
+  /* The l_pid field must be zero for the F_OFD_ commands. */
+  memset(&lock, 0, sizeof(lock));
+  lock.l_whence = SEEK_SET;
+
+  /* A PENDING lock is needed before acquiring a SHARED lock and before
+  ** acquiring an EXCLUSIVE lock.  For the SHARED lock, the PENDING will
+  ** be released.
+  */
+  if( eFileLock==SHARED_LOCK 
+      || (eFileLock==EXCLUSIVE_LOCK && pFile->eFileLock<PENDING_LOCK)
+  ){
+    lock.l_type = (eFileLock==SHARED_LOCK?F_RDLCK:F_WRLCK);
+    lock.l_start = PENDING_BYTE;
+    lock.l_len = 1L;
+    if( osSetOfdLock(pFile->h, &lock, pFile) ){
+      tErrno = errno;
       rc = sqliteErrorFromPosixError(tErrno, SQLITE_IOERR_LOCK);
       if( rc!=SQLITE_BUSY ){
         storeLastErrno(pFile, tErrno);
       }
+      goto end_lock;
     }
-    return rc;
-  } 
-  
-  /* got it, set the type and return ok */  //获取成功，设置类型并返回ok
-  pFile->eFileLock = eFileLock;
+  }
+
+  if( eFileLock==SHARED_LOCK ){
+    /* Now get the read-lock, then drop the temporary PENDING lock */
+    lock.l_start = SHARED_FIRST;
+    lock.l_len = SHARED_SIZE;
+    if( osSetOfdLock(pFile->h, &lock, pFile) ){
+      tErrno = errno;
+      rc = sqliteErrorFromPosixError(tErrno, SQLITE_IOERR_LOCK);
+    }
+    lock.l_start = PENDING_BYTE;
+    lock.l_len = 1L;
+    lock.l_type = F_UNLCK;
+    if( osSetOfdLock(pFile->h, &lock, pFile) && rc==SQLITE_OK ){
+      tErrno = errno;
+      rc = SQLITE_IOERR_UNLOCK; 
+    }
+    if( rc!=SQLITE_OK && rc!=SQLITE_BUSY ){
+      storeLastErrno(pFile, tErrno);
+    }
+  }else{
+    /* The request was for a RESERVED or EXCLUSIVE lock.  A SHARED or
+    ** greater lock is already held. */
+    assert( 0!=pFile->eFileLock );
+    assert( eFileLock==RESERVED_LOCK || eFileLock==EXCLUSIVE_LOCK );
+    lock.l_type = F_WRLCK;
+    if( eFileLock==RESERVED_LOCK ){
+      lock.l_start = RESERVED_BYTE;
+      lock.l_len = 1L;
+    }else{
+      lock.l_start = SHARED_FIRST;
+      lock.l_len = SHARED_SIZE;
+    }
+    if( osSetOfdLock(pFile->h, &lock, pFile) ){
+      tErrno = errno;
+      rc = sqliteErrorFromPosixError(tErrno, SQLITE_IOERR_LOCK);
+      if( rc!=SQLITE_BUSY ){
+        storeLastErrno(pFile, tErrno);
+      }
+    }
+  }
+
+  if( rc==SQLITE_OK ){
+    pFile->eFileLock = eFileLock;
+  }else if( eFileLock==EXCLUSIVE_LOCK ){
+    pFile->eFileLock = PENDING_LOCK;
+  }
+
+end_lock:
+  OSTRACE(("LOCK    %d %s %s (ofd)\n", pFile->h, azFileLock(eFileLock), 
+      rc==SQLITE_OK ? "ok" : "failed"));
   return rc;
 }
 
 /*
 ** Lower the locking level on file descriptor pFile to eFileLock.  eFileLock
 ** must be either NO_LOCK or SHARED_LOCK.
-** 将文件描述符pFile的锁级别降低到eFileLock，eFileLock必须是NO_LOCK or SHARED_LOCK两者之一。
 **
 ** If the locking level of the file descriptor is already at or below
 ** the requested locking level, this routine is a no-op.
-** 如果文件描述符的锁定级别已经在正在请求的锁级别或以下，那么这个程序是一个空操作
-**
-** When the locking level reaches NO_LOCK, delete the lock file.
-** 当锁定级别达到了NO_LOCK时删除锁文件
 */
-static int dotlockUnlock(sqlite3_file *id, int eFileLock) {
+static int ofdUnlock(sqlite3_file *id, int eFileLock){
   unixFile *pFile = (unixFile*)id;
-  char *zLockFile = (char *)pFile->lockingContext;
-  int rc;
+  struct flock lock;
+  int rc = SQLITE_OK;
 
   assert( pFile );
-  OSTRACE(("UNLOCK  %d %d was %d pid=%d (dotlock)\n", pFile->h, eFileLock,
-           pFile->eFileLock, osGetpid(0)));
+  OSTRACE(("UNLOCK  %d %d was %d pid=%d (ofd)\n", pFile->h, eFileLock,
+      pFile->eFileLock, osGetpid(0)));
+
   assert( eFileLock<=SHARED_LOCK );
-  
-  /* no-op if possible */  //如果可能是空操作
-  if( pFile->eFileLock==eFileLock ){
+#if SQLITE_MAX_MMAP_SIZE>0
+  assert( eFileLock==SHARED_LOCK || pFile->nFetchOut==0 );
+#endif
+  if( pFile->eFileLock<=eFileLock ){
     return SQLITE_OK;
   }
-
-  /* To downgrade to shared, simply update our internal notion of the
-  ** lock state.  No need to mess with the file on disk.
-  ** 降低到共享时，只需简单地更新锁状态的内部概念，而不需要毁坏磁盘文件
-  */
-  if( eFileLock==SHARED_LOCK ){
-    pFile->eFileLock = SHARED_LOCK;
-    return SQLITE_OK;
+  memset(&lock, 0, sizeof(lock));
+  lock.l_whence = SEEK_SET;
+  if( pFile->eFileLock>SHARED_LOCK ){
+    if( eFileLock==SHARED_LOCK ){
+      /* Converting the write-lock on the shared range to a read-lock is
+      ** atomic, so there is no need for the two-step downgrade that
+      ** posixUnlock() uses on NFS. */
+      lock.l_type = F_RDLCK;
+      lock.l_start = SHARED_FIRST;
+      lock.l_len = SHARED_SIZE;
+      if( osSetOfdLock(pFile->h, &lock, pFile) ){
+        rc = SQLITE_IOERR_RDLOCK;
+        storeLastErrno(pFile, errno);
+        return rc;
+      }
+    }
+    lock.l_type = F_UNLCK;
+    lock.l_start = PENDING_BYTE;
+    lock.l_len = 2L;  assert( PENDING_BYTE+1==RESERVED_BYTE );
+    if( osSetOfdLock(pFile->h, &lock, pFile) ){
+      rc = SQLITE_IOERR_UNLOCK;
+      storeLastErrno(pFile, errno);
+      return rc;
+    }
   }
-  
-  /* To fully unlock the database, delete the lock file */  //完全打开数据库时删除锁文件
-  assert( eFileLock==NO_LOCK );
-  rc = osRmdir(zLockFile);
-  if( rc<0 ){
-    int tErrno = errno;
-    if( tErrno==ENOENT ){
-      rc = SQLITE_OK;
-    }else{
+  if( eFileLock==NO_LOCK ){
+    lock.l_type = F_UNLCK;
+    lock.l_start = lock.l_len = 0L;
+    if( osSetOfdLock(pFile->h, &lock, pFile) ){
       rc = SQLITE_IOERR_UNLOCK;
-      storeLastErrno(pFile, tErrno);
+      storeLastErrno(pFile, errno);
     }
-    return rc; 
   }
-  pFile->eFileLock = NO_LOCK;
-  return SQLITE_OK;
+  pFile->eFileLock = eFileLock;
+  return rc;
 }
 
 /*
-** Close a file.  Make sure the lock has been released before closing.
-** 关闭一个文件，确保锁在关闭之前已经被释放
+** Close a file.  The file's OFD locks are released when its descriptor
+** is closed, so the descriptor never needs to be kept open.
 */
-static int dotlockClose(sqlite3_file *id) {
+static int ofdClose(sqlite3_file *id){
   unixFile *pFile = (unixFile*)id;
-  assert( id!=0 );
-  dotlockUnlock(id, NO_LOCK);
-  sqlite3_free(pFile->lockingContext);
+  verifyDbFile(pFile);
+  ofdUnlock(id, NO_LOCK);
+  if( pFile->pInode ){
+    sqlite3_mutex *pShardMutex;
+    assert( pFile->pShm==0 );
+    pShardMutex = unixInodeShardOf(&pFile->pInode->fileId)->pMutex;
+    sqlite3_mutex_enter(pShardMutex);
+    releaseInodeInfo(pFile);
+    sqlite3_mutex_leave(pShardMutex);
+  }
   return closeUnixFile(id);
 }
-/****************** End of the dot-file lock implementation *******************
+#endif /* SQLITE_UNIX_OFD_LOCKS */
+
+/********************** End of the OFD lock implementation ********************
 ******************************************************************************/
 
 /******************************************************************************
-************************** Begin flock Locking ********************************
-**
-** 聚集锁
-** Use the flock() system call to do file locking.  使用系统调用函数flock()执行文件锁定
+****************************** No-op Locking **********************************
 **
-** flock() locking is like dot-file locking in that the various
-** fine-grain locking levels supported by SQLite are collapsed into
-** a single exclusive lock.  In other words, SHARED, RESERVED, and
-** PENDING locks are the same thing as an EXCLUSIVE lock.  SQLite
-** still works when you do this, but concurrency is reduced since
-** only a single process can be reading the database at a time.
-** 聚集锁在sqlite支持各种细粒锁级别紧缩成一个单独的排它锁这一点上和点锁文件是一样的。换句话说，
-** 共享锁，保留锁和未决锁对于排它锁来说是一样的。当你这样做时，sqlite仍然工作，但并发性降低，因为
-** 同一时间只有一个进程可以读取数据库。
+** 无操作锁
+** Of the various locking implementations available, this is by far the
+** simplest:  locking is ignored.  No attempt is made to lock the database
+** file for reading or writing.
+** 相对于其他一系列锁的实现，这种无操作锁是迄今为止最简单的，它没有试图锁住数据库文件进行读或写。
 **
-** Omit this section if SQLITE_ENABLE_LOCKING_STYLE is turned off
-** 如果SQLITE_ENABLE_LOCKING_STYLE被关闭或者VXWORKS被编译，则忽略这部分。
+** This locking mode is appropriate for use on read-only databases
+** (ex: databases that are burned into CD-ROM, for example.)  It can
+** also be used if the application employs some external mechanism to
+** prevent simultaneous access of the same database by two or more
+** database connections.  But there is a serious risk of database
+** corruption if this locking mode is used in situations where multiple
+** database connections are accessing the same database file at the same
+** time and one or more of those connections are writing.
+** 这种模式的锁适用于只读的数据库，例如刻在CD-ROM上的数据库。当一个应用程序使用外部机制去阻止两个
+** 或两个以上的数据库连接对同一个数据库同时进行访问时也可以使用它。但是，当这种锁用于大量的数据库连接
+** 同时访问一个数据库，并且这些连接当中有一个或者更多的是进行写操作的情况的时候，就会有一个严重的数据
+** 库损坏风险。
 */
-#if SQLITE_ENABLE_LOCKING_STYLE
 
-/*
-** Retry flock() calls that fail with EINTR  系统调用中断则重试flock()函数调用
-*/
-#ifdef EINTR
-static int robust_flock(int fd, int op){
-  int rc;
-  do{ rc = flock(fd,op); }while( rc<0 && errno==EINTR );
-  return rc;
+static int nolockCheckReservedLock(sqlite3_file *NotUsed, int *pResOut){
+  UNUSED_PARAMETER(NotUsed);
+  *pResOut = 0;
+  return SQLITE_OK;
+}
+static int nolockLock(sqlite3_file *NotUsed, int NotUsed2){
+  UNUSED_PARAMETER2(NotUsed, NotUsed2);
+  return SQLITE_OK;
+}
+static int nolockUnlock(sqlite3_file *NotUsed, int NotUsed2){
+  UNUSED_PARAMETER2(NotUsed, NotUsed2);
+  return SQLITE_OK;
 }
-#else
-# define robust_flock(a,b) flock(a,b)
-#endif
-     
 
 /*
-** This routine checks if there is a RESERVED lock held on the specified
-** file by this or any other process. If such a lock is held, set *pResOut
-** to a non-zero value otherwise *pResOut is set to zero.  The return value
-** is set to SQLITE_OK unless an I/O error occurs during lock checking.
-** 这个程序会检查指定文件或者是其他任何进程里是否持有保留锁，如果持有保留锁，将指针*pResOut
-** 的值设为非零，否则设为0。返回值设为SQLITE_OK除非在锁检查期间发生I/O错误。
+** Close the file.
 */
-static int flockCheckReservedLock(sqlite3_file *id, int *pResOut){
-  int rc = SQLITE_OK;
-  int reserved = 0;
-  unixFile *pFile = (unixFile*)id;
-  
-  SimulateIOError( return SQLITE_IOERR_CHECKRESERVEDLOCK; );
-  
-  assert( pFile );
-  
-  /* Check if a thread in this process holds such a lock */  //检查进程中是否有线程持有保留锁
-  if( pFile->eFileLock>SHARED_LOCK ){
-    reserved = 1;
-  }
-  
-  /* Otherwise see if some other process holds it. */  //如果没有则查看其他进程
-  if( !reserved ){
-    /* attempt to get the lock */  //获取锁
-    int lrc = robust_flock(pFile->h, LOCK_EX | LOCK_NB);
-    if( !lrc ){
-      /* got the lock, unlock it */  //获取锁，并解锁
-      lrc = robust_flock(pFile->h, LOCK_UN);
-      if ( lrc ) {
-        int tErrno = errno;
-        /* unlock failed with an error */  //解锁发生错误并且失败
-        lrc = SQLITE_IOERR_UNLOCK; 
-        storeLastErrno(pFile, tErrno);
-        rc = lrc;
-      }
-    } else {
-      int tErrno = errno;
-      reserved = 1;
-      /* someone else might have it reserved */  //其他进程可能保留了锁
-      lrc = sqliteErrorFromPosixError(tErrno, SQLITE_IOERR_LOCK); 
-      if( IS_LOCK_ERROR(lrc) ){
-        storeLastErrno(pFile, tErrno);
-        rc = lrc;
-      }
-    }
-  }
-  OSTRACE(("TEST WR-LOCK %d %d %d (flock)\n", pFile->h, rc, reserved));
+static int nolockClose(sqlite3_file *id) {
+  return closeUnixFile(id);
+}
 
-#ifdef SQLITE_IGNORE_FLOCK_LOCK_ERRORS
-  if( (rc & 0xff) == SQLITE_IOERR ){
-    rc = SQLITE_OK;
-    reserved=1;
-  }
-#endif /* SQLITE_IGNORE_FLOCK_LOCK_ERRORS */
+/******************* End of the no-op lock implementation *********************
+******************************************************************************/
+
+/******************************************************************************
+************************* Begin dot-file Locking ******************************
+** 点文件锁
+** The dotfile locking implementation uses the existence of separate lock
+** files (really a directory) to control access to the database.  This works
+** on just about every filesystem imaginable.  But there are serious downsides:
+**
+**    (1)  There is zero concurrency.  A single reader blocks all other
+**         connections from reading or writing the database.
+**
+**    (2)  An application crash or power loss can leave stale lock files
+**         sitting around that need to be cleared manually.
+**
+** Nevertheless, a dotlock is an appropriate locking mode for use if no
+** other locking strategy is available.
+** 点文件锁的实现是使用存在单独的锁文件，就是一种目录来控制对数据库的访问。这种机制用于任意一种文件
+** 系统，但是它又存在严重的缺陷：
+** （1）它没有并发性，一个读者就阻碍了其他所有要对数据库进行读写的连接；
+** （2）应用程序的崩溃或功率的损耗都会使旧的锁文件无法自动清理，而需要手动清除。
+** 不过，点文件锁是一种适用于没有其他锁策略可用的情况的锁机制。
+**
+** Dotfile locking works by creating a subdirectory in the same directory as
+** the database and with the same name but with a ".lock" extension added.
+** The existence of a lock directory implies an EXCLUSIVE lock.  All other
+** lock types (SHARED, RESERVED, PENDING) are mapped into EXCLUSIVE.
+** 点文件锁的工作原理是在同一个目录里面创建次级目录存入数据库，并且有相同的扩展名".lock"。一个锁
+** 目录的存在意味着它是排它锁。其他所有类型的锁（共享锁，保留锁，未决锁）都映射到排它锁。
+*/
+
+/*
+** The file suffix added to the data base filename in order to create the
+** lock directory.
+** 文件后缀添加到数据库文件里面以创建锁目录
+*/
+#define DOTLOCK_SUFFIX ".lock"  //预定义锁文件的后缀为.lock
+
+/*
+** This routine checks if there is a RESERVED lock held on the specified
+** file by this or any other process. If such a lock is held, set *pResOut
+** to a non-zero value otherwise *pResOut is set to zero.  The return value
+** is set to SQLITE_OK unless an I/O error occurs during lock checking.
+** 这个程序会检查指定文件或者是其他任何进程里面是否持有保留锁，如果持有保留锁，将指针*pResOut的值设为
+** 非零，否则设为0。返回值设定为SQLITE_OK除非在锁检查期间发生I/O错误。
+**
+** In dotfile locking, either a lock exists or it does not.  So in this
+** variation of CheckReservedLock(), *pResOut is set to true if any lock
+** is held on the file and false if the file is unlocked.
+** 在点文件锁机制中，锁要么存在要么不存在。所以函数CheckReservedLock()的变化就是如果文件被加锁，*pResOut
+** 的值设为true，文件没被加锁，则设为false。
+*/
+static int dotlockCheckReservedLock(sqlite3_file *id, int *pResOut) {
+  int rc = SQLITE_OK;
+  int reserved = 0;
+  unixFile *pFile = (unixFile*)id;
+
+  SimulateIOError( return SQLITE_IOERR_CHECKRESERVEDLOCK; );
+  
+  assert( pFile );
+  reserved = osAccess((const char*)pFile->lockingContext, 0)==0;
+  OSTRACE(("TEST WR-LOCK %d %d %d (dotlock)\n", pFile->h, rc, reserved));
   *pResOut = reserved;
   return rc;
 }
@@ -2249,1496 +3259,3013 @@ static int flockCheckReservedLock(sqlite3_file *id, int *pResOut){
 ** Lock the file with the lock specified by parameter eFileLock - one
 ** of the following:
 **
-**     (1) SHARED_LOCK
-**     (2) RESERVED_LOCK
-**     (3) PENDING_LOCK
-**     (4) EXCLUSIVE_LOCK
+** 使用参数eFileLock以下值之一指定的锁对文件加锁
+**     (1) SHARED_LOCK  //共享锁
+**     (2) RESERVED_LOCK  //保留锁
+**     (3) PENDING_LOCK  //未决锁
+**     (4) EXCLUSIVE_LOCK  //排它锁
 **
 ** Sometimes when requesting one lock state, additional lock states
 ** are inserted in between.  The locking might fail on one of the later
 ** transitions leaving the lock state different from what it started but
 ** still short of its goal.  The following chart shows the allowed
 ** transitions and the inserted intermediate states:
+** 当请求一个锁状态的时候，额外的锁状态会插入其中。锁定失败后，后来的转换会使它不同于开始的时候
+** 的锁状态，但是仍能达到目标。以下的记录是允许的转换和插入的状态。
 **
-**    UNLOCKED -> SHARED
-**    SHARED -> RESERVED
-**    SHARED -> (PENDING) -> EXCLUSIVE
-**    RESERVED -> (PENDING) -> EXCLUSIVE
-**    PENDING -> EXCLUSIVE
-**
-** flock() only really support EXCLUSIVE locks.  We track intermediate
-** lock states in the sqlite3_file structure, but all locks SHARED or
-** above are really EXCLUSIVE locks and exclude all other processes from
-** access the file.
+**    UNLOCKED -> SHARED  //未加锁->共享锁
+**    SHARED -> RESERVED  //共享锁->保留锁
+**    SHARED -> (PENDING) -> EXCLUSIVE  //共享锁->未决锁（插入）->排它锁
+**    RESERVED -> (PENDING) -> EXCLUSIVE  //保留锁->未决锁（插入）->排它锁
+**    PENDING -> EXCLUSIVE  //未决锁->排它锁
 **
 ** This routine will only increase a lock.  Use the sqlite3OsUnlock()
 ** routine to lower a locking level.
+** 这个程序只是增加一个锁。使用sqlite3的OsUnlock()程序降低锁的级别。
+**
+** With dotfile locking, we really only support state (4): EXCLUSIVE.
+** But we track the other locking levels internally.
+** 使用点文件锁，实际上只支持第四种状态：排它锁，但是可以在内部追踪其他级别的锁。
 */
-static int flockLock(sqlite3_file *id, int eFileLock) {
-  int rc = SQLITE_OK;
+static int dotlockLock(sqlite3_file *id, int eFileLock) {
   unixFile *pFile = (unixFile*)id;
+  char *zLockFile = (char *)pFile->lockingContext;
+  int rc = SQLITE_OK;
 
-  assert( pFile );
 
-  /* if we already have a lock, it is exclusive.  
-  ** Just adjust level and punt on outta here. */
-  if (pFile->eFileLock > NO_LOCK) {
+  /* If we have any lock, then the lock file already exists.  All we have
+  ** to do is adjust our internal record of the lock level.
+  ** 如果有任意一种锁，那么锁文件其实已经存在了，我们要做的只是修改内部纪录的锁级别
+  */
+  if( pFile->eFileLock > NO_LOCK ){
     pFile->eFileLock = eFileLock;
+    /* Always update the timestamp on the old file */  //更新旧文件的时间戳
+#ifdef HAVE_UTIME
+    utime(zLockFile, NULL);
+#else
+    utimes(zLockFile, NULL);
+#endif
     return SQLITE_OK;
   }
   
-  /* grab an exclusive lock */
-  
-  if (robust_flock(pFile->h, LOCK_EX | LOCK_NB)) {
+  /* grab an exclusive lock */  //攫取一个排它锁
+  rc = osMkdir(zLockFile, 0777);
+  if( rc<0 ){
+    /* failed to open/create the lock directory */  //创建锁目录失败
     int tErrno = errno;
-    /* didn't get, must be busy */
-    rc = sqliteErrorFromPosixError(tErrno, SQLITE_IOERR_LOCK);
-    if( IS_LOCK_ERROR(rc) ){
-      storeLastErrno(pFile, tErrno);
+    if( EEXIST == tErrno ){
+      rc = SQLITE_BUSY;
+    } else {
+      rc = sqliteErrorFromPosixError(tErrno, SQLITE_IOERR_LOCK);
+      if( rc!=SQLITE_BUSY ){
+        storeLastErrno(pFile, tErrno);
+      }
     }
-  } else {
-    /* got it, set the type and return ok */
-    pFile->eFileLock = eFileLock;
-  }
-  OSTRACE(("LOCK    %d %s %s (flock)\n", pFile->h, azFileLock(eFileLock), 
-           rc==SQLITE_OK ? "ok" : "failed"));
-#ifdef SQLITE_IGNORE_FLOCK_LOCK_ERRORS
-  if( (rc & 0xff) == SQLITE_IOERR ){
-    rc = SQLITE_BUSY;
-  }
-#endif /* SQLITE_IGNORE_FLOCK_LOCK_ERRORS */
+    return rc;
+  } 
+  
+  /* got it, set the type and return ok */  //获取成功，设置类型并返回ok
+  pFile->eFileLock = eFileLock;
   return rc;
 }
 
-
 /*
 ** Lower the locking level on file descriptor pFile to eFileLock.  eFileLock
 ** must be either NO_LOCK or SHARED_LOCK.
+** 将文件描述符pFile的锁级别降低到eFileLock，eFileLock必须是NO_LOCK or SHARED_LOCK两者之一。
 **
 ** If the locking level of the file descriptor is already at or below
 ** the requested locking level, this routine is a no-op.
+** 如果文件描述符的锁定级别已经在正在请求的锁级别或以下，那么这个程序是一个空操作
+**
+** When the locking level reaches NO_LOCK, delete the lock file.
+** 当锁定级别达到了NO_LOCK时删除锁文件
 */
-static int flockUnlock(sqlite3_file *id, int eFileLock) {
+static int dotlockUnlock(sqlite3_file *id, int eFileLock) {
   unixFile *pFile = (unixFile*)id;
-  
+  char *zLockFile = (char *)pFile->lockingContext;
+  int rc;
+
   assert( pFile );
-  OSTRACE(("UNLOCK  %d %d was %d pid=%d (flock)\n", pFile->h, eFileLock,
+  OSTRACE(("UNLOCK  %d %d was %d pid=%d (dotlock)\n", pFile->h, eFileLock,
            pFile->eFileLock, osGetpid(0)));
   assert( eFileLock<=SHARED_LOCK );
   
-  /* no-op if possible */
+  /* no-op if possible */  //如果可能是空操作
   if( pFile->eFileLock==eFileLock ){
     return SQLITE_OK;
   }
-  
-  /* shared can just be set because we always have an exclusive */
-  if (eFileLock==SHARED_LOCK) {
-    pFile->eFileLock = eFileLock;
+
+  /* To downgrade to shared, simply update our internal notion of the
+  ** lock state.  No need to mess with the file on disk.
+  ** 降低到共享时，只需简单地更新锁状态的内部概念，而不需要毁坏磁盘文件
+  */
+  if( eFileLock==SHARED_LOCK ){
+    pFile->eFileLock = SHARED_LOCK;
     return SQLITE_OK;
   }
   
-  /* no, really, unlock. */
-  if( robust_flock(pFile->h, LOCK_UN) ){
-#ifdef SQLITE_IGNORE_FLOCK_LOCK_ERRORS
-    return SQLITE_OK;
-#endif /* SQLITE_IGNORE_FLOCK_LOCK_ERRORS */
-    return SQLITE_IOERR_UNLOCK;
-  }else{
-    pFile->eFileLock = NO_LOCK;
-    return SQLITE_OK;
+  /* To fully unlock the database, delete the lock file */  //完全打开数据库时删除锁文件
+  assert( eFileLock==NO_LOCK );
+  rc = osRmdir(zLockFile);
+  if( rc<0 ){
+    int tErrno = errno;
+    if( tErrno==ENOENT ){
+      rc = SQLITE_OK;
+    }else{
+      rc = SQLITE_IOERR_UNLOCK;
+      storeLastErrno(pFile, tErrno);
+    }
+    return rc; 
   }
+  pFile->eFileLock = NO_LOCK;
+  return SQLITE_OK;
 }
 
 /*
-** Close a file.
+** Close a file.  Make sure the lock has been released before closing.
+** 关闭一个文件，确保锁在关闭之前已经被释放
 */
-static int flockClose(sqlite3_file *id) {
+static int dotlockClose(sqlite3_file *id) {
+  unixFile *pFile = (unixFile*)id;
   assert( id!=0 );
-  flockUnlock(id, NO_LOCK);
+  dotlockUnlock(id, NO_LOCK);
+  sqlite3_free(pFile->lockingContext);
   return closeUnixFile(id);
 }
-
-#endif /* SQLITE_ENABLE_LOCKING_STYLE && !OS_VXWORK */
-
-/******************* End of the flock lock implementation *********************
+/****************** End of the dot-file lock implementation *******************
 ******************************************************************************/
 
 /******************************************************************************
-**************** Non-locking sqlite3_file methods *****************************
+************************** Begin flock Locking ********************************
 **
-** The next division contains implementations for all methods of the 
-** sqlite3_file object other than the locking methods.  The locking
-** methods were defined in divisions above (one locking method per
-** division).  Those methods that are common to all locking modes
-** are gather together into this division.
-** 下一个部分包含除锁定方法外所有sqlite3文件对象方法的实现。锁定方法已在以上部分中定义
-** （一个部分定义一个锁定方法）。那些对所有锁定模式共同的方法在这个部分聚集在一起
+** 聚集锁
+** Use the flock() system call to do file locking.  使用系统调用函数flock()执行文件锁定
+**
+** flock() locking is like dot-file locking in that the various
+** fine-grain locking levels supported by SQLite are collapsed into
+** a single exclusive lock.  In other words, SHARED, RESERVED, and
+** PENDING locks are the same thing as an EXCLUSIVE lock.  SQLite
+** still works when you do this, but concurrency is reduced since
+** only a single process can be reading the database at a time.
+** 聚集锁在sqlite支持各种细粒锁级别紧缩成一个单独的排它锁这一点上和点锁文件是一样的。换句话说，
+** 共享锁，保留锁和未决锁对于排它锁来说是一样的。当你这样做时，sqlite仍然工作，但并发性降低，因为
+** 同一时间只有一个进程可以读取数据库。
+**
+** Omit this section if SQLITE_ENABLE_LOCKING_STYLE is turned off
+** 如果SQLITE_ENABLE_LOCKING_STYLE被关闭或者VXWORKS被编译，则忽略这部分。
 */
+#if SQLITE_ENABLE_LOCKING_STYLE
 
 /*
-** Seek to the offset passed as the second argument, then read cnt 
-** bytes into pBuf. Return the number of bytes actually read.
-** 寻求偏移量作为第二个参数传递，然后读取cnt字节到pBuf中。返回实际读取的字节数。
-**
-** NB:  If you define USE_PREAD or USE_PREAD64, then it might also
-** be necessary to define _XOPEN_SOURCE to be 500.  This varies from
-** one system to another.  Since SQLite does not define USE_PREAD
-** in any form by default, we will not attempt to define _XOPEN_SOURCE.
-** See tickets #2741 and #2681.
-** 注：如果你定义USE_PREAD或者USE_PREAD64，那么它可能也有必要定义_XOPEN_SOURCE为500。
-** 从一个系统到另一个系统这个不同。因为SQLITE在默认情况下不定义USE_PREAD任何形式，我们
-** 不会试图定义_XOPEN_SOURCE。看标签#2741到#2681
-**
-** To avoid stomping the errno value on a failed read the lastErrno value
-** is set before returning.
-** 为了避免errno值的读取失败，lastErrno值在返回前被设定。
+** Retry flock() calls that fail with EINTR  系统调用中断则重试flock()函数调用
 */
-static int seekAndRead(unixFile *id, sqlite3_int64 offset, void *pBuf, int cnt){
-  int got;
-  int prior = 0;
-#if (!defined(USE_PREAD) && !defined(USE_PREAD64))
-  i64 newOffset;
-#endif
-  TIMER_START;
-  assert( cnt==(cnt&0x1ffff) );
-  assert( id->h>2 );
-  do{
-#if defined(USE_PREAD)
-    got = osPread(id->h, pBuf, cnt, offset);
-    SimulateIOError( got = -1 );
-#elif defined(USE_PREAD64)
-    got = osPread64(id->h, pBuf, cnt, offset);
-    SimulateIOError( got = -1 );
+#ifdef EINTR
+static int robust_flock(int fd, int op){
+  int rc;
+  do{ rc = flock(fd,op); }while( rc<0 && errno==EINTR );
+  return rc;
+}
 #else
-    newOffset = lseek(id->h, offset, SEEK_SET);
-    SimulateIOError( newOffset = -1 );
-    if( newOffset<0 ){
-      storeLastErrno((unixFile*)id, errno);
-      return -1;
-    }
-    got = osRead(id->h, pBuf, cnt);
+# define robust_flock(a,b) flock(a,b)
 #endif
-    if( got==cnt ) break;
-    if( got<0 ){
-      if( errno==EINTR ){ got = 1; continue; }
-      prior = 0;
-      storeLastErrno((unixFile*)id,  errno);
-      break;
-    }else if( got>0 ){
-      cnt -= got;
-      offset += got;
-      prior += got;
-      pBuf = (void*)(got + (char*)pBuf);
-    }
-  }while( got>0 );
-  TIMER_END;
-  OSTRACE(("READ    %-3d %5d %7lld %llu\n",
-            id->h, got+prior, offset-prior, TIMER_ELAPSED));
-  return got+prior;
-}
+     
 
 /*
-** Read data from a file into a buffer.  Return SQLITE_OK if all
-** bytes were read successfully and SQLITE_IOERR if anything goes
-** wrong.
-** 从文件中读取数据到缓冲区。如果所有字节读取成功返回SQLITE_OK,如果出错返回SQLITE_IOERR。
+** This routine checks if there is a RESERVED lock held on the specified
+** file by this or any other process. If such a lock is held, set *pResOut
+** to a non-zero value otherwise *pResOut is set to zero.  The return value
+** is set to SQLITE_OK unless an I/O error occurs during lock checking.
+** 这个程序会检查指定文件或者是其他任何进程里是否持有保留锁，如果持有保留锁，将指针*pResOut
+** 的值设为非零，否则设为0。返回值设为SQLITE_OK除非在锁检查期间发生I/O错误。
 */
-static int unixRead(
-  sqlite3_file *id, 
-  void *pBuf, 
-  int amt,
-  sqlite3_int64 offset
-){
-  unixFile *pFile = (unixFile *)id;
-  int got;
-  assert( id );
-  assert( offset>=0 );
-  assert( amt>0 );
-
-  /* If this is a database file (not a journal, super-journal or temp
-  ** file), the bytes in the locking range should never be read or written. 
-  ** 如果这是一个数据库文件（不是一个日志，主日志或者临时文件），锁定范围的字节不能读或写。
-  */
-#if 0
-  assert( pFile->pPreallocatedUnused==0
-       || offset>=PENDING_BYTE+512
-       || offset+amt<=PENDING_BYTE 
-  );
-#endif
-
-#if SQLITE_MAX_MMAP_SIZE>0
-  /* Deal with as much of this read request as possible by transfering
-  ** data from the memory mapping using memcpy().  */
-  if( offset<pFile->mmapSize ){
-    if( offset+amt <= pFile->mmapSize ){
-      memcpy(pBuf, &((u8 *)(pFile->pMapRegion))[offset], amt);
-      return SQLITE_OK;
-    }else{
-      int nCopy = pFile->mmapSize - offset;
-      memcpy(pBuf, &((u8 *)(pFile->pMapRegion))[offset], nCopy);
-      pBuf = &((u8 *)pBuf)[nCopy];
-      amt -= nCopy;
-      offset += nCopy;
+static int flockCheckReservedLock(sqlite3_file *id, int *pResOut){
+  int rc = SQLITE_OK;
+  int reserved = 0;
+  unixFile *pFile = (unixFile*)id;
+  
+  SimulateIOError( return SQLITE_IOERR_CHECKRESERVEDLOCK; );
+  
+  assert( pFile );
+  
+  /* Check if a thread in this process holds such a lock */  //检查进程中是否有线程持有保留锁
+  if( pFile->eFileLock>SHARED_LOCK ){
+    reserved = 1;
+  }
+  
+  /* Otherwise see if some other process holds it. */  //如果没有则查看其他进程
+  if( !reserved ){
+    /* attempt to get the lock */  //获取锁
+    int lrc = robust_flock(pFile->h, LOCK_EX | LOCK_NB);
+    if( !lrc ){
+      /* got the lock, unlock it */  //获取锁，并解锁
+      lrc = robust_flock(pFile->h, LOCK_UN);
+      if ( lrc ) {
+        int tErrno = errno;
+        /* unlock failed with an error */  //解锁发生错误并且失败
+        lrc = SQLITE_IOERR_UNLOCK; 
+        storeLastErrno(pFile, tErrno);
+        rc = lrc;
+      }
+    } else {
+      int tErrno = errno;
+      reserved = 1;
+      /* someone else might have it reserved */  //其他进程可能保留了锁
+      lrc = sqliteErrorFromPosixError(tErrno, SQLITE_IOERR_LOCK); 
+      if( IS_LOCK_ERROR(lrc) ){
+        storeLastErrno(pFile, tErrno);
+        rc = lrc;
+      }
     }
   }
-#endif
+  OSTRACE(("TEST WR-LOCK %d %d %d (flock)\n", pFile->h, rc, reserved));
 
-  got = seekAndRead(pFile, offset, pBuf, amt);
-  if( got==amt ){
-    return SQLITE_OK;
-  }else if( got<0 ){
-    /* pFile->lastErrno has been set by seekAndRead().
-    ** Usually we return SQLITE_IOERR_READ here, though for some
-    ** kinds of errors we return SQLITE_IOERR_CORRUPTFS.  The
-    ** SQLITE_IOERR_CORRUPTFS will be converted into SQLITE_CORRUPT
-    ** prior to returning to the application by the sqlite3ApiExit()
-    ** routine.
-    */
-    switch( pFile->lastErrno ){
-      case ERANGE:
-      case EIO:
-#ifdef ENXIO
-      case ENXIO:
-#endif
-#ifdef EDEVERR
-      case EDEVERR:
-#endif
-        return SQLITE_IOERR_CORRUPTFS;
-    }
-    return SQLITE_IOERR_READ;
-  }else{
-    storeLastErrno(pFile, 0);   /* not a system error */
-    /* Unread parts of the buffer must be zero-filled */
-    memset(&((char*)pBuf)[got], 0, amt-got);
-    return SQLITE_IOERR_SHORT_READ;
+#ifdef SQLITE_IGNORE_FLOCK_LOCK_ERRORS
+  if( (rc & 0xff) == SQLITE_IOERR ){
+    rc = SQLITE_OK;
+    reserved=1;
   }
+#endif /* SQLITE_IGNORE_FLOCK_LOCK_ERRORS */
+  *pResOut = reserved;
+  return rc;
 }
 
 /*
-** Attempt to seek the file-descriptor passed as the first argument to
-** absolute offset iOff, then attempt to write nBuf bytes of data from
-** pBuf to it. If an error occurs, return -1 and set *piErrno. Otherwise, 
-** return the actual number of bytes written (which may be less than
-** nBuf).
+** Lock the file with the lock specified by parameter eFileLock - one
+** of the following:
+**
+**     (1) SHARED_LOCK
+**     (2) RESERVED_LOCK
+**     (3) PENDING_LOCK
+**     (4) EXCLUSIVE_LOCK
+**
+** Sometimes when requesting one lock state, additional lock states
+** are inserted in between.  The locking might fail on one of the later
+** transitions leaving the lock state different from what it started but
+** still short of its goal.  The following chart shows the allowed
+** transitions and the inserted intermediate states:
+**
+**    UNLOCKED -> SHARED
+**    SHARED -> RESERVED
+**    SHARED -> (PENDING) -> EXCLUSIVE
+**    RESERVED -> (PENDING) -> EXCLUSIVE
+**    PENDING -> EXCLUSIVE
+**
+** flock() only really support EXCLUSIVE locks.  We track intermediate
+** lock states in the sqlite3_file structure, but all locks SHARED or
+** above are really EXCLUSIVE locks and exclude all other processes from
+** access the file.
+**
+** This routine will only increase a lock.  Use the sqlite3OsUnlock()
+** routine to lower a locking level.
 */
-static int seekAndWriteFd(
-  int fd,                         /* File descriptor to write to */
-  i64 iOff,                       /* File offset to begin writing at */
-  const void *pBuf,               /* Copy data from this buffer to the file */
-  int nBuf,                       /* Size of buffer pBuf in bytes */
-  int *piErrno                    /* OUT: Error number if error occurs */
-){
-  int rc = 0;                     /* Value returned by system call */
-
-  assert( nBuf==(nBuf&0x1ffff) );
-  assert( fd>2 );
-  assert( piErrno!=0 );
-  nBuf &= 0x1ffff;
-  TIMER_START;
+static int flockLock(sqlite3_file *id, int eFileLock) {
+  int rc = SQLITE_OK;
+  unixFile *pFile = (unixFile*)id;
 
-#if defined(USE_PREAD)
-  do{ rc = (int)osPwrite(fd, pBuf, nBuf, iOff); }while( rc<0 && errno==EINTR );
-#elif defined(USE_PREAD64)
-  do{ rc = (int)osPwrite64(fd, pBuf, nBuf, iOff);}while( rc<0 && errno==EINTR);
-#else
-  do{
-    i64 iSeek = lseek(fd, iOff, SEEK_SET);
-    SimulateIOError( iSeek = -1 );
-    if( iSeek<0 ){
-      rc = -1;
-      break;
-    }
-    rc = osWrite(fd, pBuf, nBuf);
-  }while( rc<0 && errno==EINTR );
-#endif
+  assert( pFile );
 
-  TIMER_END;
-  OSTRACE(("WRITE   %-3d %5d %7lld %llu\n", fd, rc, iOff, TIMER_ELAPSED));
-
-  if( rc<0 ) *piErrno = errno;
+  /* if we already have a lock, it is exclusive.  
+  ** Just adjust level and punt on outta here. */
+  if (pFile->eFileLock > NO_LOCK) {
+    pFile->eFileLock = eFileLock;
+    return SQLITE_OK;
+  }
+  
+  /* grab an exclusive lock */
+  
+  if (robust_flock(pFile->h, LOCK_EX | LOCK_NB)) {
+    int tErrno = errno;
+    /* didn't get, must be busy */
+    rc = sqliteErrorFromPosixError(tErrno, SQLITE_IOERR_LOCK);
+    if( IS_LOCK_ERROR(rc) ){
+      storeLastErrno(pFile, tErrno);
+    }
+  } else {
+    /* got it, set the type and return ok */
+    pFile->eFileLock = eFileLock;
+  }
+  OSTRACE(("LOCK    %d %s %s (flock)\n", pFile->h, azFileLock(eFileLock), 
+           rc==SQLITE_OK ? "ok" : "failed"));
+#ifdef SQLITE_IGNORE_FLOCK_LOCK_ERRORS
+  if( (rc & 0xff) == SQLITE_IOERR ){
+    rc = SQLITE_BUSY;
+  }
+#endif /* SQLITE_IGNORE_FLOCK_LOCK_ERRORS */
   return rc;
 }
 
 
 /*
-** Seek to the offset in id->offset then read cnt bytes into pBuf.
-** Return the number of bytes actually read.  Update the offset.
+** Lower the locking level on file descriptor pFile to eFileLock.  eFileLock
+** must be either NO_LOCK or SHARED_LOCK.
 **
-** 用id->offset寻找偏移，然后读取cnt字节到pBuf中。返回实际读取的字节数，更新偏移。
-** To avoid stomping the errno value on a failed write the lastErrno value
-** is set before returning.
-** 为了避免errno的值写入失败，lastErrno的值在返回前被设定。
+** If the locking level of the file descriptor is already at or below
+** the requested locking level, this routine is a no-op.
 */
-static int seekAndWrite(unixFile *id, i64 offset, const void *pBuf, int cnt){
-  return seekAndWriteFd(id->h, offset, pBuf, cnt, &id->lastErrno);
+static int flockUnlock(sqlite3_file *id, int eFileLock) {
+  unixFile *pFile = (unixFile*)id;
+  
+  assert( pFile );
+  OSTRACE(("UNLOCK  %d %d was %d pid=%d (flock)\n", pFile->h, eFileLock,
+           pFile->eFileLock, osGetpid(0)));
+  assert( eFileLock<=SHARED_LOCK );
+  
+  /* no-op if possible */
+  if( pFile->eFileLock==eFileLock ){
+    return SQLITE_OK;
+  }
+  
+  /* shared can just be set because we always have an exclusive */
+  if (eFileLock==SHARED_LOCK) {
+    pFile->eFileLock = eFileLock;
+    return SQLITE_OK;
+  }
+  
+  /* no, really, unlock. */
+  if( robust_flock(pFile->h, LOCK_UN) ){
+#ifdef SQLITE_IGNORE_FLOCK_LOCK_ERRORS
+    return SQLITE_OK;
+#endif /* SQLITE_IGNORE_FLOCK_LOCK_ERRORS */
+    return SQLITE_IOERR_UNLOCK;
+  }else{
+    pFile->eFileLock = NO_LOCK;
+    return SQLITE_OK;
+  }
+}
+
+/*
+** Close a file.
+*/
+static int flockClose(sqlite3_file *id) {
+  assert( id!=0 );
+  flockUnlock(id, NO_LOCK);
+  return closeUnixFile(id);
 }
 
+#endif /* SQLITE_ENABLE_LOCKING_STYLE && !OS_VXWORK */
+
+/******************* End of the flock lock implementation *********************
+******************************************************************************/
+
+/******************************************************************************
+**************** Non-locking sqlite3_file methods *****************************
+**
+** The next division contains implementations for all methods of the 
+** sqlite3_file object other than the locking methods.  The locking
+** methods were defined in divisions above (one locking method per
+** division).  Those methods that are common to all locking modes
+** are gather together into this division.
+** 下一个部分包含除锁定方法外所有sqlite3文件对象方法的实现。锁定方法已在以上部分中定义
+** （一个部分定义一个锁定方法）。那些对所有锁定模式共同的方法在这个部分聚集在一起
+*/
 
+#ifndef SQLITE_OMIT_IOSTATS
 /*
-** Write data from a buffer into a file.  Return SQLITE_OK on success
-** or some other error code on failure.
-** 从缓冲区写入数据到一个文件中。成功返回SQLITE_OK或者失败返回一些其他错误代码。
+** I/O statistics.
+**
+** Unless SQLite is compiled with SQLITE_OMIT_IOSTATS, each unixFile counts
+** the reads, writes, syncs and truncates made on it, and keeps histograms
+** of the time taken by the system calls that read, write and sync it.
+** The statistics are returned by SQLITE_FCNTL_IOSTATS.  They are only
+** ever updated by the thread using the file, so no mutex is required.
 */
-static int unixWrite(
-  sqlite3_file *id, 
-  const void *pBuf, 
-  int amt,
-  sqlite3_int64 offset 
+#define UnixIoStat(X) X
+
+/*
+** Add a system call that took nNs nanoseconds to histogram aHist[] and
+** to the total *pTotal.  aHist[0] counts calls shorter than 1024ns, and
+** each subsequent bucket covers twice the range of its predecessor.
+*/
+static void unixIoStatTime(
+  sqlite3_uint64 *aHist,
+  sqlite3_uint64 *pTotal,
+  sqlite3_int64 nNs
 ){
-  unixFile *pFile = (unixFile*)id;
-  int wrote = 0;
-  assert( id );
-  assert( amt>0 );
+  sqlite3_uint64 x;
+  int i = 0;
+  if( nNs<0 ) nNs = 0;
+  for(x=(sqlite3_uint64)nNs>>10; x && i<SQLITE_IOSTATS_NBUCKET-1; x>>=1) i++;
+  aHist[i]++;
+  *pTotal += nNs;
+}
+#else
+# define UnixIoStat(X)
+#endif /* SQLITE_OMIT_IOSTATS */
 
-#if defined(SQLITE_MMAP_READWRITE) && SQLITE_MAX_MMAP_SIZE>0
-  /* Deal with as much of this write request as possible by transfering
-  ** data from the memory mapping using memcpy().  */
-  if( offset<pFile->mmapSize ){
-    if( offset+amt <= pFile->mmapSize ){
-      memcpy(&((u8 *)(pFile->pMapRegion))[offset], pBuf, amt);
-      return SQLITE_OK;
-    }else{
-      int nCopy = pFile->mmapSize - offset;
-      memcpy(&((u8 *)(pFile->pMapRegion))[offset], pBuf, nCopy);
-      pBuf = &((u8 *)pBuf)[nCopy];
-      amt -= nCopy;
-      offset += nCopy;
-    }
-  }
+#if HAVE_POSIX_FADVISE
+/*
+** Readahead hints.
+**
+** Each unixFile watches the offsets of the reads that go to the file
+** rather than the memory mapping.  Under the SQLITE_READAHEAD_AUTO policy,
+** once SQLITE_UNIX_READAHEAD_TRIGGER reads in a row have each started at,
+** or no more than SQLITE_UNIX_READAHEAD_GAP bytes beyond, the end of the
+** previous one, the kernel is told that the file is being read
+** sequentially, and is asked to start reading the next ra.nWindow bytes
+** each time the reader gets within half a window of the end of the range
+** already requested.  Once as many reads in a row have not, the kernel is
+** told that access is random, which turns its own readahead off.
+*/
+#ifndef SQLITE_DEFAULT_READAHEAD
+# define SQLITE_DEFAULT_READAHEAD SQLITE_READAHEAD_AUTO
 #endif
- 
-  while( (wrote = seekAndWrite(pFile, offset, pBuf, amt))<amt && wrote>0 ){
-    amt -= wrote;
-    offset += wrote;
-    pBuf = &((char*)pBuf)[wrote];
+#ifndef SQLITE_DEFAULT_READAHEAD_WINDOW
+# define SQLITE_DEFAULT_READAHEAD_WINDOW (1024*1024)
+#endif
+#ifndef SQLITE_UNIX_READAHEAD_TRIGGER
+# define SQLITE_UNIX_READAHEAD_TRIGGER 4
+#endif
+#ifndef SQLITE_UNIX_READAHEAD_GAP
+# define SQLITE_UNIX_READAHEAD_GAP (64*1024)
+#endif
+
+/*
+** Give the kernel the advice for file pFile that corresponds to
+** SQLITE_READAHEAD_* value eAdvice, if it differs from the advice already
+** given.  SQLITE_READAHEAD_OFF restores the default behaviour.
+*/
+static void unixReadaheadAdvise(unixFile *pFile, int eAdvice){
+  if( eAdvice!=pFile->eRaAdvice ){
+    int iAdvice;
+    switch( eAdvice ){
+      case SQLITE_READAHEAD_SEQUENTIAL:
+        iAdvice = POSIX_FADV_SEQUENTIAL;
+        pFile->ra.nSequential++;
+        break;
+      case SQLITE_READAHEAD_RANDOM:
+        iAdvice = POSIX_FADV_RANDOM;
+        pFile->ra.nRandom++;
+        break;
+      default:
+        iAdvice = POSIX_FADV_NORMAL;
+        break;
+    }
+    osFadvise(pFile->h, 0, 0, iAdvice);
+    pFile->eRaAdvice = (unsigned char)eAdvice;
+    pFile->iRaEnd = 0;
   }
-  SimulateIOError(( wrote=(-1), amt=1 ));
-  SimulateDiskfullError(( wrote=0, amt=1 ));
+}
 
-  if( amt>wrote ){
-    if( wrote<0 && pFile->lastErrno!=ENOSPC ){
-      /* lastErrno set by seekAndWrite */
-      return SQLITE_IOERR_WRITE;
-    }else{
-      storeLastErrno(pFile, 0); /* not a system error */
-      return SQLITE_FULL;
+/*
+** Called by the read methods before reading amt bytes at offset iOfst of
+** pFile with a system call.  Update the sequential-access detector and
+** give the kernel whatever hints the readahead policy calls for.  Errors
+** are ignored, as the hints are only an optimization.
+*/
+static void unixReadahead(unixFile *pFile, i64 iOfst, int amt){
+  sqlite3_readahead *pRa = &pFile->ra;
+  int eAdvice;
+
+  /* Direct I/O bypasses the page cache, so there is nothing for the
+  ** kernel to read ahead into. */
+  if( pRa->ePolicy==SQLITE_READAHEAD_OFF || unixIsDirect(pFile) ) return;
+  if( iOfst>=pFile->iRaNext
+   && iOfst-pFile->iRaNext<=SQLITE_UNIX_READAHEAD_GAP
+  ){
+    if( pFile->nRaRun<0 ) pFile->nRaRun = 0;
+    if( pFile->nRaRun<SQLITE_UNIX_READAHEAD_TRIGGER ) pFile->nRaRun++;
+  }else{
+    if( pFile->nRaRun>0 ) pFile->nRaRun = 0;
+    if( pFile->nRaRun>-SQLITE_UNIX_READAHEAD_TRIGGER ) pFile->nRaRun--;
+    pFile->iRaEnd = 0;
+  }
+  pFile->iRaNext = iOfst + amt;
+
+  eAdvice = pRa->ePolicy;
+  if( eAdvice==SQLITE_READAHEAD_AUTO ){
+    eAdvice = pFile->eRaAdvice;
+    if( pFile->nRaRun>=SQLITE_UNIX_READAHEAD_TRIGGER ){
+      eAdvice = SQLITE_READAHEAD_SEQUENTIAL;
+    }else if( pFile->nRaRun<=-SQLITE_UNIX_READAHEAD_TRIGGER ){
+      eAdvice = SQLITE_READAHEAD_RANDOM;
     }
   }
+  unixReadaheadAdvise(pFile, eAdvice);
 
-  return SQLITE_OK;
+  if( pFile->eRaAdvice==SQLITE_READAHEAD_SEQUENTIAL
+   && pFile->nRaRun>0 && pRa->nWindow>0
+   && pFile->iRaNext + pRa->nWindow/2 > pFile->iRaEnd
+  ){
+    i64 iStart = MAX(pFile->iRaEnd, pFile->iRaNext);
+    i64 iEnd = pFile->iRaNext + pRa->nWindow;
+    osFadvise(pFile->h, iStart, iEnd-iStart, POSIX_FADV_WILLNEED);
+    pRa->nPrefetch++;
+    pRa->nPrefetchBytes += iEnd - iStart;
+    pFile->iRaEnd = iEnd;
+  }
 }
+#else
+# define unixReadahead(P,O,N)
+#endif /* HAVE_POSIX_FADVISE */
 
+#ifdef SQLITE_UNIX_DIRECT_IO
+/*
+** Direct I/O.
+**
+** The "unix-direct" VFS opens database files with O_DIRECT, so that
+** their contents are cached by the application alone and not by the
+** kernel as well.  No readahead hints are given for them.  O_DIRECT
+** requires the file offset, the length and the buffer address of each
+** read and write to be multiples of the alignment reported by the file
+** system, which is stored in unixFile.szDirect.
+**
+** WAL files are opened as usual.  Each WAL frame is appended as a 24-byte
+** header and a page at unaligned offsets, which would cost three reads,
+** two writes and up to two truncates per frame through the bounce
+** buffers described below.
+**
+** seekAndRead() and seekAndWrite() pass aligned requests straight to the
+** file.  Other requests go through a bounce buffer that covers the
+** aligned range around them.  For a write, the partly covered blocks at
+** either end of that range are first read into the buffer.  If that shows
+** the range extends past the end of the file, the file is truncated
+** after the write so that its size is the same as if the request had
+** been written directly.
+**
+** Bounce buffers of up to SQLITE_UNIX_DIRECT_BUFSZ bytes come from a
+** pool shared by all files, which keeps up to SQLITE_UNIX_DIRECT_NBUF
+** free buffers.  Larger ones are allocated for the request and freed.
+*/
+#ifndef SQLITE_UNIX_DIRECT_BUFSZ
+# define SQLITE_UNIX_DIRECT_BUFSZ (128*1024)
+#endif
+#ifndef SQLITE_UNIX_DIRECT_NBUF
+# define SQLITE_UNIX_DIRECT_NBUF 8
+#endif
 
 /*
-** We do not trust systems to provide a working fdatasync().  Some do.
-** Others do no.  To be safe, we will stick with the (slightly slower)
-** fsync(). If you know that your system does support fdatasync() correctly,
-** then simply compile with -Dfdatasync=fdatasync or -DHAVE_FDATASYNC
-** 我们不相信系统提供一个有效的fdatasync()。有些时这样的，其他的不是。为了安全起见，我们
-** 将坚持（稍慢）fsync()。如果你知道你的系统确实正确的支持fdatasync()，那么用-Dfdatasync=fdatasync
-** 简单地编译
+** Alignment of the buffers in the bounce buffer pool.
 */
-#if !defined(fdatasync) && !HAVE_FDATASYNC
-# define fdatasync fsync
-#endif
+#define UNIX_DIRECT_ALIGN 4096
+
+typedef struct unixDirectBuf unixDirectBuf;
+struct unixDirectBuf {
+  unixDirectBuf *pNext;           /* Next free buffer in the pool */
+  int nBuf;                       /* Size of aBuf[] in bytes */
+  u8 *aBuf;                       /* The aligned buffer */
+};
 
 /*
-** Define HAVE_FULLFSYNC to 0 or 1 depending on whether or not
-** the F_FULLFSYNC macro is defined.  F_FULLFSYNC is currently
-** only available on Mac OS X.  But that could change.
-** 定义HAVE_FULLFSYNC为0或者1取决于F_FULLFSYNC宏是否被定义。F_FULLFSYNC
-** 目前仅在Mac OS X上可用。但可能会改变。
+** The pool of free bounce buffers.  The mutex is allocated by
+** sqlite3_os_init().
 */
-#ifdef F_FULLFSYNC
-# define HAVE_FULLFSYNC 1
-#else
-# define HAVE_FULLFSYNC 0
-#endif
+static struct unixDirectPoolType {
+  sqlite3_mutex *pMutex;          /* Protects this object */
+  unixDirectBuf *pFree;           /* List of free buffers */
+  int nFree;                      /* Number of entries on pFree */
+} unixDirectPool;
+
+/*
+** Return a bounce buffer of at least nByte bytes aligned to szAlign, or
+** NULL if a malloc() fails.
+*/
+static unixDirectBuf *unixDirectBufGet(int nByte, int szAlign){
+  unixDirectBuf *p = 0;
+  if( nByte<=SQLITE_UNIX_DIRECT_BUFSZ && szAlign<=UNIX_DIRECT_ALIGN ){
+    sqlite3_mutex_enter(unixDirectPool.pMutex);
+    p = unixDirectPool.pFree;
+    if( p ){
+      unixDirectPool.pFree = p->pNext;
+      unixDirectPool.nFree--;
+    }
+    sqlite3_mutex_leave(unixDirectPool.pMutex);
+    if( p ) return p;
+    nByte = SQLITE_UNIX_DIRECT_BUFSZ;
+    szAlign = UNIX_DIRECT_ALIGN;
+  }
+  p = (unixDirectBuf*)sqlite3_malloc64(sizeof(*p) + nByte + szAlign);
+  if( p ){
+    p->pNext = 0;
+    p->nBuf = nByte;
+    p->aBuf = (u8*)(((uptr)&p[1] + szAlign - 1) & ~(uptr)(szAlign - 1));
+  }
+  return p;
+}
 
+/*
+** Return bounce buffer p to the pool, or free it if it is not the size
+** the pool holds or the pool is full.
+*/
+static void unixDirectBufPut(unixDirectBuf *p){
+  if( p->nBuf==SQLITE_UNIX_DIRECT_BUFSZ ){
+    sqlite3_mutex_enter(unixDirectPool.pMutex);
+    if( unixDirectPool.nFree<SQLITE_UNIX_DIRECT_NBUF ){
+      p->pNext = unixDirectPool.pFree;
+      unixDirectPool.pFree = p;
+      unixDirectPool.nFree++;
+      p = 0;
+    }
+    sqlite3_mutex_leave(unixDirectPool.pMutex);
+  }
+  sqlite3_free(p);
+}
 
 /*
-** The fsync() system call does not work as advertised on many
-** unix systems.  The following procedure is an attempt to make
-** it work better.
-** 在很多unix系统上，fsync()系统调用不像广告一样起了作用。下面的程序是为了让
-** 它工作的更好。
-**
-** The SQLITE_NO_SYNC macro disables all fsync()s.  This is useful
-** for testing when we want to run through the test suite quickly.
-** You are strongly advised *not* to deploy with SQLITE_NO_SYNC
-** enabled, however, since with SQLITE_NO_SYNC enabled, an OS crash
-** or power failure will likely corrupt the database file.
-** SQLITE_NO_SYNC宏禁用所有fsync()。当我们想快速地运行测试套件的时候，这对测试
-** 是有用的。强烈的建议不再SQLITE_NO_SYNC启用下进行配置，因为启用了SQLITE_NO_SYNC
-** 后，一个操作系统崩溃或者电源故障可能会毁坏数据库文件
-**
-** SQLite sets the dataOnly flag if the size of the file is unchanged.
-** The idea behind dataOnly is that it should only write the file content
-** to disk, not the inode.  We only set dataOnly if the file size is 
-** unchanged since the file size is part of the inode.  However, 
-** Ted Ts'o tells us that fdatasync() will also write the inode if the
-** file size has changed.  The only real difference between fdatasync()
-** and fsync(), Ted tells us, is that fdatasync() will not flush the
-** inode if the mtime or owner or other inode attributes have changed.
-** We only care about the file size, not the other file attributes, so
-** as far as SQLite is concerned, an fdatasync() is always adequate.
-** So, we always use fdatasync() if it is available, regardless of
-** the value of the dataOnly flag.
-** 如果文件的大小不变，SQLITE设置dataOnly标志。
-** dataOnly背后的想法是它应该只写文件内容到磁盘，而不是索引节点。由于文件大小是索引节
-** 的一部分，如果文件大小没变，我们只设置dataOnly。但是，Ted Ts'o告诉我们，fdatasync()也将
-** 写索引结点，如果文件大小已经改变。fdatasync()和fsync()之间唯一真正的区别，Ted告诉我们了，
-** 是fdatasync()不会刷新索引节点，如果mtime或者所有者或者其他索引节点属性已经改变了。
-** 我们只关心文件大小，不是其他文件属性，所以对sqlite而言，一个fdatasync()总是足够的。
-** 所以我们总是只用fdatasync()，如果它是可用的，不管dataOnly标志的值。
+** Free the buffers in the pool.  Called by sqlite3_os_end().
 */
-static int full_fsync(int fd, int fullSync, int dataOnly){
-  int rc;
+static void unixDirectPoolShutdown(void){
+  while( unixDirectPool.pFree ){
+    unixDirectBuf *p = unixDirectPool.pFree;
+    unixDirectPool.pFree = p->pNext;
+    sqlite3_free(p);
+  }
+  sqlite3_mutex_free(unixDirectPool.pMutex);
+  memset(&unixDirectPool, 0, sizeof(unixDirectPool));
+}
 
-  /* The following "ifdef/elif/else/" block has the same structure as
-  ** the one below. It is replicated here solely to avoid cluttering 
-  ** up the real code with the UNUSED_PARAMETER() macros.
-  ** 下面的，"ifdef/elif/else/"块如下面一个块一样具有相同的结构。它单独地复制在这里
-  ** 避免弄乱真正的带UNUSED_PARAMETER()宏的代码
-  */
-#ifdef SQLITE_NO_SYNC
-  UNUSED_PARAMETER(fd);
-  UNUSED_PARAMETER(fullSync);
-  UNUSED_PARAMETER(dataOnly);
-#elif HAVE_FULLFSYNC
-  UNUSED_PARAMETER(dataOnly);
+/*
+** Switch direct I/O on file descriptor fd on (if bOn is true) or off.
+** Return true if successful, or false if the file system does not
+** support it.
+*/
+static int unixDirectSet(int fd, int bOn){
+#if defined(O_DIRECT)
+  int f = osFcntl(fd, F_GETFL);
+  if( f<0 ) return 0;
+  return osFcntl(fd, F_SETFL, bOn ? (f|O_DIRECT) : (f&~O_DIRECT))==0;
 #else
-  UNUSED_PARAMETER(fullSync);
-  UNUSED_PARAMETER(dataOnly);
+  return osFcntl(fd, F_NOCACHE, bOn)==0;
 #endif
-
-  /* If we compiled with the SQLITE_NO_SYNC flag, then syncing is a
-  ** no-op.  But go ahead and call fstat() to validate the file
-  ** descriptor as we need a method to provoke a failure during
-  ** coverate testing.
-  ** 如果我们用SQLITE_NO_SYNC标志编译，那么同步是一个空操作。
-  */
-#ifdef SQLITE_NO_SYNC
-  {
-    struct stat buf;
-    rc = osFstat(fd, &buf);
-  }
-#elif HAVE_FULLFSYNC
-  if( fullSync ){
-    rc = osFcntl(fd, F_FULLFSYNC, 0);
-  }else{
-    rc = 1;
-  }
-  /* If the FULLFSYNC failed, fall back to attempting an fsync().
-  ** It shouldn't be possible for fullfsync to fail on the local 
-  ** file system (on OSX), so failure indicates that FULLFSYNC
-  ** isn't supported for this file system. So, attempt an fsync 
-  ** and (for now) ignore the overhead of a superfluous fcntl call.  
-  ** It'd be better to detect fullfsync support once and avoid 
-  ** the fcntl call every time sync is called.
-  ** 如果FULLFSYNC失败，回退尝试一个fsync()。
-  ** fullfsync在本地文件系统（在OSX上）失败，是不该可能的，所以失败表明
-  ** FULLFSYNC不支持这个文件系统。所以，尝试一个fsync，（现在）忽略多余的
-  ** fcntl调用开销。最好检测fullfsync支持一次，避免每次fcntl调用sync被调用。
-  */
-  if( rc ) rc = fsync(fd);
-#else 
-  rc = fdatasync(fd);
-
-#endif /* ifdef SQLITE_NO_SYNC elif HAVE_FULLFSYNC */
-
-  return rc;
-}
+}
 
 /*
-** Open a file descriptor to the directory containing file zFilename.
-** If successful, *pFd is set to the opened file descriptor and
-** SQLITE_OK is returned. If an error occurs, either SQLITE_NOMEM
-** or SQLITE_CANTOPEN is returned and *pFd is set to an undefined
-** value.
-** 打开一个文件描述符到包含文件zFilename的目录。
-** 如果成功，*pFd设置为打开的文件描述符，SQLITE_OK返回。如果出现错误，SQLITE_NOMEM
-** 或者SQLITE_CANTOPEN返回，*pFd设置一个未定义的值。
-**
-** The directory file descriptor is used for only one thing - to
-** fsync() a directory to make sure file creation and deletion events
-** are flushed to disk.  Such fsyncs are not needed on newer
-** journaling filesystems, but are required on older filesystems.
-** 目录文件描述符用于只有一件事，fsync()一个目录，确保文件创建和删除事件被刷新到磁盘
-** 这样的fsyncs在更新的日志文件系统不需要，但在旧文件系统需要。
-**
-** This routine can be overridden using the xSetSysCall interface.
-** The ability to override this routine was added in support of the
-** chromium sandbox.  Opening a directory is a security risk (we are
-** told) so making it overrideable allows the chromium sandbox to
-** replace this routine with a harmless no-op.  To make this routine
-** a no-op, replace it with a stub that returns SQLITE_OK but leaves
-** *pFd set to a negative number.
-** 这个例程使用xSetSysCall接口可以被覆盖。
-** 覆盖这个例程的能力被增加来支持chromiun浏览器沙箱。打开一个目录是一个安全风险（我们被告知）
-** 所以使他可覆盖允许chromium沙箱用一种无害的空操作来代替这个例程，代之以一个存根，返回
-** SQLITE_OK但是留下*pFd设置为负数。
-**
-** If SQLITE_OK is returned, the caller is responsible for closing
-** the file descriptor *pFd using close().
-** 如果SQLITE_OK返回，调用者负责关闭文件描述符*pFd，使用close()。
-*/
-static int openDirectory(const char *zFilename, int *pFd){
-  int ii;
-  int fd = -1;
-  char zDirname[MAX_PATHNAME+1];
-
-  sqlite3_snprintf(MAX_PATHNAME, zDirname, "%s", zFilename);
-  for(ii=(int)strlen(zDirname); ii>0 && zDirname[ii]!='/'; ii--);
-  if( ii>0 ){
-    zDirname[ii] = '\0';
-  }else{
-    if( zDirname[0]!='/' ) zDirname[0] = '.';
-    zDirname[1] = 0;
+** Return the alignment that direct I/O on file descriptor fd requires.
+** This is a power of two between 512 and 65536.
+*/
+static int unixDirectAlignment(int fd){
+  int sz = 0;
+#if defined(__linux__) && defined(STATX_DIOALIGN)
+  struct statx stx;
+  if( statx(fd, "", AT_EMPTY_PATH, STATX_DIOALIGN, &stx)==0
+   && (stx.stx_mask & STATX_DIOALIGN)!=0
+  ){
+    sz = (int)MAX(stx.stx_dio_mem_align, stx.stx_dio_offset_align);
   }
-  fd = robust_open(zDirname, O_RDONLY|O_BINARY, 0);
-  if( fd>=0 ){
-    OSTRACE(("OPENDIR %-3d %s\n", fd, zDirname));
+#endif
+  if( sz==0 ){
+    struct stat buf;
+    if( osFstat(fd, &buf)==0 ) sz = (int)buf.st_blksize;
   }
-  *pFd = fd;
-  if( fd>=0 ) return SQLITE_OK;
-  return unixLogError(SQLITE_CANTOPEN_BKPT, "openDirectory", zDirname);
+  if( sz<512 || sz>65536 || (sz & (sz-1))!=0 ) sz = UNIX_DIRECT_ALIGN;
+  return sz;
 }
 
 /*
-** Make sure all writes to a particular file are committed to disk.
-** 确保所有的写入到一个特定文件提交到磁盘
-**
-** If dataOnly==0 then both the file itself and its metadata (file
-** size, access time, etc) are synced.  If dataOnly!=0 then only the
-** file data is synced.
-** 如果dataOnly==0,那么文件本身及其元数据（文件大小、访问时间等）是同步的。
-** 如果dataOnly != 0，那么只有文件数据是同步的。
-**
-** Under Unix, also make sure that the directory entry for the file
-** has been created by fsync-ing the directory that contains the file.
-** If we do not do this and we encounter a power failure, the directory
-** entry for the journal might not exist after we reboot.  The next
-** SQLite to access the file will not know that the journal exists (because
-** the directory entry for the journal was never created) and the transaction
-** will not roll back - possibly leading to database corruption.
-** 在Unix中，也确保文件的目录条目已经通过同步包含文件的目录创建。
-** 如果我们不这么做，我们遇到停电，日志目录条目在我们重启后可能不存在。下一个SQLITE访问
-** 文件将不知道日志存在（因为日志目录条目从未创建），事务不将回滚，可能导致数据库毁坏。
+** True if a read or write of nByte bytes at offset iOfst of pFile, to or
+** from buffer pBuf, may be passed to the file as it is.
 */
-static int unixSync(sqlite3_file *id, int flags){
-  int rc;
-  unixFile *pFile = (unixFile*)id;
-
-  int isDataOnly = (flags&SQLITE_SYNC_DATAONLY);
-  int isFullsync = (flags&0x0F)==SQLITE_SYNC_FULL;
+#define unixDirectAligned(pFile, iOfst, pBuf, nByte) \
+  ((((uptr)(iOfst) | (uptr)(pBuf) | (uptr)(nByte)) \
+    & (uptr)((pFile)->szDirect - 1))==0)
 
-  /* Check that one of SQLITE_SYNC_NORMAL or FULL was passed */  //检查SQLITE_SYNC_NORMAL或者FULL的一个通过。
-  assert((flags&0x0F)==SQLITE_SYNC_NORMAL
-      || (flags&0x0F)==SQLITE_SYNC_FULL
-  );
+static int seekAndRead(unixFile*, sqlite3_int64, void*, int);
+static int seekAndWrite(unixFile*, i64, const void*, int);
 
-  /* Unix cannot, but some systems may return SQLITE_FULL from here. This
-  ** line is to test that doing so does not cause any problems.
-  ** Unix不能，但是一些系统可能从这里返回SQLITE_FULL。这行用于测试那样做，
-  ** 所以这里不会引起任何问题。
-  */
-  SimulateDiskfullError( return SQLITE_FULL );
+/*
+** Read cnt bytes at offset iOfst of direct I/O file pFile into pBuf, via a
+** bounce buffer.  Return the number of bytes read, or -1 with
+** pFile->lastErrno set if an error occurs, as seekAndRead() does.
+*/
+static int unixDirectRead(unixFile *pFile, i64 iOfst, void *pBuf, int cnt){
+  int sz = pFile->szDirect;
+  i64 iStart = iOfst & ~(i64)(sz-1);
+  int nByte = (int)(((iOfst + cnt + sz - 1) & ~(i64)(sz-1)) - iStart);
+  unixDirectBuf *pBounce;
+  int got;
 
-  assert( pFile );
-  OSTRACE(("SYNC    %-3d\n", pFile->h));
-  rc = full_fsync(pFile->h, isFullsync, isDataOnly);
-  SimulateIOError( rc=1 );
-  if( rc ){
-    storeLastErrno(pFile, errno);
-    return unixLogError(SQLITE_IOERR_FSYNC, "full_fsync", pFile->zPath);
+  pBounce = unixDirectBufGet(nByte, sz);
+  if( pBounce==0 ){
+    storeLastErrno(pFile, ENOMEM);
+    return -1;
   }
-
-  /* Also fsync the directory containing the file if the DIRSYNC flag
-  ** is set.  This is a one-time occurrence.  Many systems (examples: AIX)
-  ** are unable to fsync a directory, so ignore errors on the fsync.
-  ** 也同步包含这个文件的目录，如果DIRSYNC标志被设定。这是一次性的发生。很多系统
-  ** （例如：AIX）不能同步一个目录，所以忽略同步错误。
-  */
-  if( pFile->ctrlFlags & UNIXFILE_DIRSYNC ){
-    int dirfd;
-    OSTRACE(("DIRSYNC %s (have_fullfsync=%d fullsync=%d)\n", pFile->zPath,
-            HAVE_FULLFSYNC, isFullsync));
-    rc = osOpenDirectory(pFile->zPath, &dirfd);
-    if( rc==SQLITE_OK ){
-      full_fsync(dirfd, 0, 0);
-      robust_close(pFile, dirfd, __LINE__);
-    }else{
-      assert( rc==SQLITE_CANTOPEN );
-      rc = SQLITE_OK;
-    }
-    pFile->ctrlFlags &= ~UNIXFILE_DIRSYNC;
+  got = seekAndRead(pFile, iStart, pBounce->aBuf, nByte);
+  if( got>=0 ){
+    got -= (int)(iOfst - iStart);
+    if( got<0 ) got = 0;
+    if( got>cnt ) got = cnt;
+    memcpy(pBuf, &pBounce->aBuf[iOfst - iStart], got);
   }
-  return rc;
+  unixDirectBufPut(pBounce);
+  return got;
 }
 
 /*
-** Truncate an open file to a specified size
-** 截断一个打开的文件到指定的大小。
-*/
-static int unixTruncate(sqlite3_file *id, i64 nByte){
-  unixFile *pFile = (unixFile *)id;
-  int rc;
-  assert( pFile );
-  SimulateIOError( return SQLITE_IOERR_TRUNCATE );
-
-  /* If the user has configured a chunk-size for this file, truncate the
-  ** file so that it consists of an integer number of chunks (i.e. the
-  ** actual file size after the operation may be larger than the requested
-  ** size).
-  ** 如果用户已经配置了这个文件的块的大小，截断文件以便于包含整数的块（即操作之后的实际文件
-  ** 大小可能已经大于请求的大小）
-  */
-  if( pFile->szChunk>0 ){
-    nByte = ((nByte + pFile->szChunk - 1)/pFile->szChunk) * pFile->szChunk;
-  }
-
-  rc = robust_ftruncate(pFile->h, nByte);
-  if( rc ){
-    storeLastErrno(pFile, errno);
-    return unixLogError(SQLITE_IOERR_TRUNCATE, "ftruncate", pFile->zPath);
-  }else{
-
-#if SQLITE_MAX_MMAP_SIZE>0
-    /* If the file was just truncated to a size smaller than the currently
-    ** mapped region, reduce the effective mapping size as well. SQLite will
-    ** use read() and write() to access data beyond this point from now on.  
-    */
-    if( nByte<pFile->mmapSize ){
-      pFile->mmapSize = nByte;
-    }
-#endif
-
-    return SQLITE_OK;
+** Read the block of szDirect bytes at offset iBlk of pFile into aBlk[],
+** zero-filling whatever lies beyond the end of the file.  If the end of
+** the file is found, set *piEof to its offset.  Return SQLITE_OK, or an
+** error code with pFile->lastErrno set.
+*/
+static int unixDirectReadBlock(
+  unixFile *pFile,
+  i64 iBlk,
+  u8 *aBlk,
+  i64 *piEof
+){
+  int sz = pFile->szDirect;
+  int got = seekAndRead(pFile, iBlk, aBlk, sz);
+  if( got<0 ) return SQLITE_IOERR_READ;
+  if( got<sz ){
+    memset(&aBlk[got], 0, sz-got);
+    *piEof = iBlk + got;
   }
+  return SQLITE_OK;
 }
 
 /*
-** Determine the current size of a file in bytes
-** 确定当前文件的大小，字节为单位
-*/
-static int unixFileSize(sqlite3_file *id, i64 *pSize){
-  int rc;
-  struct stat buf;
-  assert( id );
-  rc = osFstat(((unixFile*)id)->h, &buf);
-  SimulateIOError( rc=1 );
-  if( rc!=0 ){
-    storeLastErrno((unixFile*)id, errno);
-    return SQLITE_IOERR_FSTAT;
+** Write cnt bytes from pBuf to offset iOfst of direct I/O file pFile, via
+** a bounce buffer.  Return the number of bytes written, or -1 with
+** pFile->lastErrno set if an error occurs, as seekAndWrite() does.
+*/
+static int unixDirectWrite(
+  unixFile *pFile,
+  i64 iOfst,
+  const void *pBuf,
+  int cnt
+){
+  int sz = pFile->szDirect;
+  i64 iEnd = iOfst + cnt;
+  i64 iStart = iOfst & ~(i64)(sz-1);
+  i64 iAlignEnd = (iEnd + sz - 1) & ~(i64)(sz-1);
+  int nByte = (int)(iAlignEnd - iStart);
+  i64 iEof = -1;                  /* End of file, if found by a read */
+  unixDirectBuf *pBounce;
+  int wrote = -1;
+
+  pBounce = unixDirectBufGet(nByte, sz);
+  if( pBounce==0 ){
+    storeLastErrno(pFile, ENOMEM);
+    return -1;
   }
-  *pSize = buf.st_size;
 
-  /* When opening a zero-size database, the findInodeInfo() procedure
-  ** writes a single byte into that file in order to work around a bug
-  ** in the OS-X msdos filesystem.  In order to avoid problems with upper
-  ** layers, we need to report this file size as zero even though it is
-  ** really 1.   Ticket #3260.
-  ** 当打开一个大小为0的数据库，findInodeInfo()程序将一个字节写入该文件为了解决一个
-  ** 在OS-X msdos文件系统上的错误。为了避免上面的问题，我们需要报告这个文件大小为0，
-  ** 即使它真是1。 标签#3260
-  */
-  if( *pSize==1 ) *pSize = 0;
+  /* Read the blocks at either end that the write only partly covers. */
+  if( iStart<iOfst
+   && unixDirectReadBlock(pFile, iStart, pBounce->aBuf, &iEof)
+  ){
+    goto direct_write_out;
+  }
+  if( iAlignEnd>iEnd && (iAlignEnd-sz>iStart || iStart==iOfst)
+   && unixDirectReadBlock(pFile, iAlignEnd-sz,
+                          &pBounce->aBuf[nByte-sz], &iEof)
+  ){
+    goto direct_write_out;
+  }
 
+  memcpy(&pBounce->aBuf[iOfst - iStart], pBuf, cnt);
+  wrote = seekAndWrite(pFile, iStart, pBounce->aBuf, nByte);
+  if( wrote==nByte ){
+    wrote = cnt;
+    if( iEof>=0 && MAX(iEof, iEnd)<iAlignEnd
+     && robust_ftruncate(pFile->h, MAX(iEof, iEnd))
+    ){
+      storeLastErrno(pFile, errno);
+      wrote = -1;
+    }
+  }else if( wrote>0 ){
+    wrote -= (int)(iOfst - iStart);
+    if( wrote<0 ) wrote = 0;
+  }
 
-  return SQLITE_OK;
+direct_write_out:
+  unixDirectBufPut(pBounce);
+  return wrote;
 }
 
-/* 
-** This function is called to handle the SQLITE_FCNTL_SIZE_HINT 
-** file-control operation.  Enlarge the database to nBytes in size
-** (rounded up to the next chunk-size).  If the database is already
-** nBytes or larger, this routine is a no-op.
-** 调用这个函数来处理SQLITE_FCNTL_SIZE_HIN文件控制操作。扩大数据库到nBytes大小
-** （算到下一个块大小）。如果数据库已经nBytes或者更大，这个例程是一个空操作。
-*/
-static int fcntlSizeHint(unixFile *pFile, i64 nByte){
-  if( pFile->szChunk>0 ){
-    i64 nSize;                    /* Required file size ，请求文件大小*/
-    struct stat buf;              /* Used to hold return values of fstat() ，用来保存fstat()返回值*/
-   
-    if( osFstat(pFile->h, &buf) ){
-      return SQLITE_IOERR_FSTAT;
-    }
-
-    nSize = ((nByte+pFile->szChunk-1) / pFile->szChunk) * pFile->szChunk;
-    if( nSize>(i64)buf.st_size ){
+#endif /* SQLITE_UNIX_DIRECT_IO */
 
-#if defined(HAVE_POSIX_FALLOCATE) && HAVE_POSIX_FALLOCATE
-      /* The code below is handling the return value of osFallocate() 
-      ** correctly. posix_fallocate() is defined to "returns zero on success, 
-      ** or an error number on  failure". See the manpage for details. */
-      int err;
-      do{
-        err = osFallocate(pFile->h, buf.st_size, nSize-buf.st_size);
-      }while( err==EINTR );
-      if( err && err!=EINVAL ) return SQLITE_IOERR_WRITE;
-#else
-      /* If the OS does not have posix_fallocate(), fake it. Write a 
-      ** single byte to the last byte in each block that falls entirely
-      ** within the extended region. Then, if required, a single byte
-      ** at offset (nSize-1), to set the size of the file correctly.
-      ** This is a similar technique to that used by glibc on systems
-      ** that do not have a real fallocate() call.
-      */
-      int nBlk = buf.st_blksize;  /* File-system block size */
-      int nWrite = 0;             /* Number of bytes written by seekAndWrite */
-      i64 iWrite;                 /* Next offset to write to */
-
-      iWrite = (buf.st_size/nBlk)*nBlk + nBlk - 1;
-      assert( iWrite>=buf.st_size );
-      assert( ((iWrite+1)%nBlk)==0 );
-      for(/*no-op*/; iWrite<nSize+nBlk-1; iWrite+=nBlk ){
-        if( iWrite>=nSize ) iWrite = nSize - 1;
-        nWrite = seekAndWrite(pFile, iWrite, "", 1);
-        if( nWrite!=1 ) return SQLITE_IOERR_WRITE;
-      }
+/*
+** Seek to the offset passed as the second argument, then read cnt 
+** bytes into pBuf. Return the number of bytes actually read.
+** 寻求偏移量作为第二个参数传递，然后读取cnt字节到pBuf中。返回实际读取的字节数。
+**
+** NB:  If you define USE_PREAD or USE_PREAD64, then it might also
+** be necessary to define _XOPEN_SOURCE to be 500.  This varies from
+** one system to another.  Since SQLite does not define USE_PREAD
+** in any form by default, we will not attempt to define _XOPEN_SOURCE.
+** See tickets #2741 and #2681.
+** 注：如果你定义USE_PREAD或者USE_PREAD64，那么它可能也有必要定义_XOPEN_SOURCE为500。
+** 从一个系统到另一个系统这个不同。因为SQLITE在默认情况下不定义USE_PREAD任何形式，我们
+** 不会试图定义_XOPEN_SOURCE。看标签#2741到#2681
+**
+** To avoid stomping the errno value on a failed read the lastErrno value
+** is set before returning.
+** 为了避免errno值的读取失败，lastErrno值在返回前被设定。
+*/
+static int seekAndRead(unixFile *id, sqlite3_int64 offset, void *pBuf, int cnt){
+  int got;
+  int prior = 0;
+#if (!defined(USE_PREAD) && !defined(USE_PREAD64))
+  i64 newOffset;
 #endif
-    }
+#ifndef SQLITE_OMIT_IOSTATS
+  sqlite3_int64 iStart = unixMonotonicNs();
+#endif
+#ifdef SQLITE_UNIX_DIRECT_IO
+  if( unixIsDirect(id) && !unixDirectAligned(id, offset, pBuf, cnt) ){
+    return unixDirectRead(id, offset, pBuf, cnt);
   }
-
-#if SQLITE_MAX_MMAP_SIZE>0
-  if( pFile->mmapSizeMax>0 && nByte>pFile->mmapSize ){
-    int rc;
-    if( pFile->szChunk<=0 ){
-      if( robust_ftruncate(pFile->h, nByte) ){
-        storeLastErrno(pFile, errno);
-        return unixLogError(SQLITE_IOERR_TRUNCATE, "ftruncate", pFile->zPath);
-      }
+#endif
+  TIMER_START;
+  assert( cnt==(cnt&0x1ffff) );
+  assert( id->h>2 );
+  do{
+#if defined(USE_PREAD)
+    got = osPread(id->h, pBuf, cnt, offset);
+    SimulateIOError( got = -1 );
+#elif defined(USE_PREAD64)
+    got = osPread64(id->h, pBuf, cnt, offset);
+    SimulateIOError( got = -1 );
+#else
+    newOffset = lseek(id->h, offset, SEEK_SET);
+    SimulateIOError( newOffset = -1 );
+    if( newOffset<0 ){
+      storeLastErrno((unixFile*)id, errno);
+      return -1;
     }
-
-    rc = unixMapfile(pFile, nByte);
-    return rc;
-  }
+    got = osRead(id->h, pBuf, cnt);
 #endif
+    if( got==cnt ) break;
+    if( got<0 ){
+      if( errno==EINTR ){ got = 1; continue; }
+      prior = 0;
+      storeLastErrno((unixFile*)id,  errno);
+      break;
+    }else if( got>0 ){
+      cnt -= got;
+      offset += got;
+      prior += got;
+      pBuf = (void*)(got + (char*)pBuf);
+    }
+  }while( got>0 );
+  TIMER_END;
+  UnixIoStat( unixIoStatTime(id->ioStats.aReadNs, &id->ioStats.nReadNs,
+                             unixMonotonicNs() - iStart) );
+  OSTRACE(("READ    %-3d %5d %7lld %llu\n",
+            id->h, got+prior, offset-prior, TIMER_ELAPSED));
+  return got+prior;
+}
 
-  return SQLITE_OK;
+/*
+** Return the error code for a read that failed with pFile->lastErrno.
+** Usually this is SQLITE_IOERR_READ, though for some kinds of errors it
+** is SQLITE_IOERR_CORRUPTFS.  The SQLITE_IOERR_CORRUPTFS will be converted
+** into SQLITE_CORRUPT prior to returning to the application by the
+** sqlite3ApiExit() routine.
+*/
+static int unixReadError(unixFile *pFile){
+  switch( pFile->lastErrno ){
+    case ERANGE:
+    case EIO:
+#ifdef ENXIO
+    case ENXIO:
+#endif
+#ifdef EDEVERR
+    case EDEVERR:
+#endif
+      return SQLITE_IOERR_CORRUPTFS;
+  }
+  return SQLITE_IOERR_READ;
 }
 
 /*
-** If *pArg is initially negative then this is a query.  Set *pArg to
-** 1 or 0 depending on whether or not bit mask of pFile->ctrlFlags is set.
-** 如果*pArg初始是负的，那么这是一个查询。设置*pArg为1或者0取决于是否pFile->ctrlFlags
-** 位屏蔽被设置。
-**
-** If *pArg is 0 or 1, then clear or set the mask bit of pFile->ctrlFlags.
-** 如果*pArg为0或者1，那么清除或者设置pFile->ctrlFlags屏蔽位。
+** Read data from a file into a buffer.  Return SQLITE_OK if all
+** bytes were read successfully and SQLITE_IOERR if anything goes
+** wrong.
+** 从文件中读取数据到缓冲区。如果所有字节读取成功返回SQLITE_OK,如果出错返回SQLITE_IOERR。
 */
-static void unixModeBit(unixFile *pFile, unsigned char mask, int *pArg){
-  if( *pArg<0 ){
-    *pArg = (pFile->ctrlFlags & mask)!=0;
-  }else if( (*pArg)==0 ){
-    pFile->ctrlFlags &= ~mask;
+static int unixRead(
+  sqlite3_file *id, 
+  void *pBuf, 
+  int amt,
+  sqlite3_int64 offset
+){
+  unixFile *pFile = (unixFile *)id;
+  int got;
+  assert( id );
+  assert( offset>=0 );
+  assert( amt>0 );
+
+  /* If this is a database file (not a journal, super-journal or temp
+  ** file), the bytes in the locking range should never be read or written. 
+  ** 如果这是一个数据库文件（不是一个日志，主日志或者临时文件），锁定范围的字节不能读或写。
+  */
+#if 0
+  assert( pFile->pPreallocatedUnused==0
+       || offset>=PENDING_BYTE+512
+       || offset+amt<=PENDING_BYTE 
+  );
+#endif
+
+  UnixIoStat( pFile->ioStats.nRead++ );
+  UnixIoStat( pFile->ioStats.nReadBytes += amt );
+
+#if SQLITE_MAX_MMAP_SIZE>0
+  /* Deal with as much of this read request as possible by transfering
+  ** data from the memory mapping using memcpy().  */
+  if( offset<pFile->mmapSize ){
+    if( offset+amt <= pFile->mmapSize ){
+      memcpy(pBuf, &((u8 *)(pFile->pMapRegion))[offset], amt);
+      UnixIoStat( pFile->ioStats.nMmapRead++ );
+      return SQLITE_OK;
+    }else{
+      int nCopy = pFile->mmapSize - offset;
+      memcpy(pBuf, &((u8 *)(pFile->pMapRegion))[offset], nCopy);
+      pBuf = &((u8 *)pBuf)[nCopy];
+      amt -= nCopy;
+      offset += nCopy;
+    }
+  }
+#endif
+
+  UnixIoStat( pFile->ioStats.nPread++ );
+  unixReadahead(pFile, offset, amt);
+  got = seekAndRead(pFile, offset, pBuf, amt);
+  if( got==amt ){
+    return SQLITE_OK;
+  }else if( got<0 ){
+    /* pFile->lastErrno has been set by seekAndRead(). */
+    return unixReadError(pFile);
   }else{
-    pFile->ctrlFlags |= mask;
+    UnixIoStat( pFile->ioStats.nShortRead++ );
+    storeLastErrno(pFile, 0);   /* not a system error */
+    /* Unread parts of the buffer must be zero-filled */
+    memset(&((char*)pBuf)[got], 0, amt-got);
+    return SQLITE_IOERR_SHORT_READ;
   }
 }
 
-/* Forward declaration */
-static int unixGetTempname(int nBuf, char *zBuf);
+/*
+** The largest number of buffers that unixReadV() and unixWriteV() pass
+** to a single preadv() or pwritev() call.
+*/
+#ifndef SQLITE_UNIX_IOV_MAX
+# define SQLITE_UNIX_IOV_MAX 64
+#endif
 
+#if HAVE_PREADV
 /*
-** Information and control of an open file handle.
-** 有关一个打开文件句柄的信息和控制
+** The largest number of bytes that unixReadV() passes to a single
+** preadv() call.
 */
-static int unixFileControl(sqlite3_file *id, int op, void *pArg){
-  unixFile *pFile = (unixFile*)id;
-  switch( op ){
-#if defined(__linux__) && defined(SQLITE_ENABLE_BATCH_ATOMIC_WRITE)
-    case SQLITE_FCNTL_BEGIN_ATOMIC_WRITE: {
-      int rc = osIoctl(pFile->h, F2FS_IOC_START_ATOMIC_WRITE);
-      return rc ? SQLITE_IOERR_BEGIN_ATOMIC : SQLITE_OK;
-    }
-    case SQLITE_FCNTL_COMMIT_ATOMIC_WRITE: {
-      int rc = osIoctl(pFile->h, F2FS_IOC_COMMIT_ATOMIC_WRITE);
-      return rc ? SQLITE_IOERR_COMMIT_ATOMIC : SQLITE_OK;
-    }
-    case SQLITE_FCNTL_ROLLBACK_ATOMIC_WRITE: {
-      int rc = osIoctl(pFile->h, F2FS_IOC_ABORT_VOLATILE_WRITE);
-      return rc ? SQLITE_IOERR_ROLLBACK_ATOMIC : SQLITE_OK;
-    }
-#endif /* __linux__ && SQLITE_ENABLE_BATCH_ATOMIC_WRITE */
+#ifndef SQLITE_UNIX_READV_MAX
+# define SQLITE_UNIX_READV_MAX (1024*1024)
+#endif
 
-    case SQLITE_FCNTL_LOCKSTATE: {
-      *(int*)pArg = pFile->eFileLock;
-      return SQLITE_OK;
-    }
-    case SQLITE_FCNTL_LAST_ERRNO: {
-      *(int*)pArg = pFile->lastErrno;
-      return SQLITE_OK;
-    }
-    case SQLITE_FCNTL_CHUNK_SIZE: {
-      pFile->szChunk = *(int *)pArg;
-      return SQLITE_OK;
+/*
+** Read the nVec buffers in aVec[] from pFile with preadv().  The buffers
+** are contiguous in the file, starting at aVec[0].iOfst, and there are
+** no more than SQLITE_UNIX_IOV_MAX of them.  Return SQLITE_OK, or an error
+** code as for unixRead().  If end-of-file is reached, the unread parts
+** of the buffers are zero-filled and SQLITE_IOERR_SHORT_READ returned.
+*/
+static int unixReadRun(unixFile *pFile, const sqlite3_io_vec *aVec, int nVec){
+  struct iovec aIov[SQLITE_UNIX_IOV_MAX];
+  struct iovec *pIov = aIov;
+  i64 iOfst = aVec[0].iOfst;
+  int nIov = nVec;
+  int amt = 0;
+  int got = 0;
+  int i;
+
+  assert( nVec>1 && nVec<=SQLITE_UNIX_IOV_MAX );
+  for(i=0; i<nVec; i++){
+    assert( aVec[i].nAmt>0 );
+    assert( i==0 || aVec[i].iOfst==aVec[i-1].iOfst+aVec[i-1].nAmt );
+    aIov[i].iov_base = aVec[i].pBuf;
+    aIov[i].iov_len = aVec[i].nAmt;
+    amt += aVec[i].nAmt;
+  }
+  UnixIoStat( pFile->ioStats.nRead += nVec );
+  UnixIoStat( pFile->ioStats.nReadBytes += amt );
+  UnixIoStat( pFile->ioStats.nPread += nVec );
+  unixReadahead(pFile, iOfst, amt);
+
+  while( amt>0 ){
+#ifndef SQLITE_OMIT_IOSTATS
+    sqlite3_int64 iStart = unixMonotonicNs();
+#endif
+    TIMER_START;
+    do{
+      got = (int)osPreadv(pFile->h, pIov, nIov, iOfst);
+    }while( got<0 && errno==EINTR );
+    SimulateIOError( got = -1 );
+    TIMER_END;
+    OSTRACE(("READV   %-3d %5d %7lld %llu\n",
+             pFile->h, got, iOfst, TIMER_ELAPSED));
+#ifndef SQLITE_OMIT_IOSTATS
+    unixIoStatTime(pFile->ioStats.aReadNs, &pFile->ioStats.nReadNs,
+                   unixMonotonicNs() - iStart);
+#endif
+    if( got<0 ){
+      storeLastErrno(pFile, errno);
+      return unixReadError(pFile);
     }
-    case SQLITE_FCNTL_SIZE_HINT: {
-      int rc;
-      SimulateIOErrorBenign(1);
-      rc = fcntlSizeHint(pFile, *(i64 *)pArg);
-      SimulateIOErrorBenign(0);
-      return rc;
+    if( got==0 ) break;
+    amt -= got;
+    iOfst += got;
+
+    /* Skip the buffers that were filled completely, and the part of the
+    ** first remaining buffer that was filled, if any. */
+    while( nIov>0 && (size_t)got>=pIov->iov_len ){
+      got -= (int)pIov->iov_len;
+      pIov++;
+      nIov--;
     }
-    case SQLITE_FCNTL_PERSIST_WAL: {
-      unixModeBit(pFile, UNIXFILE_PERSIST_WAL, (int*)pArg);
-      return SQLITE_OK;
+    if( nIov>0 ){
+      pIov->iov_base = &((char*)pIov->iov_base)[got];
+      pIov->iov_len -= got;
     }
-    case SQLITE_FCNTL_POWERSAFE_OVERWRITE: {
-      unixModeBit(pFile, UNIXFILE_PSOW, (int*)pArg);
-      return SQLITE_OK;
+  }
+
+  if( amt>0 ){
+    /* Unread parts of the buffers must be zero-filled */
+    UnixIoStat( pFile->ioStats.nShortRead += nIov );
+    storeLastErrno(pFile, 0);   /* not a system error */
+    for(i=0; i<nIov; i++){
+      memset(pIov[i].iov_base, 0, pIov[i].iov_len);
     }
-    case SQLITE_FCNTL_VFSNAME: {
-      *(char**)pArg = sqlite3_mprintf("%s", pFile->pVfs->zName);
-      return SQLITE_OK;
+    return SQLITE_IOERR_SHORT_READ;
+  }
+  return SQLITE_OK;
+}
+#endif /* HAVE_PREADV */
+
+/*
+** Read the nVec buffers in aVec[] from the file, each from its own
+** offset.  Return SQLITE_OK if all of them were read completely.  If an
+** error occurs, stop and return the code unixRead() would have returned.
+** Otherwise, if end-of-file was reached, zero-fill the unread parts of
+** the buffers and return SQLITE_IOERR_SHORT_READ.
+**
+** Buffers that lie entirely within the memory mapping are copied from it.
+** Runs of other buffers that are adjacent in the file, in the order in
+** which they appear in aVec[], are read with a single preadv() call each.
+** Anything else goes through unixRead().
+*/
+static int unixReadV(sqlite3_file *id, const sqlite3_io_vec *aVec, int nVec){
+  unixFile *pFile = (unixFile*)id;
+  int rc = SQLITE_OK;
+  int i = 0;
+
+  assert( id );
+  assert( nVec>=0 );
+  while( i<nVec ){
+    int n = 1;
+    int rc2;
+#if SQLITE_MAX_MMAP_SIZE>0
+    if( aVec[i].iOfst+aVec[i].nAmt<=pFile->mmapSize ){
+      memcpy(aVec[i].pBuf, &((u8*)(pFile->pMapRegion))[aVec[i].iOfst],
+             aVec[i].nAmt);
+      UnixIoStat( pFile->ioStats.nRead++ );
+      UnixIoStat( pFile->ioStats.nReadBytes += aVec[i].nAmt );
+      UnixIoStat( pFile->ioStats.nMmapRead++ );
+      i++;
+      continue;
     }
-    case SQLITE_FCNTL_TEMPFILENAME: {
-      char *zTFile = sqlite3_malloc64( pFile->pVfs->mxPathname );
-      if( zTFile ){
-        unixGetTempname(pFile->pVfs->mxPathname, zTFile);
-        *(char**)pArg = zTFile;
+#endif
+#if HAVE_PREADV
+    {
+      i64 iEnd = aVec[i].iOfst + aVec[i].nAmt;
+      i64 nByte = aVec[i].nAmt;
+#if SQLITE_MAX_MMAP_SIZE>0
+      if( aVec[i].iOfst>=pFile->mmapSize )
+#endif
+      if( !unixIsDirect(pFile) ){
+        while( i+n<nVec && n<SQLITE_UNIX_IOV_MAX
+            && aVec[i+n].iOfst==iEnd
+            && nByte+aVec[i+n].nAmt<=SQLITE_UNIX_READV_MAX
+        ){
+          iEnd += aVec[i+n].nAmt;
+          nByte += aVec[i+n].nAmt;
+          n++;
+        }
       }
-      return SQLITE_OK;
     }
-    case SQLITE_FCNTL_HAS_MOVED: {
-      *(int*)pArg = fileHasMoved(pFile);
-      return SQLITE_OK;
+    if( n>1 ){
+      rc2 = unixReadRun(pFile, &aVec[i], n);
+    }else
+#endif
+    {
+      rc2 = unixRead(id, aVec[i].pBuf, aVec[i].nAmt, aVec[i].iOfst);
     }
-#ifdef SQLITE_ENABLE_SETLK_TIMEOUT
-    case SQLITE_FCNTL_LOCK_TIMEOUT: {
-      int iOld = pFile->iBusyTimeout;
-      pFile->iBusyTimeout = *(int*)pArg;
-      *(int*)pArg = iOld;
-      return SQLITE_OK;
+    if( rc2==SQLITE_IOERR_SHORT_READ ){
+      rc = rc2;
+    }else if( rc2!=SQLITE_OK ){
+      return rc2;
     }
-#endif
-#if SQLITE_MAX_MMAP_SIZE>0
-    case SQLITE_FCNTL_MMAP_SIZE: {
-      i64 newLimit = *(i64*)pArg;
-      int rc = SQLITE_OK;
-      if( newLimit>sqlite3GlobalConfig.mxMmap ){
-        newLimit = sqlite3GlobalConfig.mxMmap;
-      }
+    i += n;
+  }
+  return rc;
+}
 
-      /* The value of newLimit may be eventually cast to (size_t) and passed
-      ** to mmap(). Restrict its value to 2GB if (size_t) is not at least a
-      ** 64-bit type. */
-      if( newLimit>0 && sizeof(size_t)<8 ){
-        newLimit = (newLimit & 0x7FFFFFFF);
-      }
+/*
+** Attempt to seek the file-descriptor passed as the first argument to
+** absolute offset iOff, then attempt to write nBuf bytes of data from
+** pBuf to it. If an error occurs, return -1 and set *piErrno. Otherwise, 
+** return the actual number of bytes written (which may be less than
+** nBuf).
+*/
+static int seekAndWriteFd(
+  int fd,                         /* File descriptor to write to */
+  i64 iOff,                       /* File offset to begin writing at */
+  const void *pBuf,               /* Copy data from this buffer to the file */
+  int nBuf,                       /* Size of buffer pBuf in bytes */
+  int *piErrno                    /* OUT: Error number if error occurs */
+){
+  int rc = 0;                     /* Value returned by system call */
 
-      *(i64*)pArg = pFile->mmapSizeMax;
-      if( newLimit>=0 && newLimit!=pFile->mmapSizeMax && pFile->nFetchOut==0 ){
-        pFile->mmapSizeMax = newLimit;
-        if( pFile->mmapSize>0 ){
-          unixUnmapfile(pFile);
-          rc = unixMapfile(pFile, -1);
-        }
-      }
-      return rc;
+  assert( nBuf==(nBuf&0x1ffff) );
+  assert( fd>2 );
+  assert( piErrno!=0 );
+  nBuf &= 0x1ffff;
+  TIMER_START;
+
+#if defined(USE_PREAD)
+  do{ rc = (int)osPwrite(fd, pBuf, nBuf, iOff); }while( rc<0 && errno==EINTR );
+#elif defined(USE_PREAD64)
+  do{ rc = (int)osPwrite64(fd, pBuf, nBuf, iOff);}while( rc<0 && errno==EINTR);
+#else
+  do{
+    i64 iSeek = lseek(fd, iOff, SEEK_SET);
+    SimulateIOError( iSeek = -1 );
+    if( iSeek<0 ){
+      rc = -1;
+      break;
     }
+    rc = osWrite(fd, pBuf, nBuf);
+  }while( rc<0 && errno==EINTR );
 #endif
 
-  }
-  return SQLITE_NOTFOUND;
+  TIMER_END;
+  OSTRACE(("WRITE   %-3d %5d %7lld %llu\n", fd, rc, iOff, TIMER_ELAPSED));
+
+  if( rc<0 ) *piErrno = errno;
+  return rc;
 }
 
+
 /*
-** If pFd->sectorSize is non-zero when this function is called, it is a
-** no-op. Otherwise, the values of pFd->sectorSize and 
-** pFd->deviceCharacteristics are set according to the file-system 
-** characteristics. 
+** Seek to the offset in id->offset then read cnt bytes into pBuf.
+** Return the number of bytes actually read.  Update the offset.
 **
-** There are two versions of this function. One for QNX and one for all
-** other systems.
+** 用id->offset寻找偏移，然后读取cnt字节到pBuf中。返回实际读取的字节数，更新偏移。
+** To avoid stomping the errno value on a failed write the lastErrno value
+** is set before returning.
+** 为了避免errno的值写入失败，lastErrno的值在返回前被设定。
 */
-#ifndef __QNXNTO__
-static void setDeviceCharacteristics(unixFile *pFd){
-  assert( pFd->deviceCharacteristics==0 || pFd->sectorSize!=0 );
-  if( pFd->sectorSize==0 ){
-#if defined(__linux__) && defined(SQLITE_ENABLE_BATCH_ATOMIC_WRITE)
-    int res;
-    u32 f = 0;
+static int seekAndWrite(unixFile *id, i64 offset, const void *pBuf, int cnt){
+#ifdef SQLITE_UNIX_DIRECT_IO
+  if( unixIsDirect(id) && !unixDirectAligned(id, offset, pBuf, cnt) ){
+    return unixDirectWrite(id, offset, pBuf, cnt);
+  }
+#endif
+#ifndef SQLITE_OMIT_IOSTATS
+  sqlite3_int64 iStart = unixMonotonicNs();
+  int rc = seekAndWriteFd(id->h, offset, pBuf, cnt, &id->lastErrno);
+  unixIoStatTime(id->ioStats.aWriteNs, &id->ioStats.nWriteNs,
+                 unixMonotonicNs() - iStart);
+  return rc;
+#else
+  return seekAndWriteFd(id->h, offset, pBuf, cnt, &id->lastErrno);
+#endif
+}
 
-    /* Check for support for F2FS atomic batch writes. */
-    res = osIoctl(pFd->h, F2FS_IOC_GET_FEATURES, &f);
-    if( res==0 && (f & F2FS_FEATURE_ATOMIC_WRITE) ){
-      pFd->deviceCharacteristics = SQLITE_IOCAP_BATCH_ATOMIC;
-    }
-#endif /* __linux__ && SQLITE_ENABLE_BATCH_ATOMIC_WRITE */
 
-    /* Set the POWERSAFE_OVERWRITE flag if requested. */
-    if( pFd->ctrlFlags & UNIXFILE_PSOW ){
-      pFd->deviceCharacteristics |= SQLITE_IOCAP_POWERSAFE_OVERWRITE;
+/*
+** Write data from a buffer into a file.  Return SQLITE_OK on success
+** or some other error code on failure.
+** 从缓冲区写入数据到一个文件中。成功返回SQLITE_OK或者失败返回一些其他错误代码。
+*/
+static int unixWrite(
+  sqlite3_file *id, 
+  const void *pBuf, 
+  int amt,
+  sqlite3_int64 offset 
+){
+  unixFile *pFile = (unixFile*)id;
+  int wrote = 0;
+  assert( id );
+  assert( amt>0 );
+  UnixIoStat( pFile->ioStats.nWrite++ );
+  UnixIoStat( pFile->ioStats.nWriteBytes += amt );
+
+#if defined(SQLITE_MMAP_READWRITE) && SQLITE_MAX_MMAP_SIZE>0
+  /* Deal with as much of this write request as possible by transfering
+  ** data from the memory mapping using memcpy().  */
+  if( offset<pFile->mmapSize ){
+    if( offset+amt <= pFile->mmapSize ){
+      memcpy(&((u8 *)(pFile->pMapRegion))[offset], pBuf, amt);
+      return SQLITE_OK;
+    }else{
+      int nCopy = pFile->mmapSize - offset;
+      memcpy(&((u8 *)(pFile->pMapRegion))[offset], pBuf, nCopy);
+      pBuf = &((u8 *)pBuf)[nCopy];
+      amt -= nCopy;
+      offset += nCopy;
     }
+  }
+#endif
+ 
+  while( (wrote = seekAndWrite(pFile, offset, pBuf, amt))<amt && wrote>0 ){
+    amt -= wrote;
+    offset += wrote;
+    pBuf = &((char*)pBuf)[wrote];
+  }
+  SimulateIOError(( wrote=(-1), amt=1 ));
+  SimulateDiskfullError(( wrote=0, amt=1 ));
 
-    pFd->sectorSize = SQLITE_DEFAULT_SECTOR_SIZE;
+  if( amt>wrote ){
+    if( wrote<0 && pFile->lastErrno!=ENOSPC ){
+      /* lastErrno set by seekAndWrite */
+      return SQLITE_IOERR_WRITE;
+    }else{
+      storeLastErrno(pFile, 0); /* not a system error */
+      return SQLITE_FULL;
+    }
   }
+
+  return SQLITE_OK;
 }
-#else
-#include <sys/dcmd_blk.h>
-#include <sys/statvfs.h>
-static void setDeviceCharacteristics(unixFile *pFile){
-  if( pFile->sectorSize == 0 ){
-    struct statvfs fsInfo;
-       
-    /* Set defaults for non-supported filesystems */
-    pFile->sectorSize = SQLITE_DEFAULT_SECTOR_SIZE;
-    pFile->deviceCharacteristics = 0;
-    if( fstatvfs(pFile->h, &fsInfo) == -1 ) {
-      return;
+
+#if HAVE_PWRITEV
+/*
+** The largest number of bytes that unixWriteV() passes to a single
+** pwritev() call.
+*/
+#ifndef SQLITE_UNIX_WRITEV_MAX
+# define SQLITE_UNIX_WRITEV_MAX (1024*1024)
+#endif
+
+/*
+** Write the nVec buffers in aVec[] to pFile with pwritev().  The buffers
+** are contiguous in the file, starting at aVec[0].iOfst, and there are
+** no more than SQLITE_UNIX_IOV_MAX of them.  Return SQLITE_OK, or an error
+** code as for unixWrite().
+*/
+static int unixWriteRun(unixFile *pFile, const sqlite3_io_vec *aVec, int nVec){
+  struct iovec aIov[SQLITE_UNIX_IOV_MAX];
+  struct iovec *pIov = aIov;
+  i64 iOfst = aVec[0].iOfst;
+  int nIov = nVec;
+  int amt = 0;
+  int wrote = 0;
+  int i;
+
+  assert( nVec>1 && nVec<=SQLITE_UNIX_IOV_MAX );
+  for(i=0; i<nVec; i++){
+    assert( aVec[i].nAmt>0 );
+    assert( i==0 || aVec[i].iOfst==aVec[i-1].iOfst+aVec[i-1].nAmt );
+    aIov[i].iov_base = aVec[i].pBuf;
+    aIov[i].iov_len = aVec[i].nAmt;
+    amt += aVec[i].nAmt;
+  }
+  UnixIoStat( pFile->ioStats.nWrite += nVec );
+  UnixIoStat( pFile->ioStats.nWriteBytes += amt );
+
+  while( amt>0 ){
+#ifndef SQLITE_OMIT_IOSTATS
+    sqlite3_int64 iStart = unixMonotonicNs();
+#endif
+    TIMER_START;
+    do{
+      wrote = (int)osPwritev(pFile->h, pIov, nIov, iOfst);
+    }while( wrote<0 && errno==EINTR );
+    TIMER_END;
+    OSTRACE(("WRITEV  %-3d %5d %7lld %llu\n",
+             pFile->h, wrote, iOfst, TIMER_ELAPSED));
+#ifndef SQLITE_OMIT_IOSTATS
+    unixIoStatTime(pFile->ioStats.aWriteNs, &pFile->ioStats.nWriteNs,
+                   unixMonotonicNs() - iStart);
+#endif
+    if( wrote<=0 ){
+      if( wrote<0 ) pFile->lastErrno = errno;
+      break;
+    }
+    amt -= wrote;
+    iOfst += wrote;
+
+    /* Skip the buffers that were written completely, and the part of the
+    ** first remaining buffer that was written, if any. */
+    while( nIov>0 && (size_t)wrote>=pIov->iov_len ){
+      wrote -= (int)pIov->iov_len;
+      pIov++;
+      nIov--;
     }
+    if( nIov>0 ){
+      pIov->iov_base = &((char*)pIov->iov_base)[wrote];
+      pIov->iov_len -= wrote;
+    }
+    wrote = 0;
+  }
+  SimulateIOError(( wrote=(-1), amt=1 ));
+  SimulateDiskfullError(( wrote=0, amt=1 ));
 
-    if( !strcmp(fsInfo.f_basetype, "tmp") ) {
-      pFile->sectorSize = fsInfo.f_bsize;
-      pFile->deviceCharacteristics =
-        SQLITE_IOCAP_ATOMIC4K |       /* All ram filesystem writes are atomic */
-        SQLITE_IOCAP_SAFE_APPEND |    /* growing the file does not occur until
-                                      ** the write succeeds */
-        SQLITE_IOCAP_SEQUENTIAL |     /* The ram filesystem has no write behind
-                                      ** so it is ordered */
-        0;
-    }else if( strstr(fsInfo.f_basetype, "etfs") ){
-      pFile->sectorSize = fsInfo.f_bsize;
-      pFile->deviceCharacteristics =
-        /* etfs cluster size writes are atomic */
-        (pFile->sectorSize / 512 * SQLITE_IOCAP_ATOMIC512) |
-        SQLITE_IOCAP_SAFE_APPEND |    /* growing the file does not occur until
-                                      ** the write succeeds */
-        SQLITE_IOCAP_SEQUENTIAL |     /* The ram filesystem has no write behind
-                                      ** so it is ordered */
-        0;
-    }else if( !strcmp(fsInfo.f_basetype, "qnx6") ){
-      pFile->sectorSize = fsInfo.f_bsize;
-      pFile->deviceCharacteristics =
-        SQLITE_IOCAP_ATOMIC |         /* All filesystem writes are atomic */
-        SQLITE_IOCAP_SAFE_APPEND |    /* growing the file does not occur until
-                                      ** the write succeeds */
-        SQLITE_IOCAP_SEQUENTIAL |     /* The ram filesystem has no write behind
-                                      ** so it is ordered */
-        0;
-    }else if( !strcmp(fsInfo.f_basetype, "qnx4") ){
-      pFile->sectorSize = fsInfo.f_bsize;
-      pFile->deviceCharacteristics =
-        /* full bitset of atomics from max sector size and smaller */
-        ((pFile->sectorSize / 512 * SQLITE_IOCAP_ATOMIC512) << 1) - 2 |
-        SQLITE_IOCAP_SEQUENTIAL |     /* The ram filesystem has no write behind
-                                      ** so it is ordered */
-        0;
-    }else if( strstr(fsInfo.f_basetype, "dos") ){
-      pFile->sectorSize = fsInfo.f_bsize;
-      pFile->deviceCharacteristics =
-        /* full bitset of atomics from max sector size and smaller */
-        ((pFile->sectorSize / 512 * SQLITE_IOCAP_ATOMIC512) << 1) - 2 |
-        SQLITE_IOCAP_SEQUENTIAL |     /* The ram filesystem has no write behind
-                                      ** so it is ordered */
-        0;
+  if( amt>0 ){
+    if( wrote<0 && pFile->lastErrno!=ENOSPC ){
+      return SQLITE_IOERR_WRITE;
     }else{
-      pFile->deviceCharacteristics =
-        SQLITE_IOCAP_ATOMIC512 |      /* blocks are atomic */
-        SQLITE_IOCAP_SAFE_APPEND |    /* growing the file does not occur until
-                                      ** the write succeeds */
-        0;
+      storeLastErrno(pFile, 0); /* not a system error */
+      return SQLITE_FULL;
     }
   }
-  /* Last chance verification.  If the sector size isn't a multiple of 512
-  ** then it isn't valid.*/
-  if( pFile->sectorSize % 512 != 0 ){
-    pFile->deviceCharacteristics = 0;
-    pFile->sectorSize = SQLITE_DEFAULT_SECTOR_SIZE;
-  }
+  return SQLITE_OK;
 }
-#endif
+#endif /* HAVE_PWRITEV */
 
 /*
-** Return the sector size in bytes of the underlying block device for
-** the specified file. This is almost always 512 bytes, but may be
-** larger for some devices.
-** 以指定文件的底层块设备来返回扇区大小。这几乎总是512字节，但可能对于一些设备来说更大。
+** Write the nVec buffers in aVec[] to the file, each at its own offset.
+** Return SQLITE_OK if all of them are written, or the error code that
+** unixWrite() returns for the first one that fails.
 **
-** SQLite code assumes this function cannot fail. It also assumes that
-** if two files are created in the same file-system directory (i.e.
-** a database and its journal file) that the sector size will be the
-** same for both.
-** SQLITE代码假设这个函数不会失败。它还假设如果两个文件在相同的文件系统目录中创建（即一个
-** 数据库和它的日志文件）两个扇区大小将一样。
+** Runs of buffers that are adjacent in the file, in the order in which
+** they appear in aVec[], are written with a single pwritev() call each.
+** Buffers that lie within a writable memory mapping, and buffers that
+** are not adjacent to their neighbours, go through unixWrite().
 */
-static int unixSectorSize(sqlite3_file *id){
-  unixFile *pFd = (unixFile*)id;
-  setDeviceCharacteristics(pFd);
-  return pFd->sectorSize;
+static int unixWriteV(sqlite3_file *id, const sqlite3_io_vec *aVec, int nVec){
+  unixFile *pFile = (unixFile*)id;
+  int rc = SQLITE_OK;
+  int i = 0;
+
+  assert( id );
+  assert( nVec>=0 );
+  while( rc==SQLITE_OK && i<nVec ){
+    int n = 1;
+#if HAVE_PWRITEV
+    i64 iEnd = aVec[i].iOfst + aVec[i].nAmt;
+    i64 nByte = aVec[i].nAmt;
+#if defined(SQLITE_MMAP_READWRITE) && SQLITE_MAX_MMAP_SIZE>0
+    if( aVec[i].iOfst>=pFile->mmapSize )
+#endif
+    if( !unixIsDirect(pFile) ){
+      while( i+n<nVec && n<SQLITE_UNIX_IOV_MAX
+          && aVec[i+n].iOfst==iEnd
+          && nByte+aVec[i+n].nAmt<=SQLITE_UNIX_WRITEV_MAX
+      ){
+        iEnd += aVec[i+n].nAmt;
+        nByte += aVec[i+n].nAmt;
+        n++;
+      }
+    }
+    if( n>1 ){
+      rc = unixWriteRun(pFile, &aVec[i], n);
+    }else
+#endif
+    {
+      rc = unixWrite(id, aVec[i].pBuf, aVec[i].nAmt, aVec[i].iOfst);
+    }
+    i += n;
+  }
+  return rc;
 }
 
+
 /*
-** Return the device characteristics for the file.
-** 返回文件的设备特征。
-**
-** This VFS is set up to return SQLITE_IOCAP_POWERSAFE_OVERWRITE by default.
-** However, that choice is controversial since technically the underlying
-** file system does not always provide powersafe overwrites.  (In other
-** words, after a power-loss event, parts of the file that were never
-** written might end up being altered.)  However, non-PSOW behavior is very,
-** very rare.  And asserting PSOW makes a large reduction in the amount
-** of required I/O for journaling, since a lot of padding is eliminated.
-**  Hence, while POWERSAFE_OVERWRITE is on by default, there is a file-control
-** available to turn it off and URI query parameter available to turn it off.
-** 这个VFS设置来默认返回SQLITE_IOCAP_POWERSAFE_OVERWRITE.
-** 但是，这个选择是矛盾的，因为技术上底层文件系统不会总是提供电源安全覆盖。
-** （换句话说，发生停电事件后，部分从来没被写入的文件可能最终被修改。）但是，non-PSOW行为
-** 是非常罕见的。并且声明PSOW使日志的I/O请求数量大量减少，因为很多填充被消除。因此，虽然
-** POWERSAFE_OVERWRITE在默认情况下，但有个文件控制可用来关掉它且URI查询参数可用来关掉它。
+** We do not trust systems to provide a working fdatasync().  Some do.
+** Others do no.  To be safe, we will stick with the (slightly slower)
+** fsync(). If you know that your system does support fdatasync() correctly,
+** then simply compile with -Dfdatasync=fdatasync or -DHAVE_FDATASYNC
+** 我们不相信系统提供一个有效的fdatasync()。有些时这样的，其他的不是。为了安全起见，我们
+** 将坚持（稍慢）fsync()。如果你知道你的系统确实正确的支持fdatasync()，那么用-Dfdatasync=fdatasync
+** 简单地编译
 */
-static int unixDeviceCharacteristics(sqlite3_file *id){
-  unixFile *pFd = (unixFile*)id;
-  setDeviceCharacteristics(pFd);
-  return pFd->deviceCharacteristics;
-}
+#if !defined(fdatasync) && !HAVE_FDATASYNC
+# define fdatasync fsync
+#endif
+
+/*
+** Define HAVE_FULLFSYNC to 0 or 1 depending on whether or not
+** the F_FULLFSYNC macro is defined.  F_FULLFSYNC is currently
+** only available on Mac OS X.  But that could change.
+** 定义HAVE_FULLFSYNC为0或者1取决于F_FULLFSYNC宏是否被定义。F_FULLFSYNC
+** 目前仅在Mac OS X上可用。但可能会改变。
+*/
+#ifdef F_FULLFSYNC
+# define HAVE_FULLFSYNC 1
+#else
+# define HAVE_FULLFSYNC 0
+#endif
 
-#if !defined(SQLITE_OMIT_WAL) || SQLITE_MAX_MMAP_SIZE>0
 
 /*
-** Return the system page size.
+** The fsync() system call does not work as advertised on many
+** unix systems.  The following procedure is an attempt to make
+** it work better.
+** 在很多unix系统上，fsync()系统调用不像广告一样起了作用。下面的程序是为了让
+** 它工作的更好。
 **
-** This function should not be called directly by other code in this file. 
-** Instead, it should be called via macro osGetpagesize().
+** The SQLITE_NO_SYNC macro disables all fsync()s.  This is useful
+** for testing when we want to run through the test suite quickly.
+** You are strongly advised *not* to deploy with SQLITE_NO_SYNC
+** enabled, however, since with SQLITE_NO_SYNC enabled, an OS crash
+** or power failure will likely corrupt the database file.
+** SQLITE_NO_SYNC宏禁用所有fsync()。当我们想快速地运行测试套件的时候，这对测试
+** 是有用的。强烈的建议不再SQLITE_NO_SYNC启用下进行配置，因为启用了SQLITE_NO_SYNC
+** 后，一个操作系统崩溃或者电源故障可能会毁坏数据库文件
+**
+** SQLite sets the dataOnly flag if the size of the file is unchanged.
+** The idea behind dataOnly is that it should only write the file content
+** to disk, not the inode.  We only set dataOnly if the file size is 
+** unchanged since the file size is part of the inode.  However, 
+** Ted Ts'o tells us that fdatasync() will also write the inode if the
+** file size has changed.  The only real difference between fdatasync()
+** and fsync(), Ted tells us, is that fdatasync() will not flush the
+** inode if the mtime or owner or other inode attributes have changed.
+** We only care about the file size, not the other file attributes, so
+** as far as SQLite is concerned, an fdatasync() is always adequate.
+** So, we always use fdatasync() if it is available, regardless of
+** the value of the dataOnly flag.
+** 如果文件的大小不变，SQLITE设置dataOnly标志。
+** dataOnly背后的想法是它应该只写文件内容到磁盘，而不是索引节点。由于文件大小是索引节
+** 的一部分，如果文件大小没变，我们只设置dataOnly。但是，Ted Ts'o告诉我们，fdatasync()也将
+** 写索引结点，如果文件大小已经改变。fdatasync()和fsync()之间唯一真正的区别，Ted告诉我们了，
+** 是fdatasync()不会刷新索引节点，如果mtime或者所有者或者其他索引节点属性已经改变了。
+** 我们只关心文件大小，不是其他文件属性，所以对sqlite而言，一个fdatasync()总是足够的。
+** 所以我们总是只用fdatasync()，如果它是可用的，不管dataOnly标志的值。
 */
-static int unixGetpagesize(void){
+static int full_fsync(int fd, int fullSync, int dataOnly){
+  int rc;
+
+  /* The following "ifdef/elif/else/" block has the same structure as
+  ** the one below. It is replicated here solely to avoid cluttering 
+  ** up the real code with the UNUSED_PARAMETER() macros.
+  ** 下面的，"ifdef/elif/else/"块如下面一个块一样具有相同的结构。它单独地复制在这里
+  ** 避免弄乱真正的带UNUSED_PARAMETER()宏的代码
+  */
+#ifdef SQLITE_NO_SYNC
+  UNUSED_PARAMETER(fd);
+  UNUSED_PARAMETER(fullSync);
+  UNUSED_PARAMETER(dataOnly);
+#elif HAVE_FULLFSYNC
+  UNUSED_PARAMETER(dataOnly);
 #else
-  return (int)sysconf(_SC_PAGESIZE);
+  UNUSED_PARAMETER(fullSync);
+  UNUSED_PARAMETER(dataOnly);
 #endif
-}
 
-#endif /* !defined(SQLITE_OMIT_WAL) || SQLITE_MAX_MMAP_SIZE>0 */
+  /* If we compiled with the SQLITE_NO_SYNC flag, then syncing is a
+  ** no-op.  But go ahead and call fstat() to validate the file
+  ** descriptor as we need a method to provoke a failure during
+  ** coverate testing.
+  ** 如果我们用SQLITE_NO_SYNC标志编译，那么同步是一个空操作。
+  */
+#ifdef SQLITE_NO_SYNC
+  {
+    struct stat buf;
+    rc = osFstat(fd, &buf);
+  }
+#elif HAVE_FULLFSYNC
+  if( fullSync ){
+    rc = osFcntl(fd, F_FULLFSYNC, 0);
+  }else{
+    rc = 1;
+  }
+  /* If the FULLFSYNC failed, fall back to attempting an fsync().
+  ** It shouldn't be possible for fullfsync to fail on the local 
+  ** file system (on OSX), so failure indicates that FULLFSYNC
+  ** isn't supported for this file system. So, attempt an fsync 
+  ** and (for now) ignore the overhead of a superfluous fcntl call.  
+  ** It'd be better to detect fullfsync support once and avoid 
+  ** the fcntl call every time sync is called.
+  ** 如果FULLFSYNC失败，回退尝试一个fsync()。
+  ** fullfsync在本地文件系统（在OSX上）失败，是不该可能的，所以失败表明
+  ** FULLFSYNC不支持这个文件系统。所以，尝试一个fsync，（现在）忽略多余的
+  ** fcntl调用开销。最好检测fullfsync支持一次，避免每次fcntl调用sync被调用。
+  */
+  if( rc ) rc = fsync(fd);
+#else 
+  rc = fdatasync(fd);
 
-#ifndef SQLITE_OMIT_WAL
+#endif /* ifdef SQLITE_NO_SYNC elif HAVE_FULLFSYNC */
+
+  return rc;
+}
 
 /*
-** Object used to represent an shared memory buffer.  
-** 对象用来代表一个共享内存缓冲区
-**
-** When multiple threads all reference the same wal-index, each thread
-** has its own unixShm object, but they all point to a single instance
-** of this unixShmNode object.  In other words, each wal-index is opened
-** only once per process.
-** 当多个线程都引用相同的wal-index索引，每个线程有它自己的unixShm对象，但是它们
-** 都指向这个unixShmNode对象的一个实例。换句话说，每个wal-index每个过程只打开一次。
-**
-** Each unixShmNode object is connected to a single unixInodeInfo object.
-** We could coalesce this object into unixInodeInfo, but that would mean
-** every open file that does not use shared memory (in other words, most
-** open files) would have to carry around this extra information.  So
-** the unixInodeInfo object contains a pointer to this unixShmNode object
-** and the unixShmNode object is created only when needed.
-** 每个unixShmNode对象关联到一个unixInodeInfo对象。我们可以合并这个对象到unixInodeInfo,
-** 但这意味着每一个打开的文件不使用共享内存（换句话说，大多数打开的文件）必须携带这额外的信息
-** 所以这个unixInodeInfo对象包含这个unixShmNode对象的一个指针，且unixShmNode对象仅当需要的时候创建
-**
-** unixMutexHeld() must be true when creating or destroying
-** this object or while reading or writing the following fields:
-** unixMutexHeld()必须为真，当创建或者销毁这个对象时，或当读或写以下字段：
+** Open a file descriptor to the directory containing file zFilename.
+** If successful, *pFd is set to the opened file descriptor and
+** SQLITE_OK is returned. If an error occurs, either SQLITE_NOMEM
+** or SQLITE_CANTOPEN is returned and *pFd is set to an undefined
+** value.
+** 打开一个文件描述符到包含文件zFilename的目录。
+** 如果成功，*pFd设置为打开的文件描述符，SQLITE_OK返回。如果出现错误，SQLITE_NOMEM
+** 或者SQLITE_CANTOPEN返回，*pFd设置一个未定义的值。
 **
-**      nRef
+** The directory file descriptor is used for only one thing - to
+** fsync() a directory to make sure file creation and deletion events
+** are flushed to disk.  Such fsyncs are not needed on newer
+** journaling filesystems, but are required on older filesystems.
+** 目录文件描述符用于只有一件事，fsync()一个目录，确保文件创建和删除事件被刷新到磁盘
+** 这样的fsyncs在更新的日志文件系统不需要，但在旧文件系统需要。
 **
-** The following fields are read-only after the object is created:
-** 以下字段在对象创建之后是只读的。
-** 
-**      hShm
-**      zFilename
+** This routine can be overridden using the xSetSysCall interface.
+** The ability to override this routine was added in support of the
+** chromium sandbox.  Opening a directory is a security risk (we are
+** told) so making it overrideable allows the chromium sandbox to
+** replace this routine with a harmless no-op.  To make this routine
+** a no-op, replace it with a stub that returns SQLITE_OK but leaves
+** *pFd set to a negative number.
+** 这个例程使用xSetSysCall接口可以被覆盖。
+** 覆盖这个例程的能力被增加来支持chromiun浏览器沙箱。打开一个目录是一个安全风险（我们被告知）
+** 所以使他可覆盖允许chromium沙箱用一种无害的空操作来代替这个例程，代之以一个存根，返回
+** SQLITE_OK但是留下*pFd设置为负数。
 **
-** Either unixShmNode.pShmMutex must be held or unixShmNode.nRef==0 and
-** unixMutexHeld() is true when reading or writing any other field
-** in this structure.
-** 要么unixShmNode.mutex互斥必须被持有或unixShmNode.nRef为0，并且当读或写在这个结构体
-** 的任何其他字段时unixMutexHeld()为真
+** If SQLITE_OK is returned, the caller is responsible for closing
+** the file descriptor *pFd using close().
+** 如果SQLITE_OK返回，调用者负责关闭文件描述符*pFd，使用close()。
 */
-struct unixShmNode {
-  unixInodeInfo *pInode;     /* unixInodeInfo that owns this SHM node */ //unixInodeInfo拥有这个SHM节点
-  sqlite3_mutex *pShmMutex;  /* Mutex to access this object */ //互斥访问这个对象
-  char *zFilename;           /* Name of the mmapped file */
-  int hShm;                  /* Open file descriptor */  //打开文件描述符
-  int szRegion;              /* Size of shared-memory regions */ //共享内存区域的大小
-  u16 nRegion;               /* Size of array apRegion */ //数组apRegion大小
-  u8 isReadonly;             /* True if read-only */
-  u8 isUnlocked;             /* True if no DMS lock held */
-  char **apRegion;           /* Array of mapped shared-memory regions */ //映射共享内存区域的数组
-  int nRef;                  /* Number of unixShm objects pointing to this */ //许多unixShm对象指向这一点
-  unixShm *pFirst;           /* All unixShm objects pointing to this */
-  int aLock[SQLITE_SHM_NLOCK];  /* # shared locks on slot, -1==excl lock */
-};
+static int openDirectory(const char *zFilename, int *pFd){
+  int ii;
+  int fd = -1;
+  char zDirname[MAX_PATHNAME+1];
+
+  sqlite3_snprintf(MAX_PATHNAME, zDirname, "%s", zFilename);
+  for(ii=(int)strlen(zDirname); ii>0 && zDirname[ii]!='/'; ii--);
+  if( ii>0 ){
+    zDirname[ii] = '\0';
+  }else{
+    if( zDirname[0]!='/' ) zDirname[0] = '.';
+    zDirname[1] = 0;
+  }
+  fd = robust_open(zDirname, O_RDONLY|O_BINARY, 0);
+  if( fd>=0 ){
+    OSTRACE(("OPENDIR %-3d %s\n", fd, zDirname));
+  }
+  *pFd = fd;
+  if( fd>=0 ) return SQLITE_OK;
+  return unixLogError(SQLITE_CANTOPEN_BKPT, "openDirectory", zDirname);
+}
 
 /*
-** Structure used internally by this VFS to record the state of an
-** open shared memory connection.
-** 这个VFS使用内部的结构体来记录一个打开的共享内存连接的状态
+** Make sure all writes to a particular file are committed to disk.
+** 确保所有的写入到一个特定文件提交到磁盘
 **
-** The following fields are initialized when this object is created and
-** are read-only thereafter:
-** 以下字段被初始化是当这个对象创建时，且之后是只读的。
-**
-**    unixShm.pShmNode
-**    unixShm.id
+** If dataOnly==0 then both the file itself and its metadata (file
+** size, access time, etc) are synced.  If dataOnly!=0 then only the
+** file data is synced.
+** 如果dataOnly==0,那么文件本身及其元数据（文件大小、访问时间等）是同步的。
+** 如果dataOnly != 0，那么只有文件数据是同步的。
 **
-** All other fields are read/write.  The unixShm.pShmNode->pShmMutex must
-** be held while accessing any read/write fields.
-** 所以其他字段是读/写。unixShm.pFile->mutex必须被持有，当访问任何读/写字段。
+** Under Unix, also make sure that the directory entry for the file
+** has been created by fsync-ing the directory that contains the file.
+** If we do not do this and we encounter a power failure, the directory
+** entry for the journal might not exist after we reboot.  The next
+** SQLite to access the file will not know that the journal exists (because
+** the directory entry for the journal was never created) and the transaction
+** will not roll back - possibly leading to database corruption.
+** 在Unix中，也确保文件的目录条目已经通过同步包含文件的目录创建。
+** 如果我们不这么做，我们遇到停电，日志目录条目在我们重启后可能不存在。下一个SQLITE访问
+** 文件将不知道日志存在（因为日志目录条目从未创建），事务不将回滚，可能导致数据库毁坏。
 */
-struct unixShm {
-  unixShmNode *pShmNode;     /* The underlying unixShmNode object */
-                             //底层unixShmNode对象
-  unixShm *pNext;            /* Next unixShm with the same unixShmNode */
-                             //下一个一样的unixShmNode的unixShm
-  u8 hasMutex;               /* True if holding the unixShmNode->pShmMutex */
-                             //如果持有unixShmNode互斥则为真
-  u8 id;                     /* Id of this connection within its unixShmNode */
-                             //unixShmNode内连接的Id
-  u16 sharedMask;            /* Mask of shared locks held */
-                             //持有共享锁掩码
-  u16 exclMask;              /* Mask of exclusive locks held */
-                             //持有排它锁掩码
-};
+static int unixSync(sqlite3_file *id, int flags){
+  int rc;
+  unixFile *pFile = (unixFile*)id;
+
+  int isDataOnly = (flags&SQLITE_SYNC_DATAONLY);
+  int isFullsync = (flags&0x0F)==SQLITE_SYNC_FULL;
+
+  /* Check that one of SQLITE_SYNC_NORMAL or FULL was passed */  //检查SQLITE_SYNC_NORMAL或者FULL的一个通过。
+  assert((flags&0x0F)==SQLITE_SYNC_NORMAL
+      || (flags&0x0F)==SQLITE_SYNC_FULL
+  );
+
+  /* Unix cannot, but some systems may return SQLITE_FULL from here. This
+  ** line is to test that doing so does not cause any problems.
+  ** Unix不能，但是一些系统可能从这里返回SQLITE_FULL。这行用于测试那样做，
+  ** 所以这里不会引起任何问题。
+  */
+  SimulateDiskfullError( return SQLITE_FULL );
+
+  assert( pFile );
+  OSTRACE(("SYNC    %-3d\n", pFile->h));
+#ifndef SQLITE_OMIT_IOSTATS
+  {
+    sqlite3_int64 iStart = unixMonotonicNs();
+    rc = full_fsync(pFile->h, isFullsync, isDataOnly);
+    pFile->ioStats.nSync++;
+    unixIoStatTime(pFile->ioStats.aSyncNs, &pFile->ioStats.nSyncNs,
+                   unixMonotonicNs() - iStart);
+  }
+#else
+  rc = full_fsync(pFile->h, isFullsync, isDataOnly);
+#endif
+  SimulateIOError( rc=1 );
+  if( rc ){
+    storeLastErrno(pFile, errno);
+    return unixLogError(SQLITE_IOERR_FSYNC, "full_fsync", pFile->zPath);
+  }
+
+  /* Also fsync the directory containing the file if the DIRSYNC flag
+  ** is set.  This is a one-time occurrence.  Many systems (examples: AIX)
+  ** are unable to fsync a directory, so ignore errors on the fsync.
+  ** 也同步包含这个文件的目录，如果DIRSYNC标志被设定。这是一次性的发生。很多系统
+  ** （例如：AIX）不能同步一个目录，所以忽略同步错误。
+  */
+  if( pFile->ctrlFlags & UNIXFILE_DIRSYNC ){
+    int dirfd;
+    OSTRACE(("DIRSYNC %s (have_fullfsync=%d fullsync=%d)\n", pFile->zPath,
+            HAVE_FULLFSYNC, isFullsync));
+    rc = osOpenDirectory(pFile->zPath, &dirfd);
+    if( rc==SQLITE_OK ){
+      full_fsync(dirfd, 0, 0);
+      robust_close(pFile, dirfd, __LINE__);
+    }else{
+      assert( rc==SQLITE_CANTOPEN );
+      rc = SQLITE_OK;
+    }
+    pFile->ctrlFlags &= ~UNIXFILE_DIRSYNC;
+  }
+  return rc;
+}
 
 /*
-** Constants used for locking
+** Truncate an open file to a specified size
+** 截断一个打开的文件到指定的大小。
 */
-#define UNIX_SHM_BASE   ((22+SQLITE_SHM_NLOCK)*4)         /* first lock byte */
-#define UNIX_SHM_DMS    (UNIX_SHM_BASE+SQLITE_SHM_NLOCK)  /* deadman switch */
+static int unixTruncate(sqlite3_file *id, i64 nByte){
+  unixFile *pFile = (unixFile *)id;
+  int rc;
+  assert( pFile );
+  SimulateIOError( return SQLITE_IOERR_TRUNCATE );
+
+  /* If the user has configured a chunk-size for this file, truncate the
+  ** file so that it consists of an integer number of chunks (i.e. the
+  ** actual file size after the operation may be larger than the requested
+  ** size).
+  ** 如果用户已经配置了这个文件的块的大小，截断文件以便于包含整数的块（即操作之后的实际文件
+  ** 大小可能已经大于请求的大小）
+  */
+  if( pFile->szChunk>0 ){
+    nByte = ((nByte + pFile->szChunk - 1)/pFile->szChunk) * pFile->szChunk;
+  }
+
+  UnixIoStat( pFile->ioStats.nTruncate++ );
+  rc = robust_ftruncate(pFile->h, nByte);
+  if( rc ){
+    storeLastErrno(pFile, errno);
+    return unixLogError(SQLITE_IOERR_TRUNCATE, "ftruncate", pFile->zPath);
+  }else{
+
+#if SQLITE_MAX_MMAP_SIZE>0
+    /* If the file was just truncated to a size smaller than the currently
+    ** mapped region, reduce the effective mapping size as well. SQLite will
+    ** use read() and write() to access data beyond this point from now on.  
+    */
+    if( nByte<pFile->mmapSize ){
+      pFile->mmapSize = nByte;
+    }
+#endif
+
+    return SQLITE_OK;
+  }
+}
 
 /*
-** Apply posix advisory locks for all bytes from ofst through ofst+n-1.
-**
-** Locks block if the mask is exactly UNIX_SHM_C and are non-blocking
-** otherwise.
+** Determine the current size of a file in bytes
+** 确定当前文件的大小，字节为单位
 */
-static int unixShmSystemLock(
-  unixFile *pFile,       /* Open connection to the WAL file */
-  int lockType,          /* F_UNLCK, F_RDLCK, or F_WRLCK */
-  int ofst,              /* First byte of the locking range */
-  int n                  /* Number of bytes to lock */
-){
-  unixShmNode *pShmNode; /* Apply locks to this open shared-memory segment */
-  struct flock f;        /* The posix advisory locking structure */
-  int rc = SQLITE_OK;    /* Result code form fcntl() */
+static int unixFileSize(sqlite3_file *id, i64 *pSize){
+  int rc;
+  struct stat buf;
+  assert( id );
+  rc = osFstat(((unixFile*)id)->h, &buf);
+  SimulateIOError( rc=1 );
+  if( rc!=0 ){
+    storeLastErrno((unixFile*)id, errno);
+    return SQLITE_IOERR_FSTAT;
+  }
+  *pSize = buf.st_size;
 
-  /* Access to the unixShmNode object is serialized by the caller */
-  pShmNode = pFile->pInode->pShmNode;
-  assert( pShmNode->nRef==0 || sqlite3_mutex_held(pShmNode->pShmMutex) );
-  assert( pShmNode->nRef>0 || unixMutexHeld() );
+  /* When opening a zero-size database, the findInodeInfo() procedure
+  ** writes a single byte into that file in order to work around a bug
+  ** in the OS-X msdos filesystem.  In order to avoid problems with upper
+  ** layers, we need to report this file size as zero even though it is
+  ** really 1.   Ticket #3260.
+  ** 当打开一个大小为0的数据库，findInodeInfo()程序将一个字节写入该文件为了解决一个
+  ** 在OS-X msdos文件系统上的错误。为了避免上面的问题，我们需要报告这个文件大小为0，
+  ** 即使它真是1。 标签#3260
+  */
+  if( *pSize==1 ) *pSize = 0;
 
-  /* Shared locks never span more than one byte */
-  assert( n==1 || lockType!=F_RDLCK );
 
-  /* Locks are within range */
-  assert( n>=1 && n<=SQLITE_SHM_NLOCK );
+  return SQLITE_OK;
+}
 
-  if( pShmNode->hShm>=0 ){
-    int res;
-    /* Initialize the locking parameters */
-    f.l_type = lockType;
-    f.l_whence = SEEK_SET;
-    f.l_start = ofst;
-    f.l_len = n;
-    res = osSetPosixAdvisoryLock(pShmNode->hShm, &f, pFile);
-    if( res==-1 ){
-#ifdef SQLITE_ENABLE_SETLK_TIMEOUT
-      rc = (pFile->iBusyTimeout ? SQLITE_BUSY_TIMEOUT : SQLITE_BUSY);
+/* 
+** This function is called to handle the SQLITE_FCNTL_SIZE_HINT 
+** file-control operation.  Enlarge the database to nBytes in size
+** (rounded up to the next chunk-size).  If the database is already
+** nBytes or larger, this routine is a no-op.
+** 调用这个函数来处理SQLITE_FCNTL_SIZE_HIN文件控制操作。扩大数据库到nBytes大小
+** （算到下一个块大小）。如果数据库已经nBytes或者更大，这个例程是一个空操作。
+*/
+static int fcntlSizeHint(unixFile *pFile, i64 nByte){
+  if( pFile->szChunk>0 ){
+    i64 nSize;                    /* Required file size ，请求文件大小*/
+    struct stat buf;              /* Used to hold return values of fstat() ，用来保存fstat()返回值*/
+   
+    if( osFstat(pFile->h, &buf) ){
+      return SQLITE_IOERR_FSTAT;
+    }
+
+    nSize = ((nByte+pFile->szChunk-1) / pFile->szChunk) * pFile->szChunk;
+    if( nSize>(i64)buf.st_size ){
+
+#if defined(HAVE_POSIX_FALLOCATE) && HAVE_POSIX_FALLOCATE
+      /* The code below is handling the return value of osFallocate() 
+      ** correctly. posix_fallocate() is defined to "returns zero on success, 
+      ** or an error number on  failure". See the manpage for details. */
+      int err;
+      do{
+        err = osFallocate(pFile->h, buf.st_size, nSize-buf.st_size);
+      }while( err==EINTR );
+      if( err && err!=EINVAL ) return SQLITE_IOERR_WRITE;
 #else
-      rc = SQLITE_BUSY;
+      /* If the OS does not have posix_fallocate(), fake it. Write a 
+      ** single byte to the last byte in each block that falls entirely
+      ** within the extended region. Then, if required, a single byte
+      ** at offset (nSize-1), to set the size of the file correctly.
+      ** This is a similar technique to that used by glibc on systems
+      ** that do not have a real fallocate() call.
+      */
+      int nBlk = buf.st_blksize;  /* File-system block size */
+      int nWrite = 0;             /* Number of bytes written by seekAndWrite */
+      i64 iWrite;                 /* Next offset to write to */
+
+      iWrite = (buf.st_size/nBlk)*nBlk + nBlk - 1;
+      assert( iWrite>=buf.st_size );
+      assert( ((iWrite+1)%nBlk)==0 );
+      for(/*no-op*/; iWrite<nSize+nBlk-1; iWrite+=nBlk ){
+        if( iWrite>=nSize ) iWrite = nSize - 1;
+        nWrite = seekAndWrite(pFile, iWrite, "", 1);
+        if( nWrite!=1 ) return SQLITE_IOERR_WRITE;
+      }
 #endif
     }
   }
 
-  return rc;        
+#if SQLITE_MAX_MMAP_SIZE>0
+  if( pFile->mmapSizeMax>0 && nByte>pFile->mmapSize ){
+    int rc;
+    if( pFile->szChunk<=0 ){
+      if( robust_ftruncate(pFile->h, nByte) ){
+        storeLastErrno(pFile, errno);
+        return unixLogError(SQLITE_IOERR_TRUNCATE, "ftruncate", pFile->zPath);
+      }
+    }
+
+    rc = unixMapfile(pFile, nByte);
+    return rc;
+  }
+#endif
+
+  return SQLITE_OK;
 }
 
 /*
-** Return the minimum number of 32KB shm regions that should be mapped at
-** a time, assuming that each mapping must be an integer multiple of the
+** If *pArg is initially negative then this is a query.  Set *pArg to
+** 1 or 0 depending on whether or not bit mask of pFile->ctrlFlags is set.
+** 如果*pArg初始是负的，那么这是一个查询。设置*pArg为1或者0取决于是否pFile->ctrlFlags
+** 位屏蔽被设置。
+**
+** If *pArg is 0 or 1, then clear or set the mask bit of pFile->ctrlFlags.
+** 如果*pArg为0或者1，那么清除或者设置pFile->ctrlFlags屏蔽位。
+*/
+static void unixModeBit(unixFile *pFile, unsigned short mask, int *pArg){
+  if( *pArg<0 ){
+    *pArg = (pFile->ctrlFlags & mask)!=0;
+  }else if( (*pArg)==0 ){
+    pFile->ctrlFlags &= ~mask;
+  }else{
+    pFile->ctrlFlags |= mask;
+  }
+}
+
+/* Forward declaration */
+static int unixGetTempname(int nBuf, char *zBuf);
+
+/*
+** Information and control of an open file handle.
+** 有关一个打开文件句柄的信息和控制
+*/
+static int unixFileControl(sqlite3_file *id, int op, void *pArg){
+  unixFile *pFile = (unixFile*)id;
+  switch( op ){
+#if defined(__linux__) && defined(SQLITE_ENABLE_BATCH_ATOMIC_WRITE)
+    case SQLITE_FCNTL_BEGIN_ATOMIC_WRITE: {
+      int rc = osIoctl(pFile->h, F2FS_IOC_START_ATOMIC_WRITE);
+      return rc ? SQLITE_IOERR_BEGIN_ATOMIC : SQLITE_OK;
+    }
+    case SQLITE_FCNTL_COMMIT_ATOMIC_WRITE: {
+      int rc = osIoctl(pFile->h, F2FS_IOC_COMMIT_ATOMIC_WRITE);
+      return rc ? SQLITE_IOERR_COMMIT_ATOMIC : SQLITE_OK;
+    }
+    case SQLITE_FCNTL_ROLLBACK_ATOMIC_WRITE: {
+      int rc = osIoctl(pFile->h, F2FS_IOC_ABORT_VOLATILE_WRITE);
+      return rc ? SQLITE_IOERR_ROLLBACK_ATOMIC : SQLITE_OK;
+    }
+#endif /* __linux__ && SQLITE_ENABLE_BATCH_ATOMIC_WRITE */
+
+    case SQLITE_FCNTL_LOCKSTATE: {
+      *(int*)pArg = pFile->eFileLock;
+      return SQLITE_OK;
+    }
+    case SQLITE_FCNTL_LAST_ERRNO: {
+      *(int*)pArg = pFile->lastErrno;
+      return SQLITE_OK;
+    }
+    case SQLITE_FCNTL_CHUNK_SIZE: {
+      pFile->szChunk = *(int *)pArg;
+      return SQLITE_OK;
+    }
+    case SQLITE_FCNTL_SIZE_HINT: {
+      int rc;
+      SimulateIOErrorBenign(1);
+      rc = fcntlSizeHint(pFile, *(i64 *)pArg);
+      SimulateIOErrorBenign(0);
+      return rc;
+    }
+    case SQLITE_FCNTL_PERSIST_WAL: {
+      unixModeBit(pFile, UNIXFILE_PERSIST_WAL, (int*)pArg);
+      return SQLITE_OK;
+    }
+    case SQLITE_FCNTL_POWERSAFE_OVERWRITE: {
+      unixModeBit(pFile, UNIXFILE_PSOW, (int*)pArg);
+      return SQLITE_OK;
+    }
+    case SQLITE_FCNTL_SHARED_LEASE: {
+      unixModeBit(pFile, UNIXFILE_LEASE, (int*)pArg);
+      return SQLITE_OK;
+    }
+#ifndef SQLITE_OMIT_IOSTATS
+    case SQLITE_FCNTL_IOSTATS: {
+      if( pArg ){
+        *(sqlite3_io_stats*)pArg = pFile->ioStats;
+      }else{
+        memset(&pFile->ioStats, 0, sizeof(pFile->ioStats));
+      }
+      return SQLITE_OK;
+    }
+#endif
+#if HAVE_POSIX_FADVISE
+    case SQLITE_FCNTL_READAHEAD: {
+      sqlite3_readahead *p = (sqlite3_readahead*)pArg;
+      if( p->ePolicy>SQLITE_READAHEAD_RANDOM ) return SQLITE_ERROR;
+      if( p->ePolicy>=0 && p->ePolicy!=pFile->ra.ePolicy
+       && !unixIsDirect(pFile)
+      ){
+        pFile->ra.ePolicy = p->ePolicy;
+        pFile->nRaRun = 0;
+        unixReadaheadAdvise(pFile, SQLITE_READAHEAD_OFF);
+      }
+      if( p->nWindow>=0 ){
+        pFile->ra.nWindow = p->nWindow;
+        pFile->iRaEnd = 0;
+      }
+      *p = pFile->ra;
+      return SQLITE_OK;
+    }
+#endif
+#ifdef SQLITE_ENABLE_LOCK_STATUS
+    case SQLITE_FCNTL_LOCK_STATUS: {
+      *(sqlite3_lock_stats*)pArg = pFile->lockStats;
+      return SQLITE_OK;
+    }
+#endif
+    case SQLITE_FCNTL_VFSNAME: {
+      *(char**)pArg = sqlite3_mprintf("%s", pFile->pVfs->zName);
+      return SQLITE_OK;
+    }
+    case SQLITE_FCNTL_TEMPFILENAME: {
+      char *zTFile = sqlite3_malloc64( pFile->pVfs->mxPathname );
+      if( zTFile ){
+        unixGetTempname(pFile->pVfs->mxPathname, zTFile);
+        *(char**)pArg = zTFile;
+      }
+      return SQLITE_OK;
+    }
+    case SQLITE_FCNTL_HAS_MOVED: {
+      *(int*)pArg = fileHasMoved(pFile);
+      return SQLITE_OK;
+    }
+#ifdef SQLITE_ENABLE_SETLK_TIMEOUT
+    case SQLITE_FCNTL_LOCK_TIMEOUT: {
+      int iOld = pFile->iBusyTimeout;
+      pFile->iBusyTimeout = *(int*)pArg;
+      *(int*)pArg = iOld;
+      return SQLITE_OK;
+    }
+#endif
+#if SQLITE_MAX_MMAP_SIZE>0
+    case SQLITE_FCNTL_MMAP_SIZE: {
+      i64 newLimit = *(i64*)pArg;
+      int rc = SQLITE_OK;
+      if( newLimit>sqlite3GlobalConfig.mxMmap ){
+        newLimit = sqlite3GlobalConfig.mxMmap;
+      }
+
+      /* The value of newLimit may be eventually cast to (size_t) and passed
+      ** to mmap(). Restrict its value to 2GB if (size_t) is not at least a
+      ** 64-bit type. */
+      if( newLimit>0 && sizeof(size_t)<8 ){
+        newLimit = (newLimit & 0x7FFFFFFF);
+      }
+
+      /* Reading a direct I/O file through a mapping would fill the page
+      ** cache that direct I/O is used to avoid. */
+      if( unixIsDirect(pFile) ) newLimit = 0;
+
+      *(i64*)pArg = pFile->mmapSizeMax;
+      if( newLimit>=0 && newLimit!=pFile->mmapSizeMax && pFile->nFetchOut==0 ){
+        pFile->mmapSizeMax = newLimit;
+        if( pFile->mmapSize>0 ){
+          unixUnmapfile(pFile);
+          rc = unixMapfile(pFile, -1);
+        }
+      }
+      return rc;
+    }
+#endif
+
+  }
+  return SQLITE_NOTFOUND;
+}
+
+/*
+** If pFd->sectorSize is non-zero when this function is called, it is a
+** no-op. Otherwise, the values of pFd->sectorSize and 
+** pFd->deviceCharacteristics are set according to the file-system 
+** characteristics. 
+**
+** There are two versions of this function. One for QNX and one for all
+** other systems.
+*/
+#ifndef __QNXNTO__
+static void setDeviceCharacteristics(unixFile *pFd){
+  assert( pFd->deviceCharacteristics==0 || pFd->sectorSize!=0 );
+  if( pFd->sectorSize==0 ){
+#if defined(__linux__) && defined(SQLITE_ENABLE_BATCH_ATOMIC_WRITE)
+    int res;
+    u32 f = 0;
+
+    /* Check for support for F2FS atomic batch writes. */
+    res = osIoctl(pFd->h, F2FS_IOC_GET_FEATURES, &f);
+    if( res==0 && (f & F2FS_FEATURE_ATOMIC_WRITE) ){
+      pFd->deviceCharacteristics = SQLITE_IOCAP_BATCH_ATOMIC;
+    }
+#endif /* __linux__ && SQLITE_ENABLE_BATCH_ATOMIC_WRITE */
+
+    /* Set the POWERSAFE_OVERWRITE flag if requested. */
+    if( pFd->ctrlFlags & UNIXFILE_PSOW ){
+      pFd->deviceCharacteristics |= SQLITE_IOCAP_POWERSAFE_OVERWRITE;
+    }
+
+    pFd->sectorSize = SQLITE_DEFAULT_SECTOR_SIZE;
+#ifdef SQLITE_UNIX_DIRECT_IO
+    /* Direct I/O is done in units of the logical block size. */
+    if( unixIsDirect(pFd) ) pFd->sectorSize = pFd->szDirect;
+#endif
+  }
+}
+#else
+#include <sys/dcmd_blk.h>
+#include <sys/statvfs.h>
+static void setDeviceCharacteristics(unixFile *pFile){
+  if( pFile->sectorSize == 0 ){
+    struct statvfs fsInfo;
+       
+    /* Set defaults for non-supported filesystems */
+    pFile->sectorSize = SQLITE_DEFAULT_SECTOR_SIZE;
+    pFile->deviceCharacteristics = 0;
+    if( fstatvfs(pFile->h, &fsInfo) == -1 ) {
+      return;
+    }
+
+    if( !strcmp(fsInfo.f_basetype, "tmp") ) {
+      pFile->sectorSize = fsInfo.f_bsize;
+      pFile->deviceCharacteristics =
+        SQLITE_IOCAP_ATOMIC4K |       /* All ram filesystem writes are atomic */
+        SQLITE_IOCAP_SAFE_APPEND |    /* growing the file does not occur until
+                                      ** the write succeeds */
+        SQLITE_IOCAP_SEQUENTIAL |     /* The ram filesystem has no write behind
+                                      ** so it is ordered */
+        0;
+    }else if( strstr(fsInfo.f_basetype, "etfs") ){
+      pFile->sectorSize = fsInfo.f_bsize;
+      pFile->deviceCharacteristics =
+        /* etfs cluster size writes are atomic */
+        (pFile->sectorSize / 512 * SQLITE_IOCAP_ATOMIC512) |
+        SQLITE_IOCAP_SAFE_APPEND |    /* growing the file does not occur until
+                                      ** the write succeeds */
+        SQLITE_IOCAP_SEQUENTIAL |     /* The ram filesystem has no write behind
+                                      ** so it is ordered */
+        0;
+    }else if( !strcmp(fsInfo.f_basetype, "qnx6") ){
+      pFile->sectorSize = fsInfo.f_bsize;
+      pFile->deviceCharacteristics =
+        SQLITE_IOCAP_ATOMIC |         /* All filesystem writes are atomic */
+        SQLITE_IOCAP_SAFE_APPEND |    /* growing the file does not occur until
+                                      ** the write succeeds */
+        SQLITE_IOCAP_SEQUENTIAL |     /* The ram filesystem has no write behind
+                                      ** so it is ordered */
+        0;
+    }else if( !strcmp(fsInfo.f_basetype, "qnx4") ){
+      pFile->sectorSize = fsInfo.f_bsize;
+      pFile->deviceCharacteristics =
+        /* full bitset of atomics from max sector size and smaller */
+        ((pFile->sectorSize / 512 * SQLITE_IOCAP_ATOMIC512) << 1) - 2 |
+        SQLITE_IOCAP_SEQUENTIAL |     /* The ram filesystem has no write behind
+                                      ** so it is ordered */
+        0;
+    }else if( strstr(fsInfo.f_basetype, "dos") ){
+      pFile->sectorSize = fsInfo.f_bsize;
+      pFile->deviceCharacteristics =
+        /* full bitset of atomics from max sector size and smaller */
+        ((pFile->sectorSize / 512 * SQLITE_IOCAP_ATOMIC512) << 1) - 2 |
+        SQLITE_IOCAP_SEQUENTIAL |     /* The ram filesystem has no write behind
+                                      ** so it is ordered */
+        0;
+    }else{
+      pFile->deviceCharacteristics =
+        SQLITE_IOCAP_ATOMIC512 |      /* blocks are atomic */
+        SQLITE_IOCAP_SAFE_APPEND |    /* growing the file does not occur until
+                                      ** the write succeeds */
+        0;
+    }
+  }
+  /* Last chance verification.  If the sector size isn't a multiple of 512
+  ** then it isn't valid.*/
+  if( pFile->sectorSize % 512 != 0 ){
+    pFile->deviceCharacteristics = 0;
+    pFile->sectorSize = SQLITE_DEFAULT_SECTOR_SIZE;
+  }
+}
+#endif
+
+/*
+** Return the sector size in bytes of the underlying block device for
+** the specified file. This is almost always 512 bytes, but may be
+** larger for some devices.
+** 以指定文件的底层块设备来返回扇区大小。这几乎总是512字节，但可能对于一些设备来说更大。
+**
+** SQLite code assumes this function cannot fail. It also assumes that
+** if two files are created in the same file-system directory (i.e.
+** a database and its journal file) that the sector size will be the
+** same for both.
+** SQLITE代码假设这个函数不会失败。它还假设如果两个文件在相同的文件系统目录中创建（即一个
+** 数据库和它的日志文件）两个扇区大小将一样。
+*/
+static int unixSectorSize(sqlite3_file *id){
+  unixFile *pFd = (unixFile*)id;
+  setDeviceCharacteristics(pFd);
+  return pFd->sectorSize;
+}
+
+/*
+** Return the device characteristics for the file.
+** 返回文件的设备特征。
+**
+** This VFS is set up to return SQLITE_IOCAP_POWERSAFE_OVERWRITE by default.
+** However, that choice is controversial since technically the underlying
+** file system does not always provide powersafe overwrites.  (In other
+** words, after a power-loss event, parts of the file that were never
+** written might end up being altered.)  However, non-PSOW behavior is very,
+** very rare.  And asserting PSOW makes a large reduction in the amount
+** of required I/O for journaling, since a lot of padding is eliminated.
+**  Hence, while POWERSAFE_OVERWRITE is on by default, there is a file-control
+** available to turn it off and URI query parameter available to turn it off.
+** 这个VFS设置来默认返回SQLITE_IOCAP_POWERSAFE_OVERWRITE.
+** 但是，这个选择是矛盾的，因为技术上底层文件系统不会总是提供电源安全覆盖。
+** （换句话说，发生停电事件后，部分从来没被写入的文件可能最终被修改。）但是，non-PSOW行为
+** 是非常罕见的。并且声明PSOW使日志的I/O请求数量大量减少，因为很多填充被消除。因此，虽然
+** POWERSAFE_OVERWRITE在默认情况下，但有个文件控制可用来关掉它且URI查询参数可用来关掉它。
+*/
+static int unixDeviceCharacteristics(sqlite3_file *id){
+  unixFile *pFd = (unixFile*)id;
+  setDeviceCharacteristics(pFd);
+  return pFd->deviceCharacteristics;
+}
+
+#if !defined(SQLITE_OMIT_WAL) || SQLITE_MAX_MMAP_SIZE>0
+
+/*
+** Return the system page size.
+**
+** This function should not be called directly by other code in this file. 
+** Instead, it should be called via macro osGetpagesize().
+*/
+static int unixGetpagesize(void){
+#else
+  return (int)sysconf(_SC_PAGESIZE);
+#endif
+}
+
+#endif /* !defined(SQLITE_OMIT_WAL) || SQLITE_MAX_MMAP_SIZE>0 */
+
+#ifndef SQLITE_OMIT_WAL
+
+/*
+** Object used to represent an shared memory buffer.  
+** 对象用来代表一个共享内存缓冲区
+**
+** When multiple threads all reference the same wal-index, each thread
+** has its own unixShm object, but they all point to a single instance
+** of this unixShmNode object.  In other words, each wal-index is opened
+** only once per process.
+** 当多个线程都引用相同的wal-index索引，每个线程有它自己的unixShm对象，但是它们
+** 都指向这个unixShmNode对象的一个实例。换句话说，每个wal-index每个过程只打开一次。
+**
+** Each unixShmNode object is connected to a single unixInodeInfo object.
+** We could coalesce this object into unixInodeInfo, but that would mean
+** every open file that does not use shared memory (in other words, most
+** open files) would have to carry around this extra information.  So
+** the unixInodeInfo object contains a pointer to this unixShmNode object
+** and the unixShmNode object is created only when needed.
+** 每个unixShmNode对象关联到一个unixInodeInfo对象。我们可以合并这个对象到unixInodeInfo,
+** 但这意味着每一个打开的文件不使用共享内存（换句话说，大多数打开的文件）必须携带这额外的信息
+** 所以这个unixInodeInfo对象包含这个unixShmNode对象的一个指针，且unixShmNode对象仅当需要的时候创建
+**
+** The mutex of the inode table shard that pInode belongs to must be held
+** when creating or destroying this object or while reading or writing
+** the following fields:
+** 当创建或者销毁这个对象时，或当读或写以下字段时，必须持有pInode所属的inode表分片的互斥锁：
+**
+**      nRef
+**
+** The following fields are read-only after the object is created:
+** 以下字段在对象创建之后是只读的。
+** 
+**      hShm
+**      zFilename
+**
+** Either unixShmNode.pShmMutex must be held or unixShmNode.nRef==0 and
+** the inode table shard mutex is held when reading or writing any other
+** field in this structure.
+** 当读或写在这个结构体的任何其他字段时，要么unixShmNode.pShmMutex必须被持有，
+** 要么unixShmNode.nRef为0并且持有inode表分片的互斥锁
+**
+** The exception is aLock[].  Its elements are only accessed using atomic
+** operations, and a count of shared locks that is greater than zero may
+** be incremented, or decremented to no less than one, without holding
+** pShmMutex.  See unixShmLockFast().  Moving an element to or from zero
+** still requires pShmMutex, along with the matching fcntl() call.
+*/
+struct unixShmNode {
+  unixInodeInfo *pInode;     /* unixInodeInfo that owns this SHM node */ //unixInodeInfo拥有这个SHM节点
+  sqlite3_mutex *pShmMutex;  /* Mutex to access this object */ //互斥访问这个对象
+  char *zFilename;           /* Name of the mmapped file */
+  int hShm;                  /* Open file descriptor */  //打开文件描述符
+  int szRegion;              /* Size of shared-memory regions */ //共享内存区域的大小
+  u16 nRegion;               /* Size of array apRegion */ //数组apRegion大小
+  u8 isReadonly;             /* True if read-only */
+  u8 isUnlocked;             /* True if no DMS lock held */
+  char **apRegion;           /* Array of mapped shared-memory regions */ //映射共享内存区域的数组
+  int nRef;                  /* Number of unixShm objects pointing to this */ //许多unixShm对象指向这一点
+  unixShm *pFirst;           /* All unixShm objects pointing to this */
+  int aLock[SQLITE_SHM_NLOCK];  /* # shared locks on slot, -1==excl lock */
+                                /* Accessed atomically. See above */
+};
+
+/*
+** Structure used internally by this VFS to record the state of an
+** open shared memory connection.
+** 这个VFS使用内部的结构体来记录一个打开的共享内存连接的状态
+**
+** The following fields are initialized when this object is created and
+** are read-only thereafter:
+** 以下字段被初始化是当这个对象创建时，且之后是只读的。
+**
+**    unixShm.pShmNode
+**    unixShm.id
+**
+** All other fields are read/write.  The unixShm.pShmNode->pShmMutex must
+** be held while accessing any read/write fields, except for sharedMask
+** and exclMask.  These are only ever accessed by the thread using the
+** connection, so they may be read or written without holding pShmMutex.
+** 所以其他字段是读/写。unixShm.pFile->mutex必须被持有，当访问任何读/写字段。
+*/
+struct unixShm {
+  unixShmNode *pShmNode;     /* The underlying unixShmNode object */
+                             //底层unixShmNode对象
+  unixShm *pNext;            /* Next unixShm with the same unixShmNode */
+                             //下一个一样的unixShmNode的unixShm
+  u8 hasMutex;               /* True if holding the unixShmNode->pShmMutex */
+                             //如果持有unixShmNode互斥则为真
+  u8 id;                     /* Id of this connection within its unixShmNode */
+                             //unixShmNode内连接的Id
+  u16 sharedMask;            /* Mask of shared locks held */
+                             //持有共享锁掩码
+  u16 exclMask;              /* Mask of exclusive locks held */
+                             //持有排它锁掩码
+};
+
+/*
+** Constants used for locking
+*/
+#define UNIX_SHM_BASE   ((22+SQLITE_SHM_NLOCK)*4)         /* first lock byte */
+#define UNIX_SHM_DMS    (UNIX_SHM_BASE+SQLITE_SHM_NLOCK)  /* deadman switch */
+
+/*
+** Apply posix advisory locks for all bytes from ofst through ofst+n-1.
+**
+** Locks block if the mask is exactly UNIX_SHM_C and are non-blocking
+** otherwise.
+*/
+static int unixShmSystemLock(
+  unixFile *pFile,       /* Open connection to the WAL file */
+  int lockType,          /* F_UNLCK, F_RDLCK, or F_WRLCK */
+  int ofst,              /* First byte of the locking range */
+  int n                  /* Number of bytes to lock */
+){
+  unixShmNode *pShmNode; /* Apply locks to this open shared-memory segment */
+  struct flock f;        /* The posix advisory locking structure */
+  int rc = SQLITE_OK;    /* Result code form fcntl() */
+
+  /* Access to the unixShmNode object is serialized by the caller */
+  pShmNode = pFile->pInode->pShmNode;
+  assert( pShmNode->nRef==0 || sqlite3_mutex_held(pShmNode->pShmMutex) );
+  assert( pShmNode->nRef>0 || unixInodeMutexHeld(pFile->pInode) );
+
+  /* Shared locks never span more than one byte */
+  assert( n==1 || lockType!=F_RDLCK );
+
+  /* Locks are within range */
+  assert( n>=1 && n<=SQLITE_SHM_NLOCK );
+
+  if( pShmNode->hShm>=0 ){
+    int res;
+    /* Initialize the locking parameters */
+    f.l_type = lockType;
+    f.l_whence = SEEK_SET;
+    f.l_start = ofst;
+    f.l_len = n;
+    UnixLockStat( pFile->lockStats.nShmFcntl++ );
+    res = osSetPosixAdvisoryLock(pShmNode->hShm, &f, pFile);
+    if( res==-1 ){
+#ifdef SQLITE_ENABLE_SETLK_TIMEOUT
+      rc = (pFile->iBusyTimeout ? SQLITE_BUSY_TIMEOUT : SQLITE_BUSY);
+#else
+      rc = SQLITE_BUSY;
+#endif
+    }
+  }
+
+  return rc;        
+}
+
+/*
+** Return the minimum number of 32KB shm regions that should be mapped at
+** a time, assuming that each mapping must be an integer multiple of the
 ** current system page-size.
 **
-** Usually, this is 1. The exception seems to be systems that are configured
-** to use 64KB pages - in this case each mapping must cover at least two
-** shm regions.
+** Usually, this is 1. The exception seems to be systems that are configured
+** to use 64KB pages - in this case each mapping must cover at least two
+** shm regions.
+*/
+static int unixShmRegionPerMap(void){
+  int shmsz = 32*1024;            /* SHM region size */
+  int pgsz = osGetpagesize();   /* System page size */
+  assert( ((pgsz-1)&pgsz)==0 );   /* Page size must be a power of 2 */
+  if( pgsz<shmsz ) return 1;
+  return pgsz/shmsz;
+}
+
+/*
+** Purge the unixShmNodeList list of all entries with unixShmNode.nRef==0.
+**
+** This is not a VFS shared-memory method; it is a utility function called
+** by VFS shared-memory methods.
+*/
+static void unixShmPurge(unixFile *pFd){
+  unixShmNode *p = pFd->pInode->pShmNode;
+  assert( unixInodeMutexHeld(pFd->pInode) );
+  if( p && ALWAYS(p->nRef==0) ){
+    int nShmPerMap = unixShmRegionPerMap();
+    int i;
+    assert( p->pInode==pFd->pInode );
+    sqlite3_mutex_free(p->pShmMutex);
+    for(i=0; i<p->nRegion; i+=nShmPerMap){
+      if( p->hShm>=0 ){
+        osMunmap(p->apRegion[i], p->szRegion);
+      }else{
+        sqlite3_free(p->apRegion[i]);
+      }
+    }
+    sqlite3_free(p->apRegion);
+    if( p->hShm>=0 ){
+      robust_close(pFd, p->hShm, __LINE__);
+      p->hShm = -1;
+    }
+    p->pInode->pShmNode = 0;
+    sqlite3_free(p);
+  }
+}
+
+/*
+** The DMS lock has not yet been taken on shm file pShmNode. Attempt to
+** take it now. Return SQLITE_OK if successful, or an SQLite error
+** code otherwise.
+**
+** If the DMS cannot be locked because this is a readonly_shm=1 
+** connection and no other process already holds a lock, return
+** SQLITE_READONLY_CANTINIT and set pShmNode->isUnlocked=1.
+*/
+static int unixLockSharedMemory(unixFile *pDbFd, unixShmNode *pShmNode){
+  struct flock lock;
+  int rc = SQLITE_OK;
+
+  /* Use F_GETLK to determine the locks other processes are holding
+  ** on the DMS byte. If it indicates that another process is holding
+  ** a SHARED lock, then this process may also take a SHARED lock
+  ** and proceed with opening the *-shm file. 
+  **
+  ** Or, if no other process is holding any lock, then this process
+  ** is the first to open it. In this case take an EXCLUSIVE lock on the
+  ** DMS byte and truncate the *-shm file to zero bytes in size. Then
+  ** downgrade to a SHARED lock on the DMS byte.
+  **
+  ** If another process is holding an EXCLUSIVE lock on the DMS byte,
+  ** return SQLITE_BUSY to the caller (it will try again). An earlier
+  ** version of this code attempted the SHARED lock at this point. But
+  ** this introduced a subtle race condition: if the process holding
+  ** EXCLUSIVE failed just before truncating the *-shm file, then this
+  ** process might open and use the *-shm file without truncating it.
+  ** And if the *-shm file has been corrupted by a power failure or
+  ** system crash, the database itself may also become corrupt.  */
+  lock.l_whence = SEEK_SET;
+  lock.l_start = UNIX_SHM_DMS;
+  lock.l_len = 1;
+  lock.l_type = F_WRLCK;
+  if( osFcntl(pShmNode->hShm, F_GETLK, &lock)!=0 ) {
+    rc = SQLITE_IOERR_LOCK;
+  }else if( lock.l_type==F_UNLCK ){
+    if( pShmNode->isReadonly ){
+      pShmNode->isUnlocked = 1;
+      rc = SQLITE_READONLY_CANTINIT;
+    }else{
+      rc = unixShmSystemLock(pDbFd, F_WRLCK, UNIX_SHM_DMS, 1);
+      /* The first connection to attach must truncate the -shm file.  We
+      ** truncate to 3 bytes (an arbitrary small number, less than the
+      ** -shm header size) rather than 0 as a system debugging aid, to
+      ** help detect if a -shm file truncation is legitimate or is the work
+      ** or a rogue process. */
+      if( rc==SQLITE_OK && robust_ftruncate(pShmNode->hShm, 3) ){
+        rc = unixLogError(SQLITE_IOERR_SHMOPEN,"ftruncate",pShmNode->zFilename);
+      }
+    }
+  }else if( lock.l_type==F_WRLCK ){
+    rc = SQLITE_BUSY;
+  }
+
+  if( rc==SQLITE_OK ){
+    assert( lock.l_type==F_UNLCK || lock.l_type==F_RDLCK );
+    rc = unixShmSystemLock(pDbFd, F_RDLCK, UNIX_SHM_DMS, 1);
+  }
+  return rc;
+}
+
+/*
+** Open a shared-memory area associated with open database file pDbFd.  
+** This particular implementation uses mmapped files.
+**
+** The file used to implement shared-memory is in the same directory
+** as the open database file and has the same name as the open database
+** file with the "-shm" suffix added.  For example, if the database file
+** is "/home/user1/config.db" then the file that is created and mmapped
+** for shared memory will be called "/home/user1/config.db-shm".  
+**
+** Another approach to is to use files in /dev/shm or /dev/tmp or an
+** some other tmpfs mount. But if a file in a different directory
+** from the database file is used, then differing access permissions
+** or a chroot() might cause two different processes on the same
+** database to end up using different files for shared memory - 
+** meaning that their memory would not really be shared - resulting
+** in database corruption.  Nevertheless, this tmpfs file usage
+** can be enabled at compile-time using -DSQLITE_SHM_DIRECTORY="/dev/shm"
+** or the equivalent.  The use of the SQLITE_SHM_DIRECTORY compile-time
+** option results in an incompatible build of SQLite;  builds of SQLite
+** that with differing SQLITE_SHM_DIRECTORY settings attempt to use the
+** same database file at the same time, database corruption will likely
+** result. The SQLITE_SHM_DIRECTORY compile-time option is considered
+** "unsupported" and may go away in a future SQLite release.
+**
+** When opening a new shared-memory file, if no other instances of that
+** file are currently open, in this process or in other processes, then
+** the file must be truncated to zero length or have its header cleared.
+**
+** If the original database file (pDbFd) is using the "unix-excl" VFS
+** that means that an exclusive lock is held on the database file and
+** that no other processes are able to read or write the database.  In
+** that case, we do not really need shared memory.  No shared memory
+** file is created.  The shared memory will be simulated with heap memory.
+*/
+static int unixOpenSharedMemory(unixFile *pDbFd){
+  struct unixShm *p = 0;          /* The connection to be opened */
+  struct unixShmNode *pShmNode;   /* The underlying mmapped file */
+  int rc = SQLITE_OK;             /* Result code */
+  unixInodeInfo *pInode;          /* The inode of fd */
+  sqlite3_mutex *pShardMutex;     /* Mutex of the inode table shard */
+  char *zShm;             /* Name of the file used for SHM */
+  int nShmFilename;               /* Size of the SHM filename in bytes */
+
+  /* Allocate space for the new unixShm object. */
+  p = sqlite3_malloc64( sizeof(*p) );
+  if( p==0 ) return SQLITE_NOMEM_BKPT;
+  memset(p, 0, sizeof(*p));
+  assert( pDbFd->pShm==0 );
+
+  /* Check to see if a unixShmNode object already exists. Reuse an existing
+  ** one if present. Create a new one if necessary.
+  */
+  assert( unixFileMutexNotheld(pDbFd) );
+  pInode = pDbFd->pInode;
+  pShardMutex = unixInodeShardOf(&pInode->fileId)->pMutex;
+  sqlite3_mutex_enter(pShardMutex);
+  pShmNode = pInode->pShmNode;
+  if( pShmNode==0 ){
+    struct stat sStat;                 /* fstat() info for database file */
+#ifndef SQLITE_SHM_DIRECTORY
+    const char *zBasePath = pDbFd->zPath;
+#endif
+
+    /* Call fstat() to figure out the permissions on the database file. If
+    ** a new *-shm file is created, an attempt will be made to create it
+    ** with the same permissions.
+    */
+    if( osFstat(pDbFd->h, &sStat) ){
+      rc = SQLITE_IOERR_FSTAT;
+      goto shm_open_err;
+    }
+
+#ifdef SQLITE_SHM_DIRECTORY
+    nShmFilename = sizeof(SQLITE_SHM_DIRECTORY) + 31;
+#else
+    nShmFilename = 6 + (int)strlen(zBasePath);
+#endif
+    pShmNode = sqlite3_malloc64( sizeof(*pShmNode) + nShmFilename );
+    if( pShmNode==0 ){
+      rc = SQLITE_NOMEM_BKPT;
+      goto shm_open_err;
+    }
+    memset(pShmNode, 0, sizeof(*pShmNode)+nShmFilename);
+    zShm = pShmNode->zFilename = (char*)&pShmNode[1];
+#ifdef SQLITE_SHM_DIRECTORY
+    sqlite3_snprintf(nShmFilename, zShm, 
+                     SQLITE_SHM_DIRECTORY "/sqlite-shm-%x-%x",
+                     (u32)sStat.st_ino, (u32)sStat.st_dev);
+#else
+    sqlite3_snprintf(nShmFilename, zShm, "%s-shm", zBasePath);
+    sqlite3FileSuffix3(pDbFd->zPath, zShm);
+#endif
+    pShmNode->hShm = -1;
+    pDbFd->pInode->pShmNode = pShmNode;
+    pShmNode->pInode = pDbFd->pInode;
+    if( sqlite3GlobalConfig.bCoreMutex ){
+      pShmNode->pShmMutex = sqlite3_mutex_alloc(SQLITE_MUTEX_RW);
+      if( pShmNode->pShmMutex==0 ){
+        rc = SQLITE_NOMEM_BKPT;
+        goto shm_open_err;
+      }
+    }
+
+    if( pInode->bProcessLock==0 ){
+      if( 0==sqlite3_uri_boolean(pDbFd->zPath, "readonly_shm", 0) ){
+        pShmNode->hShm = robust_open(zShm, O_RDWR|O_CREAT|O_NOFOLLOW,
+                                     (sStat.st_mode&0777));
+      }
+      if( pShmNode->hShm<0 ){
+        pShmNode->hShm = robust_open(zShm, O_RDONLY|O_NOFOLLOW,
+                                     (sStat.st_mode&0777));
+        if( pShmNode->hShm<0 ){
+          rc = unixLogError(SQLITE_CANTOPEN_BKPT, "open", zShm);
+          goto shm_open_err;
+        }
+        pShmNode->isReadonly = 1;
+      }
+
+      /* If this process is running as root, make sure that the SHM file
+      ** is owned by the same user that owns the original database.  Otherwise,
+      ** the original owner will not be able to connect.
+      */
+      robustFchown(pShmNode->hShm, sStat.st_uid, sStat.st_gid);
+
+      rc = unixLockSharedMemory(pDbFd, pShmNode);
+      if( rc!=SQLITE_OK && rc!=SQLITE_READONLY_CANTINIT ) goto shm_open_err;
+    }
+  }
+
+  /* Make the new connection a child of the unixShmNode */
+  p->pShmNode = pShmNode;
+  pShmNode->nRef++;
+  pDbFd->pShm = p;
+  sqlite3_mutex_leave(pShardMutex);
+
+  /* The reference count on pShmNode has already been incremented under
+  ** the cover of the inode table shard mutex and the pointer from the
+  ** new (struct unixShm) object to the pShmNode has been set. All that is
+  ** left to do is to link the new object into the linked list starting
+  ** at pShmNode->pFirst. This must be done while holding the
+  ** pShmNode->pShmMutex.
+  */
+  sqlite3_mutex_enter(pShmNode->pShmMutex);
+  p->pNext = pShmNode->pFirst;
+  pShmNode->pFirst = p;
+  sqlite3_mutex_leave(pShmNode->pShmMutex);
+  return rc;
+
+  /* Jump here on any error */
+shm_open_err:
+  unixShmPurge(pDbFd);       /* This call frees pShmNode if required */
+  sqlite3_free(p);
+  sqlite3_mutex_leave(pShardMutex);
+  return rc;
+}
+
+/*
+** This function is called to obtain a pointer to region iRegion of the 
+** shared-memory associated with the database file fd. Shared-memory regions 
+** are numbered starting from zero. Each shared-memory region is szRegion 
+** bytes in size.
+**
+** If an error occurs, an error code is returned and *pp is set to NULL.
+**
+** Otherwise, if the bExtend parameter is 0 and the requested shared-memory
+** region has not been allocated (by any client, including one running in a
+** separate process), then *pp is set to NULL and SQLITE_OK returned. If 
+** bExtend is non-zero and the requested shared-memory region has not yet 
+** been allocated, it is allocated by this function.
+**
+** If the shared-memory region has already been allocated or is allocated by
+** this call as described above, then it is mapped into this processes 
+** address space (if it is not already), *pp is set to point to the mapped 
+** memory and SQLITE_OK returned.
 */
-static int unixShmRegionPerMap(void){
-  int shmsz = 32*1024;            /* SHM region size */
-  int pgsz = osGetpagesize();   /* System page size */
-  assert( ((pgsz-1)&pgsz)==0 );   /* Page size must be a power of 2 */
-  if( pgsz<shmsz ) return 1;
-  return pgsz/shmsz;
+static int unixShmMap(
+  sqlite3_file *fd,               /* Handle open on database file */
+  int iRegion,                    /* Region to retrieve */
+  int szRegion,                   /* Size of regions */
+  int bExtend,                    /* True to extend file if necessary */
+  void volatile **pp              /* OUT: Mapped memory */
+){
+  unixFile *pDbFd = (unixFile*)fd;
+  unixShm *p;
+  unixShmNode *pShmNode;
+  int rc = SQLITE_OK;
+  int nShmPerMap = unixShmRegionPerMap();
+  int nReqRegion;
+
+  /* If the shared-memory file has not yet been opened, open it now. */
+  if( pDbFd->pShm==0 ){
+    rc = unixOpenSharedMemory(pDbFd);
+    if( rc!=SQLITE_OK ) return rc;
+  }
+
+  p = pDbFd->pShm;
+  pShmNode = p->pShmNode;
+
+  /* If the requested region is already mapped, it can be read from the
+  ** apRegion[] array while holding pShmMutex in shared mode.  apRegion[]
+  ** and nRegion are only modified while pShmMutex is held exclusively,
+  ** below.  */
+  sqlite3_mutex_enter_shared(pShmNode->pShmMutex);
+  if( pShmNode->isUnlocked==0 && pShmNode->nRegion>iRegion ){
+    assert( szRegion==pShmNode->szRegion );
+    *pp = pShmNode->apRegion[iRegion];
+    rc = pShmNode->isReadonly ? SQLITE_READONLY : SQLITE_OK;
+    sqlite3_mutex_leave_shared(pShmNode->pShmMutex);
+    return rc;
+  }
+  sqlite3_mutex_leave_shared(pShmNode->pShmMutex);
+
+  sqlite3_mutex_enter(pShmNode->pShmMutex);
+  if( pShmNode->isUnlocked ){
+    rc = unixLockSharedMemory(pDbFd, pShmNode);
+    if( rc!=SQLITE_OK ) goto shmpage_out;
+    pShmNode->isUnlocked = 0;
+  }
+  assert( szRegion==pShmNode->szRegion || pShmNode->nRegion==0 );
+  assert( pShmNode->pInode==pDbFd->pInode );
+  assert( pShmNode->hShm>=0 || pDbFd->pInode->bProcessLock==1 );
+  assert( pShmNode->hShm<0 || pDbFd->pInode->bProcessLock==0 );
+
+  /* Minimum number of regions required to be mapped. */
+  nReqRegion = ((iRegion+nShmPerMap) / nShmPerMap) * nShmPerMap;
+
+  if( pShmNode->nRegion<nReqRegion ){
+    char **apNew;                      /* New apRegion[] array */
+    int nByte = nReqRegion*szRegion;   /* Minimum required file size */
+    struct stat sStat;                 /* Used by fstat() */
+
+    pShmNode->szRegion = szRegion;
+
+    if( pShmNode->hShm>=0 ){
+      /* The requested region is not mapped into this processes address space.
+      ** Check to see if it has been allocated (i.e. if the wal-index file is
+      ** large enough to contain the requested region).
+      */
+      if( osFstat(pShmNode->hShm, &sStat) ){
+        rc = SQLITE_IOERR_SHMSIZE;
+        goto shmpage_out;
+      }
+  
+      if( sStat.st_size<nByte ){
+        /* The requested memory region does not exist. If bExtend is set to
+        ** false, exit early. *pp will be set to NULL and SQLITE_OK returned.
+        */
+        if( !bExtend ){
+          goto shmpage_out;
+        }
+
+        /* Alternatively, if bExtend is true, extend the file. Do this by
+        ** writing a single byte to the end of each (OS) page being
+        ** allocated or extended. Technically, we need only write to the
+        ** last page in order to extend the file. But writing to all new
+        ** pages forces the OS to allocate them immediately, which reduces
+        ** the chances of SIGBUS while accessing the mapped region later on.
+        */
+        else{
+          static const int pgsz = 4096;
+          int iPg;
+
+          /* Write to the last byte of each newly allocated or extended page */
+          assert( (nByte % pgsz)==0 );
+          for(iPg=(sStat.st_size/pgsz); iPg<(nByte/pgsz); iPg++){
+            int x = 0;
+            if( seekAndWriteFd(pShmNode->hShm, iPg*pgsz + pgsz-1,"",1,&x)!=1 ){
+              const char *zFile = pShmNode->zFilename;
+              rc = unixLogError(SQLITE_IOERR_SHMSIZE, "write", zFile);
+              goto shmpage_out;
+            }
+          }
+        }
+      }
+    }
+
+    /* Map the requested memory region into this processes address space. */
+    apNew = (char **)sqlite3_realloc(
+        pShmNode->apRegion, nReqRegion*sizeof(char *)
+    );
+    if( !apNew ){
+      rc = SQLITE_IOERR_NOMEM_BKPT;
+      goto shmpage_out;
+    }
+    pShmNode->apRegion = apNew;
+    while( pShmNode->nRegion<nReqRegion ){
+      int nMap = szRegion*nShmPerMap;
+      int i;
+      void *pMem;
+      if( pShmNode->hShm>=0 ){
+        pMem = osMmap(0, nMap,
+            pShmNode->isReadonly ? PROT_READ : PROT_READ|PROT_WRITE, 
+            MAP_SHARED, pShmNode->hShm, szRegion*(i64)pShmNode->nRegion
+        );
+        if( pMem==MAP_FAILED ){
+          rc = unixLogError(SQLITE_IOERR_SHMMAP, "mmap", pShmNode->zFilename);
+          goto shmpage_out;
+        }
+      }else{
+        pMem = sqlite3_malloc64(nMap);
+        if( pMem==0 ){
+          rc = SQLITE_NOMEM_BKPT;
+          goto shmpage_out;
+        }
+        memset(pMem, 0, nMap);
+      }
+
+      for(i=0; i<nShmPerMap; i++){
+        pShmNode->apRegion[pShmNode->nRegion+i] = &((char*)pMem)[szRegion*i];
+      }
+      pShmNode->nRegion += nShmPerMap;
+    }
+  }
+
+shmpage_out:
+  if( pShmNode->nRegion>iRegion ){
+    *pp = pShmNode->apRegion[iRegion];
+  }else{
+    *pp = 0;
+  }
+  if( pShmNode->isReadonly && rc==SQLITE_OK ) rc = SQLITE_READONLY;
+  sqlite3_mutex_leave(pShmNode->pShmMutex);
+  return rc;
 }
 
+
 /*
-** Purge the unixShmNodeList list of all entries with unixShmNode.nRef==0.
-**
-** This is not a VFS shared-memory method; it is a utility function called
-** by VFS shared-memory methods.
-*/
-static void unixShmPurge(unixFile *pFd){
-  unixShmNode *p = pFd->pInode->pShmNode;
-  assert( unixMutexHeld() );
-  if( p && ALWAYS(p->nRef==0) ){
-    int nShmPerMap = unixShmRegionPerMap();
-    int i;
-    assert( p->pInode==pFd->pInode );
-    sqlite3_mutex_free(p->pShmMutex);
-    for(i=0; i<p->nRegion; i+=nShmPerMap){
-      if( p->hShm>=0 ){
-        osMunmap(p->apRegion[i], p->szRegion);
-      }else{
-        sqlite3_free(p->apRegion[i]);
+** Attempt to take or release shared lock ofst on behalf of connection p
+** without entering pShmNode->pShmMutex.  This is possible when some other
+** connection in this process already holds a shared lock on the same
+** slot, as the process-level lock then stays in place and only the count
+** in aLock[ofst] need be adjusted.  The count is updated using a CAS, and
+** never to or from zero, so that it cannot race with a connection that
+** holds the mutex and is taking or releasing the process-level lock.
+**
+** Return non-zero if the lock was taken or released, or zero if the
+** caller must do so while holding pShmMutex.
+*/
+static int unixShmLockFast(unixShm *p, int ofst, int flags){
+  int *pLock = &p->pShmNode->aLock[ofst];
+  u16 mask = (u16)(1<<ofst);
+  int v = __atomic_load_n(pLock, __ATOMIC_RELAXED);
+
+  if( flags==(SQLITE_SHM_LOCK|SQLITE_SHM_SHARED) ){
+    assert( (p->sharedMask & mask)==0 );
+    while( v>0 ){
+      if( __atomic_compare_exchange_n(pLock, &v, v+1, 1,
+                                      __ATOMIC_ACQUIRE, __ATOMIC_RELAXED) ){
+        p->sharedMask |= mask;
+        return 1;
       }
     }
-    sqlite3_free(p->apRegion);
-    if( p->hShm>=0 ){
-      robust_close(pFd, p->hShm, __LINE__);
-      p->hShm = -1;
+  }else{
+    assert( flags==(SQLITE_SHM_UNLOCK|SQLITE_SHM_SHARED) );
+    assert( (p->sharedMask & mask)!=0 );
+    while( v>1 ){
+      if( __atomic_compare_exchange_n(pLock, &v, v-1, 1,
+                                      __ATOMIC_RELEASE, __ATOMIC_RELAXED) ){
+        p->sharedMask &= ~mask;
+        return 1;
+      }
     }
-    p->pInode->pShmNode = 0;
-    sqlite3_free(p);
   }
+  return 0;
 }
 
 /*
-** The DMS lock has not yet been taken on shm file pShmNode. Attempt to
-** take it now. Return SQLITE_OK if successful, or an SQLite error
-** code otherwise.
+** Change the lock state for a shared-memory segment.
 **
-** If the DMS cannot be locked because this is a readonly_shm=1 
-** connection and no other process already holds a lock, return
-** SQLITE_READONLY_CANTINIT and set pShmNode->isUnlocked=1.
+** Note that the relationship between SHAREd and EXCLUSIVE locks is a little
+** different here than in posix.  In xShmLock(), one can go from unlocked
+** to shared and back or from unlocked to exclusive and back.  But one may
+** not go from shared to exclusive or from exclusive to shared.
 */
-static int unixLockSharedMemory(unixFile *pDbFd, unixShmNode *pShmNode){
-  struct flock lock;
-  int rc = SQLITE_OK;
+static int unixShmLock(
+  sqlite3_file *fd,          /* Database file holding the shared memory */
+  int ofst,                  /* First lock to acquire or release */
+  int n,                     /* Number of locks to acquire or release */
+  int flags                  /* What to do with the lock */
+){
+  unixFile *pDbFd = (unixFile*)fd;      /* Connection holding shared memory */
+  unixShm *p = pDbFd->pShm;             /* The shared memory being locked */
+  unixShmNode *pShmNode = p->pShmNode;  /* The underlying file iNode */
+  int rc = SQLITE_OK;                   /* Result code */
+  u16 mask;                             /* Mask of locks to take or release */
+  int *aLock = pShmNode->aLock;
+#ifdef SQLITE_ENABLE_LOCK_STATUS
+  sqlite3_uint64 nShmFcntl = pDbFd->lockStats.nShmFcntl;
+  u16 mHeld = p->exclMask|p->sharedMask;  /* Locks held on entry */
+#endif
 
-  /* Use F_GETLK to determine the locks other processes are holding
-  ** on the DMS byte. If it indicates that another process is holding
-  ** a SHARED lock, then this process may also take a SHARED lock
-  ** and proceed with opening the *-shm file. 
+  assert( pShmNode==pDbFd->pInode->pShmNode );
+  assert( pShmNode->pInode==pDbFd->pInode );
+  assert( ofst>=0 && ofst+n<=SQLITE_SHM_NLOCK );
+  assert( n>=1 );
+  assert( flags==(SQLITE_SHM_LOCK | SQLITE_SHM_SHARED)
+       || flags==(SQLITE_SHM_LOCK | SQLITE_SHM_EXCLUSIVE)
+       || flags==(SQLITE_SHM_UNLOCK | SQLITE_SHM_SHARED)
+       || flags==(SQLITE_SHM_UNLOCK | SQLITE_SHM_EXCLUSIVE) );
+  assert( n==1 || (flags & SQLITE_SHM_EXCLUSIVE)!=0 );
+  assert( pShmNode->hShm>=0 || pDbFd->pInode->bProcessLock==1 );
+  assert( pShmNode->hShm<0 || pDbFd->pInode->bProcessLock==0 );
+
+  /* Check that, if this to be a blocking lock, no locks that occur later
+  ** in the following list than the lock being obtained are already held:
   **
-  ** Or, if no other process is holding any lock, then this process
-  ** is the first to open it. In this case take an EXCLUSIVE lock on the
-  ** DMS byte and truncate the *-shm file to zero bytes in size. Then
-  ** downgrade to a SHARED lock on the DMS byte.
+  **   1. Checkpointer lock (ofst==1).
+  **   2. Write lock (ofst==0).
+  **   3. Read locks (ofst>=3 && ofst<SQLITE_SHM_NLOCK).
   **
-  ** If another process is holding an EXCLUSIVE lock on the DMS byte,
-  ** return SQLITE_BUSY to the caller (it will try again). An earlier
-  ** version of this code attempted the SHARED lock at this point. But
-  ** this introduced a subtle race condition: if the process holding
-  ** EXCLUSIVE failed just before truncating the *-shm file, then this
-  ** process might open and use the *-shm file without truncating it.
-  ** And if the *-shm file has been corrupted by a power failure or
-  ** system crash, the database itself may also become corrupt.  */
-  lock.l_whence = SEEK_SET;
-  lock.l_start = UNIX_SHM_DMS;
-  lock.l_len = 1;
-  lock.l_type = F_WRLCK;
-  if( osFcntl(pShmNode->hShm, F_GETLK, &lock)!=0 ) {
-    rc = SQLITE_IOERR_LOCK;
-  }else if( lock.l_type==F_UNLCK ){
-    if( pShmNode->isReadonly ){
-      pShmNode->isUnlocked = 1;
-      rc = SQLITE_READONLY_CANTINIT;
-    }else{
-      rc = unixShmSystemLock(pDbFd, F_WRLCK, UNIX_SHM_DMS, 1);
-      /* The first connection to attach must truncate the -shm file.  We
-      ** truncate to 3 bytes (an arbitrary small number, less than the
-      ** -shm header size) rather than 0 as a system debugging aid, to
-      ** help detect if a -shm file truncation is legitimate or is the work
-      ** or a rogue process. */
-      if( rc==SQLITE_OK && robust_ftruncate(pShmNode->hShm, 3) ){
-        rc = unixLogError(SQLITE_IOERR_SHMOPEN,"ftruncate",pShmNode->zFilename);
-      }
-    }
-  }else if( lock.l_type==F_WRLCK ){
-    rc = SQLITE_BUSY;
-  }
+  ** In other words, if this is a blocking lock, none of the locks that
+  ** occur later in the above list than the lock being obtained may be
+  ** held.  
+  **
+  ** It is not permitted to block on the RECOVER lock.
+  */
+#ifdef SQLITE_ENABLE_SETLK_TIMEOUT
+  assert( (flags & SQLITE_SHM_UNLOCK) || pDbFd->iBusyTimeout==0 || (
+         (ofst!=2)                                   /* not RECOVER */
+      && (ofst!=1 || (p->exclMask|p->sharedMask)==0)
+      && (ofst!=0 || (p->exclMask|p->sharedMask)<3)
+      && (ofst<3  || (p->exclMask|p->sharedMask)<(1<<ofst))
+  ));
+#endif
 
-  if( rc==SQLITE_OK ){
-    assert( lock.l_type==F_UNLCK || lock.l_type==F_RDLCK );
-    rc = unixShmSystemLock(pDbFd, F_RDLCK, UNIX_SHM_DMS, 1);
+  mask = (1<<(ofst+n)) - (1<<ofst);
+  assert( n>1 || mask==(1<<ofst) );
+
+  /* Shared locks that are already held by another connection in this
+  ** process, and shared locks that are not the last held, are taken and
+  ** released without the mutex.  Since unixShmLockFast() may run on
+  ** other threads at any time, assertLockingArrayOk() cannot be used to
+  ** check aLock[] against the sharedMask of every connection here. */
+  if( (flags & SQLITE_SHM_SHARED)!=0
+   && ((flags & SQLITE_SHM_LOCK)!=0)==((p->sharedMask & mask)==0)
+   && unixShmLockFast(p, ofst, flags)
+  ){
+    UnixLockStat( unixLockStatShm(pDbFd, ofst, n, flags, SQLITE_OK, 1,
+                                  mHeld ^ (p->exclMask|p->sharedMask)) );
+    OSTRACE(("SHM-LOCK shmid-%d, pid-%d got %03x,%03x (fast)\n",
+             p->id, osGetpid(0), p->sharedMask, p->exclMask));
+    return SQLITE_OK;
   }
-  return rc;
-}
 
-/*
-** Open a shared-memory area associated with open database file pDbFd.  
-** This particular implementation uses mmapped files.
-**
-** The file used to implement shared-memory is in the same directory
-** as the open database file and has the same name as the open database
-** file with the "-shm" suffix added.  For example, if the database file
-** is "/home/user1/config.db" then the file that is created and mmapped
-** for shared memory will be called "/home/user1/config.db-shm".  
-**
-** Another approach to is to use files in /dev/shm or /dev/tmp or an
-** some other tmpfs mount. But if a file in a different directory
-** from the database file is used, then differing access permissions
-** or a chroot() might cause two different processes on the same
-** database to end up using different files for shared memory - 
-** meaning that their memory would not really be shared - resulting
-** in database corruption.  Nevertheless, this tmpfs file usage
-** can be enabled at compile-time using -DSQLITE_SHM_DIRECTORY="/dev/shm"
-** or the equivalent.  The use of the SQLITE_SHM_DIRECTORY compile-time
-** option results in an incompatible build of SQLite;  builds of SQLite
-** that with differing SQLITE_SHM_DIRECTORY settings attempt to use the
-** same database file at the same time, database corruption will likely
-** result. The SQLITE_SHM_DIRECTORY compile-time option is considered
-** "unsupported" and may go away in a future SQLite release.
-**
-** When opening a new shared-memory file, if no other instances of that
-** file are currently open, in this process or in other processes, then
-** the file must be truncated to zero length or have its header cleared.
-**
-** If the original database file (pDbFd) is using the "unix-excl" VFS
-** that means that an exclusive lock is held on the database file and
-** that no other processes are able to read or write the database.  In
-** that case, we do not really need shared memory.  No shared memory
-** file is created.  The shared memory will be simulated with heap memory.
-*/
-static int unixOpenSharedMemory(unixFile *pDbFd){
-  struct unixShm *p = 0;          /* The connection to be opened */
-  struct unixShmNode *pShmNode;   /* The underlying mmapped file */
-  int rc = SQLITE_OK;             /* Result code */
-  unixInodeInfo *pInode;          /* The inode of fd */
-  char *zShm;             /* Name of the file used for SHM */
-  int nShmFilename;               /* Size of the SHM filename in bytes */
+  sqlite3_mutex_enter(pShmNode->pShmMutex);
+  if( flags & SQLITE_SHM_UNLOCK ){
+    if( (p->exclMask|p->sharedMask) & mask ){
+      int ii;
+      int bUnlock = 1;
 
-  /* Allocate space for the new unixShm object. */
-  p = sqlite3_malloc64( sizeof(*p) );
-  if( p==0 ) return SQLITE_NOMEM_BKPT;
-  memset(p, 0, sizeof(*p));
-  assert( pDbFd->pShm==0 );
+      if( p->sharedMask & mask ){
+        /* Unless this is the last shared lock on the slot held by this
+        ** process, just decrement the count.  The count is only changed
+        ** using a CAS, as unixShmLockFast() may increment it, or
+        ** decrement it to no less than one, at any time until it is
+        ** zero.  Whichever connection moves it from 1 to 0 releases the
+        ** lock at the system level.  */
+        int v = __atomic_load_n(&aLock[ofst], __ATOMIC_RELAXED);
+        assert( n==1 );
+        do{
+          assert( v>=1 );
+        }while( !__atomic_compare_exchange_n(&aLock[ofst], &v,
+                                             v>1 ? v-1 : 0, 0,
+                                             __ATOMIC_ACQ_REL,
+                                             __ATOMIC_RELAXED) );
+        if( v>1 ) bUnlock = 0;
+      }
 
-  /* Check to see if a unixShmNode object already exists. Reuse an existing
-  ** one if present. Create a new one if necessary.
-  */
-  assert( unixFileMutexNotheld(pDbFd) );
-  unixEnterMutex();
-  pInode = pDbFd->pInode;
-  pShmNode = pInode->pShmNode;
-  if( pShmNode==0 ){
-    struct stat sStat;                 /* fstat() info for database file */
-#ifndef SQLITE_SHM_DIRECTORY
-    const char *zBasePath = pDbFd->zPath;
-#endif
+      if( bUnlock ){
+        rc = unixShmSystemLock(pDbFd, F_UNLCK, ofst+UNIX_SHM_BASE, n);
+        for(ii=ofst; ii<ofst+n; ii++){
+          if( rc==SQLITE_OK ){
+            __atomic_store_n(&aLock[ii], 0, __ATOMIC_RELEASE);
+          }else if( p->sharedMask & mask ){
+            __atomic_store_n(&aLock[ii], 1, __ATOMIC_RELEASE);
+          }
+        }
+      }
 
-    /* Call fstat() to figure out the permissions on the database file. If
-    ** a new *-shm file is created, an attempt will be made to create it
-    ** with the same permissions.
-    */
-    if( osFstat(pDbFd->h, &sStat) ){
-      rc = SQLITE_IOERR_FSTAT;
-      goto shm_open_err;
+      /* Undo the local locks */
+      if( rc==SQLITE_OK ){
+        p->exclMask &= ~mask;
+        p->sharedMask &= ~mask;
+      } 
     }
+  }else if( flags & SQLITE_SHM_SHARED ){
+    assert( n==1 );
+    assert( (p->exclMask & (1<<ofst))==0 );
+    if( (p->sharedMask & mask)==0 ){
+      int v = __atomic_load_n(&aLock[ofst], __ATOMIC_ACQUIRE);
+      if( v<0 ){
+        rc = SQLITE_BUSY;
+      }else if( v==0 ){
+        rc = unixShmSystemLock(pDbFd, F_RDLCK, ofst+UNIX_SHM_BASE, n);
+      }
 
-#ifdef SQLITE_SHM_DIRECTORY
-    nShmFilename = sizeof(SQLITE_SHM_DIRECTORY) + 31;
-#else
-    nShmFilename = 6 + (int)strlen(zBasePath);
-#endif
-    pShmNode = sqlite3_malloc64( sizeof(*pShmNode) + nShmFilename );
-    if( pShmNode==0 ){
-      rc = SQLITE_NOMEM_BKPT;
-      goto shm_open_err;
+      /* Get the local shared locks */
+      if( rc==SQLITE_OK ){
+        p->sharedMask |= mask;
+        __atomic_fetch_add(&aLock[ofst], 1, __ATOMIC_ACQ_REL);
+      }
     }
-    memset(pShmNode, 0, sizeof(*pShmNode)+nShmFilename);
-    zShm = pShmNode->zFilename = (char*)&pShmNode[1];
-#ifdef SQLITE_SHM_DIRECTORY
-    sqlite3_snprintf(nShmFilename, zShm, 
-                     SQLITE_SHM_DIRECTORY "/sqlite-shm-%x-%x",
-                     (u32)sStat.st_ino, (u32)sStat.st_dev);
-#else
-    sqlite3_snprintf(nShmFilename, zShm, "%s-shm", zBasePath);
-    sqlite3FileSuffix3(pDbFd->zPath, zShm);
-#endif
-    pShmNode->hShm = -1;
-    pDbFd->pInode->pShmNode = pShmNode;
-    pShmNode->pInode = pDbFd->pInode;
-    if( sqlite3GlobalConfig.bCoreMutex ){
-      pShmNode->pShmMutex = sqlite3_mutex_alloc(SQLITE_MUTEX_FAST);
-      if( pShmNode->pShmMutex==0 ){
-        rc = SQLITE_NOMEM_BKPT;
-        goto shm_open_err;
+  }else{
+    /* Make sure no sibling connections hold locks that will block this
+    ** lock.  If any do, return SQLITE_BUSY right away.  */
+    int ii;
+    for(ii=ofst; ii<ofst+n; ii++){
+      assert( (p->sharedMask & mask)==0 );
+      if( ALWAYS((p->exclMask & (1<<ii))==0)
+       && __atomic_load_n(&aLock[ii], __ATOMIC_ACQUIRE)
+      ){
+        rc = SQLITE_BUSY;
+        break;
       }
     }
 
-    if( pInode->bProcessLock==0 ){
-      if( 0==sqlite3_uri_boolean(pDbFd->zPath, "readonly_shm", 0) ){
-        pShmNode->hShm = robust_open(zShm, O_RDWR|O_CREAT|O_NOFOLLOW,
-                                     (sStat.st_mode&0777));
-      }
-      if( pShmNode->hShm<0 ){
-        pShmNode->hShm = robust_open(zShm, O_RDONLY|O_NOFOLLOW,
-                                     (sStat.st_mode&0777));
-        if( pShmNode->hShm<0 ){
-          rc = unixLogError(SQLITE_CANTOPEN_BKPT, "open", zShm);
-          goto shm_open_err;
+    /* Get the exclusive locks at the system level. Then if successful
+    ** also update the in-memory values. */
+    if( rc==SQLITE_OK ){
+      rc = unixShmSystemLock(pDbFd, F_WRLCK, ofst+UNIX_SHM_BASE, n);
+      if( rc==SQLITE_OK ){
+        assert( (p->sharedMask & mask)==0 );
+        p->exclMask |= mask;
+        for(ii=ofst; ii<ofst+n; ii++){
+          __atomic_store_n(&aLock[ii], -1, __ATOMIC_RELEASE);
         }
-        pShmNode->isReadonly = 1;
       }
-
-      /* If this process is running as root, make sure that the SHM file
-      ** is owned by the same user that owns the original database.  Otherwise,
-      ** the original owner will not be able to connect.
-      */
-      robustFchown(pShmNode->hShm, sStat.st_uid, sStat.st_gid);
-
-      rc = unixLockSharedMemory(pDbFd, pShmNode);
-      if( rc!=SQLITE_OK && rc!=SQLITE_READONLY_CANTINIT ) goto shm_open_err;
     }
   }
-
-  /* Make the new connection a child of the unixShmNode */
-  p->pShmNode = pShmNode;
-  pShmNode->nRef++;
-  pDbFd->pShm = p;
-  unixLeaveMutex();
-
-  /* The reference count on pShmNode has already been incremented under
-  ** the cover of the unixEnterMutex() mutex and the pointer from the
-  ** new (struct unixShm) object to the pShmNode has been set. All that is
-  ** left to do is to link the new object into the linked list starting
-  ** at pShmNode->pFirst. This must be done while holding the
-  ** pShmNode->pShmMutex.
-  */
-  sqlite3_mutex_enter(pShmNode->pShmMutex);
-  p->pNext = pShmNode->pFirst;
-  pShmNode->pFirst = p;
   sqlite3_mutex_leave(pShmNode->pShmMutex);
-  return rc;
-
-  /* Jump here on any error */
-shm_open_err:
-  unixShmPurge(pDbFd);       /* This call frees pShmNode if required */
-  sqlite3_free(p);
-  unixLeaveMutex();
+#ifdef SQLITE_ENABLE_LOCK_STATUS
+  unixLockStatShm(pDbFd, ofst, n, flags, rc,
+                  nShmFcntl==pDbFd->lockStats.nShmFcntl,
+                  mHeld ^ (p->exclMask|p->sharedMask));
+#endif
+  OSTRACE(("SHM-LOCK shmid-%d, pid-%d got %03x,%03x\n",
+           p->id, osGetpid(0), p->sharedMask, p->exclMask));
   return rc;
 }
 
 /*
-** This function is called to obtain a pointer to region iRegion of the 
-** shared-memory associated with the database file fd. Shared-memory regions 
-** are numbered starting from zero. Each shared-memory region is szRegion 
-** bytes in size.
+** Implement a memory barrier or memory fence on shared memory.  
 **
-** If an error occurs, an error code is returned and *pp is set to NULL.
+** The WAL-index header is read and written without a lock.  It is stored
+** twice, so that a reader can detect a concurrent update.  A writer stores
+** the second copy, calls xShmBarrier, then stores the first copy.  A reader
+** loads the first copy, calls xShmBarrier, then loads the second copy.  The
+** ordering contract is therefore:
 **
-** Otherwise, if the bExtend parameter is 0 and the requested shared-memory
-** region has not been allocated (by any client, including one running in a
-** separate process), then *pp is set to NULL and SQLITE_OK returned. If 
-** bExtend is non-zero and the requested shared-memory region has not yet 
-** been allocated, it is allocated by this function.
+**   *  Stores before the barrier are visible to other threads and
+**      processes no later than stores after it (release).
 **
-** If the shared-memory region has already been allocated or is allocated by
-** this call as described above, then it is mapped into this processes 
-** address space (if it is not already), *pp is set to point to the mapped 
-** memory and SQLITE_OK returned.
+**   *  Loads before the barrier are satisfied no later than loads and
+**      stores after it (acquire).
+**
+** An acquire-release fence provides exactly this.  It does not order a
+** store before the barrier with a load after it.  Where the WAL code
+** depends on that ordering, the store and the load are separated by a
+** call to xShmLock.
+**
+** No mutex is entered, so concurrent WAL transactions on different
+** databases do not serialize here.
 */
-static int unixShmMap(
+static void unixShmBarrier(
+  sqlite3_file *fd                /* Database file holding the shared memory */
+){
+  UNUSED_PARAMETER(fd);
+  sqlite3AcqRelBarrier();
+}
+
+/*
+** Close a connection to shared-memory.  Delete the underlying 
+** storage if deleteFlag is true.
+**
+** If there is no shared memory associated with the connection then this
+** routine is a harmless no-op.
+*/
+static int unixShmUnmap(
+  sqlite3_file *fd,               /* The underlying database file */
+  int deleteFlag                  /* Delete shared-memory if true */
+){
+  unixShm *p;                     /* The connection to be closed */
+  unixShmNode *pShmNode;          /* The underlying shared-memory file */
+  unixShm **pp;                   /* For looping over sibling connections */
+  unixFile *pDbFd;                /* The underlying database file */
+  sqlite3_mutex *pShardMutex;     /* Mutex of the inode table shard */
+
+  pDbFd = (unixFile*)fd;
+  p = pDbFd->pShm;
+  if( p==0 ) return SQLITE_OK;
+  pShmNode = p->pShmNode;
+
+  assert( pShmNode==pDbFd->pInode->pShmNode );
+  assert( pShmNode->pInode==pDbFd->pInode );
+
+  /* Remove connection p from the set of connections associated
+  ** with pShmNode */
+  sqlite3_mutex_enter(pShmNode->pShmMutex);
+  for(pp=&pShmNode->pFirst; (*pp)!=p; pp = &(*pp)->pNext){}
+  *pp = p->pNext;
+
+  /* Free the connection p */
+  sqlite3_free(p);
+  pDbFd->pShm = 0;
+  sqlite3_mutex_leave(pShmNode->pShmMutex);
+
+  /* If pShmNode->nRef has reached 0, then close the underlying
+  ** shared-memory file, too */
+  assert( unixFileMutexNotheld(pDbFd) );
+  pShardMutex = unixInodeShardOf(&pDbFd->pInode->fileId)->pMutex;
+  sqlite3_mutex_enter(pShardMutex);
+  assert( pShmNode->nRef>0 );
+  pShmNode->nRef--;
+  if( pShmNode->nRef==0 ){
+    if( deleteFlag && pShmNode->hShm>=0 ){
+      osUnlink(pShmNode->zFilename);
+    }
+    unixShmPurge(pDbFd);
+  }
+  sqlite3_mutex_leave(pShardMutex);
+
+  return SQLITE_OK;
+}
+
+
+#else
+# define unixShmMap     0
+# define unixShmLock    0
+# define unixShmBarrier 0
+# define unixShmUnmap   0
+#endif /* #ifndef SQLITE_OMIT_WAL */
+
+#ifdef SQLITE_UNIX_OFD_LOCKS
+#ifndef SQLITE_OMIT_WAL
+/*
+** The xShmMap method for unix-ofd files.  A unix-ofd file has no
+** unixInodeInfo until it is first used in WAL mode.  Attach one here, so
+** that all connections to the database in this process share a single
+** unixShmNode, before passing the call on to unixShmMap().
+*/
+static int ofdShmMap(
   sqlite3_file *fd,               /* Handle open on database file */
   int iRegion,                    /* Region to retrieve */
   int szRegion,                   /* Size of regions */
@@ -3746,561 +6273,1104 @@ static int unixShmMap(
   void volatile **pp              /* OUT: Mapped memory */
 ){
   unixFile *pDbFd = (unixFile*)fd;
-  unixShm *p;
-  unixShmNode *pShmNode;
-  int rc = SQLITE_OK;
-  int nShmPerMap = unixShmRegionPerMap();
-  int nReqRegion;
-
-  /* If the shared-memory file has not yet been opened, open it now. */
-  if( pDbFd->pShm==0 ){
-    rc = unixOpenSharedMemory(pDbFd);
-    if( rc!=SQLITE_OK ) return rc;
+  if( pDbFd->pInode==0 ){
+    struct unixFileId fileId;
+    int rc = unixFileIdOf(pDbFd, &fileId);
+    if( rc==SQLITE_OK ){
+      sqlite3_mutex *pShardMutex = unixInodeShardOf(&fileId)->pMutex;
+      sqlite3_mutex_enter(pShardMutex);
+      rc = findInodeInfo(&fileId, &pDbFd->pInode);
+      sqlite3_mutex_leave(pShardMutex);
+    }
+    if( rc!=SQLITE_OK ){
+      *pp = 0;
+      return rc;
+    }
   }
+  return unixShmMap(fd, iRegion, szRegion, bExtend, pp);
+}
+#else
+# define ofdShmMap 0
+#endif /* #ifndef SQLITE_OMIT_WAL */
+#endif /* SQLITE_UNIX_OFD_LOCKS */
 
-  p = pDbFd->pShm;
-  pShmNode = p->pShmNode;
-  sqlite3_mutex_enter(pShmNode->pShmMutex);
-  if( pShmNode->isUnlocked ){
-    rc = unixLockSharedMemory(pDbFd, pShmNode);
-    if( rc!=SQLITE_OK ) goto shmpage_out;
-    pShmNode->isUnlocked = 0;
+#if SQLITE_MAX_MMAP_SIZE>0
+/*
+** If it is currently memory mapped, unmap file pFd.
+*/
+static void unixUnmapfile(unixFile *pFd){
+  assert( pFd->nFetchOut==0 );
+  if( pFd->pMapRegion ){
+    osMunmap(pFd->pMapRegion, pFd->mmapSizeActual);
+    pFd->pMapRegion = 0;
+    pFd->mmapSize = 0;
+    pFd->mmapSizeActual = 0;
   }
-  assert( szRegion==pShmNode->szRegion || pShmNode->nRegion==0 );
-  assert( pShmNode->pInode==pDbFd->pInode );
-  assert( pShmNode->hShm>=0 || pDbFd->pInode->bProcessLock==1 );
-  assert( pShmNode->hShm<0 || pDbFd->pInode->bProcessLock==0 );
+}
 
-  /* Minimum number of regions required to be mapped. */
-  nReqRegion = ((iRegion+nShmPerMap) / nShmPerMap) * nShmPerMap;
+/*
+** Attempt to set the size of the memory mapping maintained by file 
+** descriptor pFd to nNew bytes. Any existing mapping is discarded.
+**
+** If successful, this function sets the following variables:
+**
+**       unixFile.pMapRegion
+**       unixFile.mmapSize
+**       unixFile.mmapSizeActual
+**
+** If unsuccessful, an error message is logged via sqlite3_log() and
+** the three variables above are zeroed. In this case SQLite should
+** continue accessing the database using the xRead() and xWrite()
+** methods.
+*/
+static void unixRemapfile(
+  unixFile *pFd,                  /* File descriptor object */
+  i64 nNew                        /* Required mapping size */
+){
+  const char *zErr = "mmap";
+  int h = pFd->h;                      /* File descriptor open on db file */
+  u8 *pOrig = (u8 *)pFd->pMapRegion;   /* Pointer to current file mapping */
+  i64 nOrig = pFd->mmapSizeActual;     /* Size of pOrig region in bytes */
+  u8 *pNew = 0;                        /* Location of new mapping */
+  int flags = PROT_READ;               /* Flags to pass to mmap() */
 
-  if( pShmNode->nRegion<nReqRegion ){
-    char **apNew;                      /* New apRegion[] array */
-    int nByte = nReqRegion*szRegion;   /* Minimum required file size */
-    struct stat sStat;                 /* Used by fstat() */
+  assert( pFd->nFetchOut==0 );
+  assert( nNew>pFd->mmapSize );
+  assert( nNew<=pFd->mmapSizeMax );
+  assert( nNew>0 );
+  assert( pFd->mmapSizeActual>=pFd->mmapSize );
+  assert( MAP_FAILED!=0 );
 
-    pShmNode->szRegion = szRegion;
+#ifdef SQLITE_MMAP_READWRITE
+  if( (pFd->ctrlFlags & UNIXFILE_RDONLY)==0 ) flags |= PROT_WRITE;
+#endif
 
-    if( pShmNode->hShm>=0 ){
-      /* The requested region is not mapped into this processes address space.
-      ** Check to see if it has been allocated (i.e. if the wal-index file is
-      ** large enough to contain the requested region).
-      */
-      if( osFstat(pShmNode->hShm, &sStat) ){
-        rc = SQLITE_IOERR_SHMSIZE;
-        goto shmpage_out;
-      }
-  
-      if( sStat.st_size<nByte ){
-        /* The requested memory region does not exist. If bExtend is set to
-        ** false, exit early. *pp will be set to NULL and SQLITE_OK returned.
-        */
-        if( !bExtend ){
-          goto shmpage_out;
-        }
+  if( pOrig ){
+#if HAVE_MREMAP
+    i64 nReuse = pFd->mmapSize;
+#else
+    const int szSyspage = osGetpagesize();
+    i64 nReuse = (pFd->mmapSize & ~(szSyspage-1));
+#endif
+    u8 *pReq = &pOrig[nReuse];
 
-        /* Alternatively, if bExtend is true, extend the file. Do this by
-        ** writing a single byte to the end of each (OS) page being
-        ** allocated or extended. Technically, we need only write to the
-        ** last page in order to extend the file. But writing to all new
-        ** pages forces the OS to allocate them immediately, which reduces
-        ** the chances of SIGBUS while accessing the mapped region later on.
-        */
-        else{
-          static const int pgsz = 4096;
-          int iPg;
+    /* Unmap any pages of the existing mapping that cannot be reused. */
+    if( nReuse!=nOrig ){
+      osMunmap(pReq, nOrig-nReuse);
+    }
 
-          /* Write to the last byte of each newly allocated or extended page */
-          assert( (nByte % pgsz)==0 );
-          for(iPg=(sStat.st_size/pgsz); iPg<(nByte/pgsz); iPg++){
-            int x = 0;
-            if( seekAndWriteFd(pShmNode->hShm, iPg*pgsz + pgsz-1,"",1,&x)!=1 ){
-              const char *zFile = pShmNode->zFilename;
-              rc = unixLogError(SQLITE_IOERR_SHMSIZE, "write", zFile);
-              goto shmpage_out;
-            }
-          }
-        }
+#if HAVE_MREMAP
+    pNew = osMremap(pOrig, nReuse, nNew, MREMAP_MAYMOVE);
+    zErr = "mremap";
+#else
+    pNew = osMmap(pReq, nNew-nReuse, flags, MAP_SHARED, h, nReuse);
+    if( pNew!=MAP_FAILED ){
+      if( pNew!=pReq ){
+        osMunmap(pNew, nNew - nReuse);
+        pNew = 0;
+      }else{
+        pNew = pOrig;
       }
     }
+#endif
 
-    /* Map the requested memory region into this processes address space. */
-    apNew = (char **)sqlite3_realloc(
-        pShmNode->apRegion, nReqRegion*sizeof(char *)
-    );
-    if( !apNew ){
-      rc = SQLITE_IOERR_NOMEM_BKPT;
-      goto shmpage_out;
+    /* The attempt to extend the existing mapping failed. Free it. */
+    if( pNew==MAP_FAILED || pNew==0 ){
+      osMunmap(pOrig, nReuse);
     }
-    pShmNode->apRegion = apNew;
-    while( pShmNode->nRegion<nReqRegion ){
-      int nMap = szRegion*nShmPerMap;
-      int i;
-      void *pMem;
-      if( pShmNode->hShm>=0 ){
-        pMem = osMmap(0, nMap,
-            pShmNode->isReadonly ? PROT_READ : PROT_READ|PROT_WRITE, 
-            MAP_SHARED, pShmNode->hShm, szRegion*(i64)pShmNode->nRegion
-        );
-        if( pMem==MAP_FAILED ){
-          rc = unixLogError(SQLITE_IOERR_SHMMAP, "mmap", pShmNode->zFilename);
-          goto shmpage_out;
-        }
-      }else{
-        pMem = sqlite3_malloc64(nMap);
-        if( pMem==0 ){
-          rc = SQLITE_NOMEM_BKPT;
-          goto shmpage_out;
-        }
-        memset(pMem, 0, nMap);
-      }
+  }
 
-      for(i=0; i<nShmPerMap; i++){
-        pShmNode->apRegion[pShmNode->nRegion+i] = &((char*)pMem)[szRegion*i];
-      }
-      pShmNode->nRegion += nShmPerMap;
+  /* If pNew is still NULL, try to create an entirely new mapping. */
+  if( pNew==0 ){
+    pNew = osMmap(0, nNew, flags, MAP_SHARED, h, 0);
+  }
+
+  if( pNew==MAP_FAILED ){
+    pNew = 0;
+    nNew = 0;
+    unixLogError(SQLITE_OK, zErr, pFd->zPath);
+
+    /* If the mmap() above failed, assume that all subsequent mmap() calls
+    ** will probably fail too. Fall back to using xRead/xWrite exclusively
+    ** in this case.  */
+    pFd->mmapSizeMax = 0;
+  }
+  pFd->pMapRegion = (void *)pNew;
+  pFd->mmapSize = pFd->mmapSizeActual = nNew;
+}
+
+/*
+** Memory map or remap the file opened by file-descriptor pFd (if the file
+** is already mapped, the existing mapping is replaced by the new). Or, if 
+** there already exists a mapping for this file, and there are still 
+** outstanding xFetch() references to it, this function is a no-op.
+**
+** If parameter nByte is non-negative, then it is the requested size of 
+** the mapping to create. Otherwise, if nByte is less than zero, then the 
+** requested size is the size of the file on disk. The actual size of the
+** created mapping is either the requested size or the value configured 
+** using SQLITE_FCNTL_MMAP_LIMIT, whichever is smaller.
+**
+** SQLITE_OK is returned if no error occurs (even if the mapping is not
+** recreated as a result of outstanding references) or an SQLite error
+** code otherwise.
+*/
+static int unixMapfile(unixFile *pFd, i64 nMap){
+  assert( nMap>=0 || pFd->nFetchOut==0 );
+  assert( nMap>0 || (pFd->mmapSize==0 && pFd->pMapRegion==0) );
+  if( pFd->nFetchOut>0 ) return SQLITE_OK;
+
+  if( nMap<0 ){
+    struct stat statbuf;          /* Low-level file information */
+    if( osFstat(pFd->h, &statbuf) ){
+      return SQLITE_IOERR_FSTAT;
     }
+    nMap = statbuf.st_size;
+  }
+  if( nMap>pFd->mmapSizeMax ){
+    nMap = pFd->mmapSizeMax;
   }
 
-shmpage_out:
-  if( pShmNode->nRegion>iRegion ){
-    *pp = pShmNode->apRegion[iRegion];
-  }else{
-    *pp = 0;
+  assert( nMap>0 || (pFd->mmapSize==0 && pFd->pMapRegion==0) );
+  if( nMap!=pFd->mmapSize ){
+    unixRemapfile(pFd, nMap);
   }
-  if( pShmNode->isReadonly && rc==SQLITE_OK ) rc = SQLITE_READONLY;
-  sqlite3_mutex_leave(pShmNode->pShmMutex);
-  return rc;
+
+  return SQLITE_OK;
 }
+#endif /* SQLITE_MAX_MMAP_SIZE>0 */
+
+/*
+** If possible, return a pointer to a mapping of file fd starting at offset
+** iOff. The mapping must be valid for at least nAmt bytes.
+**
+** If such a pointer can be obtained, store it in *pp and return SQLITE_OK.
+** Or, if one cannot but no error occurs, set *pp to 0 and return SQLITE_OK.
+** Finally, if an error does occur, return an SQLite error code. The final
+** value of *pp is undefined in this case.
+**
+** If this function does return a pointer, the caller must eventually 
+** release the reference by calling unixUnfetch().
+*/
+static int unixFetch(sqlite3_file *fd, i64 iOff, int nAmt, void **pp){
+#if SQLITE_MAX_MMAP_SIZE>0
+  unixFile *pFd = (unixFile *)fd;   /* The underlying database file */
+#endif
+  *pp = 0;
 
+#if SQLITE_MAX_MMAP_SIZE>0
+  if( pFd->mmapSizeMax>0 ){
+    if( pFd->pMapRegion==0 ){
+      int rc = unixMapfile(pFd, -1);
+      if( rc!=SQLITE_OK ) return rc;
+    }
+    if( pFd->mmapSize >= iOff+nAmt ){
+      *pp = &((u8 *)pFd->pMapRegion)[iOff];
+      pFd->nFetchOut++;
+    }
+  }
+#endif
+  return SQLITE_OK;
+}
 
 /*
-** Change the lock state for a shared-memory segment.
+** If the third argument is non-NULL, then this function releases a 
+** reference obtained by an earlier call to unixFetch(). The second
+** argument passed to this function must be the same as the corresponding
+** argument that was passed to the unixFetch() invocation. 
 **
-** Note that the relationship between SHAREd and EXCLUSIVE locks is a little
-** different here than in posix.  In xShmLock(), one can go from unlocked
-** to shared and back or from unlocked to exclusive and back.  But one may
-** not go from shared to exclusive or from exclusive to shared.
+** Or, if the third argument is NULL, then this function is being called 
+** to inform the VFS layer that, according to POSIX, any existing mapping 
+** may now be invalid and should be unmapped.
 */
-static int unixShmLock(
-  sqlite3_file *fd,          /* Database file holding the shared memory */
-  int ofst,                  /* First lock to acquire or release */
-  int n,                     /* Number of locks to acquire or release */
-  int flags                  /* What to do with the lock */
-){
-  unixFile *pDbFd = (unixFile*)fd;      /* Connection holding shared memory */
-  unixShm *p = pDbFd->pShm;             /* The shared memory being locked */
-  unixShmNode *pShmNode = p->pShmNode;  /* The underlying file iNode */
-  int rc = SQLITE_OK;                   /* Result code */
-  u16 mask;                             /* Mask of locks to take or release */
-  int *aLock = pShmNode->aLock;
+static int unixUnfetch(sqlite3_file *fd, i64 iOff, void *p){
+#if SQLITE_MAX_MMAP_SIZE>0
+  unixFile *pFd = (unixFile *)fd;   /* The underlying database file */
+  UNUSED_PARAMETER(iOff);
 
-  assert( pShmNode==pDbFd->pInode->pShmNode );
-  assert( pShmNode->pInode==pDbFd->pInode );
-  assert( ofst>=0 && ofst+n<=SQLITE_SHM_NLOCK );
-  assert( n>=1 );
-  assert( flags==(SQLITE_SHM_LOCK | SQLITE_SHM_SHARED)
-       || flags==(SQLITE_SHM_LOCK | SQLITE_SHM_EXCLUSIVE)
-       || flags==(SQLITE_SHM_UNLOCK | SQLITE_SHM_SHARED)
-       || flags==(SQLITE_SHM_UNLOCK | SQLITE_SHM_EXCLUSIVE) );
-  assert( n==1 || (flags & SQLITE_SHM_EXCLUSIVE)!=0 );
-  assert( pShmNode->hShm>=0 || pDbFd->pInode->bProcessLock==1 );
-  assert( pShmNode->hShm<0 || pDbFd->pInode->bProcessLock==0 );
+  /* If p==0 (unmap the entire file) then there must be no outstanding 
+  ** xFetch references. Or, if p!=0 (meaning it is an xFetch reference),
+  ** then there must be at least one outstanding.  */
+  assert( (p==0)==(pFd->nFetchOut==0) );
 
-  /* Check that, if this to be a blocking lock, no locks that occur later
-  ** in the following list than the lock being obtained are already held:
-  **
-  **   1. Checkpointer lock (ofst==1).
-  **   2. Write lock (ofst==0).
-  **   3. Read locks (ofst>=3 && ofst<SQLITE_SHM_NLOCK).
-  **
-  ** In other words, if this is a blocking lock, none of the locks that
-  ** occur later in the above list than the lock being obtained may be
-  ** held.  
-  **
-  ** It is not permitted to block on the RECOVER lock.
-  */
-#ifdef SQLITE_ENABLE_SETLK_TIMEOUT
-  assert( (flags & SQLITE_SHM_UNLOCK) || pDbFd->iBusyTimeout==0 || (
-         (ofst!=2)                                   /* not RECOVER */
-      && (ofst!=1 || (p->exclMask|p->sharedMask)==0)
-      && (ofst!=0 || (p->exclMask|p->sharedMask)<3)
-      && (ofst<3  || (p->exclMask|p->sharedMask)<(1<<ofst))
-  ));
+  /* If p!=0, it must match the iOff value. */
+  assert( p==0 || p==&((u8 *)pFd->pMapRegion)[iOff] );
+
+  if( p ){
+    pFd->nFetchOut--;
+  }else{
+    unixUnmapfile(pFd);
+  }
+
+  assert( pFd->nFetchOut>=0 );
+#else
+  UNUSED_PARAMETER(fd);
+  UNUSED_PARAMETER(p);
+  UNUSED_PARAMETER(iOff);
+#endif
+  return SQLITE_OK;
+}
+
+/*
+******************************************************************************
+************************** Asynchronous I/O **********************************
+**
+** The xSubmit and xComplete methods (sqlite3_io_methods version 4) allow a
+** caller to have many reads, writes and syncs of a file in flight at once.
+** Requests passed to xSubmit are started in the background, and xComplete
+** waits for them to finish and hands them back.
+**
+** Each unixFile that has used these methods has a unixAio object, which
+** is created by the first call to xSubmit and destroyed, after waiting for
+** any requests still in flight, by closeUnixFile().  There are three ways
+** of carrying the requests out:
+**
+**   UNIX_AIO_URING   On Linux, each unixAio has its own io_uring, which
+**                    is only ever used by the thread using the file.
+**
+**   UNIX_AIO_POOL    If an io_uring cannot be set up, the requests are
+**                    carried out by a pool of SQLITE_UNIX_AIO_THREADS
+**                    threads shared by all files.
+**
+**   UNIX_AIO_SYNC    If threads are not available either, xSubmit carries
+**                    each request out before it returns.
+**
+** A SYNC request is not started until every request submitted before it
+** on the same file has completed, and requests submitted after it are not
+** started until it has completed.  Other requests may be carried out in
+** any order, and concurrently with each other.
+*/
+#define UNIX_AIO_SYNC   0
+#define UNIX_AIO_POOL   1
+#define UNIX_AIO_URING  2
+
+/*
+** The number of threads in the pool used when io_uring is unavailable,
+** and the number of entries in the submission queue of each io_uring.
+*/
+#ifndef SQLITE_UNIX_AIO_THREADS
+# define SQLITE_UNIX_AIO_THREADS 4
+#endif
+#ifndef SQLITE_UNIX_URING_DEPTH
+# define SQLITE_UNIX_URING_DEPTH 64
 #endif
 
-  mask = (1<<(ofst+n)) - (1<<ofst);
-  assert( n>1 || mask==(1<<ofst) );
-  sqlite3_mutex_enter(pShmNode->pShmMutex);
-  assert( assertLockingArrayOk(pShmNode) );
-  if( flags & SQLITE_SHM_UNLOCK ){
-    if( (p->exclMask|p->sharedMask) & mask ){
-      int ii;
-      int bUnlock = 1;
+#if SQLITE_THREADSAFE>0 && !defined(SQLITE_DISABLE_AIO_THREADS)
+# define SQLITE_UNIX_AIO_POOL 1
+#endif
 
-      for(ii=ofst; ii<ofst+n; ii++){
-        if( aLock[ii]>((p->sharedMask & (1<<ii)) ? 1 : 0) ){
-          bUnlock = 0;
-        }
-      }
+#if defined(__linux__) && !defined(SQLITE_DISABLE_IO_URING) \
+ && defined(__has_include)
+# if __has_include(<linux/io_uring.h>)
+#  include <linux/io_uring.h>
+#  include <sys/syscall.h>
+#  include <sys/mman.h>
+   /* IORING_FEAT_RW_CUR_POS first appeared in the same kernel headers
+   ** as IORING_OP_READ and IORING_REGISTER_PROBE, which are enums. */
+#  if defined(__NR_io_uring_setup) && defined(IORING_FEAT_RW_CUR_POS) \
+   && (!defined(SQLITE_OMIT_WAL) || SQLITE_MAX_MMAP_SIZE>0)
+#   define SQLITE_UNIX_IO_URING 1
+#  endif
+# endif
+#endif
 
-      if( bUnlock ){
-        rc = unixShmSystemLock(pDbFd, F_UNLCK, ofst+UNIX_SHM_BASE, n);
-        if( rc==SQLITE_OK ){
-          memset(&aLock[ofst], 0, sizeof(int)*n);
-        }
-      }else if( ALWAYS(p->sharedMask & (1<<ofst)) ){
-        assert( n==1 && aLock[ofst]>1 );
-        aLock[ofst]--;
-      }
+#ifdef SQLITE_UNIX_IO_URING
+/*
+** The mappings of an io_uring.  This is a minimal version of the
+** structure that liburing keeps, so that liburing is not required.
+*/
+typedef struct unixUring unixUring;
+struct unixUring {
+  int fd;                         /* io_uring file descriptor */
+  unsigned nEntry;                /* Number of submission queue entries */
+  unsigned *pSqHead;              /* Submission queue head (kernel) */
+  unsigned *pSqTail;              /* Submission queue tail (us) */
+  unsigned *pSqMask;              /* Submission queue index mask */
+  unsigned *aSqIdx;               /* Submission queue index array */
+  struct io_uring_sqe *aSqe;      /* Submission queue entries */
+  unsigned *pCqHead;              /* Completion queue head (us) */
+  unsigned *pCqTail;              /* Completion queue tail (kernel) */
+  unsigned *pCqMask;              /* Completion queue index mask */
+  struct io_uring_cqe *aCqe;      /* Completion queue entries */
+  void *pSqMap; size_t nSqMap;    /* Mapping of the submission queue */
+  void *pCqMap; size_t nCqMap;    /* Mapping of the completion queue */
+  size_t nSqeMap;                 /* Size of the mapping at aSqe */
+  unsigned nUnsubmitted;          /* Entries queued but not yet entered */
+};
+#endif
 
-      /* Undo the local locks */
-      if( rc==SQLITE_OK ){
-        p->exclMask &= ~mask;
-        p->sharedMask &= ~mask;
-      } 
-    }
-  }else if( flags & SQLITE_SHM_SHARED ){
-    assert( n==1 );
-    assert( (p->exclMask & (1<<ofst))==0 );
-    if( (p->sharedMask & mask)==0 ){
-      if( aLock[ofst]<0 ){
-        rc = SQLITE_BUSY;
-      }else if( aLock[ofst]==0 ){
-        rc = unixShmSystemLock(pDbFd, F_RDLCK, ofst+UNIX_SHM_BASE, n);
-      }
+/*
+** Asynchronous I/O state of a single unixFile.
+**
+** When eBackend is UNIX_AIO_POOL, all fields from nActive onwards are
+** protected by unixAioPool.pMutex.  Otherwise they are only ever used by
+** the thread using the file.
+*/
+typedef struct unixAio unixAio;
+struct unixAio {
+  int eBackend;                   /* UNIX_AIO_SYNC, _POOL or _URING */
+  int h;                          /* File descriptor */
+  int nOutstanding;               /* Submitted but not returned by xComplete */
+#ifdef SQLITE_UNIX_IO_URING
+  unixUring ring;                 /* The io_uring, for UNIX_AIO_URING */
+  int nInFlight;                  /* Requests owned by the kernel */
+#endif
+  sqlite3_mutex_cond *pCond;      /* Signaled when a request completes */
+  int nActive;                    /* Requests queued to or run by the pool */
+  int bSyncActive;                /* A SYNC request is queued or running */
+  sqlite3_io_request *pHeld;      /* Requests not yet queued or started */
+  sqlite3_io_request *pHeldLast;  /* Last entry on pHeld */
+  sqlite3_io_request *pDone;      /* Completed requests, oldest first */
+  sqlite3_io_request *pDoneLast;  /* Last entry on pDone */
+  int nDone;                      /* Number of entries on pDone */
+};
 
-      /* Get the local shared locks */
-      if( rc==SQLITE_OK ){
-        p->sharedMask |= mask;
-        aLock[ofst]++;
+/*
+** Add request p to the end of the list *ppFirst .. *ppLast.
+*/
+static void unixAioAppend(
+  sqlite3_io_request **ppFirst,
+  sqlite3_io_request **ppLast,
+  sqlite3_io_request *p
+){
+  p->pVfsNext = 0;
+  if( *ppLast ){
+    (*ppLast)->pVfsNext = p;
+  }else{
+    *ppFirst = p;
+  }
+  *ppLast = p;
+}
+
+/*
+** Remove and return the first request on the list *ppFirst .. *ppLast.
+** The list must not be empty.
+*/
+static sqlite3_io_request *unixAioPop(
+  sqlite3_io_request **ppFirst,
+  sqlite3_io_request **ppLast
+){
+  sqlite3_io_request *p = *ppFirst;
+  assert( p!=0 );
+  *ppFirst = p->pVfsNext;
+  if( *ppFirst==0 ) *ppLast = 0;
+  p->pVfsNext = 0;
+  return p;
+}
+
+/*
+** Set p->rc to the result of a request that transferred nDone bytes of
+** p->nAmt and then stopped, either because iErrno was set or because
+** end-of-file was reached.  A short read zero-fills the rest of the
+** buffer, as xRead does.
+*/
+static void unixAioResult(sqlite3_io_request *p, int nDone, int iErrno){
+  switch( p->op ){
+    case SQLITE_IOREQ_READ:
+      if( iErrno ){
+        p->rc = SQLITE_IOERR_READ;
+      }else if( nDone<p->nAmt ){
+        memset(&((char*)p->pBuf)[nDone], 0, p->nAmt-nDone);
+        p->rc = SQLITE_IOERR_SHORT_READ;
+      }else{
+        p->rc = SQLITE_OK;
       }
+      break;
+    case SQLITE_IOREQ_WRITE:
+      if( iErrno && iErrno!=ENOSPC ){
+        p->rc = SQLITE_IOERR_WRITE;
+      }else if( nDone<p->nAmt ){
+        p->rc = SQLITE_FULL;
+      }else{
+        p->rc = SQLITE_OK;
+      }
+      break;
+    default:
+      p->rc = iErrno ? SQLITE_IOERR_FSYNC : SQLITE_OK;
+      break;
+  }
+}
+
+/*
+** Carry out request p on file descriptor h, using blocking system calls,
+** and set p->rc.  This is safe to call from any thread, as it does not
+** touch the unixFile.
+*/
+static void unixAioExecute(int h, sqlite3_io_request *p){
+  int nDone = 0;
+  int iErrno = 0;
+  if( p->op==SQLITE_IOREQ_SYNC ){
+    if( full_fsync(h, (p->flags&0x0F)==SQLITE_SYNC_FULL,
+                   p->flags & SQLITE_SYNC_DATAONLY) ){
+      iErrno = errno;
     }
   }else{
-    /* Make sure no sibling connections hold locks that will block this
-    ** lock.  If any do, return SQLITE_BUSY right away.  */
-    int ii;
-    for(ii=ofst; ii<ofst+n; ii++){
-      assert( (p->sharedMask & mask)==0 );
-      if( ALWAYS((p->exclMask & (1<<ii))==0) && aLock[ii] ){
-        rc = SQLITE_BUSY;
+    while( nDone<p->nAmt ){
+      char *z = &((char*)p->pBuf)[nDone];
+      int n = p->nAmt - nDone;
+      i64 iOfst = p->iOfst + nDone;
+      ssize_t got;
+#if defined(USE_PREAD)
+      if( p->op==SQLITE_IOREQ_READ ){
+        got = osPread(h, z, n, iOfst);
+      }else{
+        got = osPwrite(h, z, n, iOfst);
+      }
+#elif defined(USE_PREAD64)
+      if( p->op==SQLITE_IOREQ_READ ){
+        got = osPread64(h, z, n, iOfst);
+      }else{
+        got = osPwrite64(h, z, n, iOfst);
+      }
+#else
+      /* seekAndRead() and seekAndWrite() use lseek() here, which would
+      ** race with the thread using the file. */
+      if( p->op==SQLITE_IOREQ_READ ){
+        got = pread(h, z, n, iOfst);
+      }else{
+        got = pwrite(h, z, n, iOfst);
+      }
+#endif
+      if( got<0 ){
+        if( errno==EINTR ) continue;
+        iErrno = errno;
         break;
       }
+      if( got==0 ) break;
+      nDone += (int)got;
     }
+  }
+  unixAioResult(p, nDone, iErrno);
+}
 
-    /* Get the exclusive locks at the system level. Then if successful
-    ** also update the in-memory values. */
-    if( rc==SQLITE_OK ){
-      rc = unixShmSystemLock(pDbFd, F_WRLCK, ofst+UNIX_SHM_BASE, n);
-      if( rc==SQLITE_OK ){
-        assert( (p->sharedMask & mask)==0 );
-        p->exclMask |= mask;
-        for(ii=ofst; ii<ofst+n; ii++){
-          aLock[ii] = -1;
-        }
-      }
+#ifdef SQLITE_UNIX_DIRECT_IO
+/*
+** Carry out read or write request p on direct I/O file pFile.  This is
+** used instead of unixAioExecute(), as it deals with alignment.
+*/
+static void unixDirectExecute(unixFile *pFile, sqlite3_io_request *p){
+  int nDone = 0;
+  int iErrno = 0;
+  while( nDone<p->nAmt ){
+    u8 *z = &((u8*)p->pBuf)[nDone];
+    int n = MIN(p->nAmt - nDone, SQLITE_UNIX_DIRECT_BUFSZ/2);
+    if( p->op==SQLITE_IOREQ_READ ){
+      n = seekAndRead(pFile, p->iOfst + nDone, z, n);
+    }else{
+      n = seekAndWrite(pFile, p->iOfst + nDone, z, n);
+    }
+    if( n<0 ){
+      iErrno = pFile->lastErrno;
+      break;
     }
+    if( n==0 ) break;
+    nDone += n;
   }
-  assert( assertLockingArrayOk(pShmNode) );
-  sqlite3_mutex_leave(pShmNode->pShmMutex);
-  OSTRACE(("SHM-LOCK shmid-%d, pid-%d got %03x,%03x\n",
-           p->id, osGetpid(0), p->sharedMask, p->exclMask));
-  return rc;
+  unixAioResult(p, nDone, iErrno);
 }
+#endif
 
+#ifdef SQLITE_UNIX_IO_URING
 /*
-** Implement a memory barrier or memory fence on shared memory.  
-**
-** All loads and stores begun before the barrier must complete before
-** any load or store begun after the barrier.
+** Wrappers for the io_uring system calls.
 */
-static void unixShmBarrier(
-  sqlite3_file *fd                /* Database file holding the shared memory */
-){
-  UNUSED_PARAMETER(fd);
-  sqlite3MemoryBarrier();         /* compiler-defined memory barrier */
-  assert( fd->pMethods->xLock==nolockLock 
-       || unixFileMutexNotheld((unixFile*)fd) 
-  );
-  unixEnterMutex();               /* Also mutex, for redundancy */
-  unixLeaveMutex();
+static int unixUringSetup(unsigned nEntry, struct io_uring_params *p){
+  return (int)syscall(__NR_io_uring_setup, nEntry, p);
+}
+static int unixUringEnter(int fd, unsigned nSubmit, unsigned nMin){
+  return (int)syscall(__NR_io_uring_enter, fd, nSubmit, nMin,
+                      nMin ? IORING_ENTER_GETEVENTS : 0, (void*)0, 0);
 }
 
 /*
-** Close a connection to shared-memory.  Delete the underlying 
-** storage if deleteFlag is true.
-**
-** If there is no shared memory associated with the connection then this
-** routine is a harmless no-op.
+** Unmap and close io_uring pRing.
 */
-static int unixShmUnmap(
-  sqlite3_file *fd,               /* The underlying database file */
-  int deleteFlag                  /* Delete shared-memory if true */
-){
-  unixShm *p;                     /* The connection to be closed */
-  unixShmNode *pShmNode;          /* The underlying shared-memory file */
-  unixShm **pp;                   /* For looping over sibling connections */
-  unixFile *pDbFd;                /* The underlying database file */
-
-  pDbFd = (unixFile*)fd;
-  p = pDbFd->pShm;
-  if( p==0 ) return SQLITE_OK;
-  pShmNode = p->pShmNode;
-
-  assert( pShmNode==pDbFd->pInode->pShmNode );
-  assert( pShmNode->pInode==pDbFd->pInode );
-
-  /* Remove connection p from the set of connections associated
-  ** with pShmNode */
-  sqlite3_mutex_enter(pShmNode->pShmMutex);
-  for(pp=&pShmNode->pFirst; (*pp)!=p; pp = &(*pp)->pNext){}
-  *pp = p->pNext;
-
-  /* Free the connection p */
-  sqlite3_free(p);
-  pDbFd->pShm = 0;
-  sqlite3_mutex_leave(pShmNode->pShmMutex);
+static void unixUringClose(unixUring *pRing){
+  if( pRing->aSqe ) osMunmap(pRing->aSqe, pRing->nSqeMap);
+  if( pRing->pCqMap && pRing->pCqMap!=pRing->pSqMap ){
+    osMunmap(pRing->pCqMap, pRing->nCqMap);
+  }
+  if( pRing->pSqMap ) osMunmap(pRing->pSqMap, pRing->nSqMap);
+  if( pRing->fd>=0 ) osClose(pRing->fd);
+  memset(pRing, 0, sizeof(*pRing));
+  pRing->fd = -1;
+}
 
-  /* If pShmNode->nRef has reached 0, then close the underlying
-  ** shared-memory file, too */
-  assert( unixFileMutexNotheld(pDbFd) );
-  unixEnterMutex();
-  assert( pShmNode->nRef>0 );
-  pShmNode->nRef--;
-  if( pShmNode->nRef==0 ){
-    if( deleteFlag && pShmNode->hShm>=0 ){
-      osUnlink(pShmNode->zFilename);
+/*
+** Return true if the kernel that io_uring fd belongs to supports the
+** read, write and fsync operations used here.
+*/
+static int unixUringProbe(int fd){
+  int nOp = IORING_OP_WRITE+1;
+  size_t nByte = sizeof(struct io_uring_probe)
+               + nOp*sizeof(struct io_uring_probe_op);
+  struct io_uring_probe *pProbe;
+  int bOk = 0;
+  pProbe = (struct io_uring_probe*)sqlite3_malloc64(nByte);
+  if( pProbe ){
+    memset(pProbe, 0, nByte);
+    if( syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE,
+                pProbe, nOp)==0
+     && pProbe->last_op>=IORING_OP_WRITE
+     && (pProbe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED)
+     && (pProbe->ops[IORING_OP_WRITE].flags & IO_URING_OP_SUPPORTED)
+     && (pProbe->ops[IORING_OP_FSYNC].flags & IO_URING_OP_SUPPORTED)
+    ){
+      bOk = 1;
     }
-    unixShmPurge(pDbFd);
+    sqlite3_free(pProbe);
   }
-  unixLeaveMutex();
+  return bOk;
+}
+
+/*
+** Set up and map an io_uring in *pRing.  Return SQLITE_OK if successful,
+** or an error code if the kernel or the process does not allow it.
+*/
+static int unixUringOpen(unixUring *pRing){
+  struct io_uring_params prm;
+  void *pMap;
+
+  memset(pRing, 0, sizeof(*pRing));
+  memset(&prm, 0, sizeof(prm));
+  pRing->fd = unixUringSetup(SQLITE_UNIX_URING_DEPTH, &prm);
+  if( pRing->fd<0 ){
+    pRing->fd = -1;
+    return SQLITE_ERROR;
+  }
+  if( !unixUringProbe(pRing->fd) ) goto uring_open_err;
 
+  pRing->nSqMap = prm.sq_off.array + prm.sq_entries*sizeof(unsigned);
+  pRing->nCqMap = prm.cq_off.cqes + prm.cq_entries*sizeof(struct io_uring_cqe);
+  if( prm.features & IORING_FEAT_SINGLE_MMAP ){
+    if( pRing->nCqMap>pRing->nSqMap ) pRing->nSqMap = pRing->nCqMap;
+    pRing->nCqMap = pRing->nSqMap;
+  }
+  pMap = osMmap(0, pRing->nSqMap, PROT_READ|PROT_WRITE,
+                MAP_SHARED|MAP_POPULATE, pRing->fd, IORING_OFF_SQ_RING);
+  if( pMap==MAP_FAILED ) goto uring_open_err;
+  pRing->pSqMap = pMap;
+  if( prm.features & IORING_FEAT_SINGLE_MMAP ){
+    pRing->pCqMap = pMap;
+  }else{
+    pMap = osMmap(0, pRing->nCqMap, PROT_READ|PROT_WRITE,
+                  MAP_SHARED|MAP_POPULATE, pRing->fd, IORING_OFF_CQ_RING);
+    if( pMap==MAP_FAILED ) goto uring_open_err;
+    pRing->pCqMap = pMap;
+  }
+  pRing->nSqeMap = prm.sq_entries*sizeof(struct io_uring_sqe);
+  pMap = osMmap(0, pRing->nSqeMap, PROT_READ|PROT_WRITE,
+                MAP_SHARED|MAP_POPULATE, pRing->fd, IORING_OFF_SQES);
+  if( pMap==MAP_FAILED ) goto uring_open_err;
+  pRing->aSqe = (struct io_uring_sqe*)pMap;
+
+  pRing->nEntry = prm.sq_entries;
+  pRing->pSqHead = (unsigned*)((char*)pRing->pSqMap + prm.sq_off.head);
+  pRing->pSqTail = (unsigned*)((char*)pRing->pSqMap + prm.sq_off.tail);
+  pRing->pSqMask = (unsigned*)((char*)pRing->pSqMap + prm.sq_off.ring_mask);
+  pRing->aSqIdx = (unsigned*)((char*)pRing->pSqMap + prm.sq_off.array);
+  pRing->pCqHead = (unsigned*)((char*)pRing->pCqMap + prm.cq_off.head);
+  pRing->pCqTail = (unsigned*)((char*)pRing->pCqMap + prm.cq_off.tail);
+  pRing->pCqMask = (unsigned*)((char*)pRing->pCqMap + prm.cq_off.ring_mask);
+  pRing->aCqe = (struct io_uring_cqe*)((char*)pRing->pCqMap + prm.cq_off.cqes);
   return SQLITE_OK;
-}
 
+uring_open_err:
+  unixUringClose(pRing);
+  return SQLITE_ERROR;
+}
 
-#else
-# define unixShmMap     0
-# define unixShmLock    0
-# define unixShmBarrier 0
-# define unixShmUnmap   0
-#endif /* #ifndef SQLITE_OMIT_WAL */
+/*
+** Queue an io_uring operation that carries out the part of request p
+** that is not yet done.  nVfsDone holds the number of bytes already
+** transferred.  The submission queue must have a free entry.
+*/
+static void unixUringQueue(unixAio *pAio, sqlite3_io_request *p){
+  unixUring *pRing = &pAio->ring;
+  unsigned iTail = *pRing->pSqTail;
+  unsigned iIdx = iTail & *pRing->pSqMask;
+  struct io_uring_sqe *pSqe = &pRing->aSqe[iIdx];
+  int nDone = (int)p->nVfsDone;
+
+  assert( iTail - __atomic_load_n(pRing->pSqHead, __ATOMIC_ACQUIRE)
+          < pRing->nEntry );
+  memset(pSqe, 0, sizeof(*pSqe));
+  pSqe->fd = pAio->h;
+  pSqe->user_data = (u64)(uptr)p;
+  switch( p->op ){
+    case SQLITE_IOREQ_READ:
+    case SQLITE_IOREQ_WRITE:
+      pSqe->opcode = (p->op==SQLITE_IOREQ_READ ? IORING_OP_READ
+                                               : IORING_OP_WRITE);
+      pSqe->addr = (u64)(uptr)&((char*)p->pBuf)[nDone];
+      pSqe->len = (unsigned)(p->nAmt - nDone);
+      pSqe->off = (u64)(p->iOfst + nDone);
+      break;
+    default:
+      pSqe->opcode = IORING_OP_FSYNC;
+      if( p->flags & SQLITE_SYNC_DATAONLY ){
+        pSqe->fsync_flags = IORING_FSYNC_DATASYNC;
+      }
+      break;
+  }
+  pRing->aSqIdx[iIdx] = iIdx;
+  __atomic_store_n(pRing->pSqTail, iTail+1, __ATOMIC_RELEASE);
+  pRing->nUnsubmitted++;
+  pAio->nInFlight++;
+}
 
-#if SQLITE_MAX_MMAP_SIZE>0
 /*
-** If it is currently memory mapped, unmap file pFd.
-*/
-static void unixUnmapfile(unixFile *pFd){
-  assert( pFd->nFetchOut==0 );
-  if( pFd->pMapRegion ){
-    osMunmap(pFd->pMapRegion, pFd->mmapSizeActual);
-    pFd->pMapRegion = 0;
-    pFd->mmapSize = 0;
-    pFd->mmapSizeActual = 0;
+** Queue as many of the requests held back on pAio as may now be started.
+**
+** io_uring does not order operations on its own, so SYNC barriers are
+** kept in user space, as for UNIX_AIO_POOL.  A SYNC is only queued once
+** every earlier request has completed in full, including the rest of any
+** partial read or write, and no later request is queued until the SYNC
+** has completed.  Requests are also held while the submission queue is
+** full.
+*/
+static void unixUringRelease(unixAio *pAio){
+  while( pAio->pHeld && !pAio->bSyncActive
+      && pAio->nInFlight<(int)pAio->ring.nEntry
+  ){
+    sqlite3_io_request *p = pAio->pHeld;
+    if( p->op==SQLITE_IOREQ_SYNC ){
+      if( pAio->nInFlight>0 ) break;
+      pAio->bSyncActive = 1;
+    }
+    unixAioPop(&pAio->pHeld, &pAio->pHeldLast);
+    unixUringQueue(pAio, p);
   }
 }
 
 /*
-** Attempt to set the size of the memory mapping maintained by file 
-** descriptor pFd to nNew bytes. Any existing mapping is discarded.
-**
-** If successful, this function sets the following variables:
-**
-**       unixFile.pMapRegion
-**       unixFile.mmapSize
-**       unixFile.mmapSizeActual
-**
-** If unsuccessful, an error message is logged via sqlite3_log() and
-** the three variables above are zeroed. In this case SQLite should
-** continue accessing the database using the xRead() and xWrite()
-** methods.
+** The number of times unixUringEnterAll() sleeps and retries when
+** io_uring_enter() fails with EAGAIN or EBUSY and there is nothing in
+** flight whose completion might free up resources.
 */
-static void unixRemapfile(
-  unixFile *pFd,                  /* File descriptor object */
-  i64 nNew                        /* Required mapping size */
-){
-  const char *zErr = "mmap";
-  int h = pFd->h;                      /* File descriptor open on db file */
-  u8 *pOrig = (u8 *)pFd->pMapRegion;   /* Pointer to current file mapping */
-  i64 nOrig = pFd->mmapSizeActual;     /* Size of pOrig region in bytes */
-  u8 *pNew = 0;                        /* Location of new mapping */
-  int flags = PROT_READ;               /* Flags to pass to mmap() */
-
-  assert( pFd->nFetchOut==0 );
-  assert( nNew>pFd->mmapSize );
-  assert( nNew<=pFd->mmapSizeMax );
-  assert( nNew>0 );
-  assert( pFd->mmapSizeActual>=pFd->mmapSize );
-  assert( MAP_FAILED!=0 );
-
-#ifdef SQLITE_MMAP_READWRITE
-  if( (pFd->ctrlFlags & UNIXFILE_RDONLY)==0 ) flags |= PROT_WRITE;
-#endif
-
-  if( pOrig ){
-#if HAVE_MREMAP
-    i64 nReuse = pFd->mmapSize;
-#else
-    const int szSyspage = osGetpagesize();
-    i64 nReuse = (pFd->mmapSize & ~(szSyspage-1));
+#ifndef SQLITE_UNIX_URING_RETRY
+# define SQLITE_UNIX_URING_RETRY 100
 #endif
-    u8 *pReq = &pOrig[nReuse];
-
-    /* Unmap any pages of the existing mapping that cannot be reused. */
-    if( nReuse!=nOrig ){
-      osMunmap(pReq, nOrig-nReuse);
-    }
 
-#if HAVE_MREMAP
-    pNew = osMremap(pOrig, nReuse, nNew, MREMAP_MAYMOVE);
-    zErr = "mremap";
-#else
-    pNew = osMmap(pReq, nNew-nReuse, flags, MAP_SHARED, h, nReuse);
-    if( pNew!=MAP_FAILED ){
-      if( pNew!=pReq ){
-        osMunmap(pNew, nNew - nReuse);
-        pNew = 0;
-      }else{
-        pNew = pOrig;
+/*
+** Pass any queued operations to the kernel and, if nMin is greater than
+** zero, wait until at least nMin operations have completed.  Return
+** SQLITE_OK, or SQLITE_IOERR if io_uring_enter() fails, or keeps
+** failing with EAGAIN or EBUSY.
+*/
+static int unixUringEnterAll(unixAio *pAio, unsigned nMin){
+  unixUring *pRing = &pAio->ring;
+  int nRetry = 0;
+  while( pRing->nUnsubmitted>0 || nMin>0 ){
+    int n = unixUringEnter(pRing->fd, pRing->nUnsubmitted, nMin);
+    if( n<0 ){
+      if( errno==EINTR ) continue;
+      if( errno==EAGAIN || errno==EBUSY ){
+        /* Out of resources, or the completion queue is full.  Waiting for
+        ** at least one completion frees up something. */
+        if( nMin==0 && pAio->nInFlight>(int)pRing->nUnsubmitted ){
+          nMin = 1;
+          continue;
+        }
+        if( ++nRetry>SQLITE_UNIX_URING_RETRY ) return SQLITE_IOERR;
+        unixSleep(0, 1000);
+        continue;
       }
+      return SQLITE_IOERR;
     }
-#endif
+    pRing->nUnsubmitted -= (unsigned)n;
+    if( pRing->nUnsubmitted==0 ) break;
+  }
+  return SQLITE_OK;
+}
 
-    /* The attempt to extend the existing mapping failed. Free it. */
-    if( pNew==MAP_FAILED || pNew==0 ){
-      osMunmap(pOrig, nReuse);
+/*
+** Called after unixUringEnterAll() fails.  Take back the operations that
+** were queued but never passed to the kernel, and complete their requests
+** with an I/O error, so that xComplete returns them like any other
+** failed request.
+*/
+static void unixUringFailUnsubmitted(unixAio *pAio){
+  unixUring *pRing = &pAio->ring;
+  unsigned iTail = *pRing->pSqTail;
+  while( pRing->nUnsubmitted>0 ){
+    struct io_uring_sqe *pSqe;
+    sqlite3_io_request *p;
+    iTail--;
+    pSqe = &pRing->aSqe[iTail & *pRing->pSqMask];
+    p = (sqlite3_io_request*)(uptr)pSqe->user_data;
+    pRing->nUnsubmitted--;
+    pAio->nInFlight--;
+    if( p->op==SQLITE_IOREQ_SYNC ) pAio->bSyncActive = 0;
+    unixAioResult(p, (int)p->nVfsDone, EIO);
+    unixAioAppend(&pAio->pDone, &pAio->pDoneLast, p);
+    pAio->nDone++;
+  }
+  __atomic_store_n(pRing->pSqTail, iTail, __ATOMIC_RELEASE);
+}
+
+/*
+** Move the completed io_uring operations to the pDone list, queueing new
+** operations for any read or write that was only partly carried out and
+** for any held requests that may now be started.
+*/
+static void unixUringReap(unixAio *pAio){
+  unixUring *pRing = &pAio->ring;
+  unsigned iHead = *pRing->pCqHead;
+  unsigned iTail = __atomic_load_n(pRing->pCqTail, __ATOMIC_ACQUIRE);
+
+  while( iHead!=iTail ){
+    struct io_uring_cqe *pCqe = &pRing->aCqe[iHead & *pRing->pCqMask];
+    sqlite3_io_request *p = (sqlite3_io_request*)(uptr)pCqe->user_data;
+    int res = pCqe->res;
+    int nDone = (int)p->nVfsDone;
+
+    iHead++;
+    pAio->nInFlight--;
+    if( p->op==SQLITE_IOREQ_SYNC ) pAio->bSyncActive = 0;
+    if( p->op!=SQLITE_IOREQ_SYNC && res>0 && nDone+res<p->nAmt ){
+      /* A partial read or write.  Queue the rest of it. */
+      p->nVfsDone = nDone+res;
+      unixUringQueue(pAio, p);
+      continue;
+    }
+    if( res>=0 ){
+      unixAioResult(p, p->op==SQLITE_IOREQ_SYNC ? 0 : nDone+res, 0);
+    }else{
+      unixAioResult(p, nDone, -res);
     }
+    unixAioAppend(&pAio->pDone, &pAio->pDoneLast, p);
+    pAio->nDone++;
   }
+  __atomic_store_n(pRing->pCqHead, iHead, __ATOMIC_RELEASE);
+  unixUringRelease(pAio);
+}
+#endif /* SQLITE_UNIX_IO_URING */
 
-  /* If pNew is still NULL, try to create an entirely new mapping. */
-  if( pNew==0 ){
-    pNew = osMmap(0, nNew, flags, MAP_SHARED, h, 0);
+#ifdef SQLITE_UNIX_AIO_POOL
+/*
+** The thread pool shared by all files using UNIX_AIO_POOL.  The mutex and
+** condition variable are allocated by sqlite3_os_init(), and the threads
+** are started the first time a file needs them.
+*/
+static struct unixAioPoolType {
+  sqlite3_mutex *pMutex;          /* Protects this object and pool unixAios */
+  sqlite3_mutex_cond *pCond;      /* Signaled when work is queued */
+  int nThread;                    /* Number of threads in aThread[] */
+  int bShutdown;                  /* True when the threads should exit */
+  pthread_t aThread[SQLITE_UNIX_AIO_THREADS];  /* Worker threads */
+  sqlite3_io_request *pQueue;     /* Requests waiting for a worker */
+  sqlite3_io_request *pQueueLast; /* Last entry on pQueue */
+} unixAioPool;
+
+/*
+** Queue as many of the requests held back by SYNC barriers on pAio as
+** may now be started.  unixAioPool.pMutex must be held.
+*/
+static void unixAioPoolRelease(unixAio *pAio){
+  assert( sqlite3_mutex_held(unixAioPool.pMutex) );
+  while( pAio->pHeld && !pAio->bSyncActive ){
+    sqlite3_io_request *p = pAio->pHeld;
+    if( p->op==SQLITE_IOREQ_SYNC ){
+      if( pAio->nActive>0 ) break;
+      pAio->bSyncActive = 1;
+    }
+    unixAioPop(&pAio->pHeld, &pAio->pHeldLast);
+    pAio->nActive++;
+    unixAioAppend(&unixAioPool.pQueue, &unixAioPool.pQueueLast, p);
   }
+}
 
-  if( pNew==MAP_FAILED ){
-    pNew = 0;
-    nNew = 0;
-    unixLogError(SQLITE_OK, zErr, pFd->zPath);
+/*
+** Body of each pool thread.  Run queued requests until told to exit.
+*/
+static void *unixAioPoolMain(void *pArg){
+  UNUSED_PARAMETER(pArg);
+  sqlite3_mutex_enter(unixAioPool.pMutex);
+  for(;;){
+    sqlite3_io_request *p;
+    unixAio *pAio;
+    while( unixAioPool.pQueue==0 && !unixAioPool.bShutdown ){
+      sqlite3_mutex_cond_wait(unixAioPool.pCond, unixAioPool.pMutex, -1);
+    }
+    if( unixAioPool.pQueue==0 ) break;
+    p = unixAioPop(&unixAioPool.pQueue, &unixAioPool.pQueueLast);
+    pAio = (unixAio*)p->pVfsCtx;
+    sqlite3_mutex_leave(unixAioPool.pMutex);
+
+    unixAioExecute(pAio->h, p);
+
+    sqlite3_mutex_enter(unixAioPool.pMutex);
+    pAio->nActive--;
+    if( p->op==SQLITE_IOREQ_SYNC ) pAio->bSyncActive = 0;
+    unixAioAppend(&pAio->pDone, &pAio->pDoneLast, p);
+    pAio->nDone++;
+    if( pAio->pHeld ){
+      unixAioPoolRelease(pAio);
+      sqlite3_mutex_cond_broadcast(unixAioPool.pCond);
+    }
+    sqlite3_mutex_cond_broadcast(pAio->pCond);
+  }
+  sqlite3_mutex_leave(unixAioPool.pMutex);
+  return 0;
+}
 
-    /* If the mmap() above failed, assume that all subsequent mmap() calls
-    ** will probably fail too. Fall back to using xRead/xWrite exclusively
-    ** in this case.  */
-    pFd->mmapSizeMax = 0;
+/*
+** Start the pool threads if they are not already running.  Return
+** SQLITE_OK if at least one thread is running.  unixAioPool.pMutex must
+** be held.
+*/
+static int unixAioPoolStart(void){
+  assert( sqlite3_mutex_held(unixAioPool.pMutex) );
+  while( unixAioPool.nThread<SQLITE_UNIX_AIO_THREADS ){
+    pthread_t *pThread = &unixAioPool.aThread[unixAioPool.nThread];
+    if( pthread_create(pThread, 0, unixAioPoolMain, 0) ) break;
+    unixAioPool.nThread++;
   }
-  pFd->pMapRegion = (void *)pNew;
-  pFd->mmapSize = pFd->mmapSizeActual = nNew;
+  return unixAioPool.nThread>0 ? SQLITE_OK : SQLITE_ERROR;
 }
 
 /*
-** Memory map or remap the file opened by file-descriptor pFd (if the file
-** is already mapped, the existing mapping is replaced by the new). Or, if 
-** there already exists a mapping for this file, and there are still 
-** outstanding xFetch() references to it, this function is a no-op.
-**
-** If parameter nByte is non-negative, then it is the requested size of 
-** the mapping to create. Otherwise, if nByte is less than zero, then the 
-** requested size is the size of the file on disk. The actual size of the
-** created mapping is either the requested size or the value configured 
-** using SQLITE_FCNTL_MMAP_LIMIT, whichever is smaller.
-**
-** SQLITE_OK is returned if no error occurs (even if the mapping is not
-** recreated as a result of outstanding references) or an SQLite error
-** code otherwise.
+** Stop the pool threads.  Called by sqlite3_os_end().  The caller must
+** ensure that no requests are outstanding.
 */
-static int unixMapfile(unixFile *pFd, i64 nMap){
-  assert( nMap>=0 || pFd->nFetchOut==0 );
-  assert( nMap>0 || (pFd->mmapSize==0 && pFd->pMapRegion==0) );
-  if( pFd->nFetchOut>0 ) return SQLITE_OK;
+static void unixAioPoolShutdown(void){
+  int i;
+  sqlite3_mutex_enter(unixAioPool.pMutex);
+  unixAioPool.bShutdown = 1;
+  sqlite3_mutex_cond_broadcast(unixAioPool.pCond);
+  sqlite3_mutex_leave(unixAioPool.pMutex);
+  for(i=0; i<unixAioPool.nThread; i++){
+    pthread_join(unixAioPool.aThread[i], 0);
+  }
+  sqlite3_mutex_cond_free(unixAioPool.pCond);
+  sqlite3_mutex_free(unixAioPool.pMutex);
+  memset(&unixAioPool, 0, sizeof(unixAioPool));
+}
+#endif /* SQLITE_UNIX_AIO_POOL */
 
-  if( nMap<0 ){
-    struct stat statbuf;          /* Low-level file information */
-    if( osFstat(pFd->h, &statbuf) ){
-      return SQLITE_IOERR_FSTAT;
+/*
+** Return the unixAio object of pFile, creating it if it does not exist.
+** Return NULL if a malloc() fails.
+*/
+static unixAio *unixAioGet(unixFile *pFile){
+  unixAio *pAio = pFile->pAio;
+  if( pAio==0 ){
+    pAio = (unixAio*)sqlite3_malloc64(sizeof(unixAio));
+    if( pAio==0 ) return 0;
+    memset(pAio, 0, sizeof(*pAio));
+    pAio->h = pFile->h;
+    pAio->eBackend = UNIX_AIO_SYNC;
+#ifdef SQLITE_UNIX_IO_URING
+    pAio->ring.fd = -1;
+    /* Direct I/O files use UNIX_AIO_SYNC, which deals with alignment. */
+    if( !unixIsDirect(pFile) && unixUringOpen(&pAio->ring)==SQLITE_OK ){
+      pAio->eBackend = UNIX_AIO_URING;
     }
-    nMap = statbuf.st_size;
-  }
-  if( nMap>pFd->mmapSizeMax ){
-    nMap = pFd->mmapSizeMax;
+#endif
+#ifdef SQLITE_UNIX_AIO_POOL
+    if( pAio->eBackend==UNIX_AIO_SYNC && unixAioPool.pCond
+     && !unixIsDirect(pFile)
+    ){
+      pAio->pCond = sqlite3_mutex_cond_alloc();
+      if( pAio->pCond ){
+        int rc;
+        sqlite3_mutex_enter(unixAioPool.pMutex);
+        rc = unixAioPoolStart();
+        sqlite3_mutex_leave(unixAioPool.pMutex);
+        if( rc==SQLITE_OK ){
+          pAio->eBackend = UNIX_AIO_POOL;
+        }else{
+          sqlite3_mutex_cond_free(pAio->pCond);
+          pAio->pCond = 0;
+        }
+      }
+    }
+#endif
+    pFile->pAio = pAio;
   }
+  return pAio;
+}
 
-  assert( nMap>0 || (pFd->mmapSize==0 && pFd->pMapRegion==0) );
-  if( nMap!=pFd->mmapSize ){
-    unixRemapfile(pFd, nMap);
+/*
+** Implementation of xComplete.  Wait until at least nMin of the requests
+** submitted on file id and not yet returned have completed, or until all
+** of them have if there are fewer than nMin, then store pointers to up to
+** nMax completed requests in apDone[] and their number in *pnDone.
+*/
+static int unixComplete(
+  sqlite3_file *id,
+  int nMin,
+  int nMax,
+  sqlite3_io_request **apDone,
+  int *pnDone
+){
+  unixFile *pFile = (unixFile*)id;
+  unixAio *pAio = pFile->pAio;
+  int rc = SQLITE_OK;
+  int n = 0;
+
+  *pnDone = 0;
+  if( pAio==0 ) return SQLITE_OK;
+  if( nMin>nMax ) nMin = nMax;
+  if( nMin>pAio->nOutstanding ) nMin = pAio->nOutstanding;
+
+  switch( pAio->eBackend ){
+#ifdef SQLITE_UNIX_IO_URING
+    case UNIX_AIO_URING: {
+      /* Held requests are only waiting for requests in flight, so
+      ** waiting for more than nInFlight completions is never needed. */
+      unixUringReap(pAio);
+      while( rc==SQLITE_OK && pAio->nDone<nMin ){
+        int nWait = MIN(nMin - pAio->nDone, pAio->nInFlight);
+        assert( nWait>0 );
+        rc = unixUringEnterAll(pAio, (unsigned)nWait);
+        unixUringReap(pAio);
+      }
+      if( rc==SQLITE_OK ) rc = unixUringEnterAll(pAio, 0);
+      break;
+    }
+#endif
+#ifdef SQLITE_UNIX_AIO_POOL
+    case UNIX_AIO_POOL: {
+      sqlite3_mutex_enter(unixAioPool.pMutex);
+      while( pAio->nDone<nMin ){
+        sqlite3_mutex_cond_wait(pAio->pCond, unixAioPool.pMutex, -1);
+      }
+      break;
+    }
+#endif
+    default:
+      break;
   }
 
-  return SQLITE_OK;
+  while( n<nMax && pAio->pDone ){
+    sqlite3_io_request *p = unixAioPop(&pAio->pDone, &pAio->pDoneLast);
+    p->pVfsCtx = 0;
+    apDone[n++] = p;
+    pAio->nDone--;
+  }
+#ifdef SQLITE_UNIX_AIO_POOL
+  if( pAio->eBackend==UNIX_AIO_POOL ) sqlite3_mutex_leave(unixAioPool.pMutex);
+#endif
+  pAio->nOutstanding -= n;
+  *pnDone = n;
+  return rc;
 }
-#endif /* SQLITE_MAX_MMAP_SIZE>0 */
 
 /*
-** If possible, return a pointer to a mapping of file fd starting at offset
-** iOff. The mapping must be valid for at least nAmt bytes.
+** Implementation of xSubmit.  Start the nReq requests in apReq[].
 **
-** If such a pointer can be obtained, store it in *pp and return SQLITE_OK.
-** Or, if one cannot but no error occurs, set *pp to 0 and return SQLITE_OK.
-** Finally, if an error does occur, return an SQLite error code. The final
-** value of *pp is undefined in this case.
+** Return SQLITE_OK if all of them were started, in which case each will
+** be returned by a later call to xComplete.  Otherwise, return an error
+** code and store the number that were started in *pnReq.  In that case
+** the rest were not, and will not be returned by xComplete.
 **
-** If this function does return a pointer, the caller must eventually 
-** release the reference by calling unixUnfetch().
+** Only a failed malloc() leaves requests unstarted.  If io_uring_enter()
+** fails, the requests it did not take are returned by xComplete with an
+** I/O error instead.
 */
-static int unixFetch(sqlite3_file *fd, i64 iOff, int nAmt, void **pp){
-#if SQLITE_MAX_MMAP_SIZE>0
-  unixFile *pFd = (unixFile *)fd;   /* The underlying database file */
-#endif
-  *pp = 0;
+static int unixSubmit(sqlite3_file *id, sqlite3_io_request **apReq, int *pnReq){
+  unixFile *pFile = (unixFile*)id;
+  unixAio *pAio = unixAioGet(pFile);
+  int nReq = *pnReq;
+  int i;
 
-#if SQLITE_MAX_MMAP_SIZE>0
-  if( pFd->mmapSizeMax>0 ){
-    if( pFd->pMapRegion==0 ){
-      int rc = unixMapfile(pFd, -1);
-      if( rc!=SQLITE_OK ) return rc;
+  if( pAio==0 ){
+    *pnReq = 0;
+    return SQLITE_NOMEM_BKPT;
+  }
+  for(i=0; i<nReq; i++){
+    sqlite3_io_request *p = apReq[i];
+    assert( p->op==SQLITE_IOREQ_READ || p->op==SQLITE_IOREQ_WRITE
+         || p->op==SQLITE_IOREQ_SYNC );
+    assert( p->op==SQLITE_IOREQ_SYNC || (p->nAmt>0 && p->iOfst>=0) );
+    p->rc = SQLITE_OK;
+    p->pVfsNext = 0;
+    p->pVfsCtx = 0;
+    p->nVfsDone = 0;
+#ifndef SQLITE_OMIT_IOSTATS
+    if( p->op==SQLITE_IOREQ_READ ){
+      pFile->ioStats.nRead++;
+      pFile->ioStats.nReadBytes += p->nAmt;
+    }else if( p->op==SQLITE_IOREQ_WRITE ){
+      pFile->ioStats.nWrite++;
+      pFile->ioStats.nWriteBytes += p->nAmt;
+    }else{
+      pFile->ioStats.nSync++;
     }
-    if( pFd->mmapSize >= iOff+nAmt ){
-      *pp = &((u8 *)pFd->pMapRegion)[iOff];
-      pFd->nFetchOut++;
+#endif
+    switch( pAio->eBackend ){
+#ifdef SQLITE_UNIX_IO_URING
+      case UNIX_AIO_URING: {
+        /* Queued by unixUringRelease(), which keeps no more operations
+        ** in flight than there are submission queue entries, so that
+        ** neither queue can overflow. */
+        unixAioAppend(&pAio->pHeld, &pAio->pHeldLast, p);
+        unixUringRelease(pAio);
+        break;
+      }
+#endif
+#ifdef SQLITE_UNIX_AIO_POOL
+      case UNIX_AIO_POOL: {
+        p->pVfsCtx = (void*)pAio;
+        sqlite3_mutex_enter(unixAioPool.pMutex);
+        unixAioAppend(&pAio->pHeld, &pAio->pHeldLast, p);
+        unixAioPoolRelease(pAio);
+        sqlite3_mutex_cond_broadcast(unixAioPool.pCond);
+        sqlite3_mutex_leave(unixAioPool.pMutex);
+        break;
+      }
+#endif
+      default: {
+#ifdef SQLITE_UNIX_DIRECT_IO
+        if( unixIsDirect(pFile) && p->op!=SQLITE_IOREQ_SYNC ){
+          unixDirectExecute(pFile, p);
+        }else
+#endif
+        unixAioExecute(pAio->h, p);
+        unixAioAppend(&pAio->pDone, &pAio->pDoneLast, p);
+        pAio->nDone++;
+        break;
+      }
     }
+    pAio->nOutstanding++;
+  }
+#ifdef SQLITE_UNIX_IO_URING
+  if( pAio->eBackend==UNIX_AIO_URING
+   && unixUringEnterAll(pAio, 0)!=SQLITE_OK
+  ){
+    unixUringFailUnsubmitted(pAio);
   }
 #endif
   return SQLITE_OK;
 }
 
 /*
-** If the third argument is non-NULL, then this function releases a 
-** reference obtained by an earlier call to unixFetch(). The second
-** argument passed to this function must be the same as the corresponding
-** argument that was passed to the unixFetch() invocation. 
-**
-** Or, if the third argument is NULL, then this function is being called 
-** to inform the VFS layer that, according to POSIX, any existing mapping 
-** may now be invalid and should be unmapped.
-*/
-static int unixUnfetch(sqlite3_file *fd, i64 iOff, void *p){
-#if SQLITE_MAX_MMAP_SIZE>0
-  unixFile *pFd = (unixFile *)fd;   /* The underlying database file */
-  UNUSED_PARAMETER(iOff);
-
-  /* If p==0 (unmap the entire file) then there must be no outstanding 
-  ** xFetch references. Or, if p!=0 (meaning it is an xFetch reference),
-  ** then there must be at least one outstanding.  */
-  assert( (p==0)==(pFd->nFetchOut==0) );
-
-  /* If p!=0, it must match the iOff value. */
-  assert( p==0 || p==&((u8 *)pFd->pMapRegion)[iOff] );
-
-  if( p ){
-    pFd->nFetchOut--;
-  }else{
-    unixUnmapfile(pFd);
-  }
-
-  assert( pFd->nFetchOut>=0 );
-#else
-  UNUSED_PARAMETER(fd);
-  UNUSED_PARAMETER(p);
-  UNUSED_PARAMETER(iOff);
+** Wait for every request still in flight on pFile, then free its unixAio
+** object.  Called by closeUnixFile().  Requests not yet returned by
+** xComplete are lost, which is a misuse, but at least no I/O is still
+** running on the file descriptor when it is closed.
+*/
+static void unixAioFree(unixFile *pFile){
+  unixAio *pAio = pFile->pAio;
+  if( pAio ){
+    while( pAio->nOutstanding>0 ){
+      sqlite3_io_request *aDone[16];
+      int nDone = 0;
+      if( unixComplete((sqlite3_file*)pFile, 1, 16, aDone, &nDone)!=SQLITE_OK
+       || nDone==0
+      ){
+        break;
+      }
+    }
+#ifdef SQLITE_UNIX_IO_URING
+    if( pAio->eBackend==UNIX_AIO_URING ) unixUringClose(&pAio->ring);
 #endif
-  return SQLITE_OK;
+    sqlite3_mutex_cond_free(pAio->pCond);
+    sqlite3_free(pAio);
+    pFile->pAio = 0;
+  }
 }
 
 /*
@@ -4364,6 +7434,10 @@ static const sqlite3_io_methods METHOD = {                                   \
    unixShmUnmap,               /* xShmUnmap */                               \
    unixFetch,                  /* xFetch */                                  \
    unixUnfetch,                /* xUnfetch */                                \
+   unixSubmit,                 /* xSubmit */                                 \
+   unixComplete,               /* xComplete */                               \
+   unixWriteV,                 /* xWriteV */                                 \
+   unixReadV,                  /* xReadV */                                  \
 };                                                                           \
 static const sqlite3_io_methods *FINDER##Impl(const char *z, unixFile *p){   \
   UNUSED_PARAMETER(z); UNUSED_PARAMETER(p);                                  \
@@ -4380,7 +7454,7 @@ static const sqlite3_io_methods *(*const FINDER)(const char*,unixFile *p)    \
 IOMETHODS(
   posixIoFinder,            /* Finder function name */
   posixIoMethods,           /* sqlite3_io_methods object name */
-  3,                        /* shared memory and mmap are enabled */
+  6,                        /* shm, mmap, async and vector I/O enabled */
   unixClose,                /* xClose method */
   unixLock,                 /* xLock method */
   unixUnlock,               /* xUnlock method */
@@ -4390,7 +7464,7 @@ IOMETHODS(
 IOMETHODS(
   nolockIoFinder,           /* Finder function name */
   nolockIoMethods,          /* sqlite3_io_methods object name */
-  3,                        /* shared memory and mmap are enabled */
+  6,                        /* shm, mmap, async and vector I/O enabled */
   nolockClose,              /* xClose method */
   nolockLock,               /* xLock method */
   nolockUnlock,             /* xUnlock method */
@@ -4408,6 +7482,19 @@ IOMETHODS(
   0                         /* xShmMap method */
 )
 
+#ifdef SQLITE_UNIX_OFD_LOCKS
+IOMETHODS(
+  ofdIoFinder,              /* Finder function name */
+  ofdIoMethods,             /* sqlite3_io_methods object name */
+  6,                        /* shm, mmap, async and vector I/O enabled */
+  ofdClose,                 /* xClose method */
+  ofdLock,                  /* xLock method */
+  ofdUnlock,                /* xUnlock method */
+  ofdCheckReservedLock,     /* xCheckReservedLock method */
+  ofdShmMap                 /* xShmMap method */
+)
+#endif
+
 #if SQLITE_ENABLE_LOCKING_STYLE
 IOMETHODS(
   flockIoFinder,            /* Finder function name */
@@ -4422,6 +7509,15 @@ IOMETHODS(
 #endif
 
 
+/*
+** True if VFS pVfs is the "unix-ofd" VFS.
+*/
+#ifdef SQLITE_UNIX_OFD_LOCKS
+# define unixVfsUsesOfdLocks(pVfs) ((pVfs)->pAppData==(void*)&ofdIoFinder)
+#else
+# define unixVfsUsesOfdLocks(pVfs) 0
+#endif
+
 /*
 ** An abstract type for a pointer to an IO method finder function:
 */
@@ -4458,17 +7554,29 @@ static int fillInUnixFile(
   pNew->h = h;
   pNew->pVfs = pVfs;
   pNew->zPath = zFilename;
-  pNew->ctrlFlags = (u8)ctrlFlags;
+  pNew->ctrlFlags = (unsigned short)ctrlFlags;
 #if SQLITE_MAX_MMAP_SIZE>0
-  pNew->mmapSizeMax = sqlite3GlobalConfig.szMmap;
+  pNew->mmapSizeMax = unixIsDirect(pNew) ? 0 : sqlite3GlobalConfig.szMmap;
+#endif
+#ifdef SQLITE_UNIX_DIRECT_IO
+  if( unixIsDirect(pNew) ) pNew->szDirect = unixDirectAlignment(h);
 #endif
   if( sqlite3_uri_boolean(((ctrlFlags & UNIXFILE_URI) ? zFilename : 0),
                            "psow", SQLITE_POWERSAFE_OVERWRITE) ){
     pNew->ctrlFlags |= UNIXFILE_PSOW;
   }
+  if( sqlite3_uri_boolean(((ctrlFlags & UNIXFILE_URI) ? zFilename : 0),
+                           "shared_lease", 0) ){
+    pNew->ctrlFlags |= UNIXFILE_LEASE;
+  }
   if( strcmp(pVfs->zName,"unix-excl")==0 ){
     pNew->ctrlFlags |= UNIXFILE_EXCL;
   }
+#if HAVE_POSIX_FADVISE
+  pNew->ra.ePolicy = unixIsDirect(pNew) ? SQLITE_READAHEAD_OFF
+                                        : SQLITE_DEFAULT_READAHEAD;
+  pNew->ra.nWindow = SQLITE_DEFAULT_READAHEAD_WINDOW;
+#endif
 
 
   if( ctrlFlags & UNIXFILE_NOLOCK ){
@@ -4485,8 +7593,14 @@ static int fillInUnixFile(
 
   if( pLockingStyle == &posixIoMethods
   ){
-    unixEnterMutex();
-    rc = findInodeInfo(pNew, &pNew->pInode);
+    struct unixFileId fileId;
+    sqlite3_mutex *pShardMutex = 0;
+    rc = unixFileIdOf(pNew, &fileId);
+    if( rc==SQLITE_OK ){
+      pShardMutex = unixInodeShardOf(&fileId)->pMutex;
+      sqlite3_mutex_enter(pShardMutex);
+      rc = findInodeInfo(&fileId, &pNew->pInode);
+    }
     if( rc!=SQLITE_OK ){
       /* If an error occurred in findInodeInfo(), close the file descriptor
       ** immediately, before releasing the mutex. findInodeInfo() may fail
@@ -4509,7 +7623,7 @@ static int fillInUnixFile(
       robust_close(pNew, h, __LINE__);
       h = -1;
     }
-    unixLeaveMutex();
+    sqlite3_mutex_leave(pShardMutex);
   }
 
 
@@ -4575,6 +7689,110 @@ static const char *unixTempFileDir(void){
   return 0;
 }
 
+/*
+** Fill zBuf with nBuf bytes of entropy from the operating system.  The
+** getrandom() system call is used where it is available, so that no file
+** descriptor needs to be opened.  Otherwise, or if getrandom() fails,
+** the remainder is read from /dev/urandom.  Return the number of bytes
+** of entropy written to zBuf.
+*/
+static int unixOsEntropy(char *zBuf, int nBuf){
+  int nGot = 0;
+  int fd;
+  ssize_t got;
+
+  if( osGetrandom ){
+    while( nGot<nBuf ){
+      got = osGetrandom(&zBuf[nGot], nBuf-nGot, 0);
+      if( got<0 ){
+        if( errno==EINTR ) continue;
+        break;
+      }
+      nGot += (int)got;
+    }
+    if( nGot==nBuf ) return nGot;
+  }
+
+  fd = robust_open("/dev/urandom", O_RDONLY, 0);
+  if( fd>=0 ){
+    do{ got = osRead(fd, &zBuf[nGot], nBuf-nGot); }while( got<0 && errno==EINTR );
+    robust_close(0, fd, __LINE__);
+    if( got>0 ) nGot += (int)got;
+  }
+  return nGot;
+}
+
+/*
+** Per-thread pseudo-random number generator.
+**
+** Temporary file names only need to be unpredictable enough not to
+** collide, but obtaining them from sqlite3_randomness() serializes every
+** caller on the SQLITE_MUTEX_STATIC_PRNG mutex.  Instead, each thread
+** keeps its own xoshiro256** generator, seeded from unixOsEntropy() the
+** first time the thread uses it.  Because the generator is thread-local
+** no mutex is required.
+**
+** After a fork() the child inherits a copy of the parent thread's state,
+** and would otherwise produce the same sequence as the parent.  So the
+** generator also records the process id it was seeded in, and reseeds
+** itself if that changes.
+*/
+typedef struct UnixPrng UnixPrng;
+struct UnixPrng {
+  pid_t pid;                 /* Process the state was seeded in, or 0 */
+  u64 s[4];                  /* xoshiro256** state */
+};
+static SQLITE_THREAD_LOCAL UnixPrng unixPrng;
+
+/*
+** Seed the calling thread's generator.
+*/
+static void unixPrngSeed(UnixPrng *p, pid_t pid){
+  u64 x;
+  int i;
+  memset(p->s, 0, sizeof(p->s));
+  if( unixOsEntropy((char*)p->s, sizeof(p->s))!=(int)sizeof(p->s) ){
+    /* No entropy source.  Mix the time, the process id and the address
+    ** of this thread's state using splitmix64.  This is enough to keep
+    ** temporary file names from colliding. */
+    struct timeval tv;
+    gettimeofday(&tv, 0);
+    x = ((u64)tv.tv_sec<<20) ^ (u64)tv.tv_usec ^ ((u64)pid<<32)
+      ^ (u64)(uptr)p;
+    for(i=0; i<4; i++){
+      u64 z = (x += 0x9e3779b97f4a7c15ULL);
+      z = (z ^ (z>>30)) * 0xbf58476d1ce4e5b9ULL;
+      z = (z ^ (z>>27)) * 0x94d049bb133111ebULL;
+      p->s[i] ^= z ^ (z>>31);
+    }
+  }
+  if( (p->s[0]|p->s[1]|p->s[2]|p->s[3])==0 ) p->s[0] = 1;
+  p->pid = pid;
+}
+
+static u64 unixPrngRotl(u64 x, int k){
+  return (x<<k) | (x>>(64-k));
+}
+
+/*
+** Return the next 64-bit value from the calling thread's generator.
+*/
+static u64 unixRandomU64(void){
+  UnixPrng *p = &unixPrng;
+  pid_t pid = osGetpid(0);
+  u64 r, t;
+  if( p->pid!=pid ) unixPrngSeed(p, pid);
+  r = unixPrngRotl(p->s[1]*5, 7)*9;
+  t = p->s[1]<<17;
+  p->s[2] ^= p->s[0];
+  p->s[3] ^= p->s[1];
+  p->s[1] ^= p->s[2];
+  p->s[0] ^= p->s[3];
+  p->s[2] ^= t;
+  p->s[3] = unixPrngRotl(p->s[3], 45);
+  return r;
+}
+
 /*
 ** Create a temporary file name in zBuf.  zBuf must be allocated
 ** by the calling process and must be big enough to hold at least
@@ -4594,8 +7812,7 @@ static int unixGetTempname(int nBuf, char *zBuf){
   zDir = unixTempFileDir();
   if( zDir==0 ) return SQLITE_IOERR_GETTEMPPATH;
   do{
-    u64 r;
-    sqlite3_randomness(sizeof(r), &r);
+    u64 r = unixRandomU64();
     assert( nBuf>2 );
     zBuf[nBuf-2] = 0;
     sqlite3_snprintf(nBuf, zBuf, "%s/"SQLITE_TEMP_FILE_PREFIX"%llx%c",
@@ -4633,8 +7850,6 @@ static UnixUnusedFd *findReusableFd(const char *zPath, int flags){
 #if !OS_VXWORKS
   struct stat sStat;                   /* Results of stat() call */
 
-  unixEnterMutex();
-
   /* A stat() call may fail for various reasons. If this happens, it is
   ** almost certain that an open() call on the same path will also fail.
   ** For this reason, if an error occurs in the stat() call here, it is
@@ -4643,14 +7858,21 @@ static UnixUnusedFd *findReusableFd(const char *zPath, int flags){
   **
   ** Even if a subsequent open() call does succeed, the consequences of
   ** not searching for a reusable file descriptor are not dire.  */
-  if( inodeList!=0 && 0==osStat(zPath, &sStat) ){
+  if( 0==osStat(zPath, &sStat) ){
+    struct unixFileId fileId;
+    unixInodeShard *pShard;
     unixInodeInfo *pInode;
 
-    pInode = inodeList;
-    while( pInode && (pInode->fileId.dev!=sStat.st_dev
-                     || pInode->fileId.ino!=(u64)sStat.st_ino) ){
-       pInode = pInode->pNext;
-    }
+    memset(&fileId, 0, sizeof(fileId));
+    fileId.dev = sStat.st_dev;
+    fileId.ino = (u64)sStat.st_ino;
+    pShard = unixInodeShardOf(&fileId);
+
+    /* Only the shard itself is read here, and the pUnused list of the
+    ** inode found is protected by its pLockMutex.  An inode cannot be
+    ** freed while the shard mutex is held.  */
+    sqlite3_mutex_enter(pShard->pMutex);
+    pInode = unixInodeLookup(pShard, &fileId);
     if( pInode ){
       UnixUnusedFd **pp;
       assert( sqlite3_mutex_notheld(pInode->pLockMutex) );
@@ -4663,8 +7885,8 @@ static UnixUnusedFd *findReusableFd(const char *zPath, int flags){
       }
       sqlite3_mutex_leave(pInode->pLockMutex);
     }
+    sqlite3_mutex_leave(pShard->pMutex);
   }
-  unixLeaveMutex();
 #endif    /* if !OS_VXWORKS */
   return pUnused;
 }
@@ -4802,6 +8024,7 @@ static int unixOpen(
   int noLock;                    /* True to omit locking primitives */
   int rc = SQLITE_OK;            /* Function Return Code */
   int ctrlFlags = 0;             /* UNIXFILE_* flags */
+  int isReused = 0;              /* True if fd came from findReusableFd() */
 
   int isExclusive  = (flags & SQLITE_OPEN_EXCLUSIVE);
   int isDelete     = (flags & SQLITE_OPEN_DELETEONCLOSE);
@@ -4865,11 +8088,14 @@ static int unixOpen(
   }
   memset(p, 0, sizeof(unixFile));
 
-  if( eType==SQLITE_OPEN_MAIN_DB ){
+  /* A unix-ofd file never defers the close of a file descriptor, so there
+  ** are no unused descriptors to reuse and none need be preallocated. */
+  if( eType==SQLITE_OPEN_MAIN_DB && !unixVfsUsesOfdLocks(pVfs) ){
     UnixUnusedFd *pUnused;
     pUnused = findReusableFd(zName, flags);
     if( pUnused ){
       fd = pUnused->fd;
+      isReused = 1;
     }else{
       pUnused = sqlite3_malloc64(sizeof(*pUnused));
       if( !pUnused ){
@@ -4984,6 +8210,23 @@ static int unixOpen(
   if( noLock )                  ctrlFlags |= UNIXFILE_NOLOCK;
   if( isNewJrnl )               ctrlFlags |= UNIXFILE_DIRSYNC;
   if( flags & SQLITE_OPEN_URI ) ctrlFlags |= UNIXFILE_URI;
+#ifdef SQLITE_UNIX_DIRECT_IO
+  /* The "unix-direct" VFS uses direct I/O for database files, if the file
+  ** system supports it.  Other files, including WAL files, whose frames
+  ** are never aligned, are used as usual.  The unused descriptors of an
+  ** inode are shared by all VFSes, so a reused descriptor may have been
+  ** left in direct mode by a "unix-direct" connection.  Switch it back
+  ** for any other VFS. */
+  if( eType==SQLITE_OPEN_MAIN_DB ){
+    if( strcmp(pVfs->zName, "unix-direct")==0 ){
+      if( unixDirectSet(fd, 1) ) ctrlFlags |= UNIXFILE_DIRECT;
+    }else if( isReused ){
+      unixDirectSet(fd, 0);
+    }
+  }
+#else
+  UNUSED_PARAMETER(isReused);
+#endif
 
 #if SQLITE_ENABLE_LOCKING_STYLE
 #if SQLITE_PREFER_PROXY_LOCKING
@@ -5365,20 +8608,13 @@ static int unixRandomness(sqlite3_vfs *NotUsed, int nBuf, char *zBuf){
   memset(zBuf, 0, nBuf);
   randomnessPid = osGetpid(0);  
 #if !defined(SQLITE_TEST) && !defined(SQLITE_OMIT_RANDOMNESS)
-  {
-    int fd, got;
-    fd = robust_open("/dev/urandom", O_RDONLY, 0);
-    if( fd<0 ){
-      time_t t;
-      time(&t);
-      memcpy(zBuf, &t, sizeof(t));
-      memcpy(&zBuf[sizeof(t)], &randomnessPid, sizeof(randomnessPid));
-      assert( sizeof(t)+sizeof(randomnessPid)<=(size_t)nBuf );
-      nBuf = sizeof(t) + sizeof(randomnessPid);
-    }else{
-      do{ got = osRead(fd, zBuf, nBuf); }while( got<0 && errno==EINTR );
-      robust_close(0, fd, __LINE__);
-    }
+  if( unixOsEntropy(zBuf, nBuf)<=0 ){
+    time_t t;
+    time(&t);
+    memcpy(zBuf, &t, sizeof(t));
+    memcpy(&zBuf[sizeof(t)], &randomnessPid, sizeof(randomnessPid));
+    assert( sizeof(t)+sizeof(randomnessPid)<=(size_t)nBuf );
+    nBuf = sizeof(t) + sizeof(randomnessPid);
   }
 #endif
   return nBuf;
@@ -5392,12 +8628,26 @@ static int unixRandomness(sqlite3_vfs *NotUsed, int nBuf, char *zBuf){
 ** requested from the underlying operating system, a number which
 ** might be greater than or equal to the argument, but not less
 ** than the argument.
+**
+** Where nanosleep() is available the sleep has microsecond resolution.
+** If it is interrupted by a signal, it is resumed for the time that
+** remains.  Otherwise the argument is rounded up to whole seconds.
 */
 static int unixSleep(sqlite3_vfs *NotUsed, int microseconds){
+#if OS_VXWORKS || _POSIX_C_SOURCE >= 199309L || _POSIX_VERSION >= 199309L
+  struct timespec sp;
+  if( microseconds<0 ) microseconds = 0;
+  sp.tv_sec = microseconds / 1000000;
+  sp.tv_nsec = (microseconds % 1000000) * 1000;
+  while( nanosleep(&sp, &sp)<0 && errno==EINTR ){}
+  UNUSED_PARAMETER(NotUsed);
+  return microseconds;
+#else
   int seconds = (microseconds+999999)/1000000;
   sleep(seconds);
   UNUSED_PARAMETER(NotUsed);
   return seconds*1000000;
+#endif
 }
 
 /*
@@ -5697,36 +8947,97 @@ int sqlite3_os_init(void){
     UNIXVFS("unix-none",     nolockIoFinder ),
     UNIXVFS("unix-dotfile",  dotlockIoFinder ),
     UNIXVFS("unix-excl",     posixIoFinder ),
+#ifdef SQLITE_UNIX_DIRECT_IO
+    UNIXVFS("unix-direct",   posixIoFinder ),
+#endif
 #if SQLITE_ENABLE_LOCKING_STYLE || OS_VXWORKS
     UNIXVFS("unix-posix",    posixIoFinder ),
 #endif
 #if SQLITE_ENABLE_LOCKING_STYLE
     UNIXVFS("unix-flock",    flockIoFinder ),
+#endif
+#ifdef SQLITE_UNIX_OFD_LOCKS
+    UNIXVFS("unix-ofd",      ofdIoFinder ),
 #endif
   };
   unsigned int i;          /* Loop counter */
 
   /* Double-check that the aSyscall[] array has been constructed
   ** correctly.  See ticket [bb3a86e890c8e96ab] */
-  assert( ArraySize(aSyscall)==29 );
+  assert( ArraySize(aSyscall)==33 );
+
+  /* Allocate the inode table shard mutexes and the direct I/O pool mutex
+  ** before any VFS is registered.  sqlite3MutexAlloc() returns NULL
+  ** without error if core mutexing is disabled.  Otherwise, a NULL return
+  ** is an OOM, and any mutexes already allocated are freed again.  */
+  for(i=0; i<SQLITE_UNIX_INODE_NSHARD; i++){
+    aInodeShard[i].pMutex = sqlite3MutexAlloc(SQLITE_MUTEX_FAST);
+    if( aInodeShard[i].pMutex==0 && sqlite3GlobalConfig.bCoreMutex ){
+      goto os_init_nomem;
+    }
+  }
+#ifdef SQLITE_UNIX_DIRECT_IO
+  unixDirectPool.pMutex = sqlite3MutexAlloc(SQLITE_MUTEX_FAST);
+  if( unixDirectPool.pMutex==0 && sqlite3GlobalConfig.bCoreMutex ){
+    goto os_init_nomem;
+  }
+#endif
 
   /* Register all VFSes defined in the aVfs[] array */
   for(i=0; i<(sizeof(aVfs)/sizeof(sqlite3_vfs)); i++){
     sqlite3_vfs_register(&aVfs[i], i==0);
   }
   unixBigLock = sqlite3MutexAlloc(SQLITE_MUTEX_STATIC_VFS1);
+#ifdef SQLITE_UNIX_AIO_POOL
+  unixAioPool.pMutex = sqlite3MutexAlloc(SQLITE_MUTEX_FAST);
+  if( unixAioPool.pMutex ){
+    unixAioPool.pCond = sqlite3_mutex_cond_alloc();
+  }
+#endif
+#ifdef SQLITE_UNIX_LEASE_REAPER
+  unixLeaseReaper.pMutex = sqlite3MutexAlloc(SQLITE_MUTEX_FAST);
+  if( unixLeaseReaper.pMutex ){
+    unixLeaseReaper.pCond = sqlite3_mutex_cond_alloc();
+  }
+#endif
   return SQLITE_OK; 
+
+os_init_nomem:
+  for(i=0; i<SQLITE_UNIX_INODE_NSHARD; i++){
+    sqlite3_mutex_free(aInodeShard[i].pMutex);
+    aInodeShard[i].pMutex = 0;
+  }
+  return SQLITE_NOMEM_BKPT;
 }
 
 /*
 ** Shutdown the operating system interface.
 **
 ** Some operating systems might need to do some cleanup in this routine,
-** to release dynamically allocated objects.  But not on unix.
-** This routine is a no-op for unix.
+** to release dynamically allocated objects.  On unix, these are the
+** mutexes and bucket arrays of the inode table shards, the threads of
+** the asynchronous I/O pool, the lease reaper thread and the free direct
+** I/O bounce buffers.
 */
 int sqlite3_os_end(void){ 
+  int i;
   unixBigLock = 0;
+#ifdef SQLITE_UNIX_DIRECT_IO
+  unixDirectPoolShutdown();
+#endif
+#ifdef SQLITE_UNIX_AIO_POOL
+  unixAioPoolShutdown();
+#endif
+#ifdef SQLITE_UNIX_LEASE_REAPER
+  unixLeaseReaperShutdown();
+#endif
+  for(i=0; i<SQLITE_UNIX_INODE_NSHARD; i++){
+    unixInodeShard *pShard = &aInodeShard[i];
+    assert( pShard->nInode==0 );
+    sqlite3_mutex_free(pShard->pMutex);
+    sqlite3_free(pShard->aBucket);
+    memset(pShard, 0, sizeof(*pShard));
+  }
   return SQLITE_OK; 
 }
  
@@ -0,0 +1,129 @@
+/*
+** 2026 October 17
+**
+** The author disclaims copyright to this source code.  In place of
+** a legal notice, here is a blessing:
+**
+**    May you do good and not evil.
+**    May you find forgiveness for yourself and forgive others.
+**    May you share freely, never taking more than you give.
+**
+******************************************************************************
+**
+** Test that shared shm locks taken and released concurrently by several
+** connections in one process are all released at the system level.
+**
+** Two threads, each with its own connection to the same database, take
+** and release a SHARED lock on the same shm slot many times.  Most of the
+** time the other thread also holds the slot, so the count in aLock[] is
+** adjusted without the mutex by unixShmLockFast(), racing with the last
+** holder releasing the slot under the mutex.  Once both threads are done,
+** a second process must be able to take the slot EXCLUSIVE.  If the count
+** ever reached zero without the F_UNLCK being issued, the process still
+** holds a read lock on the slot and the second process gets SQLITE_BUSY.
+*/
+#include "os_test.h"
+#include <pthread.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/wait.h>
+
+#define TEST_DB    "shm_lock_test.db"
+#define TEST_SLOT  3
+#define TEST_NLOOP 200000
+
+static sqlite3_vfs *pVfs;
+
+/*
+** Open TEST_DB and map its shm.
+*/
+static sqlite3_file *testOpenShm(void){
+  sqlite3_file *pFile = osTestOpen(pVfs, TEST_DB);
+  void volatile *pMap = 0;
+  int rc = pFile->pMethods->xShmMap(pFile, 0, 32768, 1, &pMap);
+  if( rc!=SQLITE_OK ) osTestFail("xShmMap: %d", rc);
+  return pFile;
+}
+
+/*
+** Body of each thread.  Take and release a SHARED lock on TEST_SLOT of
+** connection pArg TEST_NLOOP times.
+*/
+static void *testThread(void *pArg){
+  sqlite3_file *pFile = (sqlite3_file*)pArg;
+  const sqlite3_io_methods *pM = pFile->pMethods;
+  int i;
+  for(i=0; i<TEST_NLOOP; i++){
+    int rc = pM->xShmLock(pFile, TEST_SLOT, 1,
+                          SQLITE_SHM_LOCK|SQLITE_SHM_SHARED);
+    if( rc!=SQLITE_OK ) osTestFail("SHARED lock: %d", rc);
+    if( (i%64)==0 ) sched_yield();
+    rc = pM->xShmLock(pFile, TEST_SLOT, 1,
+                      SQLITE_SHM_UNLOCK|SQLITE_SHM_SHARED);
+    if( rc!=SQLITE_OK ) osTestFail("SHARED unlock: %d", rc);
+  }
+  return 0;
+}
+
+/*
+** Body of the second process.  Wait until the first is done, then take
+** TEST_SLOT EXCLUSIVE.
+*/
+static int testChild(int fdWait){
+  sqlite3_file *pFile;
+  char c;
+  int rc;
+  if( read(fdWait, &c, 1)!=1 ) return 2;
+  pVfs = osTestInit("unix");
+  pFile = testOpenShm();
+  rc = pFile->pMethods->xShmLock(pFile, TEST_SLOT, 1,
+                                 SQLITE_SHM_LOCK|SQLITE_SHM_EXCLUSIVE);
+  if( rc!=SQLITE_OK ){
+    fprintf(stderr, "FAILED: EXCLUSIVE lock in second process: %d\n", rc);
+    return 1;
+  }
+  pFile->pMethods->xShmLock(pFile, TEST_SLOT, 1,
+                            SQLITE_SHM_UNLOCK|SQLITE_SHM_EXCLUSIVE);
+  pFile->pMethods->xShmUnmap(pFile, 0);
+  osTestClose(pFile);
+  return 0;
+}
+
+int main(void){
+  sqlite3_file *apFile[2];
+  pthread_t aThread[2];
+  int aPipe[2];
+  int status = 0;
+  pid_t pid;
+  int i;
+
+  unlink(TEST_DB);
+  unlink(TEST_DB "-shm");
+  if( pipe(aPipe) ) osTestFail("pipe");
+  pid = fork();
+  if( pid<0 ) osTestFail("fork");
+  if( pid==0 ) exit(testChild(aPipe[0]));
+
+  pVfs = osTestInit("unix");
+  if( pVfs==0 ) osTestFail("no unix VFS");
+  for(i=0; i<2; i++) apFile[i] = testOpenShm();
+  for(i=0; i<2; i++){
+    pthread_create(&aThread[i], 0, testThread, (void*)apFile[i]);
+  }
+  for(i=0; i<2; i++) pthread_join(aThread[i], 0);
+
+  /* Keep both connections open while the second process tries. */
+  if( write(aPipe[1], "x", 1)!=1 ) osTestFail("write");
+  waitpid(pid, &status, 0);
+  if( !WIFEXITED(status) || WEXITSTATUS(status)!=0 ){
+    osTestFail("slot %d was not released", TEST_SLOT);
+  }
+
+  for(i=0; i<2; i++){
+    apFile[i]->pMethods->xShmUnmap(apFile[i], 1);
+    osTestClose(apFile[i]);
+  }
+  unlink(TEST_DB);
+  printf("shm_lock_test: ok\n");
+  return 0;
+}
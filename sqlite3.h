@@ -686,6 +686,68 @@ struct sqlite3_file {
   const struct sqlite3_io_methods *pMethods;  /* Methods for an open file */
 };
 
+/*
+** CAPI3REF: Asynchronous I/O Requests
+** KEYWORDS: {asynchronous I/O request}
+**
+** An instance of this object describes a single read, write or sync
+** passed to the xSubmit method of a version 4 or later
+** [sqlite3_io_methods] object.  The caller fills in the op, flags, pBuf,
+** nAmt and iOfst fields, and may use pAppData for any purpose.  The
+** object and the buffer it points to must remain valid and unchanged
+** until the request has been returned by xComplete.  The VFS sets the rc
+** field before returning the request from xComplete.  The remaining
+** fields are for the use of the VFS only.
+**
+** ^The op field is one of [SQLITE_IOREQ_READ], [SQLITE_IOREQ_WRITE] or
+** [SQLITE_IOREQ_SYNC].  ^For reads and writes, nAmt bytes are transferred
+** between pBuf and the file at offset iOfst, and flags is ignored.  ^For
+** syncs, flags has the same meaning as the argument to xSync and pBuf,
+** nAmt and iOfst are ignored.  ^The rc field is set to the value that the
+** corresponding call to xRead, xWrite or xSync would have returned,
+** including the zero-filling of the buffer that goes with
+** [SQLITE_IOERR_SHORT_READ].
+*/
+typedef struct sqlite3_io_request sqlite3_io_request;
+struct sqlite3_io_request {
+  int op;                        /* SQLITE_IOREQ_READ, _WRITE or _SYNC */
+  int flags;                     /* SQLITE_SYNC_* flags for a sync */
+  void *pBuf;                    /* Buffer to read into or write from */
+  int nAmt;                      /* Number of bytes to read or write */
+  sqlite3_int64 iOfst;           /* Offset in the file */
+  int rc;                        /* OUT: Result of the request */
+  void *pAppData;                /* For use by the caller */
+  sqlite3_io_request *pVfsNext;  /* Reserved for the VFS */
+  void *pVfsCtx;                 /* Reserved for the VFS */
+  sqlite3_int64 nVfsDone;        /* Reserved for the VFS */
+};
+
+/*
+** CAPI3REF: Asynchronous I/O Request Types
+**
+** These integer constants are the values of the op field of an
+** [sqlite3_io_request] object.
+*/
+#define SQLITE_IOREQ_READ           1
+#define SQLITE_IOREQ_WRITE          2
+#define SQLITE_IOREQ_SYNC           3
+
+/*
+** CAPI3REF: Vectored I/O Buffers
+**
+** An array of these objects is passed to the xWriteV method of a version
+** 5 or later [sqlite3_io_methods] object, or to the xReadV method of a
+** version 6 or later object.  Each describes nAmt bytes at pBuf to be
+** written to or read from the file at offset iOfst.  xWriteV does not
+** modify the buffers.
+*/
+typedef struct sqlite3_io_vec sqlite3_io_vec;
+struct sqlite3_io_vec {
+  void *pBuf;                    /* Buffer to transfer to or from */
+  int nAmt;                      /* Size of pBuf in bytes */
+  sqlite3_int64 iOfst;           /* Offset in the file */
+};
+
 /*
 ** CAPI3REF: OS Interface File Virtual Methods Object
 **
@@ -779,6 +841,38 @@ struct sqlite3_file {
 ** fails to zero-fill short reads might seem to work.  However,
 ** failure to zero-fill short reads will eventually lead to
 ** database corruption.
+**
+** The xSubmit() and xComplete() methods, present in version 4 and later,
+** carry out [asynchronous I/O request | asynchronous I/O requests].
+** xSubmit() starts the *pnReq requests in apReq[] and returns without
+** waiting for them.  If it returns other than SQLITE_OK, it sets *pnReq
+** to the number of requests that were started; the others were not, and
+** may be submitted again later.  xComplete() waits until at least nMin of
+** the started requests have completed (or all of them, if fewer than nMin
+** are outstanding), then stores up to nMax completed requests in apDone[]
+** and their number in *pnDone.  Requests on the same file may complete in
+** any order, except that a SQLITE_IOREQ_SYNC request is not started until
+** every request submitted before it has completed, and no request
+** submitted after it is started until it has completed.  A sync request
+** does not sync the directory containing the file, as xSync may.  Every
+** started request must be returned by xComplete before the file is
+** closed.
+**
+** The xWriteV() method, present in version 5 and later, writes each of
+** the nVec buffers described by aVec[] as if by a call to xWrite(), and
+** returns what the first failing xWrite() would have returned, or
+** SQLITE_OK.  It exists so that a VFS can write buffers that are adjacent
+** in the file, in the order they appear in aVec[], with a single system
+** call.  If an error occurs, any subset of the buffers may have been
+** written.
+**
+** The xReadV() method, present in version 6 and later, reads each of the
+** nVec buffers described by aVec[] as if by a call to xRead().  If any
+** of those xRead() calls would have failed with an error other than
+** [SQLITE_IOERR_SHORT_READ], xReadV() returns that error and the contents
+** of the buffers are undefined.  Otherwise it returns
+** [SQLITE_IOERR_SHORT_READ] if any buffer extends past the end of the
+** file, with the unread parts of every buffer zero-filled, or SQLITE_OK.
 */
 typedef struct sqlite3_io_methods sqlite3_io_methods;
 struct sqlite3_io_methods {
@@ -804,6 +898,14 @@ struct sqlite3_io_methods {
   int (*xFetch)(sqlite3_file*, sqlite3_int64 iOfst, int iAmt, void **pp);
   int (*xUnfetch)(sqlite3_file*, sqlite3_int64 iOfst, void *p);
   /* Methods above are valid for version 3 */
+  int (*xSubmit)(sqlite3_file*, sqlite3_io_request **apReq, int *pnReq);
+  int (*xComplete)(sqlite3_file*, int nMin, int nMax,
+                   sqlite3_io_request **apDone, int *pnDone);
+  /* Methods above are valid for version 4 */
+  int (*xWriteV)(sqlite3_file*, const sqlite3_io_vec *aVec, int nVec);
+  /* Methods above are valid for version 5 */
+  int (*xReadV)(sqlite3_file*, const sqlite3_io_vec *aVec, int nVec);
+  /* Methods above are valid for version 6 */
   /* Additional methods may be added in future releases */
 };
 
@@ -1127,6 +1229,47 @@ struct sqlite3_io_methods {
 ** in wal mode after the client has finished copying pages from the wal
 ** file to the database file, but before the *-shm file is updated to
 ** record the fact that the pages have been checkpointed.
+**
+** <li>[[SQLITE_FCNTL_SHARED_LEASE]]
+** The [SQLITE_FCNTL_SHARED_LEASE] opcode is used to set or query the
+** shared-lock lease setting of the unix VFS.  ^When leases are enabled,
+** the OS-level SHARED lock on a rollback-journal database is not released
+** when the last reader in the process finishes, but kept until a writer
+** in another process signals that it wants the database, which saves
+** several system calls per read transaction.  ^A lease that is not used
+** again within SQLITE_UNIX_LEASE_MS milliseconds (100 by default) is given
+** up by a background thread, so an idle process delays writers in other
+** processes by at most about twice that.  ^Leases are never kept in
+** builds without threads.
+** The argument is a pointer to an integer.  ^Set the integer to 0 or 1
+** to disable or enable leases, or to -1 to query the current setting,
+** which is written back into the integer.  ^Leases may also be enabled
+** using the "shared_lease" URI parameter.
+**
+** <li>[[SQLITE_FCNTL_LOCK_STATUS]]
+** The [SQLITE_FCNTL_LOCK_STATUS] opcode is only available if SQLite is
+** compiled with SQLITE_ENABLE_LOCK_STATUS.  ^The argument is a pointer
+** to an [sqlite3_lock_stats] object, into which the lock contention
+** statistics of the file are copied.  ^Only the unix VFS supports this
+** opcode.
+**
+** <li>[[SQLITE_FCNTL_IOSTATS]]
+** The [SQLITE_FCNTL_IOSTATS] opcode is used to retrieve or reset the
+** I/O statistics of a file, unless SQLite is compiled with
+** SQLITE_OMIT_IOSTATS.  ^If the argument is a pointer to an
+** [sqlite3_io_stats] object, the statistics are copied into it.  ^If the
+** argument is NULL, the statistics are reset to zero.  ^Only the unix VFS
+** supports this opcode.
+**
+** <li>[[SQLITE_FCNTL_READAHEAD]]
+** The [SQLITE_FCNTL_READAHEAD] opcode is used to set or query the
+** readahead policy of a file, and to retrieve the counters that go with
+** it.  ^The argument is a pointer to an [sqlite3_readahead] object.  ^If
+** its ePolicy field is one of the [SQLITE_READAHEAD_OFF | SQLITE_READAHEAD_*]
+** values, or its nWindow field is not negative, the policy or window of
+** the file is changed accordingly.  ^The current settings and counters
+** are then copied into the object.  ^Only the unix VFS supports this
+** opcode, and only on systems that provide posix_fadvise().
 ** </ul>
 */
 #define SQLITE_FCNTL_LOCKSTATE               1
@@ -1167,6 +1310,97 @@ struct sqlite3_io_methods {
 #define SQLITE_FCNTL_CKPT_DONE              37
 #define SQLITE_FCNTL_RESERVE_BYTES          38
 #define SQLITE_FCNTL_CKPT_START             39
+#define SQLITE_FCNTL_SHARED_LEASE           40
+#define SQLITE_FCNTL_LOCK_STATUS            41
+#define SQLITE_FCNTL_IOSTATS                42
+#define SQLITE_FCNTL_READAHEAD              43
+
+#ifndef SQLITE_OMIT_IOSTATS
+/*
+** CAPI3REF: File I/O Statistics
+**
+** ^Unless SQLite is compiled with SQLITE_OMIT_IOSTATS, each file opened by
+** the unix VFS records the statistics in an instance of the following
+** structure.  They are retrieved using [SQLITE_FCNTL_IOSTATS].  All times
+** are in nanoseconds.
+**
+** ^The nRead and nReadBytes fields count the calls to xRead and the bytes
+** requested.  ^Of those calls, nMmapRead were satisfied entirely from the
+** memory mapping, nPread had to read at least part of the data using a
+** system call, and nShortRead found the end of the file.  ^nWrite and
+** nWriteBytes count the calls to xWrite and the bytes written, and nSync
+** and nTruncate the calls to xSync and xTruncate.
+**
+** ^The aReadNs[], aWriteNs[] and aSyncNs[] arrays are histograms of the
+** time taken by each system call that read, wrote or synced the file, and
+** nReadNs, nWriteNs and nSyncNs are the totals.  ^Bucket 0 counts calls
+** shorter than 1024ns, each subsequent bucket covers twice the range of
+** its predecessor, and bucket SQLITE_IOSTATS_NBUCKET-1 also counts all
+** calls longer than that.
+*/
+#define SQLITE_IOSTATS_NBUCKET 24
+typedef struct sqlite3_io_stats sqlite3_io_stats;
+struct sqlite3_io_stats {
+  sqlite3_uint64 nRead;           /* xRead calls */
+  sqlite3_uint64 nReadBytes;      /* Bytes requested by xRead */
+  sqlite3_uint64 nMmapRead;       /* xRead calls served from the mapping */
+  sqlite3_uint64 nPread;          /* xRead calls that read the file */
+  sqlite3_uint64 nShortRead;      /* xRead calls that found end-of-file */
+  sqlite3_uint64 nWrite;          /* xWrite calls */
+  sqlite3_uint64 nWriteBytes;     /* Bytes written by xWrite */
+  sqlite3_uint64 nSync;           /* xSync calls */
+  sqlite3_uint64 nTruncate;       /* xTruncate calls */
+  sqlite3_uint64 nReadNs;         /* Total time spent reading */
+  sqlite3_uint64 nWriteNs;        /* Total time spent writing */
+  sqlite3_uint64 nSyncNs;         /* Total time spent syncing */
+  sqlite3_uint64 aReadNs[SQLITE_IOSTATS_NBUCKET];   /* Read latencies */
+  sqlite3_uint64 aWriteNs[SQLITE_IOSTATS_NBUCKET];  /* Write latencies */
+  sqlite3_uint64 aSyncNs[SQLITE_IOSTATS_NBUCKET];   /* Sync latencies */
+};
+#endif
+
+/*
+** CAPI3REF: File Readahead Policy
+**
+** An instance of this structure is passed to [SQLITE_FCNTL_READAHEAD].
+** ^The ePolicy field is one of the following values, or -1 to leave the
+** policy unchanged:
+**
+** <dl>
+** <dt>SQLITE_READAHEAD_OFF</dt>
+** <dd>^No hints are given and the kernel behaves as it does by default.</dd>
+** <dt>SQLITE_READAHEAD_AUTO</dt>
+** <dd>^The VFS watches the offsets of reads.  ^When several reads in a row
+** continue where the previous one ended, it tells the kernel that the
+** file is being read sequentially and asks it to read the next nWindow
+** bytes ahead of the reader.  ^When several reads in a row do not, it
+** tells the kernel that access is random, so that no readahead is done.
+** This is the default.</dd>
+** <dt>SQLITE_READAHEAD_SEQUENTIAL</dt>
+** <dd>^Reads are always treated as sequential.</dd>
+** <dt>SQLITE_READAHEAD_RANDOM</dt>
+** <dd>^Reads are always treated as random.</dd>
+** </dl>
+**
+** ^The nWindow field is the number of bytes read ahead of a sequential
+** reader, or -1 to leave it unchanged.  ^The remaining fields are output
+** only.  ^nSequential and nRandom count the times the kernel was told
+** that access is sequential or random, and nPrefetch and nPrefetchBytes
+** count the readahead requests made and the bytes they covered.
+*/
+typedef struct sqlite3_readahead sqlite3_readahead;
+struct sqlite3_readahead {
+  int ePolicy;                    /* IN/OUT: SQLITE_READAHEAD_* or -1 */
+  int nWindow;                    /* IN/OUT: Readahead window or -1 */
+  sqlite3_uint64 nSequential;     /* OUT: Switches to sequential advice */
+  sqlite3_uint64 nRandom;         /* OUT: Switches to random advice */
+  sqlite3_uint64 nPrefetch;       /* OUT: Readahead requests made */
+  sqlite3_uint64 nPrefetchBytes;  /* OUT: Bytes covered by those requests */
+};
+#define SQLITE_READAHEAD_OFF         0
+#define SQLITE_READAHEAD_AUTO        1
+#define SQLITE_READAHEAD_SEQUENTIAL  2
+#define SQLITE_READAHEAD_RANDOM      3
 
 /* deprecated names */
 #define SQLITE_GET_LOCKPROXYFILE      SQLITE_FCNTL_GET_LOCKPROXYFILE
@@ -1467,6 +1701,56 @@ struct sqlite3_vfs {
 */
 #define SQLITE_SHM_NLOCK        8
 
+#ifdef SQLITE_ENABLE_LOCK_STATUS
+/*
+** CAPI3REF: File Lock Contention Statistics
+**
+** ^If SQLite is compiled with SQLITE_ENABLE_LOCK_STATUS, each file opened
+** by the unix VFS records the statistics in an instance of the following
+** structure.  They are retrieved using [SQLITE_FCNTL_LOCK_STATUS].  All
+** times are in nanoseconds.
+**
+** ^The aLock[], aLockOk[], aBusyLocal[] and aBusyRemote[] arrays are
+** indexed by the lock level requested from xLock, SQLITE_LOCK_SHARED
+** through SQLITE_LOCK_EXCLUSIVE.  ^They count the requests made, those
+** that succeeded, and those that failed with SQLITE_BUSY because of
+** a lock held by another connection in the same process (aBusyLocal)
+** or by another process (aBusyRemote).  ^nUnlock counts the calls to
+** xUnlock that lowered the lock level.  ^nFcntl counts the fcntl() calls
+** made on the database file to take, release or test locks, and
+** nInProcess counts the lock and unlock requests that were satisfied
+** without any, because another connection in the same process already
+** held a SHARED lock.  ^nReservedNs is the time spent holding a RESERVED,
+** PENDING or EXCLUSIVE lock, and nExclusiveNs the part of that spent
+** holding an EXCLUSIVE lock.
+**
+** ^The aShmLock[], aShmBusyLocal[], aShmBusyRemote[] and aShmHeldNs[]
+** arrays are indexed by xShmLock slot.  ^They count the lock requests on
+** each slot, those that failed with SQLITE_BUSY for either reason, and
+** the time each slot was held.  ^nShmFcntl and nShmInProcess count the
+** fcntl() calls made on the shared-memory file and the xShmLock requests
+** that were satisfied without any.
+*/
+typedef struct sqlite3_lock_stats sqlite3_lock_stats;
+struct sqlite3_lock_stats {
+  sqlite3_uint64 aLock[5];           /* xLock requests by level */
+  sqlite3_uint64 aLockOk[5];         /* Successful xLock requests */
+  sqlite3_uint64 aBusyLocal[5];      /* BUSY due to this process */
+  sqlite3_uint64 aBusyRemote[5];     /* BUSY due to another process */
+  sqlite3_uint64 nUnlock;            /* xUnlock requests */
+  sqlite3_uint64 nFcntl;             /* fcntl() calls on the database */
+  sqlite3_uint64 nInProcess;         /* Requests needing no fcntl() call */
+  sqlite3_uint64 nReservedNs;        /* Time at RESERVED or higher */
+  sqlite3_uint64 nExclusiveNs;       /* Time at EXCLUSIVE */
+  sqlite3_uint64 aShmLock[SQLITE_SHM_NLOCK];        /* xShmLock requests */
+  sqlite3_uint64 aShmBusyLocal[SQLITE_SHM_NLOCK];   /* BUSY, this process */
+  sqlite3_uint64 aShmBusyRemote[SQLITE_SHM_NLOCK];  /* BUSY, other process */
+  sqlite3_uint64 aShmHeldNs[SQLITE_SHM_NLOCK];      /* Time each slot held */
+  sqlite3_uint64 nShmFcntl;          /* fcntl() calls on the -shm file */
+  sqlite3_uint64 nShmInProcess;      /* xShmLock requests needing none */
+};
+#endif
+
 
 /*
 ** CAPI3REF: Initialize The SQLite Library
@@ -1855,6 +2139,22 @@ struct sqlite3_mem_methods {
 ** [sqlite3_config()] with the SQLITE_CONFIG_GETMUTEX configuration option will
 ** return [SQLITE_ERROR].</dd>
 **
+** [[SQLITE_CONFIG_MUTEX_V2]] <dt>SQLITE_CONFIG_MUTEX_V2</dt>
+** <dd> ^(The SQLITE_CONFIG_MUTEX_V2 option is the same as
+** [SQLITE_CONFIG_MUTEX] except that its argument is a pointer to an
+** instance of the [sqlite3_mutex_methods_v2] structure.)^  ^SQLite
+** copies the methods that the iVersion field of the structure says are
+** present and treats the others as NULL.</dd>
+**
+** [[SQLITE_CONFIG_GETMUTEX_V2]] <dt>SQLITE_CONFIG_GETMUTEX_V2</dt>
+** <dd> ^(The SQLITE_CONFIG_GETMUTEX_V2 option is the same as
+** [SQLITE_CONFIG_GETMUTEX] except that its argument is a pointer to an
+** instance of the [sqlite3_mutex_methods_v2] structure.)^  ^The caller
+** sets the iVersion field to the version of the structure it passes.
+** ^SQLite fills in only the methods present in that version, and sets
+** iVersion to the lower of that version and the version of the
+** structure that SQLite was compiled with.</dd>
+**
 ** [[SQLITE_CONFIG_LOOKASIDE]] <dt>SQLITE_CONFIG_LOOKASIDE</dt>
 ** <dd> ^(The SQLITE_CONFIG_LOOKASIDE option takes two arguments that determine
 ** the default size of lookaside memory on each [database connection].
@@ -2057,6 +2357,8 @@ struct sqlite3_mem_methods {
 #define SQLITE_CONFIG_SMALL_MALLOC        27  /* boolean */
 #define SQLITE_CONFIG_SORTERREF_SIZE      28  /* int nByte */
 #define SQLITE_CONFIG_MEMDB_MAXSIZE       29  /* sqlite3_int64 */
+#define SQLITE_CONFIG_MUTEX_V2            30  /* sqlite3_mutex_methods_v2* */
+#define SQLITE_CONFIG_GETMUTEX_V2         31  /* sqlite3_mutex_methods_v2* */
 
 /*
 ** CAPI3REF: Database Connection Configuration Options
@@ -7430,6 +7732,7 @@ SQLITE_API int sqlite3_vfs_unregister(sqlite3_vfs*);
 ** <ul>
 ** <li>  SQLITE_MUTEX_FAST
 ** <li>  SQLITE_MUTEX_RECURSIVE
+** <li>  SQLITE_MUTEX_RW
 ** <li>  SQLITE_MUTEX_STATIC_MAIN
 ** <li>  SQLITE_MUTEX_STATIC_MEM
 ** <li>  SQLITE_MUTEX_STATIC_OPEN
@@ -7448,6 +7751,11 @@ SQLITE_API int sqlite3_vfs_unregister(sqlite3_vfs*);
 ** cause sqlite3_mutex_alloc() to create
 ** a new mutex.  ^The new mutex is recursive when SQLITE_MUTEX_RECURSIVE
 ** is used but not necessarily so when SQLITE_MUTEX_FAST is used.
+** ^SQLITE_MUTEX_RW also creates a new, non-recursive mutex.  ^In addition
+** to the usual exclusive entry, an SQLITE_MUTEX_RW mutex may be entered
+** in shared mode using sqlite3_mutex_enter_shared() by any number of
+** threads at once, provided no thread holds it exclusively.
+** ^Shared entry is released with sqlite3_mutex_leave_shared().
 ** The mutex implementation does not need to make a distinction
 ** between SQLITE_MUTEX_RECURSIVE and SQLITE_MUTEX_FAST if it does
 ** not want to.  SQLite will only request a recursive mutex in
@@ -7507,6 +7815,46 @@ SQLITE_API void sqlite3_mutex_free(sqlite3_mutex*);
 SQLITE_API void sqlite3_mutex_enter(sqlite3_mutex*);
 SQLITE_API int sqlite3_mutex_try(sqlite3_mutex*);
 SQLITE_API void sqlite3_mutex_leave(sqlite3_mutex*);
+SQLITE_API void sqlite3_mutex_enter_shared(sqlite3_mutex*);
+SQLITE_API void sqlite3_mutex_leave_shared(sqlite3_mutex*);
+
+/*
+** CAPI3REF: Mutex Condition Variables
+**
+** ^A condition variable allows a thread that holds a mutex to release
+** the mutex and wait until another thread reports that some state
+** protected by the mutex has changed.
+**
+** ^The sqlite3_mutex_cond_alloc() routine allocates a new condition
+** variable.  ^It returns NULL if memory cannot be allocated or if the
+** mutex implementation does not provide condition variables.  ^A
+** condition variable is deallocated with sqlite3_mutex_cond_free().
+**
+** ^The sqlite3_mutex_cond_wait(C,M,T) routine must be called by a thread
+** that has entered mutex M exactly once.  M must be an SQLITE_MUTEX_FAST
+** mutex.  ^It releases M, blocks until condition variable C is signaled
+** by sqlite3_mutex_cond_broadcast() or until T milliseconds have passed,
+** and then enters M again before returning.  ^If T is negative there is
+** no time limit.  ^The return value is SQLITE_OK if the thread was woken
+** and SQLITE_BUSY if the time limit expired.  Wake-ups may be spurious,
+** so the caller must test the state it is waiting for in a loop.  ^If C
+** is a NULL pointer, sqlite3_mutex_cond_wait() returns SQLITE_BUSY
+** immediately, without releasing M.
+**
+** ^The sqlite3_mutex_cond_broadcast(C) routine wakes all threads waiting
+** on condition variable C.  It is usually called by a thread holding the
+** mutex that the waiters passed to sqlite3_mutex_cond_wait(), after it
+** changes the state that they are waiting for.
+**
+** ^If the argument to sqlite3_mutex_cond_free() or
+** sqlite3_mutex_cond_broadcast() is a NULL pointer, these routines
+** behave as no-ops.
+*/
+typedef struct sqlite3_mutex_cond sqlite3_mutex_cond;
+SQLITE_API sqlite3_mutex_cond *sqlite3_mutex_cond_alloc(void);
+SQLITE_API void sqlite3_mutex_cond_free(sqlite3_mutex_cond*);
+SQLITE_API int sqlite3_mutex_cond_wait(sqlite3_mutex_cond*, sqlite3_mutex*, int);
+SQLITE_API void sqlite3_mutex_cond_broadcast(sqlite3_mutex_cond*);
 
 /*
 ** CAPI3REF: Mutex Methods Object
@@ -7586,6 +7934,88 @@ struct sqlite3_mutex_methods {
   int (*xMutexNotheld)(sqlite3_mutex *);
 };
 
+/*
+** CAPI3REF: Mutex Methods Object, Version 2
+**
+** An instance of this structure defines the same low-level mutex routines
+** as [sqlite3_mutex_methods], followed by methods that were added to the
+** mutex interface later.  The application passes it to sqlite3_config()
+** with the [SQLITE_CONFIG_MUTEX_V2] option, or reads the current mutex
+** implementation into it with the [SQLITE_CONFIG_GETMUTEX_V2] option.
+** [sqlite3_mutex_methods] itself is never extended, so that applications
+** compiled against older versions of this header continue to work.
+**
+** ^The iVersion field is the version of the structure, which determines
+** which of the methods that follow xMutexNotheld are present.  It is
+** currently 2.  ^The methods from xMutexInit to xMutexNotheld have the
+** same meaning as in [sqlite3_mutex_methods].
+**
+** ^(Version 1 adds the xMutexEnterShared and xMutexLeaveShared methods,
+** which implement [sqlite3_mutex_enter_shared()] and
+** [sqlite3_mutex_leave_shared()] for mutexes allocated as
+** SQLITE_MUTEX_RW.)^  ^An implementation that does not support shared
+** entry may set both to NULL.  ^In that case SQLite allocates an
+** SQLITE_MUTEX_FAST mutex whenever SQLITE_MUTEX_RW is requested and
+** enters it exclusively in place of shared entry.
+**
+** ^(Version 2 adds the xCondAlloc, xCondFree, xCondWait and xCondBroadcast
+** methods, which implement [sqlite3_mutex_cond_alloc()],
+** [sqlite3_mutex_cond_free()], [sqlite3_mutex_cond_wait()] and
+** [sqlite3_mutex_cond_broadcast()].)^  ^An implementation that does not
+** provide condition variables may set all four to NULL, in which case
+** sqlite3_mutex_cond_alloc() always returns NULL.  ^xCondAlloc() may use
+** SQLite memory allocation.
+**
+** ^Methods that are not present, because the mutex routines were set
+** using [SQLITE_CONFIG_MUTEX] or the iVersion passed with
+** [SQLITE_CONFIG_MUTEX_V2] is too low, are treated as NULL.
+*/
+typedef struct sqlite3_mutex_methods_v2 sqlite3_mutex_methods_v2;
+struct sqlite3_mutex_methods_v2 {
+  int iVersion;
+  int (*xMutexInit)(void);
+  int (*xMutexEnd)(void);
+  sqlite3_mutex *(*xMutexAlloc)(int);
+  void (*xMutexFree)(sqlite3_mutex *);
+  void (*xMutexEnter)(sqlite3_mutex *);
+  int (*xMutexTry)(sqlite3_mutex *);
+  void (*xMutexLeave)(sqlite3_mutex *);
+  int (*xMutexHeld)(sqlite3_mutex *);
+  int (*xMutexNotheld)(sqlite3_mutex *);
+  /* Methods above are valid for version 0 */
+  void (*xMutexEnterShared)(sqlite3_mutex *);
+  void (*xMutexLeaveShared)(sqlite3_mutex *);
+  /* Methods above are valid for version 1 */
+  sqlite3_mutex_cond *(*xCondAlloc)(void);
+  void (*xCondFree)(sqlite3_mutex_cond *);
+  int (*xCondWait)(sqlite3_mutex_cond *, sqlite3_mutex *, int);
+  void (*xCondBroadcast)(sqlite3_mutex_cond *);
+  /* Methods above are valid for version 2 */
+};
+
+#ifdef SQLITE_ENABLE_FUTEX_MUTEX
+/*
+** CAPI3REF: Adaptive Spin-Then-Futex Mutexes
+**
+** ^On Linux builds compiled with SQLITE_ENABLE_FUTEX_MUTEX, this routine
+** returns a pointer to an [sqlite3_mutex_methods_v2] object whose mutexes
+** spin in user space for a short, self-tuning number of iterations before
+** blocking on a futex.  The object may be passed to
+** [sqlite3_config]([SQLITE_CONFIG_MUTEX_V2],...).  ^If SQLite is also compiled
+** with SQLITE_DEFAULT_FUTEX_MUTEX then these methods are used by default.
+**
+** ^The SQLITE_MUTEX_FIFO, SQLITE_ENABLE_MUTEX_POOL and
+** SQLITE_ATOMIC_RECURSIVE_MUTEX options of the pthreads mutexes have no
+** effect on the futex mutexes.  ^Their static mutexes are never FIFO,
+** their dynamic mutexes are always obtained from sqlite3_malloc(), and
+** recursive entry is counted by the futex mutex itself.  ^The futex
+** mutexes do not support shared entry, so an SQLITE_MUTEX_RW request is
+** satisfied with an SQLITE_MUTEX_FAST mutex that is always entered
+** exclusively.
+*/
+SQLITE_API sqlite3_mutex_methods_v2 const *sqlite3_mutex_futex(void);
+#endif
+
 /*
 ** CAPI3REF: Mutex Verification Routines
 **
@@ -7646,6 +8076,54 @@ SQLITE_API int sqlite3_mutex_notheld(sqlite3_mutex*);
 #define SQLITE_MUTEX_STATIC_VFS1     11  /* For use by built-in VFS */
 #define SQLITE_MUTEX_STATIC_VFS2     12  /* For use by extension VFS */
 #define SQLITE_MUTEX_STATIC_VFS3     13  /* For use by application VFS */
+#define SQLITE_MUTEX_RW              14  /* Dynamic reader/writer mutex */
+
+#ifdef SQLITE_ENABLE_MUTEX_STATUS
+/*
+** CAPI3REF: Mutex Contention Statistics
+**
+** ^If SQLite is compiled with SQLITE_ENABLE_MUTEX_STATUS, every mutex
+** obtained from [sqlite3_mutex_alloc()] records the statistics in an
+** instance of the following structure.  All times are in nanoseconds.
+**
+** ^The nEnter field counts successful calls to [sqlite3_mutex_enter()]
+** and [sqlite3_mutex_try()], and nContended counts those calls to
+** sqlite3_mutex_enter() that had to wait for another thread.  ^nWaitNs
+** and mxWaitNs are the total and the largest time spent waiting.
+** ^nHoldNs and mxHoldNs are the total and the largest time the mutex was
+** held, measured from the outermost enter to the matching leave, and
+** aHold[] is a histogram of hold times.  ^aHold[0] counts holds shorter
+** than 128ns, each subsequent bucket covers twice the range of its
+** predecessor, and aHold[SQLITE_MUTEX_NHOLD-1] also counts all holds
+** longer than that.
+**
+** ^sqlite3_mutex_status(id,pOut,resetFlag) copies the statistics for the
+** mutex type id into *pOut.  ^For the static mutex types (for example
+** SQLITE_MUTEX_STATIC_MEM or SQLITE_MUTEX_STATIC_VFS1) these are the
+** statistics of that single mutex.  ^For SQLITE_MUTEX_FAST and
+** SQLITE_MUTEX_RECURSIVE they are the sum over every dynamic mutex of
+** that type.  ^sqlite3_mutex_status_handle() copies the statistics of a
+** single mutex, which may be either static or dynamic.  ^In both cases
+** the statistics are zeroed afterwards if resetFlag is true, and
+** SQLITE_MISUSE is returned if the arguments are not valid.
+**
+** The statistics are updated without locking and should be treated
+** as approximate if they are read while the mutexes are in use.
+*/
+#define SQLITE_MUTEX_NHOLD 20
+typedef struct sqlite3_mutex_stats sqlite3_mutex_stats;
+struct sqlite3_mutex_stats {
+  sqlite3_uint64 nEnter;      /* Successful enter and try calls */
+  sqlite3_uint64 nContended;  /* Enter calls that had to wait */
+  sqlite3_uint64 nWaitNs;     /* Total time spent waiting */
+  sqlite3_uint64 mxWaitNs;    /* Longest single wait */
+  sqlite3_uint64 nHoldNs;     /* Total time held */
+  sqlite3_uint64 mxHoldNs;    /* Longest single hold */
+  sqlite3_uint64 aHold[SQLITE_MUTEX_NHOLD];  /* Hold-time histogram */
+};
+SQLITE_API int sqlite3_mutex_status(int id, sqlite3_mutex_stats*, int resetFlag);
+SQLITE_API int sqlite3_mutex_status_handle(sqlite3_mutex*, sqlite3_mutex_stats*, int resetFlag);
+#endif
 
 /* Legacy compatibility: */
 #define SQLITE_MUTEX_STATIC_MASTER    2
@@ -262,6 +262,24 @@
 #  define SQLITE_NOINLINE
 #endif
 
+/*
+** The storage class of a variable that has a separate instance in each
+** thread.  The GCC and MSVC keywords are preferred to C++11 thread_local,
+** because a thread_local variable defined in a different translation
+** unit is accessed through a call to its initialization wrapper.  A
+** variable declared SQLITE_THREAD_LOCAL must not require dynamic
+** initialization.
+*/
+#if !defined(SQLITE_THREAD_LOCAL)
+#  if defined(__GNUC__)
+#    define SQLITE_THREAD_LOCAL  __thread
+#  elif defined(_MSC_VER)
+#    define SQLITE_THREAD_LOCAL  __declspec(thread)
+#  else
+#    define SQLITE_THREAD_LOCAL  thread_local
+#  endif
+#endif
+
 /*
 ** Make sure that the compiler intrinsics we desire are enabled when
 ** compiling with an appropriate version of MSVC unless prevented by
@@ -3664,7 +3682,7 @@ struct Sqlite3Config {
   int nLookaside;                   /* Default lookaside buffer count */
   int nStmtSpill;                   /* Stmt-journal spill-to-disk threshold */
   sqlite3_mem_methods m;            /* Low-level memory allocation interface */
-  sqlite3_mutex_methods mutex;      /* Low-level mutex interface */
+  sqlite3_mutex_methods_v2 mutex;   /* Low-level mutex interface */
   sqlite3_pcache_methods2 pcache2;  /* Low-level page-cache interface */
   void *pHeap;                      /* Heap storage space */
   int nHeap;                        /* Size of pHeap[] */
@@ -4045,11 +4063,14 @@ const sqlite3_mem_methods *sqlite3MemGetMemsys3(void);
 
 
 #ifndef SQLITE_MUTEX_OMIT
-  sqlite3_mutex_methods const *sqlite3DefaultMutex(void);
-  sqlite3_mutex_methods const *sqlite3NoopMutex(void);
+  sqlite3_mutex_methods_v2 const *sqlite3DefaultMutex(void);
+  sqlite3_mutex_methods_v2 const *sqlite3NoopMutex(void);
   sqlite3_mutex *sqlite3MutexAlloc(int);
+  int sqlite3MutexShard(void);
   int sqlite3MutexInit(void);
   int sqlite3MutexEnd(void);
+  void sqlite3MutexSetMethods(const void*, int);
+  void sqlite3MutexGetMethods(void*, int);
 #endif
 #if !defined(SQLITE_MUTEX_OMIT) && !defined(SQLITE_MUTEX_NOOP)
   void sqlite3MemoryBarrier(void);